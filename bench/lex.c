@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+/*
+ * Benchmark of the lexer, a generated source is scanned
+ * with lexer_scan() to the end and the number of tokens
+ * per second printed.
+ *
+ * Usage: bench/lex [MiB] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "gup/state.h"
+#include "gup/lexer.h"
+
+/* Default size of the source in MiB */
+#define BENCH_MIB 16
+
+/* Default number of rounds, the fastest one counts */
+#define BENCH_ROUNDS 5
+
+/* Procedure the source is made of, '%zu' keeps names apart */
+#define BENCH_PROC                                  \
+    "// Sum up to a bound\n"                        \
+    "pub proc sum%zu -> u32 {\n"                    \
+    "    u32 i;\n"                                  \
+    "    u32 s;\n"                                  \
+    "\n"                                            \
+    "    i = 0;\n"                                  \
+    "    s = 0x10;\n"                               \
+    "    loop {\n"                                  \
+    "        if (i >= 1000) {\n"                    \
+    "            break;\n"                          \
+    "        }\n"                                   \
+    "\n"                                            \
+    "        s = s + (i << 2) * 3;  // scaled\n"    \
+    "        i = i + 1;\n"                          \
+    "    }\n"                                       \
+    "\n"                                            \
+    "    return s;\n"                               \
+    "}\n"                                           \
+    "\n"
+
+/*
+ * Returns the current time in seconds
+ */
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Generate a source of procedures one after another
+ *
+ * @len: Size of the source, rounded up to a procedure
+ * @res_len: Length of the source is written here
+ *
+ * Returns the source, NULL on failure
+ */
+static char *
+bench_gen(size_t len, size_t *res_len)
+{
+    char *buf;
+    size_t n = 0, off = 0;
+    int k;
+
+    if ((buf = malloc(len + sizeof(BENCH_PROC) + 32)) == NULL) {
+        return NULL;
+    }
+
+    while (off < len) {
+        k = sprintf(buf + off, BENCH_PROC, n++);
+        off += k;
+    }
+
+    *res_len = off;
+    return buf;
+}
+
+/*
+ * Scan a source to the end of it
+ *
+ * @state: Compiler state holding the source
+ * @ntoks: Number of tokens is written here
+ *
+ * Returns zero on success
+ */
+static int
+bench_lex(struct gup_state *state, size_t *ntoks)
+{
+    struct token tok;
+    size_t n = 0;
+
+    state->in_off = 0;
+    state->line_num = 1;
+    for (;;) {
+        if (lexer_scan(state, &tok) < 0) {
+            return -1;
+        }
+
+        if (tok.type == TT_NONE) {
+            break;
+        }
+
+        ++n;
+    }
+
+    *ntoks = n;
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct gup_state state;
+    size_t len, ntoks = 0;
+    int r, rounds = BENCH_ROUNDS;
+    double best = 0, t;
+    char *buf;
+
+    len = (size_t)BENCH_MIB << 20;
+    if (argc > 1) {
+        len = strtoul(argv[1], NULL, 10) << 20;
+    }
+
+    if (argc > 2) {
+        rounds = atoi(argv[2]);
+    }
+
+    if (len == 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [MiB] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    if ((buf = bench_gen(len, &len)) == NULL) {
+        fprintf(stderr, "failed to allocate source\n");
+        return 1;
+    }
+
+    /* Only the input is needed for scanning */
+    memset(&state, 0, sizeof(state));
+    state.in_buf = buf;
+    state.in_len = len;
+
+    for (r = 0; r < rounds; ++r) {
+        t = bench_now();
+        if (bench_lex(&state, &ntoks) < 0) {
+            fprintf(stderr, "failed to scan source\n");
+            free(buf);
+            return 1;
+        }
+
+        t = bench_now() - t;
+        if (r == 0 || t < best) {
+            best = t;
+        }
+    }
+
+    printf(
+        "lex       %zu tokens in %.1f MiB %10.1f Mtok/s %10.1f MiB/s\n",
+        ntoks, len / (1024.0 * 1024.0), ntoks / best / 1e6,
+        len / (1024.0 * 1024.0) / best
+    );
+
+    free(buf);
+    return 0;
+}
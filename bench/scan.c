@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+/*
+ * Microbenchmark of the scanning kernels, every kernel set
+ * the host supports and the entry points dispatching to the
+ * best of them are run over the same inputs and the
+ * throughput of each printed next to the others.
+ *
+ * Usage: bench/scan [MiB] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* The kernels are private to the scanner, take them as is */
+#include "../src/scan.c"
+
+/* Default size of each input in MiB */
+#define BENCH_MIB 64
+
+/* Default number of rounds, the fastest one counts */
+#define BENCH_ROUNDS 5
+
+/* What the lexer calls, short runs first then the best kernels */
+static const struct scan_ops bench_dispatch = {
+    .skip_ws = scan_skip_ws,
+    .find_nl = scan_find_nl,
+    .count_nl = scan_count_nl
+};
+
+/*
+ * Represents a kernel set under test
+ *
+ * @name: Name printed for it
+ * @ops: Kernels
+ */
+struct bench_kernels {
+    const char *name;
+    const struct scan_ops *ops;
+};
+
+/*
+ * Represents an input to run the kernels over
+ *
+ * @name: Name printed for it
+ * @buf: Bytes of the input
+ * @len: Length of 'buf'
+ */
+struct bench_input {
+    const char *name;
+    char *buf;
+    size_t len;
+};
+
+/*
+ * Returns the current time in seconds
+ */
+static double
+bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Fill a buffer with source-like text, indented lines of
+ * short tokens with a blank line every so often.
+ *
+ * @buf: Buffer to fill
+ * @len: Length of 'buf'
+ */
+static void
+bench_fill_source(char *buf, size_t len)
+{
+    static const char *line = "x = x + 1; // step";
+    size_t i = 0, n = 0, indent, k;
+
+    while (i < len) {
+        indent = 4 * (1 + n % 3);
+        for (k = 0; k < indent && i < len; ++k) {
+            buf[i++] = ' ';
+        }
+
+        for (k = 0; line[k] != '\0' && i < len; ++k) {
+            buf[i++] = line[k];
+        }
+
+        if (i < len) {
+            buf[i++] = '\n';
+        }
+
+        if (++n % 8 == 0 && i < len) {
+            buf[i++] = '\n';
+        }
+    }
+}
+
+/*
+ * Fill a buffer with long runs of whitespace broken up
+ * by a single token byte, e.g., padded tables.
+ *
+ * @buf: Buffer to fill
+ * @len: Length of 'buf'
+ */
+static void
+bench_fill_runs(char *buf, size_t len)
+{
+    static const char ws[] = { ' ', '\t', ' ', '\n', ' ', '\r', ' ', '\f' };
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        buf[i] = (i % 256 == 255) ? 'x' : ws[i % sizeof(ws)];
+    }
+}
+
+/*
+ * Skip every run of whitespace in an input, stepping over
+ * the bytes in between one at a time as the lexer would.
+ *
+ * Returns the number of newlines skipped
+ */
+static size_t
+bench_skip_ws(const struct scan_ops *ops, const char *p, const char *end)
+{
+    size_t nlines = 0;
+
+    while (p < end) {
+        p = ops->skip_ws(p, end, &nlines);
+        while (p < end && !scan_is_ws(*p)) {
+            ++p;
+        }
+    }
+
+    return nlines;
+}
+
+/*
+ * Find every newline in an input one after another
+ *
+ * Returns the number of newlines found
+ */
+static size_t
+bench_find_nl(const struct scan_ops *ops, const char *p, const char *end)
+{
+    size_t n = 0;
+
+    while ((p = ops->find_nl(p, end)) != NULL) {
+        ++n;
+        ++p;
+    }
+
+    return n;
+}
+
+/*
+ * Count the newlines of an input in one go
+ *
+ * Returns the number of newlines counted
+ */
+static size_t
+bench_count_nl(const struct scan_ops *ops, const char *p, const char *end)
+{
+    return ops->count_nl(p, end);
+}
+
+/*
+ * Run a workload over an input with every kernel set and
+ * print the throughput of each, all of them have to agree
+ * on the result.
+ *
+ * @name: Name of the workload
+ * @fn: Workload
+ * @in: Input
+ * @kernels: Kernel sets
+ * @nkernels: Number of kernel sets
+ * @rounds: Number of rounds, the fastest one counts
+ *
+ * Returns zero if every kernel set agreed
+ */
+static int
+bench_run(const char *name,
+    size_t (*fn)(const struct scan_ops *, const char *, const char *),
+    const struct bench_input *in, const struct bench_kernels *kernels,
+    size_t nkernels, int rounds)
+{
+    size_t i, res, want = 0;
+    double best, t;
+    int r, error = 0;
+
+    for (i = 0; i < nkernels; ++i) {
+        best = 0;
+        res = 0;
+        for (r = 0; r < rounds; ++r) {
+            t = bench_now();
+            res = fn(kernels[i].ops, in->buf, in->buf + in->len);
+            t = bench_now() - t;
+            if (r == 0 || t < best) {
+                best = t;
+            }
+        }
+
+        if (i == 0) {
+            want = res;
+        }
+
+        printf(
+            "%-9s %-7s %-9s %10.1f MiB/s%s\n",
+            name, in->name, kernels[i].name,
+            in->len / (1024.0 * 1024.0) / best,
+            (res != want) ? "  MISMATCH" : ""
+        );
+
+        if (res != want) {
+            error = -1;
+        }
+    }
+
+    return error;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench_kernels kernels[4];
+    struct bench_input inputs[2];
+    size_t i, len, nkernels = 0;
+    int rounds = BENCH_ROUNDS;
+    int error = 0;
+
+    len = (size_t)BENCH_MIB << 20;
+    if (argc > 1) {
+        len = strtoul(argv[1], NULL, 10) << 20;
+    }
+
+    if (argc > 2) {
+        rounds = atoi(argv[2]);
+    }
+
+    if (len == 0 || rounds <= 0) {
+        fprintf(stderr, "usage: %s [MiB] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    kernels[nkernels].name = "scalar";
+    kernels[nkernels++].ops = &scan_scalar;
+#if SCAN_SIMD
+    __builtin_cpu_init();
+    kernels[nkernels].name = "sse2";
+    kernels[nkernels++].ops = &scan_sse2;
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[nkernels].name = "avx2";
+        kernels[nkernels++].ops = &scan_avx2;
+    }
+#endif  /* SCAN_SIMD */
+
+    kernels[nkernels].name = "dispatch";
+    kernels[nkernels++].ops = &bench_dispatch;
+
+    inputs[0].name = "source";
+    inputs[1].name = "runs";
+    for (i = 0; i < 2; ++i) {
+        inputs[i].len = len;
+        if ((inputs[i].buf = malloc(len)) == NULL) {
+            fprintf(stderr, "failed to allocate input\n");
+            return 1;
+        }
+    }
+
+    bench_fill_source(inputs[0].buf, len);
+    bench_fill_runs(inputs[1].buf, len);
+
+    for (i = 0; i < 2; ++i) {
+        error |= bench_run(
+            "skip_ws", bench_skip_ws, &inputs[i],
+            kernels, nkernels, rounds
+        );
+
+        error |= bench_run(
+            "find_nl", bench_find_nl, &inputs[i],
+            kernels, nkernels, rounds
+        );
+
+        error |= bench_run(
+            "count_nl", bench_count_nl, &inputs[i],
+            kernels, nkernels, rounds
+        );
+    }
+
+    for (i = 0; i < 2; ++i) {
+        free(inputs[i].buf);
+    }
+
+    return (error != 0) ? 1 : 0;
+}
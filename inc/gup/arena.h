@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_ARENA_H
+#define GUP_ARENA_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Default size of an arena chunk */
+#define ARENA_CHUNK_SIZE 65536
+
+/* Alignment suitable for any object */
+#define ARENA_ALIGN _Alignof(max_align_t)
+
+/*
+ * Represents a single chunk of arena memory, the usable
+ * bytes follow the header.
+ *
+ * @next: Next (older) chunk
+ * @size: Number of usable bytes
+ * @used: Number of bytes handed out
+ * @data: Usable bytes
+ */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+};
+
+/*
+ * An arena hands out memory by bumping a pointer through
+ * large chunks, everything is released at once when the
+ * arena is reset or destroyed.
+ *
+ * @head: Chunk currently being allocated from
+ * @chunk_size: Size of new chunks
+ * @chunk_count: Number of chunks held
+ */
+struct arena {
+    struct arena_chunk *head;
+    size_t chunk_size;
+    size_t chunk_count;
+};
+
+/*
+ * Represents a point in time of an arena that it may
+ * be reset back to.
+ *
+ * @chunk: Chunk in use when marked
+ * @used: Bytes used in that chunk when marked
+ */
+struct arena_mark {
+    struct arena_chunk *chunk;
+    size_t used;
+};
+
+/*
+ * Initialize an arena
+ *
+ * @res: Arena to initialize
+ * @chunk_size: Size of chunks, zero for the default
+ *
+ * Returns zero on success
+ */
+int arena_init(struct arena *res, size_t chunk_size);
+
+/*
+ * Allocate memory from an arena
+ *
+ * @arena: Arena to allocate from
+ * @sz: Allocation size
+ * @align: Alignment, must be a power of two
+ *
+ * Returns the base of the allocated memory on success
+ */
+void *arena_alloc(struct arena *arena, size_t sz, size_t align);
+
+/*
+ * Record the current position of an arena
+ *
+ * @arena: Arena to mark
+ * @res: Mark is written here
+ */
+void arena_mark(struct arena *arena, struct arena_mark *res);
+
+/*
+ * Release everything allocated from an arena since
+ * a mark was taken.
+ *
+ * @arena: Arena to reset
+ * @mark: Mark to reset to, NULL to release everything
+ */
+void arena_reset(struct arena *arena, const struct arena_mark *mark);
+
+/*
+ * Destroy an arena and release all of its memory
+ *
+ * @arena: Arena to destroy
+ */
+void arena_destroy(struct arena *arena);
+
+#endif  /* !GUP_ARENA_H */
@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "gup/state.h"
 #include "gup/symbol.h"
 
@@ -29,8 +30,10 @@
  * @AST_ACCESS: Structure access
  * @AST_ASSIGN: Assignment
  * @AST_NUMBER: A number
- * @AST_EQUALITY: Eqaulity operator
- * @AST_IF: If statement
+ * @AST_BINOP: Binary operator, see 'op'
+ * @AST_UNOP: Unary operator on 'right', see 'op'
+ * @AST_IF: If statement, the condition is 'right'
+ * @AST_ELSE: Else arm of the if statement before it
  */
 typedef enum {
     AST_NONE,
@@ -47,8 +50,10 @@ typedef enum {
     AST_ACCESS,
     AST_ASSIGN,
     AST_NUMBER,
-    AST_EQUALITY,
+    AST_BINOP,
+    AST_UNOP,
     AST_IF,
+    AST_ELSE,
 } ast_op_t;
 
 /*
@@ -60,7 +65,13 @@ typedef enum {
  * @right: Right node
  * @symbol: Symbol associated with node
  * @epilogue: If set, indicates end of block
+ * @wide: Set on a folded number that was worked in 64 bits
  * @field_type: Used in structure fields
+ * @op: Operator token of AST_BINOP and AST_UNOP
+ * @len: Length of 's' when it is a view into the source input
+ * @line: Source line the node was parsed at
+ * @next: Next node of the same block within a module tree
+ * @body: First node of a block within a module tree
  */
 struct ast_node {
     ast_op_t type;
@@ -68,13 +79,77 @@ struct ast_node {
     struct ast_node *right;
     struct symbol *symbol;
     uint8_t epilogue : 1;
+    uint8_t wide : 1;
     gup_type_t field_type;
+    tt_t op;
+    size_t len;
+    size_t line;
+    struct ast_node *next;
+    struct ast_node *body;
     union {
-        char *s;
+        const char *s;
         ssize_t v;
     };
 };
 
+/*
+ * Represents a block of a module tree that is still
+ * being parsed.
+ *
+ * @node: Node of the block, NULL at the top level
+ * @tail: Link the next node of the block is written to
+ * @up: Enclosing block
+ */
+struct ast_block {
+    struct ast_node *node;
+    struct ast_node **tail;
+    struct ast_block *up;
+};
+
+/*
+ * Represents a whole module (i.e., translation unit) as
+ * a tree, nodes come in the order they would have been
+ * emitted. Procedures, loops and the arms of if
+ * statements hold their nodes in 'body', ending with
+ * their epilogue if they have one.
+ *
+ * @head: First top-level node
+ * @root: Top-level block
+ * @open: Innermost open block
+ * @free: Closed blocks ready for reuse
+ */
+struct ast_module {
+    struct ast_node *head;
+    struct ast_block root;
+    struct ast_block *open;
+    struct ast_block *free;
+};
+
+/*
+ * Returns true if a node opens a block within a module
+ * tree, i.e., every node up to its epilogue goes in
+ * its body.
+ *
+ * @node: Node to test
+ */
+static inline bool
+ast_opens_block(const struct ast_node *node)
+{
+    if (node->epilogue) {
+        return false;
+    }
+
+    switch (node->type) {
+    case AST_PROC:
+    case AST_LOOP:
+    case AST_IF:
+    case AST_ELSE:
+        return true;
+    default:
+        return false;
+    }
+}
+
 /*
  * Allocate an abstract syntax tree node
  *
@@ -87,4 +162,35 @@ int ast_alloc_node(
     struct ast_node **res
 );
 
+/*
+ * Start building a module tree, the parser hands its
+ * nodes to it from here on instead of emitting them.
+ *
+ * @state: Compiler state
+ *
+ * Returns zero on success
+ */
+int ast_module_init(struct gup_state *state);
+
+/*
+ * Append a node to the innermost open block of the module
+ * tree, opening a new block if it is the start of one.
+ *
+ * @state: Compiler state
+ * @node: Node to append
+ *
+ * Returns zero on success
+ */
+int ast_module_add(struct gup_state *state, struct ast_node *node);
+
+/*
+ * Close the innermost open block of the module tree
+ *
+ * @state: Compiler state
+ * @epilogue: Epilogue of the block, NULL if it has none
+ *
+ * Returns zero on success
+ */
+int ast_module_close(struct gup_state *state, struct ast_node *epilogue);
+
 #endif  /* !GUP_AST_H */
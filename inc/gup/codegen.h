@@ -8,6 +8,7 @@
 
 #include "gup/ast.h"
 #include "gup/state.h"
+#include "gup/mu.h"
 
 /*
  * Compile an abstract syntax tree node
@@ -19,4 +20,46 @@
  */
 int cg_compile_node(struct gup_state *state, struct ast_node *node);
 
+/*
+ * Compile every node of a module tree in order
+ *
+ * @state: Compiler state
+ * @mod: Module tree
+ *
+ * Returns zero on success
+ */
+int cg_compile_module(struct gup_state *state, struct ast_module *mod);
+
+/*
+ * Obtain the machine size of a variable or field
+ *
+ * @symbol: Symbol to size
+ *
+ * Returns MSIZE_BAD on failure
+ */
+msize_t cg_symbol_msize(struct symbol *symbol);
+
+/*
+ * Get the size an expression is worked in by itself, it
+ * is the size of its widest value but at least 32 bits
+ * as registers are worked on in 32 bits or more anyways.
+ *
+ * @node: Root of the expression
+ */
+msize_t cg_expr_size(struct ast_node *node);
+
+/*
+ * Reserve stack frame space for a local variable
+ *
+ * @state: Compiler state
+ * @func: Procedure the local belongs to
+ * @local: Local variable symbol
+ *
+ * Returns zero on success
+ */
+int cg_alloc_local(
+    struct gup_state *state, struct symbol *func,
+    struct symbol *local
+);
+
 #endif  /* !GUP_CODEGEN_H */
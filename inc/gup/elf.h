@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_ELF_H
+#define GUP_ELF_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Section index of symbols that are not defined */
+#define ELF_SECTION_UNDEF UINT32_MAX
+
+/*
+ * Represents a relocation against the contents of a
+ * section.
+ *
+ * @offset: Offset of the field to relocate within the section
+ * @symbol: Index of the symbol referenced
+ * @type: Machine specific relocation type
+ * @addend: Constant added to the symbol value
+ */
+struct elf_rela {
+    uint64_t offset;
+    uint32_t symbol;
+    uint32_t type;
+    int64_t addend;
+};
+
+/*
+ * Represents a section of a relocatable object
+ *
+ * @name: Section name
+ * @type: ELF section type (SHT_*)
+ * @flags: ELF section flags (SHF_*)
+ * @align: Section alignment in bytes
+ * @data: Section contents, NULL for SHT_NOBITS
+ * @size: Section size in bytes
+ * @rela: Relocations against the section
+ * @rela_count: Number of relocations
+ */
+struct elf_section {
+    const char *name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t align;
+    const void *data;
+    size_t size;
+    const struct elf_rela *rela;
+    size_t rela_count;
+};
+
+/*
+ * Represents a symbol of a relocatable object
+ *
+ * @name: Symbol name, not NUL terminated
+ * @name_len: Length of the symbol name
+ * @section: Index of the defining section or ELF_SECTION_UNDEF
+ * @value: Offset of the symbol within its section
+ * @global: Symbol is visible to other objects if set
+ */
+struct elf_symbol {
+    const char *name;
+    size_t name_len;
+    uint32_t section;
+    uint64_t value;
+    uint8_t global : 1;
+};
+
+/*
+ * Write a 64-bit relocatable object. Relocations against
+ * local symbols are rewritten against the symbol of their
+ * section, like most assemblers do.
+ *
+ * @fd: File descriptor to write to
+ * @file: Source file name recorded in the symbol table
+ * @machine: ELF machine type (EM_*)
+ * @sections: Sections of the object, in order
+ * @section_count: Number of sections
+ * @symbols: Symbols of the object
+ * @symbol_count: Number of symbols
+ *
+ * Returns zero on success
+ */
+int elf64_write_rel(
+    int fd, const char *file, uint16_t machine,
+    const struct elf_section *sections, size_t section_count,
+    const struct elf_symbol *symbols, size_t symbol_count
+);
+
+#endif  /* !GUP_ELF_H */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_INTERN_H
+#define GUP_INTERN_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "gup/arena.h"
+
+/*
+ * Represents a slot in the intern pool hash table
+ *
+ * @hash: Hash of the string
+ * @len: Length of the string
+ * @str: Interned string, NULL if free
+ */
+struct intern_slot {
+    uint32_t hash;
+    uint32_t len;
+    const char *str;
+};
+
+/*
+ * An intern pool keeps a single copy of every distinct
+ * string given to it, equal strings interned from the
+ * same pool therefore compare equal by pointer.
+ *
+ * @arena: Interned strings are allocated here
+ * @slots: Hash table slots
+ * @slot_cap: Number of hash table slots
+ * @count: Number of strings interned
+ */
+struct intern_pool {
+    struct arena arena;
+    struct intern_slot *slots;
+    size_t slot_cap;
+    size_t count;
+};
+
+/*
+ * Initialize an intern pool
+ *
+ * @res: Intern pool to initialize
+ *
+ * Returns zero on success
+ */
+int intern_init(struct intern_pool *res);
+
+/*
+ * Intern a string that is not NUL terminated, such as a
+ * view into the source input.
+ *
+ * @pool: Intern pool
+ * @s: String to intern
+ * @len: Length of string
+ *
+ * Returns a NUL terminated string that lives as long as
+ * the pool, NULL on failure.
+ */
+const char *intern_strn(struct intern_pool *pool, const char *s, size_t len);
+
+/*
+ * Intern a NUL terminated string
+ *
+ * @pool: Intern pool
+ * @s: String to intern
+ *
+ * Returns NULL on failure
+ */
+const char *intern_str(struct intern_pool *pool, const char *s);
+
+/*
+ * Look up a string without interning it
+ *
+ * @pool: Intern pool
+ * @s: String to look up
+ * @len: Length of string
+ *
+ * Returns NULL if the string was never interned
+ */
+const char *intern_lookup(struct intern_pool *pool, const char *s, size_t len);
+
+/*
+ * Destroy an intern pool, all interned strings are
+ * released with it.
+ *
+ * @pool: Intern pool to destroy
+ */
+void intern_destroy(struct intern_pool *pool);
+
+#endif  /* !GUP_INTERN_H */
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_IR_H
+#define GUP_IR_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "gup/symbol.h"
+#include "gup/mu.h"
+
+/* Maximum length of a block label, including the NUL */
+#define IR_LABEL_MAX 32
+
+/* A virtual register, IR_VREG_NONE if there is none */
+typedef uint32_t ir_vreg_t;
+#define IR_VREG_NONE ((ir_vreg_t)-1)
+
+/*
+ * Valid IR operations, 'a' and 'b' are the operands
+ * and 'dst' is the virtual register written.
+ */
+typedef enum {
+    IR_NOP,     /* Removed by a pass, nothing */
+    IR_LABEL,   /* Start of block target[0] */
+    IR_CONST,   /* dst = a */
+    IR_MOV,     /* dst = a, a virtual register, see ir_promote() */
+    IR_LOAD,    /* dst = [addr] */
+    IR_STORE,   /* [addr] = a */
+    IR_ADD,     /* dst = a + b */
+    IR_SUB,     /* dst = a - b */
+    IR_MUL,     /* dst = a * b */
+    IR_DIV,     /* dst = a / b, unsigned */
+    IR_MOD,     /* dst = a % b, unsigned */
+    IR_AND,     /* dst = a & b */
+    IR_OR,      /* dst = a | b */
+    IR_XOR,     /* dst = a ^ b */
+    IR_SHL,     /* dst = a << b */
+    IR_SHR,     /* dst = a >> b */
+    IR_EQ,      /* dst = a == b */
+    IR_NE,      /* dst = a != b */
+    IR_LT,      /* dst = a < b, unsigned */
+    IR_LE,      /* dst = a <= b, unsigned */
+    IR_CALL,    /* Call procedure 's' */
+    IR_RET,     /* Return a, if there is one */
+    IR_JMP,     /* Jump to block target[0] */
+    IR_BR,      /* Jump to block target[0] if a <cond> b, else target[1] */
+    IR_ASM,     /* Inline assembly 's' */
+} ir_op_t;
+
+/*
+ * Valid kinds of operands
+ */
+typedef enum {
+    IR_OPND_NONE,
+    IR_OPND_VREG,
+    IR_OPND_IMM
+} ir_opnd_t;
+
+/*
+ * Represents an operand of an instruction
+ *
+ * @kind: Operand kind
+ * @vreg: Virtual register, for IR_OPND_VREG
+ * @imm: Immediate value, for IR_OPND_IMM
+ */
+struct ir_operand {
+    ir_opnd_t kind;
+    union {
+        ir_vreg_t vreg;
+        int64_t imm;
+    };
+};
+
+/*
+ * Represents a memory location
+ *
+ * @label: Label of a global, NULL for a local
+ * @off: Offset of a local below the frame base
+ */
+struct ir_addr {
+    const char *label;
+    size_t off;
+};
+
+/*
+ * Represents a single IR instruction
+ *
+ * @op: Operation
+ * @size: Size of the values operated on
+ * @dst: Virtual register written
+ * @a: First operand
+ * @b: Second operand
+ * @addr: Memory location of loads and stores
+ * @target: Blocks jumped to, or the block of a label
+ * @cond: Comparison of a branch, from IR_EQ up to IR_LE
+ * @s: Procedure called, or inline assembly
+ * @len: Length of 's' for inline assembly
+ */
+struct ir_insn {
+    ir_op_t op;
+    msize_t size;
+    ir_vreg_t dst;
+    struct ir_operand a;
+    struct ir_operand b;
+    struct ir_addr addr;
+    uint32_t target[2];
+    ir_op_t cond;
+    const char *s;
+    size_t len;
+};
+
+/*
+ * Represents a basic block, it starts at its IR_LABEL
+ * and runs up to the next label or jump.
+ *
+ * @label: Label emitted for the block, empty if none
+ */
+struct ir_block {
+    char label[IR_LABEL_MAX];
+};
+
+/*
+ * Represents a procedure being lowered to IR, the storage
+ * is kept from one procedure to the next.
+ *
+ * @func: Procedure, NULL outside of one
+ * @insns: Instructions in the order they run
+ * @count: Number of instructions
+ * @cap: Capacity of 'insns'
+ * @blocks: Blocks, indexed by the targets of instructions
+ * @nblocks: Number of blocks
+ * @block_cap: Capacity of 'blocks'
+ * @nvregs: Number of virtual registers
+ * @loops: Head blocks of the loops being lowered, innermost
+ *         last, the end block of a loop follows its head
+ * @nloops: Number of loops being lowered
+ * @loop_cap: Capacity of 'loops'
+ * @ifs: Else blocks of the if statements being lowered,
+ *       innermost last, the end block of an if follows
+ *       its else block
+ * @nifs: Number of if statements being lowered
+ * @if_cap: Capacity of 'ifs'
+ */
+struct ir_proc {
+    struct symbol *func;
+    struct ir_insn *insns;
+    size_t count;
+    size_t cap;
+    struct ir_block *blocks;
+    size_t nblocks;
+    size_t block_cap;
+    ir_vreg_t nvregs;
+    uint32_t *loops;
+    size_t nloops;
+    size_t loop_cap;
+    uint32_t *ifs;
+    size_t nifs;
+    size_t if_cap;
+};
+
+/*
+ * Returns true if control never falls through past
+ * an instruction.
+ *
+ * @insn: Instruction to test
+ */
+static inline bool
+ir_is_jump(const struct ir_insn *insn)
+{
+    switch (insn->op) {
+    case IR_RET:
+    case IR_JMP:
+    case IR_BR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Returns true if an operation works on two operands,
+ * from IR_ADD up to IR_LE.
+ *
+ * @op: Operation to test
+ */
+static inline bool
+ir_is_binop(ir_op_t op)
+{
+    return op >= IR_ADD && op <= IR_LE;
+}
+
+/*
+ * Returns true if an instruction does nothing but write
+ * its virtual register.
+ *
+ * XXX: Loads are not, they may be reading device memory.
+ *
+ * @insn: Instruction to test
+ */
+static inline bool
+ir_is_pure(const struct ir_insn *insn)
+{
+    return insn->op == IR_CONST || ir_is_binop(insn->op);
+}
+
+/*
+ * Start lowering a procedure, dropping whatever was
+ * lowered before.
+ *
+ * @proc: IR procedure
+ * @func: Procedure to lower
+ */
+void ir_begin(struct ir_proc *proc, struct symbol *func);
+
+/*
+ * Append an instruction
+ *
+ * @proc: IR procedure
+ * @op: Operation
+ * @size: Size of the values operated on
+ *
+ * Returns the zeroed instruction, valid up until the next
+ * one is appended, or NULL on failure.
+ */
+struct ir_insn *ir_push(struct ir_proc *proc, ir_op_t op, msize_t size);
+
+/*
+ * Allocate a virtual register
+ *
+ * @proc: IR procedure
+ */
+ir_vreg_t ir_vreg(struct ir_proc *proc);
+
+/*
+ * Create a block without placing it, jumps may target
+ * it right away.
+ *
+ * @proc: IR procedure
+ * @label: Label of the block, NULL if it needs none
+ * @res: Block is written here
+ *
+ * Returns zero on success
+ */
+int ir_block(struct ir_proc *proc, const char *label, uint32_t *res);
+
+/*
+ * Place a block at the end of the procedure
+ *
+ * @proc: IR procedure
+ * @block: Block to place
+ *
+ * Returns zero on success
+ */
+int ir_place(struct ir_proc *proc, uint32_t block);
+
+/*
+ * Enter a loop being lowered, see the 'loops' field
+ *
+ * @proc: IR procedure
+ * @head: Head block of the loop
+ *
+ * Returns zero on success
+ */
+int ir_loop_push(struct ir_proc *proc, uint32_t head);
+
+/*
+ * Enter an if statement being lowered, see the 'ifs' field
+ *
+ * @proc: IR procedure
+ * @other: Else block of the if statement
+ *
+ * Returns zero on success
+ */
+int ir_if_push(struct ir_proc *proc, uint32_t other);
+
+/*
+ * Optimize a procedure with constant folding, jump
+ * threading and dead code removal.
+ *
+ * @proc: IR procedure
+ *
+ * Returns zero on success
+ */
+int ir_optimize(struct ir_proc *proc);
+
+/*
+ * Keep the locals of a procedure in virtual registers
+ * rather than in its frame, so that they are register
+ * allocated like any other value. Loads of a local read
+ * its virtual register and stores write it.
+ *
+ * XXX: This is the last pass before register allocation,
+ *      a promoted local is written more than once which
+ *      the other passes do not expect.
+ *
+ * XXX: Inline assembly may address locals in the frame,
+ *      procedures with it are left alone.
+ *
+ * @proc: IR procedure
+ *
+ * Returns zero on success
+ */
+int ir_promote(struct ir_proc *proc);
+
+/*
+ * Release the storage of an IR procedure
+ *
+ * @proc: IR procedure
+ */
+void ir_destroy(struct ir_proc *proc);
+
+#endif  /* !GUP_IR_H */
@@ -9,13 +9,29 @@
 #include "gup/state.h"
 #include "gup/token.h"
 
+/*
+ * Obtain the text of a token as a view into the
+ * source input.
+ *
+ * @state: Compiler state
+ * @tok: Token to obtain text of
+ *
+ * XXX: The result is not NUL terminated, use 'tok->len'
+ */
+static inline const char *
+lexer_tokstr(struct gup_state *state, struct token *tok)
+{
+    return state->in_buf + tok->off;
+}
+
 /*
  * Scan for a single token within the source input
  *
  * @state: Compiler state
  * @res: Token is written here
  *
- * Returns zero on success
+ * Returns zero on success, a token of type TT_NONE marks
+ * the end of the source input.
  */
 int lexer_scan(struct gup_state *state, struct token *res);
 
@@ -10,6 +10,9 @@
 #include "gup/state.h"
 #include "gup/ast.h"
 
+/* Forward declaration */
+struct ir_proc;
+
 /*
  * Valid machine sizes
  */
@@ -22,6 +25,16 @@ typedef enum {
     MSIZE_MAX,
 } msize_t;
 
+/*
+ * Output formats of the built-in assembler
+ */
+typedef enum {
+    MU_OUT_ELF64,   /* ELF64 relocatable object */
+    MU_OUT_BIN,     /* Flat binary */
+    MU_OUT_BOOT,    /* Flat binary padded out to a signed boot sector */
+    MU_OUT_MAX
+} mu_out_t;
+
 /*
  * Convert a program data type to a machine size
  * constant.
@@ -44,15 +57,33 @@ type_to_msize(gup_type_t type)
     return MSIZE_BAD;
 }
 
+/*
+ * Obtain the number of bytes of a machine size
+ *
+ * @size: Machine size
+ *
+ * Returns zero on failure
+ */
+static inline size_t
+msize_bytes(msize_t size)
+{
+    if (size == MSIZE_BAD || size >= MSIZE_MAX) {
+        return 0;
+    }
+
+    return (size_t)1 << (size - MSIZE_BYTE);
+}
+
 /*
  * Inject assembly into the program
  *
  * @state: Compiler state
  * @str: Assembly to inject
+ * @len: Length of assembly to inject
  *
  * Returns zero on success
  */
-int mu_cg_inject(struct gup_state *state, const char *str);
+int mu_cg_inject(struct gup_state *state, const char *str, size_t len);
 
 /*
  * Create an assembly label
@@ -74,6 +105,25 @@ int mu_cg_label(struct gup_state *state, const char *s, bool is_global);
  */
 int mu_cg_ret(struct gup_state *state);
 
+/*
+ * Set up a stack frame for the locals of a procedure
+ *
+ * @state: Compiler state
+ * @size:  Bytes of locals
+ *
+ * Returns zero on success
+ */
+int mu_cg_frame(struct gup_state *state, size_t size);
+
+/*
+ * Tear down the stack frame of a procedure
+ *
+ * @state: Compiler state
+ *
+ * Returns zero on success
+ */
+int mu_cg_leave(struct gup_state *state);
+
 /*
  * Emit a return instruction as well as loading the return
  * register with an immediate
@@ -131,6 +181,21 @@ int mu_cg_loadvar(
     msize_t size, ssize_t ival
 );
 
+/*
+ * Emit a load to a local variable
+ *
+ * @state: Compiler state
+ * @off:   Offset of variable below the frame base
+ * @size:  Size of value to load
+ * @ival:  Immediate value to load
+ *
+ * Returns zero on success
+ */
+int mu_cg_loadlocal(
+    struct gup_state *state, size_t off,
+    msize_t size, ssize_t ival
+);
+
 /*
  * Emit a variable
  *
@@ -138,7 +203,7 @@ int mu_cg_loadvar(
  * @sect:  Section to put label in
  * @label: Label of variable to create
  * @size:  Variable size
- * @ival:  Initial value
+ * @ival:  Initial value, unused for SECTION_BSS
  *
  * Returns zero on success
  */
@@ -147,4 +212,42 @@ int mu_cg_var(
     const char *label, msize_t size, ssize_t ival
 );
 
+/*
+ * Select instructions for a procedure lowered to IR and
+ * emit them, this is the only way code gets into the
+ * procedure bodies.
+ *
+ * @state: Compiler state
+ * @proc: IR procedure
+ *
+ * Returns zero on success
+ */
+int mu_isel(struct gup_state *state, struct ir_proc *proc);
+
+/*
+ * Assemble the generated program straight into its output
+ * file without an external assembler.
+ *
+ * @state: Compiler state
+ * @path: Path of the output to write, "-" for stdout
+ * @fmt: Output format
+ *
+ * Returns zero on success, fails with -ENOTSUP without writing
+ * anything when the program uses assembly that cannot be
+ * encoded in-process, or with -EFBIG when a boot sector does
+ * not fit.
+ */
+int mu_assemble(struct gup_state *state, const char *path, mu_out_t fmt);
+
+/*
+ * Pad a flat binary written by an external assembler out
+ * to a signed boot sector, see MU_OUT_BOOT.
+ *
+ * @path: Path of the binary
+ *
+ * Returns zero on success, fails with -EFBIG when the binary
+ * does not fit.
+ */
+int mu_seal_boot(const char *path);
+
 #endif  /* !GUP_MU_H */
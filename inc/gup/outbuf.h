@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_OUTBUF_H
+#define GUP_OUTBUF_H 1
+
+#include <sys/types.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Initial size of an output buffer, allocated on first write */
+#define OUTBUF_INIT_CAP 65536
+
+/* Maximum number of characters of a formatted 64-bit integer */
+#define OUTBUF_INT_MAX 20
+
+/* Maximum number of output buffers flushed together */
+#define OUTBUF_IOV_MAX 8
+
+/*
+ * Represents a growable in-memory output buffer, output
+ * is collected here and written out in one go.
+ *
+ * XXX: A failed allocation sets 'error' and drops any
+ *      further output, it is reported when flushing so
+ *      that emitters need not check every write.
+ *
+ * @buf: Buffer contents
+ * @len: Number of bytes written
+ * @cap: Capacity of buffer
+ * @error: Set if output has been lost
+ */
+struct outbuf {
+    char *buf;
+    size_t len;
+    size_t cap;
+    uint8_t error : 1;
+};
+
+/*
+ * Initialize an output buffer
+ *
+ * @res: Output buffer to initialize
+ *
+ * Returns zero on success
+ */
+int outbuf_init(struct outbuf *res);
+
+/*
+ * Make room for more bytes in an output buffer
+ *
+ * @ob: Output buffer
+ * @n: Number of bytes needed past the current length
+ *
+ * Returns zero on success
+ */
+int outbuf_grow(struct outbuf *ob, size_t n);
+
+/*
+ * Format an unsigned integer in decimal
+ *
+ * @dst: Digits are written here, must fit OUTBUF_INT_MAX bytes
+ * @v: Value to format
+ *
+ * Returns the number of digits written
+ */
+size_t outbuf_fmtu(char *dst, uint64_t v);
+
+/*
+ * Write an unsigned integer in decimal
+ *
+ * @ob: Output buffer
+ * @v: Value to write
+ */
+void outbuf_putu(struct outbuf *ob, uint64_t v);
+
+/*
+ * Write a signed integer in decimal
+ *
+ * @ob: Output buffer
+ * @v: Value to write
+ */
+void outbuf_puti(struct outbuf *ob, int64_t v);
+
+/*
+ * Write formatted text to an output buffer, meant for
+ * diagnostics rather than the hot emit paths.
+ *
+ * @ob: Output buffer
+ * @fmt: printf(3) style format
+ * @ap: Format arguments
+ */
+void outbuf_vprintf(struct outbuf *ob, const char *fmt, va_list ap);
+
+/*
+ * Write formatted text to an output buffer, see
+ * outbuf_vprintf().
+ *
+ * @ob: Output buffer
+ * @fmt: printf(3) style format
+ */
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*
+ * Write the whole contents of an output buffer to a
+ * file descriptor and empty it.
+ *
+ * @ob: Output buffer
+ * @fd: File descriptor to write to
+ *
+ * Returns zero on success
+ */
+int outbuf_flush(struct outbuf *ob, int fd);
+
+/*
+ * Write the contents of several output buffers back to
+ * back with a single gathered write and empty them.
+ *
+ * @obs: Output buffers, in the order they are written
+ * @count: Number of output buffers, at most OUTBUF_IOV_MAX
+ * @fd: File descriptor to write to
+ *
+ * Returns zero on success
+ */
+int outbuf_flushv(struct outbuf *obs, size_t count, int fd);
+
+/*
+ * Destroy an output buffer
+ *
+ * @ob: Output buffer to destroy
+ */
+void outbuf_destroy(struct outbuf *ob);
+
+/*
+ * Write bytes to an output buffer
+ *
+ * @ob: Output buffer
+ * @s: Bytes to write
+ * @len: Number of bytes
+ */
+static inline void
+outbuf_putn(struct outbuf *ob, const char *s, size_t len)
+{
+    if (ob->cap - ob->len < len && outbuf_grow(ob, len) < 0) {
+        return;
+    }
+
+    memcpy(&ob->buf[ob->len], s, len);
+    ob->len += len;
+}
+
+/*
+ * Write a NUL terminated string to an output buffer
+ *
+ * @ob: Output buffer
+ * @s: String to write
+ */
+static inline void
+outbuf_puts(struct outbuf *ob, const char *s)
+{
+    outbuf_putn(ob, s, strlen(s));
+}
+
+/*
+ * Write a single character to an output buffer
+ *
+ * @ob: Output buffer
+ * @c: Character to write
+ */
+static inline void
+outbuf_putc(struct outbuf *ob, char c)
+{
+    if (ob->len == ob->cap && outbuf_grow(ob, 1) < 0) {
+        return;
+    }
+
+    ob->buf[ob->len++] = c;
+}
+
+/* Write a string literal, its length is known up front */
+#define outbuf_lit(ob, s) outbuf_putn((ob), "" s, sizeof(s) - 1)
+
+#endif  /* !GUP_OUTBUF_H */
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_PASS_H
+#define GUP_PASS_H 1
+
+#include "gup/state.h"
+#include "gup/ast.h"
+
+/*
+ * Represents a pass over a whole module tree
+ *
+ * @name: Name of the pass, used in diagnostics
+ * @run: Run the pass, returns zero on success
+ */
+struct pass {
+    const char *name;
+    int (*run)(struct gup_state *state, struct ast_module *mod);
+};
+
+/*
+ * Run every pass over the module tree of the compiler
+ * state, in order.
+ *
+ * @state: Compiler state
+ *
+ * Returns zero on success
+ */
+int pass_run(struct gup_state *state);
+
+#endif  /* !GUP_PASS_H */
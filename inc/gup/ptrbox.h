@@ -6,32 +6,21 @@
 #ifndef GUP_PTRBOX_H
 #define GUP_PTRBOX_H
 
-#include <sys/queue.h>
 #include <stdint.h>
 #include <stddef.h>
-
-/*
- * Represents a pointer box entry which stores a reference
- * to allocated memory
- *
- * @data: Allocated memory
- * @link: Queue link
- */
-struct ptrbox_entry {
-    void *data;
-    TAILQ_ENTRY(ptrbox_entry) link;
-};
+#include "gup/arena.h"
 
 /*
  * A pointer box stores one or more references to allocated memory
  * so that it can be cleaned up in one sweep when usage is complete.
  *
- * @entries: Pointer box entries
- * @entry_count: Number of entries in pointer box
+ * XXX: This is a thin layer over an arena, memory is bump
+ *      allocated and released a chunk at a time.
+ *
+ * @arena: Backing arena
  */
 struct ptrbox {
-    TAILQ_HEAD(, ptrbox_entry) entries;
-    size_t entry_count;
+    struct arena arena;
 };
 
 /*
@@ -55,6 +44,19 @@ void *ptrbox_alloc(struct ptrbox *ptrbox, size_t sz);
  */
 void *ptrbox_strdup(struct ptrbox *ptrbox, const char *s);
 
+/*
+ * Duplicate at most 'len' bytes of a string and save the
+ * reference in a pointer box, the result is always NUL
+ * terminated.
+ *
+ * @ptrbox: Ptrbox to save reference within
+ * @s: String to dup
+ * @len: Maximum number of bytes to dup
+ *
+ * Returns dupped string on success
+ */
+void *ptrbox_strndup(struct ptrbox *ptrbox, const char *s, size_t len);
+
 /*
  * Destroy a pointer box
  *
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_REGALLOC_H
+#define GUP_REGALLOC_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "gup/ir.h"
+
+/* Maximum number of registers of a target */
+#define RA_REG_MAX 32
+
+/* Virtual register is not held in a register */
+#define RA_NOREG 0xFF
+
+/* Virtual register has no spill slot */
+#define RA_NOSLOT ((size_t)-1)
+
+/*
+ * Describes the registers a target hands to the
+ * allocator, numbered from zero. Calls keep the
+ * callee-saved ones and inline assembly keeps none.
+ *
+ * @count: Number of registers
+ * @saved: Mask of the callee-saved registers
+ */
+struct ra_target {
+    uint8_t count;
+    uint32_t saved;
+};
+
+/*
+ * Represents where a virtual register lives, it is
+ * held in 'reg' up until instruction 'split' and in
+ * its spill slot from there on.
+ *
+ * @reg: Register, RA_NOREG if it is always in its slot
+ * @slot: Spill slot, RA_NOSLOT if it never leaves 'reg'
+ * @split: Instruction the register is left at, SIZE_MAX
+ *         if it never is
+ */
+struct ra_loc {
+    uint8_t reg;
+    size_t slot;
+    size_t split;
+};
+
+/*
+ * Represents the store of a register to the spill slot
+ * of a split virtual register, right after it is written
+ * and ahead of where the register is left, see 'split'.
+ *
+ * @pos: Instruction the register is stored before
+ * @reg: Register left
+ * @slot: Spill slot stored to
+ */
+struct ra_spill {
+    size_t pos;
+    uint8_t reg;
+    size_t slot;
+};
+
+/*
+ * Represents the register allocation of a procedure
+ *
+ * @locs: Location of each virtual register
+ * @spills: Registers left for spill slots, in order
+ * @nspills: Number of entries in 'spills'
+ * @nslots: Number of spill slots, each eight bytes
+ * @used: Mask of the registers handed out
+ */
+struct ra_alloc {
+    struct ra_loc *locs;
+    struct ra_spill *spills;
+    size_t nspills;
+    size_t nslots;
+    uint32_t used;
+};
+
+/*
+ * Allocate registers for the virtual registers of a
+ * procedure with linear scan.
+ *
+ * Every virtual register is live from its definition up
+ * to its last use, stretched over the whole of any loop
+ * it is live across. Values live across a call go in
+ * callee-saved registers, and ones that cannot stay in
+ * a register are split and continue in a spill slot.
+ * When registers run out, the value used least often
+ * for its length is the one spilled, uses within loops
+ * counting more.
+ *
+ * Variables, virtual registers written more than once
+ * such as promoted locals, are live from their first
+ * write or read to their last, over the whole of any
+ * loop they are in. They are never split, one that
+ * cannot stay in a register lives in its slot.
+ *
+ * @proc: IR procedure, after ir_optimize() and ir_promote()
+ * @target: Registers of the target
+ * @res: Allocation is written here
+ *
+ * Returns zero on success
+ */
+int ra_allocate(struct ir_proc *proc, const struct ra_target *target,
+    struct ra_alloc *res);
+
+/*
+ * Release a register allocation
+ *
+ * @ra: Allocation to release
+ */
+void ra_free(struct ra_alloc *ra);
+
+#endif  /* !GUP_REGALLOC_H */
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_SCAN_H
+#define GUP_SCAN_H 1
+
+#include <stddef.h>
+
+/*
+ * Skip over whitespace within a byte range
+ *
+ * @p:      Start of range
+ * @end:    End of range
+ * @nlines: Number of newlines skipped is added here
+ *
+ * Returns the first byte that is not whitespace or 'end'
+ * if the whole range was skipped.
+ */
+const char *scan_skip_ws(const char *p, const char *end, size_t *nlines);
+
+/*
+ * Find the next newline within a byte range
+ *
+ * @p:   Start of range
+ * @end: End of range
+ *
+ * Returns NULL if there is no newline in the range
+ */
+const char *scan_find_nl(const char *p, const char *end);
+
+/*
+ * Count the newlines within a byte range
+ *
+ * @p:   Start of range
+ * @end: End of range
+ */
+size_t scan_count_nl(const char *p, const char *end);
+
+#endif  /* !GUP_SCAN_H */
@@ -8,8 +8,52 @@
 
 #include <stdint.h>
 #include "gup/token.h"
+#include "gup/symbol.h"
 #include "gup/state.h"
 
+/*
+ * Represents a slot in the symbol map of a scope
+ *
+ * @gen: Generation of the scope the slot was filled in
+ * @symbol: Symbol in this slot
+ */
+struct scope_slot {
+    uint32_t gen;
+    struct symbol *symbol;
+};
+
+/*
+ * Represents a lexical scope, scopes are chained to the
+ * scope they are opened in. Each has its own small map
+ * of the symbols declared within it.
+ *
+ * XXX: Popped scopes are recycled. Bumping the generation
+ *      frees every slot at once so popping is O(1).
+ *
+ * @type: Token of the block that opened the scope
+ * @parent: Enclosing scope, NULL if outermost
+ * @lookup: Nearest enclosing scope holding any symbols
+ * @slots: Symbol map, 'slot_cap' is a power of two
+ * @slot_cap: Number of slots
+ * @count: Number of symbols in the scope
+ * @gen: Current generation
+ * @keep: If set, the scope outlives its block
+ * @next: Free list link
+ * @all: Link of the list of every scope allocated
+ */
+struct scope {
+    tt_t type;
+    struct scope *parent;
+    struct scope *lookup;
+    struct scope_slot *slots;
+    size_t slot_cap;
+    size_t count;
+    uint32_t gen;
+    uint8_t keep : 1;
+    struct scope *next;
+    struct scope *all;
+};
+
 /*
  * Push a scope token onto the scope stack
  *
@@ -34,4 +78,61 @@ tt_t scope_top(struct gup_state *state);
  */
 tt_t scope_pop(struct gup_state *state);
 
+/*
+ * Obtain the innermost scope
+ *
+ * @state: Compiler state
+ *
+ * Returns NULL if no scope is open
+ */
+struct scope *scope_current(struct gup_state *state);
+
+/*
+ * Obtain the scope of the procedure being parsed
+ *
+ * @state: Compiler state
+ *
+ * Returns NULL if not within a procedure
+ */
+struct scope *scope_proc(struct gup_state *state);
+
+/*
+ * Declare a symbol within a scope
+ *
+ * @scope: Scope to declare symbol in
+ * @symbol: Symbol to declare, its name must be interned
+ *
+ * Returns zero on success, -1 with errno set to -EEXIST
+ * if the name is already declared in the scope.
+ */
+int scope_insert(struct scope *scope, struct symbol *symbol);
+
+/*
+ * Find a symbol declared within a single scope
+ *
+ * @scope: Scope to search
+ * @name: Interned name to look up
+ *
+ * Returns NULL if not found
+ */
+struct symbol *scope_find(const struct scope *scope, const char *name);
+
+/*
+ * Look up a name from the innermost scope outwards,
+ * ending at the global symbol table.
+ *
+ * @state: Compiler state
+ * @name: Interned name to look up
+ *
+ * Returns NULL if not found
+ */
+struct symbol *scope_lookup(struct gup_state *state, const char *name);
+
+/*
+ * Release every scope, including those that were kept
+ *
+ * @state: Compiler state
+ */
+void scope_destroy(struct gup_state *state);
+
 #endif  /* !GUP_SCOPE_H */
@@ -7,12 +7,22 @@
 #define GUP_STATE_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "gup/ptrbox.h"
+#include "gup/intern.h"
+#include "gup/outbuf.h"
 #include "gup/token.h"
 #include "gup/symbol.h"
+#include "gup/tokstream.h"
 
 #define DEFAULT_ASMOUT "gupgen.asm"
-#define MAX_SCOPE_DEPTH 8
+#define DEFAULT_OBJOUT "gupgen.o"
+#define DEFAULT_BINOUT "gupgen"
+
+/* Forward declarations */
+struct scope;
+struct ast_module;
+struct ir_proc;
 
 /*
  * Represents valid sections within the output
@@ -23,44 +33,91 @@ typedef enum {
     SECTION_TEXT,
     SECTION_DATA,
     SECTION_BSS,
+    SECTION_RODATA,
     SECTION_MAX
 } bin_section_t;
 
 /*
- * Represents the compiler state
+ * Represents the compiler state, this is everything a
+ * compilation touches so any number of them may run at
+ * once on different threads.
  *
- * @in_fd: Source input file descriptor
- * @line_no: Line number
- * @putback: Putback buffer
+ * @in_buf: Source input buffer
+ * @in_len: Length of source input buffer
+ * @in_off: Lexer cursor within the source input buffer
+ * @in_mapped: Set if the source input buffer is memory mapped
+ * @line_num: Line number
+ * @tokens: Pre-lexed token stream of the source input
+ * @tok_idx: Index of the next token to be parsed
  * @ptrbox: Global pointer box
+ * @names: Interned identifiers
  * @symtab: Global symbol table
- * @scope_stack: Keeps track of scopes
- * @scope_depth: Current scope depth
+ * @scope: Innermost scope, NULL at the top level
+ * @scope_free: Popped scopes ready for reuse
+ * @scope_all: Every scope allocated
  * @loop_count: Number of loops in program
- * @cur_section: Current section
+ * @if_count: Number of if statements in program
  * @this_func: Current function
- * @unreachable: Entering unreachable code if set
- * @out_fp: Output file
+ * @decl_locals: Set while the locals of a procedure may be declared
+ * @quiet: Suppress diagnostics, used for speculative lexing
+ * @whole_module: Parse the whole module before passes and emission
+ * @inline_asm: Set once inline assembly has been emitted
+ * @module: Module tree, NULL while nodes are emitted as parsed
+ * @ir: Procedure being lowered to IR, NULL until the first one
+ * @out: Output of each section, buffered in memory until flushed
+ * @diag: Diagnostics are collected here if set, else written to stderr
  */
 struct gup_state {
-    int in_fd;
+    const char *in_buf;
+    size_t in_len;
+    size_t in_off;
+    uint8_t in_mapped : 1;
     size_t line_num;
-    char putback;
+    struct tokstream tokens;
+    size_t tok_idx;
     struct ptrbox ptrbox;
+    struct intern_pool names;
     struct symbol_table symtab;
-    tt_t scope_stack[MAX_SCOPE_DEPTH];
-    size_t scope_depth;
+    struct scope *scope;
+    struct scope *scope_free;
+    struct scope *scope_all;
     size_t loop_count;
-    bin_section_t cur_section;
+    size_t if_count;
     struct symbol *this_func;
-    uint8_t unreachable : 1;
-    FILE *out_fp;
+    uint8_t decl_locals : 1;
+    uint8_t quiet : 1;
+    uint8_t whole_module : 1;
+    uint8_t inline_asm : 1;
+    struct ast_module *module;
+    struct ir_proc *ir;
+    struct outbuf out[SECTION_MAX];
+    struct outbuf *diag;
 };
 
+/*
+ * Report a diagnostic, see the 'diag' field
+ *
+ * @state: Compiler state
+ * @fmt: printf(3) style format
+ */
+void gup_state_log(struct gup_state *state, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/*
+ * Write the buffered output of every section to a file,
+ * each section appears once.
+ *
+ * @state: Compiler state
+ * @fd: File descriptor to write to
+ *
+ * Returns zero on success
+ */
+int gup_state_flush(struct gup_state *state, int fd);
+
 /*
  * Initialize the compiler state
  *
- * @path: Source input file path
+ * @path: Source input file path, "-" for standard input
  * @state: Compiler state
  *
  * Returns zero on success
@@ -6,13 +6,14 @@
 #ifndef GUP_SYMBOL_H
 #define GUP_SYMBOL_H 1
 
-#include <sys/queue.h>
 #include <stdint.h>
 #include <stddef.h>
+#include "gup/arena.h"
 #include "gup/types.h"
 
-/* Forward declaration */
+/* Forward declarations */
 struct ast_node;
+struct scope;
 
 /* Symbol ID */
 typedef size_t sym_id_t;
@@ -25,39 +26,79 @@ typedef enum {
     SYMBOL_FUNC,
     SYMBOL_VAR,
     SYMBOL_STRUCT,
-    SYMBOL_TYPEDEF
+    SYMBOL_TYPEDEF,
+    SYMBOL_FIELD
 } sym_type_t;
 
 /*
  * Represents a program symbol
  *
- * @name: Symbol name
+ * @name: Symbol name (interned)
  * @id: Symbol ID
  * @type: Symbol type
  * @global: If set, symbol is global
+ * @local: If set, symbol is a local variable
  * @data_type: Symbol data type
  * @tree: Tree associated with symbol
- * @link: Queue link
+ * @fields: Field scope of a struct or struct instance
+ * @frame_off: Offset below the frame base of a local
+ * @frame_size: Bytes of locals of a procedure
  */
 struct symbol {
-    char *name;
+    const char *name;
     sym_id_t id;
     sym_type_t type;
     uint8_t global : 1;
+    uint8_t local : 1;
     struct datum_type data_type;
     struct ast_node *tree;
-    TAILQ_ENTRY(symbol) link;
+    struct scope *fields;
+    size_t frame_off;
+    size_t frame_size;
+};
+
+/*
+ * Represents a slot in the symbol hash table
+ *
+ * @hash: Hash of the symbol name
+ * @symbol: Symbol in this slot, NULL if free
+ */
+struct symbol_slot {
+    uint32_t hash;
+    struct symbol *symbol;
 };
 
 /*
  * Represents the program symbol table
  *
+ * XXX: Symbols are found by name through an open addressing
+ *      hash table and by ID through a vector which also keeps
+ *      them in the order they were declared. When the hash
+ *      table grows, the old slots are moved over a few at a
+ *      time on each insert.
+ *
  * @symbol_count: Number of symbols in table
- * @symbols: List of symbols present
+ * @symbols: Symbols present, indexed by ID
+ * @symbol_cap: Capacity of the symbol vector
+ * @arena: Symbols are allocated here
+ * @slots: Hash table slots
+ * @slot_cap: Number of hash table slots
+ * @slot_count: Number of distinct names in the table
+ * @old_slots: Slots still being moved, NULL if none
+ * @old_cap: Number of old slots
+ * @old_idx: Next old slot to move
  */
 struct symbol_table {
     size_t symbol_count;
-    TAILQ_HEAD(, symbol) symbols;
+    struct symbol **symbols;
+    size_t symbol_cap;
+    struct arena arena;
+    struct symbol_slot *slots;
+    size_t slot_cap;
+    size_t slot_count;
+    struct symbol_slot *old_slots;
+    size_t old_cap;
+    size_t old_idx;
 };
 
 /*
@@ -83,17 +124,34 @@ struct symbol *symbol_from_id(struct symbol_table *symtab, sym_id_t id);
  * Obtain a symbol using its name
  *
  * @symtab: Symbol table to look up from
- * @name:   Name to look up
+ * @name:   Interned name to look up
  *
  * Returns NULL on failure
  */
 struct symbol *symbol_from_name(struct symbol_table *symtab, const char *name);
 
+/*
+ * Allocate a new symbol without making it visible by name
+ * in the symbol table, used for symbols that belong to an
+ * inner scope.
+ *
+ * @symtab: Symbol table to allocate symbol from
+ * @name: Interned name of new symbol, it is not copied
+ * @type: Symbol data type
+ * @res: Symbol result is written here
+ *
+ * Returns zero on success
+ */
+int symbol_alloc(
+    struct symbol_table *symtab, const char *name,
+    gup_type_t type, struct symbol **res
+);
+
 /*
  * Allocate a new symbol
  *
  * @symtab: Symbol table to add symbol to
- * @name: Name of new symbol
+ * @name: Interned name of new symbol, it is not copied
  * @type: Symbol data type
  * @res: Symbol result is written here
  *
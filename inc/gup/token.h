@@ -28,6 +28,19 @@ typedef enum {
     TT_DOT,         /* '.' */
     TT_EQUALS,      /* '=' */
     TT_EQUALITY,    /* '==' */
+    TT_NEQ,         /* '!=' */
+    TT_LTE,         /* '<=' */
+    TT_GTE,         /* '>=' */
+    TT_SHL,         /* '<<' */
+    TT_SHR,         /* '>>' */
+    TT_AMP,         /* '&' */
+    TT_PIPE,        /* '|' */
+    TT_CARET,       /* '^' */
+    TT_TILDE,       /* '~' */
+    TT_BANG,        /* '!' */
+    TT_PERCENT,     /* '%' */
+    TT_LAND,        /* '&&' */
+    TT_LOR,         /* '||' */
     TT_U8,          /* 'u8' */
     TT_U16,         /* 'u16' */
     TT_U32,         /* 'u32' */
@@ -41,6 +54,7 @@ typedef enum {
     TT_RETURN,      /* 'return' */
     TT_STRUCT,      /* 'struct' */
     TT_IF,          /* 'if' */
+    TT_ELSE,        /* 'else' */
     TT_TYPE,        /* 'type' */
     TT_NUMBER,      /* <NUMBER> */
     TT_IDENT,       /* <IDENTIFIER> */
@@ -52,14 +66,18 @@ typedef enum {
  * source input.
  *
  * @type: Type of this token
+ * @off: Offset of the token text within the source input
+ * @len: Length of the token text
+ *
+ * XXX: Token text is never copied, identifiers and assembly
+ *      are a view into the source input buffer and are not
+ *      NUL terminated.
  */
 struct token {
     tt_t type;
-    union {
-        char c;
-        char *s;
-        ssize_t v;
-    };
+    size_t off;
+    size_t len;
+    ssize_t v;
 };
 
 #endif  /* !GUP_TOKEN_H */
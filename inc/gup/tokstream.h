@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef GUP_TOKSTREAM_H
+#define GUP_TOKSTREAM_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "gup/token.h"
+
+/* Forward declaration */
+struct gup_state;
+
+/*
+ * Represents the whole source input as a dense stream of
+ * pre-lexed tokens, stored as a structure of arrays so that
+ * the parser can look any number of tokens ahead or behind.
+ *
+ * @type:  Token types
+ * @off:   Offsets of token text within the source input
+ * @len:   Lengths of token text
+ * @line:  Line number each token is on
+ * @vidx:  Index into 'value' for tokens that carry one
+ * @value: Values of numeric tokens
+ * @count: Number of tokens in stream
+ * @cap:   Capacity of the token arrays
+ * @value_count: Number of entries in 'value'
+ * @value_cap:   Capacity of 'value'
+ *
+ * XXX: Token text is never copied into the stream, it
+ *      stays in the source input buffer.
+ */
+struct tokstream {
+    uint8_t *type;
+    uint32_t *off;
+    uint32_t *len;
+    uint32_t *line;
+    uint32_t *vidx;
+    ssize_t *value;
+    size_t count;
+    size_t cap;
+    size_t value_count;
+    size_t value_cap;
+};
+
+/*
+ * Initialize a token stream
+ *
+ * @ts: Token stream to initialize
+ * @hint: Expected number of tokens, may be zero
+ *
+ * Returns zero on success
+ */
+int tokstream_init(struct tokstream *ts, size_t hint);
+
+/*
+ * Append a token to a token stream
+ *
+ * @ts: Token stream to append to
+ * @tok: Token to append
+ * @line: Line the token is on
+ *
+ * Returns zero on success
+ */
+int tokstream_push(struct tokstream *ts, const struct token *tok, size_t line);
+
+/*
+ * Lex the whole source input into a token stream
+ *
+ * @state: Compiler state
+ * @ts: Token stream to lex into, must be initialized
+ *
+ * Returns zero on success
+ */
+int tokstream_lex(struct gup_state *state, struct tokstream *ts);
+
+/*
+ * Obtain a token from a token stream
+ *
+ * @ts: Token stream to read from
+ * @idx: Index of token
+ * @res: Token is written here
+ *
+ * Returns zero on success, or a negative value if
+ * 'idx' is out of bounds.
+ */
+int tokstream_get(const struct tokstream *ts, size_t idx, struct token *res);
+
+/*
+ * Destroy a token stream
+ *
+ * @ts: Token stream to destroy
+ */
+void tokstream_destroy(struct tokstream *ts);
+
+#endif  /* !GUP_TOKSTREAM_H */
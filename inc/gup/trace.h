@@ -9,16 +9,36 @@
 #include <stdio.h>
 #include "gup/state.h"
 
-#define trace_error(gup_state, fmt, ...)    \
-    printf("[\033[90;91merror\033[0m]: " fmt, ##__VA_ARGS__); \
-    printf("[near line %zu]\n", (gup_state)->line_num);
-#define trace_warn(fmt, ...)   \
-    printf("[\033[90;95mwarn\033[0m]: " fmt, ##__VA_ARGS__)
+/*
+ * Both halves of an error are written under the stderr lock
+ * so that compilations on other threads cannot split them,
+ * a state with its own log needs no lock.
+ */
+#define trace_error(gup_state, fmt, ...)                               \
+    do {                                                               \
+        if ((gup_state)->quiet)                                        \
+            break;                                                     \
+        if ((gup_state)->diag == NULL)                                 \
+            flockfile(stderr);                                         \
+        gup_state_log((gup_state), "[\033[90;91merror\033[0m]: " fmt,  \
+            ##__VA_ARGS__);                                            \
+        gup_state_log((gup_state), "[near line %zu]\n",                \
+            (gup_state)->line_num);                                    \
+        if ((gup_state)->diag == NULL)                                 \
+            funlockfile(stderr);                                       \
+    } while (0)
+#define trace_warn(gup_state, fmt, ...)                                \
+    do {                                                               \
+        if ((gup_state)->quiet)                                        \
+            break;                                                     \
+        gup_state_log((gup_state), "[\033[90;95mwarn\033[0m]: " fmt,   \
+            ##__VA_ARGS__);                                            \
+    } while (0)
 
 #define DEBUG 0
 #if DEBUG
 #define trace_debug(fmt, ...)   \
-    printf("[\033[90;94mdebug\033[0m]: " fmt, ##__VA_ARGS__)
+    fprintf(stderr, "[\033[90;94mdebug\033[0m]: " fmt, ##__VA_ARGS__)
 #else
 #define trace_debug(...) (void)0
 #endif  /* DEBUG */
@@ -1,3 +1,4 @@
 CC = gcc
-CFLAGS = -Wall -pedantic -MMD -Iinc/
+CFLAGS = -Wall -pedantic -MMD -Iinc/ -pthread
+LDFLAGS = -pthread
 ARCH = x86_64
@@ -4,7 +4,12 @@
  */
 
 #include <errno.h>
+#include <stdint.h>
+#include <string.h>
 #include "gup/mu.h"
+#include "gup/ir.h"
+#include "gup/regalloc.h"
+#include "gup/outbuf.h"
 #include "gup/state.h"
 #include "gup/trace.h"
 
@@ -13,7 +18,8 @@ static const char *sectab[] = {
     [SECTION_NONE] = "none",
     [SECTION_TEXT] = ".text",
     [SECTION_DATA] = ".data",
-    [SECTION_BSS]  = ".bss"
+    [SECTION_BSS]  = ".bss",
+    [SECTION_RODATA] = ".rodata"
 };
 
 /* Define <n> size lookup table */
@@ -25,6 +31,15 @@ static const char *dsztab[] = {
     [MSIZE_QWORD] = "dq"
 };
 
+/* Reserve <n> size lookup table */
+static const char *rsztab[] = {
+    [MSIZE_BAD]  = "bad",
+    [MSIZE_BYTE] = "resb",
+    [MSIZE_WORD] = "resw",
+    [MSIZE_DWORD] = "resd",
+    [MSIZE_QWORD] = "resq"
+};
+
 /* <n> size lookup table */
 static const char *sztab[] = {
     [MSIZE_BAD] = "bad",
@@ -43,69 +58,183 @@ static const char *rettab[] = {
     [MSIZE_QWORD] = "rax"
 };
 
+/* Second scratch register of each size, see rettab */
+static const char *cnttab[] = {
+    [MSIZE_BAD] = "bad",
+    [MSIZE_BYTE] = "cl",
+    [MSIZE_WORD] = "cx",
+    [MSIZE_DWORD] = "ecx",
+    [MSIZE_QWORD] = "rcx"
+};
+
+/* Instructions of the two operand IR operations */
+static const char *binoptab[] = {
+    [IR_ADD] = "add",
+    [IR_SUB] = "sub",
+    [IR_MUL] = "imul",
+    [IR_DIV] = "div",
+    [IR_MOD] = "div",
+    [IR_AND] = "and",
+    [IR_OR]  = "or",
+    [IR_XOR] = "xor",
+    [IR_SHL] = "shl",
+    [IR_SHR] = "shr",
+    [IR_EQ]  = "sete",
+    [IR_NE]  = "setne",
+    [IR_LT]  = "setb",
+    [IR_LE]  = "setbe"
+};
+
+/* Jumps of each comparison, taken then not taken */
+static const char *jcctab[][2] = {
+    [IR_EQ] = { "je", "jne" },
+    [IR_NE] = { "jne", "je" },
+    [IR_LT] = { "jb", "jae" },
+    [IR_LE] = { "jbe", "ja" }
+};
+
+/* Jumps of each comparison with its operands swapped */
+static const char *rjcctab[][2] = {
+    [IR_EQ] = { "je", "jne" },
+    [IR_NE] = { "jne", "je" },
+    [IR_LT] = { "ja", "jbe" },
+    [IR_LE] = { "jae", "jb" }
+};
+
 /*
- * Ensure that we are currently in the desired section
+ * Registers handed to the register allocator, by size,
+ * the callee-saved ones last. The A, C and D registers
+ * are kept as scratch for instruction selection, the
+ * D register for division.
+ */
+static const char *regtab[][MSIZE_MAX] = {
+    { "bad", "sil", "si", "esi", "rsi" },
+    { "bad", "dil", "di", "edi", "rdi" },
+    { "bad", "r8b", "r8w", "r8d", "r8" },
+    { "bad", "r9b", "r9w", "r9d", "r9" },
+    { "bad", "r10b", "r10w", "r10d", "r10" },
+    { "bad", "r11b", "r11w", "r11d", "r11" },
+    { "bad", "bl", "bx", "ebx", "rbx" },
+    { "bad", "r12b", "r12w", "r12d", "r12" },
+    { "bad", "r13b", "r13w", "r13d", "r13" },
+    { "bad", "r14b", "r14w", "r14d", "r14" },
+    { "bad", "r15b", "r15w", "r15d", "r15" }
+};
+
+/* Registers of regtab as seen by the register allocator */
+static const struct ra_target regtarget = {
+    .count = sizeof(regtab) / sizeof(regtab[0]),
+    .saved = 0x7C0      /* rbx, r12-r15 */
+};
+
+/*
+ * Represents the state of instruction selection for
+ * a single procedure.
+ *
+ * Values are held zero extended to 64 bits, in their
+ * allocated register or spill slot alike, values in
+ * memory are worked on in the A and C registers.
  *
  * @state: Compiler state
- * @what:  Expected section
+ * @proc: IR procedure
+ * @ob: Output buffer of .text
+ * @ra: Register allocation of the procedure
+ * @slot_base: Offset of the spill slots below the frame base
+ * @frame: Bytes of stack frame, zero if there is none
+ * @pos: Instruction being selected
+ * @spill: Next entry of the spills of 'ra'
  */
-static void
-cg_assert_section(struct gup_state *state, bin_section_t what)
+struct isel {
+    struct gup_state *state;
+    struct ir_proc *proc;
+    struct outbuf *ob;
+    struct ra_alloc ra;
+    size_t slot_base;
+    size_t frame;
+    size_t pos;
+    size_t spill;
+};
+
+/*
+ * Get the output buffer of a section, a section directive
+ * opens the buffer on its first use so that every section
+ * appears once and contiguously in the final output.
+ *
+ * @state: Compiler state
+ * @what:  Section to emit into
+ */
+static struct outbuf *
+cg_section(struct gup_state *state, bin_section_t what)
 {
-    if (state == NULL) {
-        return;
+    struct outbuf *ob = &state->out[what];
+
+    if (ob->len == 0) {
+        outbuf_lit(ob, "[section ");
+        outbuf_puts(ob, sectab[what]);
+        outbuf_lit(ob, "]\n");
     }
 
-    if (state->cur_section != what) {
-        fprintf(
-            state->out_fp,
-            "[section %s]\n",
-            sectab[what]
-        );
+    return ob;
+}
+
+/*
+ * Write an immediate, truncated to its size and zero
+ * extended from it, wider values are never encodable.
+ *
+ * @ob: Output buffer
+ * @v: Immediate
+ * @size: Size of the immediate
+ */
+static void
+cg_imm(struct outbuf *ob, int64_t v, msize_t size)
+{
+    uint64_t mask;
 
-        state->cur_section = what;
+    if (size == MSIZE_QWORD) {
+        outbuf_puti(ob, v);
+        return;
     }
+
+    mask = ((uint64_t)1 << (msize_bytes(size) * 8)) - 1;
+    outbuf_putu(ob, (uint64_t)v & mask);
 }
 
 int
-mu_cg_inject(struct gup_state *state, const char *str)
+mu_cg_inject(struct gup_state *state, const char *str, size_t len)
 {
+    struct outbuf *ob;
+
     if (state == NULL || str == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    cg_assert_section(state, SECTION_TEXT);
-    fprintf(
-        state->out_fp,
-        "\t%s\n",
-        str
-    );
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_putc(ob, '\t');
+    outbuf_putn(ob, str, len);
+    outbuf_putc(ob, '\n');
     return 0;
 }
 
 int
 mu_cg_label(struct gup_state *state, const char *s, bool is_global)
 {
+    struct outbuf *ob;
+
     if (state == NULL || s == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    cg_assert_section(state, SECTION_TEXT);
+    ob = cg_section(state, SECTION_TEXT);
     if (is_global) {
-        fprintf(
-            state->out_fp,
-            "[global %s]\n",
-            s
-        );
+        outbuf_lit(ob, "[global ");
+        outbuf_puts(ob, s);
+        outbuf_lit(ob, "]\n");
     }
 
-    fprintf(
-        state->out_fp,
-        "%s:\n",
-        s
-    );
+    outbuf_puts(ob, s);
+    outbuf_lit(ob, ":\n");
 
     return 0;
 }
@@ -113,31 +242,75 @@ mu_cg_label(struct gup_state *state, const char *s, bool is_global)
 int
 mu_cg_ret(struct gup_state *state)
 {
+    struct outbuf *ob;
+
     if (state == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    fprintf(
-        state->out_fp,
-        "\tret\n"
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(ob, "\tret\n");
+
+    return 0;
+}
+
+int
+mu_cg_frame(struct gup_state *state, size_t size)
+{
+    struct outbuf *ob;
+
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Keep the stack 16 byte aligned */
+    size = (size + 15) & ~(size_t)15;
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(
+        ob,
+        "\tpush rbp\n"
+        "\tmov rbp, rsp\n"
+        "\tsub rsp, "
     );
 
+    outbuf_putu(ob, size);
+    outbuf_putc(ob, '\n');
+
+    return 0;
+}
+
+int
+mu_cg_leave(struct gup_state *state)
+{
+    struct outbuf *ob;
+
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(ob, "\tleave\n");
+
     return 0;
 }
 
 int
 mu_cg_jmp(struct gup_state *state, const char *s)
 {
+    struct outbuf *ob;
+
     if (state == NULL || s == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    fprintf(
-        state->out_fp,
-        "\tjmp %s\n", s
-    );
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(ob, "\tjmp ");
+    outbuf_puts(ob, s);
+    outbuf_putc(ob, '\n');
 
     return 0;
 }
@@ -146,6 +319,8 @@ int
 mu_cg_var(struct gup_state *state, bin_section_t sect, const char *label,
     msize_t size, ssize_t ival)
 {
+    struct outbuf *ob;
+
     if (state == NULL || label == NULL) {
         errno = -EINVAL;
         return -1;
@@ -161,14 +336,21 @@ mu_cg_var(struct gup_state *state, bin_section_t sect, const char *label,
         return -1;
     }
 
-    cg_assert_section(state, sect);
-    fprintf(
-        state->out_fp,
-        "%s: %s %zd\n",
-        label,
-        dsztab[size],
-        ival
-    );
+    ob = cg_section(state, sect);
+    outbuf_puts(ob, label);
+    outbuf_lit(ob, ": ");
+
+    /* Nothing is stored for .bss, only reserved */
+    if (sect == SECTION_BSS) {
+        outbuf_puts(ob, rsztab[size]);
+        outbuf_lit(ob, " 1\n");
+        return 0;
+    }
+
+    outbuf_puts(ob, dsztab[size]);
+    outbuf_putc(ob, ' ');
+    outbuf_puti(ob, ival);
+    outbuf_putc(ob, '\n');
 
     return 0;
 }
@@ -176,16 +358,17 @@ mu_cg_var(struct gup_state *state, bin_section_t sect, const char *label,
 int
 mu_cg_call(struct gup_state *state, const char *s)
 {
+    struct outbuf *ob;
+
     if (state == NULL || s == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    fprintf(
-        state->out_fp,
-        "\tcall %s\n",
-        s
-    );
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(ob, "\tcall ");
+    outbuf_puts(ob, s);
+    outbuf_putc(ob, '\n');
 
     return 0;
 }
@@ -193,6 +376,8 @@ mu_cg_call(struct gup_state *state, const char *s)
 int
 mu_cg_retimm(struct gup_state *state, msize_t size, ssize_t imm)
 {
+    struct outbuf *ob;
+
     if (state == NULL) {
         errno = -EINVAL;
         return -1;
@@ -203,13 +388,12 @@ mu_cg_retimm(struct gup_state *state, msize_t size, ssize_t imm)
         return -1;
     }
 
-    fprintf(
-        state->out_fp,
-        "\tmov %s, %zd\n"
-        "\tret\n",
-        rettab[size],
-        imm
-    );
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(ob, "\tmov ");
+    outbuf_puts(ob, rettab[size]);
+    outbuf_lit(ob, ", ");
+    cg_imm(ob, imm, size);
+    outbuf_lit(ob, "\n\tret\n");
 
     return 0;
 }
@@ -217,6 +401,7 @@ mu_cg_retimm(struct gup_state *state, msize_t size, ssize_t imm)
 int
 mu_cg_struct(struct gup_state *state, struct ast_node *parent)
 {
+    struct outbuf *ob;
     struct ast_node *cur;
     msize_t size;
 
@@ -235,7 +420,7 @@ mu_cg_struct(struct gup_state *state, struct ast_node *parent)
         return -1;
     }
 
-    cg_assert_section(state, SECTION_DATA);
+    ob = cg_section(state, SECTION_DATA);
     cur = parent->right->right;
 
     while (cur != NULL) {
@@ -245,13 +430,12 @@ mu_cg_struct(struct gup_state *state, struct ast_node *parent)
             continue;
         }
 
-        fprintf(
-            state->out_fp,
-            "%s.%s: %s 0\n",
-            parent->s,
-            cur->s,
-            dsztab[size]
-        );
+        outbuf_puts(ob, parent->s);
+        outbuf_putc(ob, '.');
+        outbuf_puts(ob, cur->s);
+        outbuf_lit(ob, ": ");
+        outbuf_puts(ob, dsztab[size]);
+        outbuf_lit(ob, " 0\n");
 
         cur = cur->right;
     }
@@ -262,6 +446,8 @@ mu_cg_struct(struct gup_state *state, struct ast_node *parent)
 int
 mu_cg_loadvar(struct gup_state *state, const char *label, msize_t size, ssize_t ival)
 {
+    struct outbuf *ob;
+
     if (state == NULL || label == NULL) {
         errno = -EINVAL;
         return -1;
@@ -272,13 +458,875 @@ mu_cg_loadvar(struct gup_state *state, const char *label, msize_t size, ssize_t
         return -1;
     }
 
-    fprintf(
-        state->out_fp,
-        "\tmov %s [rel %s], %zd\n",
-        sztab[size],
-        label,
-        ival
-    );
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(ob, "\tmov ");
+    outbuf_puts(ob, sztab[size]);
+    outbuf_lit(ob, " [rel ");
+    outbuf_puts(ob, label);
+    outbuf_lit(ob, "], ");
+    cg_imm(ob, ival, size);
+    outbuf_putc(ob, '\n');
+
+    return 0;
+}
+
+int
+mu_cg_loadlocal(struct gup_state *state, size_t off, msize_t size, ssize_t ival)
+{
+    struct outbuf *ob;
+
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    ob = cg_section(state, SECTION_TEXT);
+    outbuf_lit(ob, "\tmov ");
+    outbuf_puts(ob, sztab[size]);
+    outbuf_lit(ob, " [rbp - ");
+    outbuf_putu(ob, off);
+    outbuf_lit(ob, "], ");
+    cg_imm(ob, ival, size);
+    outbuf_putc(ob, '\n');
 
     return 0;
 }
+
+/*
+ * Returns true if an immediate is encoded as is by an
+ * instruction of the given size.
+ *
+ * @v: Immediate
+ * @size: Size of the instruction
+ */
+static inline bool
+isel_imm_fits(int64_t v, msize_t size)
+{
+    /* There is no 64-bit immediate, only a sign extended one */
+    return size != MSIZE_QWORD || (v >= INT32_MIN && v <= INT32_MAX);
+}
+
+/*
+ * Get the size of the registers a value is worked on in
+ *
+ * @size: Size of the value
+ */
+static inline msize_t
+isel_wide(msize_t size)
+{
+    return (size == MSIZE_QWORD) ? MSIZE_QWORD : MSIZE_DWORD;
+}
+
+/*
+ * Get the register a virtual register is held in at the
+ * instruction being selected.
+ *
+ * @is: Instruction selection state
+ * @vreg: Virtual register
+ *
+ * Returns the register by size, NULL if it is in its slot
+ */
+static const char **
+isel_reg(struct isel *is, ir_vreg_t vreg)
+{
+    struct ra_loc *loc = &is->ra.locs[vreg];
+
+    if (loc->reg == RA_NOREG || is->pos >= loc->split) {
+        return NULL;
+    }
+
+    return regtab[loc->reg];
+}
+
+/*
+ * Get the offset of the spill slot of a virtual register
+ * below the frame base.
+ *
+ * @is: Instruction selection state
+ * @vreg: Virtual register
+ */
+static inline size_t
+isel_slot(struct isel *is, ir_vreg_t vreg)
+{
+    return is->slot_base + 8 * (is->ra.locs[vreg].slot + 1);
+}
+
+/*
+ * Write a memory operand
+ *
+ * @ob: Output buffer
+ * @label: Label of a global, NULL for a local
+ * @off: Offset of a local below the frame base
+ */
+static void
+isel_mem(struct outbuf *ob, const char *label, size_t off)
+{
+    if (label != NULL) {
+        outbuf_lit(ob, "[rel ");
+        outbuf_puts(ob, label);
+    } else {
+        outbuf_lit(ob, "[rbp - ");
+        outbuf_putu(ob, off);
+    }
+
+    outbuf_putc(ob, ']');
+}
+
+/*
+ * Load a value from memory into a register, zero
+ * extended to at least 32 bits.
+ *
+ * @ob: Output buffer
+ * @regs: Register by size, e.g., rettab
+ * @size: Size of the value
+ * @label: Label of a global, NULL for a local
+ * @off: Offset of a local below the frame base
+ */
+static void
+isel_load(struct outbuf *ob, const char **regs, msize_t size,
+    const char *label, size_t off)
+{
+    if (size == MSIZE_BYTE || size == MSIZE_WORD) {
+        outbuf_lit(ob, "\tmovzx ");
+        outbuf_puts(ob, regs[MSIZE_DWORD]);
+    } else {
+        outbuf_lit(ob, "\tmov ");
+        outbuf_puts(ob, regs[size]);
+    }
+
+    outbuf_lit(ob, ", ");
+    outbuf_puts(ob, sztab[size]);
+    outbuf_putc(ob, ' ');
+    isel_mem(ob, label, off);
+    outbuf_putc(ob, '\n');
+}
+
+/*
+ * Store a register to memory
+ *
+ * @ob: Output buffer
+ * @regs: Register by size, e.g., rettab
+ * @size: Size of the value
+ * @label: Label of a global, NULL for a local
+ * @off: Offset of a local below the frame base
+ */
+static void
+isel_store(struct outbuf *ob, const char **regs, msize_t size,
+    const char *label, size_t off)
+{
+    outbuf_lit(ob, "\tmov ");
+    outbuf_puts(ob, sztab[size]);
+    outbuf_putc(ob, ' ');
+    isel_mem(ob, label, off);
+    outbuf_lit(ob, ", ");
+    outbuf_puts(ob, regs[size]);
+    outbuf_putc(ob, '\n');
+}
+
+/*
+ * Get an operand into a scratch register, zero extended
+ * to at least 32 bits.
+ *
+ * @is: Instruction selection state
+ * @regs: Scratch register by size, rettab or cnttab
+ * @opnd: Operand
+ * @size: Size of the operand
+ */
+static void
+isel_get(struct isel *is, const char **regs, const struct ir_operand *opnd,
+    msize_t size)
+{
+    struct outbuf *ob = is->ob;
+    const char **src;
+
+    if (opnd->kind == IR_OPND_VREG) {
+        if ((src = isel_reg(is, opnd->vreg)) == NULL) {
+            isel_load(ob, regs, size, NULL, isel_slot(is, opnd->vreg));
+            return;
+        }
+
+        outbuf_lit(ob, "\tmov ");
+        outbuf_puts(ob, regs[isel_wide(size)]);
+        outbuf_lit(ob, ", ");
+        outbuf_puts(ob, src[isel_wide(size)]);
+        outbuf_putc(ob, '\n');
+        return;
+    }
+
+    outbuf_lit(ob, "\tmov ");
+    outbuf_puts(ob, regs[isel_wide(size)]);
+    outbuf_lit(ob, ", ");
+    cg_imm(ob, opnd->imm, size);
+    outbuf_putc(ob, '\n');
+}
+
+/*
+ * Get the second operand of a two operand instruction
+ * ready, it is loaded into the C register unless it can
+ * be used as is.
+ *
+ * @is: Instruction selection state
+ * @opnd: Operand
+ * @size: Size of the operand
+ *
+ * Returns the register holding it, NULL for an immediate
+ */
+static const char *
+isel_src(struct isel *is, const struct ir_operand *opnd, msize_t size)
+{
+    const char **regs;
+
+    if (opnd->kind == IR_OPND_VREG) {
+        if ((regs = isel_reg(is, opnd->vreg)) != NULL) {
+            return regs[isel_wide(size)];
+        }
+    } else if (isel_imm_fits(opnd->imm, size)) {
+        return NULL;
+    }
+
+    isel_get(is, cnttab, opnd, size);
+    return cnttab[isel_wide(size)];
+}
+
+/*
+ * Write the value in the A register to a virtual register
+ *
+ * @is: Instruction selection state
+ * @dst: Virtual register written
+ * @size: Size of the value
+ */
+static void
+isel_set(struct isel *is, ir_vreg_t dst, msize_t size)
+{
+    struct outbuf *ob = is->ob;
+    const char **regs;
+
+    /* Slots hold the whole value so any size may read it */
+    if ((regs = isel_reg(is, dst)) == NULL) {
+        if (size == MSIZE_BYTE || size == MSIZE_WORD) {
+            outbuf_lit(ob, "\tmovzx eax, ");
+            outbuf_puts(ob, rettab[size]);
+            outbuf_putc(ob, '\n');
+        }
+
+        isel_store(ob, rettab, MSIZE_QWORD, NULL, isel_slot(is, dst));
+        return;
+    }
+
+    /* Bits above the value are cleared in the register */
+    if (size == MSIZE_BYTE || size == MSIZE_WORD) {
+        outbuf_lit(ob, "\tmovzx ");
+    } else {
+        outbuf_lit(ob, "\tmov ");
+    }
+
+    outbuf_puts(ob, regs[isel_wide(size)]);
+    outbuf_lit(ob, ", ");
+    outbuf_puts(ob, rettab[size]);
+    outbuf_putc(ob, '\n');
+}
+
+/*
+ * Store a value to memory
+ *
+ * @is: Instruction selection state
+ * @opnd: Value to store
+ * @size: Size of the value
+ * @label: Label of a global, NULL for a local
+ * @off: Offset of a local below the frame base
+ *
+ * Returns zero on success
+ */
+static int
+isel_put(struct isel *is, const struct ir_operand *opnd, msize_t size,
+    const char *label, size_t off)
+{
+    const char **regs;
+
+    if (opnd->kind == IR_OPND_IMM && isel_imm_fits(opnd->imm, size)) {
+        if (label != NULL) {
+            return mu_cg_loadvar(is->state, label, size, opnd->imm);
+        }
+
+        return mu_cg_loadlocal(is->state, off, size, opnd->imm);
+    }
+
+    regs = NULL;
+    if (opnd->kind == IR_OPND_VREG) {
+        regs = isel_reg(is, opnd->vreg);
+    }
+
+    if (regs == NULL) {
+        isel_get(is, rettab, opnd, size);
+        regs = rettab;
+    }
+
+    isel_store(is->ob, regs, size, label, off);
+    return 0;
+}
+
+/*
+ * Select a constant
+ *
+ * @is: Instruction selection state
+ * @insn: Instruction
+ *
+ * Returns zero on success
+ */
+static int
+isel_const(struct isel *is, const struct ir_insn *insn)
+{
+    struct outbuf *ob = is->ob;
+    const char **regs;
+
+    if ((regs = isel_reg(is, insn->dst)) == NULL) {
+        isel_get(is, rettab, &insn->a, insn->size);
+        isel_set(is, insn->dst, insn->size);
+        return 0;
+    }
+
+    outbuf_lit(ob, "\tmov ");
+    outbuf_puts(ob, regs[isel_wide(insn->size)]);
+    outbuf_lit(ob, ", ");
+    cg_imm(ob, insn->a.imm, insn->size);
+    outbuf_putc(ob, '\n');
+    return 0;
+}
+
+/*
+ * Select a copy from one virtual register to another,
+ * truncated to the size of the copy.
+ *
+ * @is: Instruction selection state
+ * @insn: Instruction
+ */
+static void
+isel_mov(struct isel *is, const struct ir_insn *insn)
+{
+    struct outbuf *ob = is->ob;
+    const char **dst, **src;
+
+    if ((dst = isel_reg(is, insn->dst)) == NULL) {
+        isel_get(is, rettab, &insn->a, insn->size);
+        isel_set(is, insn->dst, insn->size);
+        return;
+    }
+
+    if ((src = isel_reg(is, insn->a.vreg)) == NULL) {
+        isel_load(ob, dst, insn->size, NULL, isel_slot(is, insn->a.vreg));
+        return;
+    }
+
+    /* Bits above the value are cleared in the register */
+    if (insn->size == MSIZE_BYTE || insn->size == MSIZE_WORD) {
+        outbuf_lit(ob, "\tmovzx ");
+        outbuf_puts(ob, dst[MSIZE_DWORD]);
+    } else {
+        outbuf_lit(ob, "\tmov ");
+        outbuf_puts(ob, dst[insn->size]);
+    }
+
+    outbuf_lit(ob, ", ");
+    outbuf_puts(ob, src[insn->size]);
+    outbuf_putc(ob, '\n');
+}
+
+/*
+ * Select a load from memory
+ *
+ * @is: Instruction selection state
+ * @insn: Instruction
+ */
+static void
+isel_load_insn(struct isel *is, const struct ir_insn *insn)
+{
+    const struct ir_addr *addr = &insn->addr;
+    const char **regs;
+
+    if ((regs = isel_reg(is, insn->dst)) != NULL) {
+        isel_load(is->ob, regs, insn->size, addr->label, addr->off);
+        return;
+    }
+
+    isel_load(is->ob, rettab, insn->size, addr->label, addr->off);
+    isel_set(is, insn->dst, insn->size);
+}
+
+/*
+ * Select a two operand operation, it is worked on in
+ * the A register.
+ *
+ * @is: Instruction selection state
+ * @insn: Instruction
+ */
+static void
+isel_binop(struct isel *is, const struct ir_insn *insn)
+{
+    struct outbuf *ob = is->ob;
+    const char **regs;
+    const char *src;
+    msize_t wide;
+
+    wide = isel_wide(insn->size);
+    isel_get(is, rettab, &insn->a, insn->size);
+
+    switch (insn->op) {
+    case IR_SHL:
+    case IR_SHR:
+        /* The count is an immediate or in CL */
+        if (insn->b.kind != IR_OPND_IMM) {
+            isel_get(is, cnttab, &insn->b, insn->size);
+        }
+
+        outbuf_putc(ob, '\t');
+        outbuf_puts(ob, binoptab[insn->op]);
+        outbuf_putc(ob, ' ');
+        outbuf_puts(ob, rettab[wide]);
+        outbuf_lit(ob, ", ");
+        if (insn->b.kind == IR_OPND_IMM) {
+            outbuf_putu(ob, insn->b.imm & ((wide == MSIZE_QWORD) ? 63 : 31));
+        } else {
+            outbuf_lit(ob, "cl");
+        }
+
+        outbuf_putc(ob, '\n');
+        break;
+    case IR_DIV:
+    case IR_MOD:
+        /* The divisor is never an immediate, D takes the rest */
+        regs = NULL;
+        if (insn->b.kind == IR_OPND_VREG) {
+            regs = isel_reg(is, insn->b.vreg);
+        }
+
+        if (regs != NULL) {
+            src = regs[wide];
+        } else {
+            isel_get(is, cnttab, &insn->b, insn->size);
+            src = cnttab[wide];
+        }
+
+        outbuf_lit(ob, "\txor edx, edx\n\tdiv ");
+        outbuf_puts(ob, src);
+        outbuf_putc(ob, '\n');
+        if (insn->op == IR_MOD) {
+            outbuf_lit(ob, "\tmov ");
+            outbuf_puts(ob, rettab[wide]);
+            outbuf_puts(ob, (wide == MSIZE_QWORD) ? ", rdx\n" : ", edx\n");
+        }
+
+        break;
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+        src = isel_src(is, &insn->b, insn->size);
+        outbuf_lit(ob, "\tcmp ");
+        outbuf_puts(ob, rettab[wide]);
+        outbuf_lit(ob, ", ");
+        if (src != NULL) {
+            outbuf_puts(ob, src);
+        } else {
+            cg_imm(ob, insn->b.imm, insn->size);
+        }
+
+        outbuf_lit(ob, "\n\t");
+        outbuf_puts(ob, binoptab[insn->op]);
+        outbuf_lit(ob, " al\n\tmovzx eax, al\n");
+        break;
+    default:
+        src = isel_src(is, &insn->b, insn->size);
+        outbuf_putc(ob, '\t');
+        outbuf_puts(ob, binoptab[insn->op]);
+        outbuf_putc(ob, ' ');
+        outbuf_puts(ob, rettab[wide]);
+        outbuf_lit(ob, ", ");
+        if (src != NULL) {
+            outbuf_puts(ob, src);
+        } else {
+            cg_imm(ob, insn->b.imm, insn->size);
+        }
+
+        outbuf_putc(ob, '\n');
+        break;
+    }
+
+    isel_set(is, insn->dst, insn->size);
+}
+
+/*
+ * Returns true if control reaches a block straight from
+ * the instruction before 'i', making a jump to it moot.
+ *
+ * @proc: IR procedure
+ * @i: Index of the instruction after the jump
+ * @block: Block jumped to
+ */
+static bool
+isel_falls_into(struct ir_proc *proc, size_t i, uint32_t block)
+{
+    struct ir_insn *insn;
+
+    for (; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        if (insn->op == IR_NOP) {
+            continue;
+        }
+
+        if (insn->op != IR_LABEL) {
+            return false;
+        }
+
+        if (insn->target[0] == block) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Get the label of a block that is jumped to
+ *
+ * @is: Instruction selection state
+ * @block: Block jumped to
+ *
+ * Returns NULL if the block has no label
+ */
+static const char *
+isel_label(struct isel *is, uint32_t block)
+{
+    const char *label;
+
+    if (block >= is->proc->nblocks) {
+        return NULL;
+    }
+
+    label = is->proc->blocks[block].label;
+    return (label[0] != '\0') ? label : NULL;
+}
+
+/*
+ * Save or restore the callee-saved registers the
+ * procedure uses.
+ *
+ * @is: Instruction selection state
+ * @restore: If true, restore them
+ */
+static void
+isel_saved(struct isel *is, bool restore)
+{
+    struct outbuf *ob = is->ob;
+    uint32_t saved;
+    uint8_t i, reg, count = 0;
+    bool pad;
+
+    saved = is->ra.used & regtarget.saved;
+    for (i = 0; i < regtarget.count; ++i) {
+        count += (saved >> i) & 1;
+    }
+
+    /* A frame keeps the stack 16 byte aligned, see mu_cg_frame() */
+    pad = is->frame > 0 && (count & 1) != 0;
+    if (pad && restore) {
+        outbuf_lit(ob, "\tadd rsp, 8\n");
+    }
+
+    for (i = 0; i < regtarget.count; ++i) {
+        /* Restored in the opposite order */
+        reg = restore ? regtarget.count - 1 - i : i;
+        if ((saved & ((uint32_t)1 << reg)) == 0) {
+            continue;
+        }
+
+        outbuf_puts(ob, restore ? "\tpop " : "\tpush ");
+        outbuf_puts(ob, regtab[reg][MSIZE_QWORD]);
+        outbuf_putc(ob, '\n');
+    }
+
+    if (pad && !restore) {
+        outbuf_lit(ob, "\tsub rsp, 8\n");
+    }
+}
+
+/*
+ * Leave the procedure, returning whatever is in the
+ * A register.
+ *
+ * @is: Instruction selection state
+ * @insn: Return instruction
+ *
+ * Returns zero on success
+ */
+static int
+isel_ret(struct isel *is, const struct ir_insn *insn)
+{
+    if (insn->a.kind == IR_OPND_VREG) {
+        isel_get(is, rettab, &insn->a, insn->size);
+    }
+
+    isel_saved(is, true);
+    if (is->frame > 0) {
+        mu_cg_leave(is->state);
+    }
+
+    if (insn->a.kind == IR_OPND_IMM) {
+        return mu_cg_retimm(is->state, insn->size, insn->a.imm);
+    }
+
+    return mu_cg_ret(is->state);
+}
+
+/*
+ * Finish the compare of a branch with its jump
+ *
+ * @ob: Output buffer
+ * @jcc: Conditional jump, see jcctab
+ * @label: Label jumped to
+ */
+static void
+isel_jcc(struct outbuf *ob, const char *jcc, const char *label)
+{
+    outbuf_lit(ob, "\n\t");
+    outbuf_puts(ob, jcc);
+    outbuf_putc(ob, ' ');
+    outbuf_puts(ob, label);
+    outbuf_putc(ob, '\n');
+}
+
+/*
+ * Select a conditional branch, the compare and the jump
+ * are kept next to each other so that they fuse.
+ *
+ * @is: Instruction selection state
+ * @insn: Branch instruction
+ * @i: Index of the instruction after the branch
+ *
+ * Returns zero on success
+ */
+static int
+isel_br(struct isel *is, const struct ir_insn *insn, size_t i)
+{
+    struct outbuf *ob = is->ob;
+    const struct ir_operand *a, *b;
+    const char *reg, *src, *label;
+    const char **cc;
+    msize_t wide;
+
+    if (insn->cond < IR_EQ || insn->cond > IR_LE) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Only the second operand of a compare may be an immediate */
+    a = &insn->a;
+    b = &insn->b;
+    cc = jcctab[insn->cond];
+    if (a->kind == IR_OPND_IMM && b->kind == IR_OPND_VREG) {
+        a = &insn->b;
+        b = &insn->a;
+        cc = rjcctab[insn->cond];
+    }
+
+    wide = isel_wide(insn->size);
+    if (a->kind == IR_OPND_VREG && isel_reg(is, a->vreg) != NULL) {
+        reg = isel_reg(is, a->vreg)[wide];
+    } else {
+        isel_get(is, rettab, a, insn->size);
+        reg = rettab[wide];
+    }
+
+    /* Equality with zero needs no immediate */
+    if ((insn->cond == IR_EQ || insn->cond == IR_NE) &&
+        b->kind == IR_OPND_IMM && b->imm == 0) {
+        outbuf_lit(ob, "\ttest ");
+        outbuf_puts(ob, reg);
+        outbuf_lit(ob, ", ");
+        outbuf_puts(ob, reg);
+    } else {
+        src = isel_src(is, b, insn->size);
+        outbuf_lit(ob, "\tcmp ");
+        outbuf_puts(ob, reg);
+        outbuf_lit(ob, ", ");
+        if (src != NULL) {
+            outbuf_puts(ob, src);
+        } else {
+            cg_imm(ob, b->imm, insn->size);
+        }
+    }
+
+    /* Branch on whichever way does not fall through */
+    if (isel_falls_into(is->proc, i, insn->target[0])) {
+        if ((label = isel_label(is, insn->target[1])) == NULL) {
+            errno = -EINVAL;
+            return -1;
+        }
+
+        isel_jcc(ob, cc[1], label);
+        return 0;
+    }
+
+    if ((label = isel_label(is, insn->target[0])) == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    isel_jcc(ob, cc[0], label);
+    if (isel_falls_into(is->proc, i, insn->target[1])) {
+        return 0;
+    }
+
+    if ((label = isel_label(is, insn->target[1])) == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    return mu_cg_jmp(is->state, label);
+}
+
+/*
+ * Store the registers left for their spill slots at the
+ * instruction being selected.
+ *
+ * @is: Instruction selection state
+ */
+static void
+isel_spill(struct isel *is)
+{
+    struct ra_spill *spill;
+
+    while (is->spill < is->ra.nspills) {
+        spill = &is->ra.spills[is->spill];
+        if (spill->pos > is->pos) {
+            break;
+        }
+
+        /* The whole register, reads take the low bytes */
+        isel_store(
+            is->ob, regtab[spill->reg], MSIZE_QWORD,
+            NULL, is->slot_base + 8 * (spill->slot + 1)
+        );
+
+        ++is->spill;
+    }
+}
+
+/*
+ * Select a single instruction
+ *
+ * @is: Instruction selection state
+ * @i: Index of the instruction
+ *
+ * Returns zero on success
+ */
+static int
+isel_insn(struct isel *is, size_t i)
+{
+    struct ir_insn *insn = &is->proc->insns[i];
+    const char *label;
+
+    is->pos = i;
+    isel_spill(is);
+
+    switch (insn->op) {
+    case IR_NOP:
+        return 0;
+    case IR_LABEL:
+        if ((label = isel_label(is, insn->target[0])) == NULL) {
+            return 0;
+        }
+
+        return mu_cg_label(is->state, label, false);
+    case IR_CONST:
+        return isel_const(is, insn);
+    case IR_MOV:
+        isel_mov(is, insn);
+        return 0;
+    case IR_LOAD:
+        isel_load_insn(is, insn);
+        return 0;
+    case IR_STORE:
+        return isel_put(
+            is, &insn->a, insn->size,
+            insn->addr.label, insn->addr.off
+        );
+    case IR_CALL:
+        return mu_cg_call(is->state, insn->s);
+    case IR_RET:
+        return isel_ret(is, insn);
+    case IR_JMP:
+        if (isel_falls_into(is->proc, i + 1, insn->target[0])) {
+            return 0;
+        }
+
+        if ((label = isel_label(is, insn->target[0])) == NULL) {
+            errno = -EINVAL;
+            return -1;
+        }
+
+        return mu_cg_jmp(is->state, label);
+    case IR_BR:
+        return isel_br(is, insn, i + 1);
+    case IR_ASM:
+        return mu_cg_inject(is->state, insn->s, insn->len);
+    default:
+        if (ir_is_binop(insn->op)) {
+            isel_binop(is, insn);
+            return 0;
+        }
+
+        errno = -EINVAL;
+        return -1;
+    }
+}
+
+int
+mu_isel(struct gup_state *state, struct ir_proc *proc)
+{
+    struct symbol *func;
+    struct isel is;
+    size_t i;
+    int error = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((func = proc->func) == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(&is, 0, sizeof(is));
+    is.state = state;
+    is.proc = proc;
+    is.ob = cg_section(state, SECTION_TEXT);
+    if (ra_allocate(proc, &regtarget, &is.ra) < 0) {
+        return -1;
+    }
+
+    /* Spill slots go below the locals */
+    is.slot_base = (func->frame_size + 7) & ~(size_t)7;
+    if (is.ra.nslots > 0 || func->frame_size > 0) {
+        is.frame = is.slot_base + 8 * is.ra.nslots;
+    }
+
+    mu_cg_label(state, func->name, func->global);
+    if (is.frame > 0) {
+        mu_cg_frame(state, is.frame);
+    }
+
+    isel_saved(&is, false);
+    for (i = 0; i < proc->count && error == 0; ++i) {
+        error = isel_insn(&is, i);
+    }
+
+    ra_free(&is.ra);
+    return error;
+}
@@ -0,0 +1,3018 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gup/arena.h"
+#include "gup/elf.h"
+#include "gup/mu.h"
+#include "gup/outbuf.h"
+#include "gup/state.h"
+
+/* Initial number of symbol hash table slots, must be a power of two */
+#define AS_SYM_INIT_CAP 256
+
+/* Maximum number of operands of an instruction */
+#define AS_MAX_OPND 2
+
+/* REX prefix bits */
+#define REX     0x40
+#define REX_W   0x08
+#define REX_R   0x04
+#define REX_B   0x01
+
+/* Flags a ModRM reg field as a byte register that needs REX */
+#define AS_REX8 0x10
+
+/* Flags a ModRM reg field as ah, ch, dh or bh, which rule out REX */
+#define AS_HIGH 0x20
+
+/* Register numbers with a fixed role in encodings */
+#define REG_RSP 4
+#define REG_RBP 5
+
+/* 16-bit ModRM r/m field of a bare displacement, and of [bp] */
+#define RM16_DISP 6
+
+/* Alignment of the sections that follow .text in a flat binary */
+#define AS_BIN_ALIGN 4
+
+/* Size of a boot sector, the last two bytes hold the signature */
+#define AS_BOOT_SIZE 512
+
+/* Branch kinds of a fragment */
+#define AS_BR_NONE 0
+#define AS_BR_JMP  1
+#define AS_BR_JCC  2
+
+/*
+ * Valid operand kinds
+ */
+typedef enum {
+    OPND_NONE,
+    OPND_REG,       /* Register */
+    OPND_IMM,       /* Immediate */
+    OPND_MEM,       /* Memory reference */
+    OPND_SYM,       /* Branch target or label address */
+    OPND_SREG,      /* Segment register */
+    OPND_FAR        /* Far pointer (seg:label) */
+} opnd_kind_t;
+
+/*
+ * Represents an instruction operand
+ *
+ * @kind: Operand kind
+ * @size: Size in bytes, zero if not given
+ * @reg: Register, or base register of a memory reference
+ * @rex8: Byte register that can only be reached with REX
+ * @high: One of ah, ch, dh or bh
+ * @rip: Memory reference is relative to RIP
+ * @abs: Memory reference is the absolute address of a label
+ * @imm: Immediate value, displacement or segment of a far pointer
+ * @sym: Symbol of a branch target, label address or memory reference
+ */
+struct as_opnd {
+    opnd_kind_t kind;
+    uint8_t size;
+    uint8_t reg;
+    uint8_t rex8 : 1;
+    uint8_t high : 1;
+    uint8_t rip : 1;
+    uint8_t abs : 1;
+    int64_t imm;
+    uint32_t sym;
+};
+
+/*
+ * A fragment is a run of encoded bytes that may end in
+ * a branch. Branch sizes are only known once every
+ * label has an address so they are kept apart.
+ *
+ * @start: Offset of the bytes within the section code
+ * @len: Number of bytes
+ * @addr: Offset of the fragment within the section
+ * @sym: Branch target
+ * @br: Branch kind (AS_BR_*)
+ * @cc: Condition code of AS_BR_JCC
+ * @is_long: Branch uses a 16 or 32-bit displacement
+ * @code16: Branch is in 16-bit code
+ */
+struct as_frag {
+    size_t start;
+    size_t len;
+    uint64_t addr;
+    uint32_t sym;
+    uint8_t br;
+    uint8_t cc;
+    uint8_t is_long : 1;
+    uint8_t code16 : 1;
+};
+
+/*
+ * Represents a field holding the address of a symbol, to
+ * be resolved once the layout is final.
+ *
+ * @sect: Section of the field
+ * @frag: Fragment of the field
+ * @off: Offset of the field within the fragment
+ * @sym: Symbol referenced
+ * @addend: Offset from the symbol
+ * @width: Size of the field in bytes
+ * @pcrel: Field is relative to the end of the instruction
+ * @tail: Bytes between the field and the end of the instruction
+ */
+struct as_fixup {
+    bin_section_t sect;
+    uint32_t frag;
+    size_t off;
+    uint32_t sym;
+    int64_t addend;
+    uint8_t width;
+    uint8_t pcrel : 1;
+    uint8_t tail;
+};
+
+/*
+ * Represents an assembler symbol
+ *
+ * @name: Symbol name, not NUL terminated
+ * @len: Length of the name
+ * @hash: Hash of the name
+ * @sect: Defining section
+ * @frag: Defining fragment
+ * @off: Offset within the defining fragment
+ * @value: Offset within the section once laid out
+ * @defined: Label has been seen
+ * @global: Declared global
+ */
+struct as_sym {
+    const char *name;
+    size_t len;
+    uint32_t hash;
+    bin_section_t sect;
+    uint32_t frag;
+    size_t off;
+    uint64_t value;
+    uint8_t defined : 1;
+    uint8_t global : 1;
+};
+
+/*
+ * Represents a slot in the symbol hash table, the hash
+ * is kept alongside to avoid touching symbols that
+ * cannot match.
+ *
+ * @hash: Hash of the symbol name
+ * @idx: Index of the symbol plus one, zero if free
+ */
+struct as_slot {
+    uint32_t hash;
+    uint32_t idx;
+};
+
+/*
+ * Represents a section being assembled
+ *
+ * @code: Encoded bytes of every fragment
+ * @frags: Fragments
+ * @frag_count: Number of fragments
+ * @frag_cap: Capacity of fragments
+ * @size: Final size, or reserved bytes of .bss
+ * @image: Final contents
+ * @rela: Relocations against the section
+ * @rela_count: Number of relocations
+ * @rela_cap: Capacity of relocations
+ * @used: Section has been switched to
+ */
+struct as_section {
+    struct outbuf code;
+    struct as_frag *frags;
+    size_t frag_count;
+    size_t frag_cap;
+    uint64_t size;
+    struct outbuf image;
+    struct elf_rela *rela;
+    size_t rela_count;
+    size_t rela_cap;
+    uint8_t used : 1;
+};
+
+/*
+ * Represents the assembler state
+ *
+ * @state: Compiler state
+ * @fmt: Output format
+ * @bits: Current code size, 16 or 64
+ * @org: Address a flat binary is loaded at
+ * @has_org: Origin has been given
+ * @base: Address of each section of a flat binary
+ * @order: Sections in the order they are first used
+ * @order_count: Number of sections used
+ * @sects: Sections
+ * @sect: Current section
+ * @syms: Symbols
+ * @sym_count: Number of symbols
+ * @sym_cap: Capacity of symbols
+ * @slots: Symbol hash table
+ * @slot_cap: Number of hash table slots
+ * @fixups: Fields to resolve after layout
+ * @fixup_count: Number of fixups
+ * @fixup_cap: Capacity of fixups
+ * @names: Local label names are built here
+ * @scope: Last non-local label, local labels hang off it
+ * @scope_len: Length of the last non-local label
+ */
+struct as_ctx {
+    struct gup_state *state;
+    mu_out_t fmt;
+    uint8_t bits;
+    uint64_t org;
+    bool has_org;
+    uint64_t base[SECTION_MAX];
+    bin_section_t order[SECTION_MAX];
+    size_t order_count;
+    struct as_section sects[SECTION_MAX];
+    bin_section_t sect;
+    struct as_sym *syms;
+    size_t sym_count;
+    size_t sym_cap;
+    struct as_slot *slots;
+    size_t slot_cap;
+    struct as_fixup *fixups;
+    size_t fixup_count;
+    size_t fixup_cap;
+    struct arena names;
+    const char *scope;
+    size_t scope_len;
+};
+
+/*
+ * Represents the rest of a line being parsed
+ *
+ * @p: Cursor
+ * @end: End of the line
+ */
+struct as_line {
+    const char *p;
+    const char *end;
+};
+
+/*
+ * Represents a register name
+ *
+ * @name: Register name
+ * @reg: Register number
+ * @size: Size in bytes
+ * @high: One of ah, ch, dh or bh
+ */
+struct as_reg {
+    const char *name;
+    uint8_t reg;
+    uint8_t size;
+    uint8_t high;
+};
+
+/*
+ * Represents an instruction without operands
+ *
+ * @name: Mnemonic
+ * @len: Number of opcode bytes
+ * @op: Opcode bytes
+ * @long_only: Only valid in 64-bit code
+ */
+struct as_plain {
+    const char *name;
+    uint8_t len;
+    uint8_t op[3];
+    uint8_t long_only;
+};
+
+/* Section names, indexed by bin_section_t */
+static const char *sectnames[] = {
+    [SECTION_NONE]   = NULL,
+    [SECTION_TEXT]   = ".text",
+    [SECTION_DATA]   = ".data",
+    [SECTION_BSS]    = ".bss",
+    [SECTION_RODATA] = ".rodata"
+};
+
+/* Registers */
+static const struct as_reg regtab[] = {
+    { "rax", 0, 8 }, { "rcx", 1, 8 }, { "rdx", 2, 8 }, { "rbx", 3, 8 },
+    { "rsp", 4, 8 }, { "rbp", 5, 8 }, { "rsi", 6, 8 }, { "rdi", 7, 8 },
+    { "r8", 8, 8 }, { "r9", 9, 8 }, { "r10", 10, 8 }, { "r11", 11, 8 },
+    { "r12", 12, 8 }, { "r13", 13, 8 }, { "r14", 14, 8 }, { "r15", 15, 8 },
+    { "eax", 0, 4 }, { "ecx", 1, 4 }, { "edx", 2, 4 }, { "ebx", 3, 4 },
+    { "esp", 4, 4 }, { "ebp", 5, 4 }, { "esi", 6, 4 }, { "edi", 7, 4 },
+    { "r8d", 8, 4 }, { "r9d", 9, 4 }, { "r10d", 10, 4 }, { "r11d", 11, 4 },
+    { "r12d", 12, 4 }, { "r13d", 13, 4 }, { "r14d", 14, 4 }, { "r15d", 15, 4 },
+    { "ax", 0, 2 }, { "cx", 1, 2 }, { "dx", 2, 2 }, { "bx", 3, 2 },
+    { "sp", 4, 2 }, { "bp", 5, 2 }, { "si", 6, 2 }, { "di", 7, 2 },
+    { "r8w", 8, 2 }, { "r9w", 9, 2 }, { "r10w", 10, 2 }, { "r11w", 11, 2 },
+    { "r12w", 12, 2 }, { "r13w", 13, 2 }, { "r14w", 14, 2 }, { "r15w", 15, 2 },
+    { "al", 0, 1 }, { "cl", 1, 1 }, { "dl", 2, 1 }, { "bl", 3, 1 },
+    { "spl", 4, 1 }, { "bpl", 5, 1 }, { "sil", 6, 1 }, { "dil", 7, 1 },
+    { "r8b", 8, 1 }, { "r9b", 9, 1 }, { "r10b", 10, 1 }, { "r11b", 11, 1 },
+    { "r12b", 12, 1 }, { "r13b", 13, 1 }, { "r14b", 14, 1 }, { "r15b", 15, 1 },
+    { "ah", 4, 1, 1 }, { "ch", 5, 1, 1 }, { "dh", 6, 1, 1 }, { "bh", 7, 1, 1 }
+};
+
+/* Segment registers, indexed by register number */
+static const char *sregtab[] = {
+    "es", "cs", "ss", "ds", "fs", "gs"
+};
+
+/* Instructions without operands */
+static const struct as_plain plaintab[] = {
+    { "ret",     1, { 0xC3 } },
+    { "leave",   1, { 0xC9 } },
+    { "nop",     1, { 0x90 } },
+    { "hlt",     1, { 0xF4 } },
+    { "cli",     1, { 0xFA } },
+    { "sti",     1, { 0xFB } },
+    { "cld",     1, { 0xFC } },
+    { "std",     1, { 0xFD } },
+    { "clc",     1, { 0xF8 } },
+    { "stc",     1, { 0xF9 } },
+    { "cmc",     1, { 0xF5 } },
+    { "int3",    1, { 0xCC } },
+    { "cdq",     1, { 0x99 } },
+    { "cqo",     2, { 0x48, 0x99 }, 1 },
+    { "pushfq",  1, { 0x9C }, 1 },
+    { "popfq",   1, { 0x9D }, 1 },
+    { "lodsb",   1, { 0xAC } },
+    { "stosb",   1, { 0xAA } },
+    { "movsb",   1, { 0xA4 } },
+    { "pause",   2, { 0xF3, 0x90 } },
+    { "iretq",   2, { 0x48, 0xCF }, 1 },
+    { "syscall", 2, { 0x0F, 0x05 } },
+    { "cpuid",   2, { 0x0F, 0xA2 } },
+    { "rdtsc",   2, { 0x0F, 0x31 } },
+    { "ud2",     2, { 0x0F, 0x0B } },
+    { "wbinvd",  2, { 0x0F, 0x09 } },
+    { "lfence",  3, { 0x0F, 0xAE, 0xE8 } },
+    { "mfence",  3, { 0x0F, 0xAE, 0xF0 } },
+    { "sfence",  3, { 0x0F, 0xAE, 0xF8 } }
+};
+
+/* Arithmetic instructions, indexed by their ModRM extension */
+static const char *alutab[] = {
+    "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"
+};
+
+/* Unary instructions and their opcode extension */
+static const struct {
+    const char *name;
+    uint8_t op;
+    uint8_t ext;
+} unarytab[] = {
+    { "inc", 0xFE, 0 },
+    { "dec", 0xFE, 1 },
+    { "not", 0xF6, 2 },
+    { "neg", 0xF6, 3 },
+    { "mul", 0xF6, 4 },
+    { "div", 0xF6, 6 }
+};
+
+/* Shift instructions and their opcode extension */
+static const struct {
+    const char *name;
+    uint8_t ext;
+} shifttab[] = {
+    { "shl", 4 },
+    { "shr", 5 },
+    { "sar", 7 }
+};
+
+/* Conditional jumps and their condition codes */
+static const struct {
+    const char *name;
+    uint8_t cc;
+} jcctab[] = {
+    { "jo", 0x0 }, { "jno", 0x1 }, { "jb", 0x2 }, { "jc", 0x2 },
+    { "jnae", 0x2 }, { "jae", 0x3 }, { "jnb", 0x3 }, { "jnc", 0x3 },
+    { "je", 0x4 }, { "jz", 0x4 }, { "jne", 0x5 }, { "jnz", 0x5 },
+    { "jbe", 0x6 }, { "jna", 0x6 }, { "ja", 0x7 }, { "jnbe", 0x7 },
+    { "js", 0x8 }, { "jns", 0x9 }, { "jp", 0xA }, { "jpe", 0xA },
+    { "jnp", 0xB }, { "jpo", 0xB }, { "jl", 0xC }, { "jnge", 0xC },
+    { "jge", 0xD }, { "jnl", 0xD }, { "jle", 0xE }, { "jng", 0xE },
+    { "jg", 0xF }, { "jnle", 0xF }
+};
+
+/*
+ * Give up on the program, the caller falls back to an
+ * external assembler.
+ *
+ * Returns -1
+ */
+static inline int
+as_unsupported(void)
+{
+    errno = -ENOTSUP;
+    return -1;
+}
+
+/*
+ * Check if a token equals a NUL terminated string
+ *
+ * @s: Token
+ * @len: Length of token
+ * @what: String to compare against
+ */
+static inline bool
+as_eq(const char *s, size_t len, const char *what)
+{
+    return strncmp(s, what, len) == 0 && what[len] == '\0';
+}
+
+/*
+ * Make room for one more element of a growable array
+ *
+ * @arr: Array to grow
+ * @count: Number of elements in use
+ * @cap: Capacity of the array
+ * @elem: Size of each element
+ *
+ * Returns zero on success
+ */
+static int
+as_reserve(void **arr, size_t count, size_t *cap, size_t elem)
+{
+    size_t new_cap;
+    void *p;
+
+    if (count < *cap) {
+        return 0;
+    }
+
+    new_cap = (*cap == 0) ? 64 : *cap * 2;
+    if ((p = realloc(*arr, new_cap * elem)) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    *arr = p;
+    *cap = new_cap;
+    return 0;
+}
+
+/*
+ * Hash a symbol name (32-bit FNV-1a)
+ *
+ * @s: Name to hash
+ * @len: Length of name
+ */
+static inline uint32_t
+as_hash(const char *s, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        hash ^= (uint8_t)s[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/*
+ * Grow the symbol hash table
+ *
+ * @ctx: Assembler state
+ *
+ * Returns zero on success
+ */
+static int
+as_sym_grow(struct as_ctx *ctx)
+{
+    struct as_slot *slots;
+    size_t cap, i, j;
+
+    cap = (ctx->slot_cap == 0) ? AS_SYM_INIT_CAP : ctx->slot_cap * 2;
+    if ((slots = calloc(cap, sizeof(*slots))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < ctx->sym_count; ++i) {
+        j = ctx->syms[i].hash & (cap - 1);
+        while (slots[j].idx != 0) {
+            j = (j + 1) & (cap - 1);
+        }
+
+        slots[j].hash = ctx->syms[i].hash;
+        slots[j].idx = i + 1;
+    }
+
+    free(ctx->slots);
+    ctx->slots = slots;
+    ctx->slot_cap = cap;
+    return 0;
+}
+
+/*
+ * Look up a symbol by name, creating it if needed. Local
+ * labels (starting with '.') are qualified by the last
+ * non-local label.
+ *
+ * @ctx: Assembler state
+ * @s: Symbol name
+ * @len: Length of name
+ * @res: Index of the symbol is written here
+ *
+ * Returns zero on success
+ */
+static int
+as_sym(struct as_ctx *ctx, const char *s, size_t len, uint32_t *res)
+{
+    struct as_sym *sym;
+    char *name;
+    uint32_t hash;
+    size_t i;
+
+    if (len > 1 && s[0] == '.' && s[1] == '.') {
+        return as_unsupported();
+    }
+
+    if (s[0] == '.') {
+        if (ctx->scope == NULL) {
+            return as_unsupported();
+        }
+
+        name = arena_alloc(&ctx->names, ctx->scope_len + len, 1);
+        if (name == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        memcpy(name, ctx->scope, ctx->scope_len);
+        memcpy(&name[ctx->scope_len], s, len);
+        s = name;
+        len += ctx->scope_len;
+    }
+
+    hash = as_hash(s, len);
+    if (ctx->slot_cap != 0) {
+        i = hash & (ctx->slot_cap - 1);
+        while (ctx->slots[i].idx != 0) {
+            sym = &ctx->syms[ctx->slots[i].idx - 1];
+            if (ctx->slots[i].hash == hash && sym->len == len &&
+                memcmp(sym->name, s, len) == 0) {
+                *res = ctx->slots[i].idx - 1;
+                return 0;
+            }
+
+            i = (i + 1) & (ctx->slot_cap - 1);
+        }
+    }
+
+    /* Keep the table at most half full */
+    if ((ctx->sym_count + 1) * 2 > ctx->slot_cap) {
+        if (as_sym_grow(ctx) < 0) {
+            return -1;
+        }
+    }
+
+    if (as_reserve((void **)&ctx->syms, ctx->sym_count, &ctx->sym_cap,
+        sizeof(*ctx->syms)) < 0) {
+        return -1;
+    }
+
+    sym = &ctx->syms[ctx->sym_count];
+    memset(sym, 0, sizeof(*sym));
+    sym->name = s;
+    sym->len = len;
+    sym->hash = hash;
+
+    i = hash & (ctx->slot_cap - 1);
+    while (ctx->slots[i].idx != 0) {
+        i = (i + 1) & (ctx->slot_cap - 1);
+    }
+
+    ctx->slots[i].hash = hash;
+    ctx->slots[i].idx = ++ctx->sym_count;
+    *res = ctx->sym_count - 1;
+    return 0;
+}
+
+/*
+ * Start a new fragment in the current section
+ *
+ * @ctx: Assembler state
+ *
+ * Returns zero on success
+ */
+static int
+as_frag_new(struct as_ctx *ctx)
+{
+    struct as_section *sect = &ctx->sects[ctx->sect];
+    struct as_frag *frag;
+
+    if (as_reserve((void **)&sect->frags, sect->frag_count,
+        &sect->frag_cap, sizeof(*sect->frags)) < 0) {
+        return -1;
+    }
+
+    frag = &sect->frags[sect->frag_count++];
+    memset(frag, 0, sizeof(*frag));
+    frag->start = sect->code.len;
+    return 0;
+}
+
+/*
+ * Get the fragment bytes are currently added to
+ *
+ * @ctx: Assembler state
+ */
+static inline struct as_frag *
+as_frag(struct as_ctx *ctx)
+{
+    struct as_section *sect = &ctx->sects[ctx->sect];
+
+    return &sect->frags[sect->frag_count - 1];
+}
+
+/*
+ * Append bytes to the current fragment
+ *
+ * @ctx: Assembler state
+ * @p: Bytes to append
+ * @len: Number of bytes
+ */
+static void
+as_put(struct as_ctx *ctx, const void *p, size_t len)
+{
+    outbuf_putn(&ctx->sects[ctx->sect].code, p, len);
+    as_frag(ctx)->len += len;
+}
+
+/*
+ * Append a little endian value to the current fragment
+ *
+ * @ctx: Assembler state
+ * @v: Value to append
+ * @len: Number of bytes
+ */
+static void
+as_put_le(struct as_ctx *ctx, uint64_t v, size_t len)
+{
+    uint8_t buf[8];
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        buf[i] = v >> (i * 8);
+    }
+
+    as_put(ctx, buf, len);
+}
+
+/*
+ * Append a field holding the address of a symbol to the
+ * current fragment
+ *
+ * @ctx: Assembler state
+ * @sym: Symbol referenced
+ * @addend: Offset from the symbol
+ * @width: Size of the field in bytes
+ * @pcrel: Field is relative to the end of the instruction
+ * @tail: Bytes of the instruction that follow the field
+ *
+ * Returns zero on success
+ */
+static int
+as_put_ref(struct as_ctx *ctx, uint32_t sym, int64_t addend, uint8_t width,
+    bool pcrel, uint8_t tail)
+{
+    struct as_fixup *fixup;
+
+    if (as_reserve((void **)&ctx->fixups, ctx->fixup_count,
+        &ctx->fixup_cap, sizeof(*ctx->fixups)) < 0) {
+        return -1;
+    }
+
+    fixup = &ctx->fixups[ctx->fixup_count++];
+    fixup->sect = ctx->sect;
+    fixup->frag = ctx->sects[ctx->sect].frag_count - 1;
+    fixup->off = as_frag(ctx)->len;
+    fixup->sym = sym;
+    fixup->addend = addend;
+    fixup->width = width;
+    fixup->pcrel = pcrel;
+    fixup->tail = tail;
+    as_put_le(ctx, 0, width);
+    return 0;
+}
+
+/*
+ * Check if a value fits in a signed number of bytes
+ *
+ * @v: Value to check
+ * @bytes: Number of bytes
+ */
+static inline bool
+as_fits_signed(int64_t v, uint8_t bytes)
+{
+    int64_t lim;
+
+    if (bytes >= 8) {
+        return true;
+    }
+
+    lim = (int64_t)1 << (bytes * 8 - 1);
+    return v >= -lim && v < lim;
+}
+
+/*
+ * Check if a value fits in a number of bytes either as
+ * a signed or as an unsigned number.
+ *
+ * @v: Value to check
+ * @bytes: Number of bytes
+ */
+static inline bool
+as_fits(int64_t v, uint8_t bytes)
+{
+    if (bytes >= 8) {
+        return true;
+    }
+
+    return v >= -((int64_t)1 << (bytes * 8 - 1)) &&
+        v < ((int64_t)1 << (bytes * 8));
+}
+
+/*
+ * Truncate a value to a number of bytes and sign extend
+ * it back, e.g. 0xFFFF as a word is -1.
+ *
+ * @v: Value to truncate
+ * @bytes: Number of bytes
+ */
+static inline int64_t
+as_wrap(int64_t v, uint8_t bytes)
+{
+    uint64_t sign;
+
+    if (bytes >= 8) {
+        return v;
+    }
+
+    sign = (uint64_t)1 << (bytes * 8 - 1);
+    v &= (int64_t)((sign << 1) - 1);
+    return (int64_t)(((uint64_t)v ^ sign) - sign);
+}
+
+/*
+ * Get the ModRM reg field of a register operand
+ *
+ * @opnd: Register operand
+ */
+static inline uint8_t
+as_regf(const struct as_opnd *opnd)
+{
+    return opnd->reg | (opnd->rex8 ? AS_REX8 : 0) | (opnd->high ? AS_HIGH : 0);
+}
+
+/*
+ * Get the size of the displacement of near calls and
+ * branches in the current code
+ *
+ * @ctx: Assembler state
+ */
+static inline uint8_t
+as_relsize(struct as_ctx *ctx)
+{
+    return (ctx->bits == 16) ? 2 : 4;
+}
+
+/*
+ * Encode an instruction in 16-bit code, see as_encode()
+ *
+ * Returns zero on success
+ */
+static int
+as_encode16(struct as_ctx *ctx, uint8_t size, const uint8_t *op, size_t op_len,
+    uint8_t reg, const struct as_opnd *rm, int64_t imm, uint8_t imm_len)
+{
+    uint8_t modrm, mod, base;
+    int64_t disp;
+
+    /* Nothing that needs REX exists here */
+    if (size == 8 || (reg & (8 | AS_REX8)) != 0) {
+        return as_unsupported();
+    }
+
+    if (rm != NULL && rm->kind == OPND_REG && (rm->reg >= 8 || rm->rex8)) {
+        return as_unsupported();
+    }
+
+    if (size == 4) {
+        as_put(ctx, "\x66", 1);
+    }
+
+    as_put(ctx, op, op_len);
+    if (rm == NULL) {
+        as_put_le(ctx, imm, imm_len);
+        return 0;
+    }
+
+    if (rm->kind == OPND_REG) {
+        modrm = 0xC0 | (reg & 7) << 3 | (rm->reg & 7);
+        as_put(ctx, &modrm, 1);
+        as_put_le(ctx, imm, imm_len);
+        return 0;
+    }
+
+    if (rm->abs) {
+        modrm = (reg & 7) << 3 | RM16_DISP;
+        as_put(ctx, &modrm, 1);
+        if (as_put_ref(ctx, rm->sym, rm->imm, 2, false, 0) < 0) {
+            return -1;
+        }
+
+        as_put_le(ctx, imm, imm_len);
+        return 0;
+    }
+
+    /* Only bx, bp, si and di can be a base on their own */
+    switch (rm->reg) {
+    case 3:
+        base = 7;
+        break;
+    case 5:
+        base = 6;
+        break;
+    case 6:
+        base = 4;
+        break;
+    default:
+        base = 5;
+        break;
+    }
+
+    /* As with rbp, a base of bp always needs a displacement */
+    disp = rm->imm;
+    if (disp == 0 && base != RM16_DISP) {
+        mod = 0x00;
+    } else if (as_fits_signed(disp, 1)) {
+        mod = 0x40;
+    } else {
+        mod = 0x80;
+    }
+
+    modrm = mod | (reg & 7) << 3 | base;
+    as_put(ctx, &modrm, 1);
+    if (mod == 0x40) {
+        as_put_le(ctx, disp, 1);
+    } else if (mod == 0x80) {
+        as_put_le(ctx, disp, 2);
+    }
+
+    as_put_le(ctx, imm, imm_len);
+    return 0;
+}
+
+/*
+ * Encode an instruction
+ *
+ * @ctx: Assembler state
+ * @size: Operand size in bytes, selects the 0x66 and REX.W prefixes
+ * @op: Opcode bytes
+ * @op_len: Number of opcode bytes
+ * @reg: ModRM reg field, a register (see as_regf()) or opcode extension
+ * @rm: ModRM r/m operand, NULL if there is no ModRM byte
+ * @imm: Immediate
+ * @imm_len: Number of immediate bytes
+ *
+ * Returns zero on success
+ */
+static int
+as_encode(struct as_ctx *ctx, uint8_t size, const uint8_t *op, size_t op_len,
+    uint8_t reg, const struct as_opnd *rm, int64_t imm, uint8_t imm_len)
+{
+    uint8_t rex = REX, modrm, mod;
+    bool need_rex = false;
+    int64_t disp;
+
+    if (ctx->bits == 16) {
+        return as_encode16(ctx, size, op, op_len, reg, rm, imm, imm_len);
+    }
+
+    if (size == 2) {
+        as_put(ctx, "\x66", 1);
+    }
+
+    if (size == 8) {
+        rex |= REX_W;
+    }
+
+    if ((reg & 8) != 0) {
+        rex |= REX_R;
+    }
+
+    if (rm != NULL && (rm->kind == OPND_REG || !rm->rip) && rm->reg >= 8) {
+        rex |= REX_B;
+    }
+
+    if ((rm != NULL && rm->rex8) || (reg & AS_REX8) != 0) {
+        need_rex = true;
+    }
+
+    if (rex != REX || need_rex) {
+        if ((reg & AS_HIGH) != 0 || (rm != NULL && rm->high)) {
+            return as_unsupported();
+        }
+
+        as_put(ctx, &rex, 1);
+    }
+
+    as_put(ctx, op, op_len);
+    if (rm == NULL) {
+        as_put_le(ctx, imm, imm_len);
+        return 0;
+    }
+
+    if (rm->kind == OPND_REG) {
+        modrm = 0xC0 | (reg & 7) << 3 | (rm->reg & 7);
+        as_put(ctx, &modrm, 1);
+        as_put_le(ctx, imm, imm_len);
+        return 0;
+    }
+
+    if (rm->rip) {
+        modrm = (reg & 7) << 3 | 5;
+        as_put(ctx, &modrm, 1);
+        if (as_put_ref(ctx, rm->sym, rm->imm, 4, true, imm_len) < 0) {
+            return -1;
+        }
+
+        as_put_le(ctx, imm, imm_len);
+        return 0;
+    }
+
+    /*
+     * Use the shortest displacement, a base of rbp or r13
+     * always needs one and rsp or r12 need a SIB byte.
+     */
+    disp = rm->imm;
+    if (disp == 0 && (rm->reg & 7) != REG_RBP) {
+        mod = 0x00;
+    } else if (as_fits_signed(disp, 1)) {
+        mod = 0x40;
+    } else {
+        mod = 0x80;
+    }
+
+    modrm = mod | (reg & 7) << 3 | (rm->reg & 7);
+    as_put(ctx, &modrm, 1);
+    if ((rm->reg & 7) == REG_RSP) {
+        as_put(ctx, "\x24", 1);
+    }
+
+    if (mod == 0x40) {
+        as_put_le(ctx, disp, 1);
+    } else if (mod == 0x80) {
+        as_put_le(ctx, disp, 4);
+    }
+
+    as_put_le(ctx, imm, imm_len);
+    return 0;
+}
+
+/*
+ * Encode an instruction that holds its register in the
+ * low bits of the opcode.
+ *
+ * @ctx: Assembler state
+ * @size: Operand size in bytes, zero for no size prefix
+ * @op: Opcode with the low bits of the register
+ * @reg: Register operand
+ * @imm: Immediate
+ * @imm_len: Number of immediate bytes
+ *
+ * Returns zero on success
+ */
+static int
+as_encode_opreg(struct as_ctx *ctx, uint8_t size, uint8_t op,
+    const struct as_opnd *reg, int64_t imm, uint8_t imm_len)
+{
+    uint8_t rex = REX;
+
+    if (ctx->bits == 16) {
+        if (size == 8 || reg->reg >= 8 || reg->rex8) {
+            return as_unsupported();
+        }
+
+        if (size == 4) {
+            as_put(ctx, "\x66", 1);
+        }
+
+        as_put(ctx, &op, 1);
+        as_put_le(ctx, imm, imm_len);
+        return 0;
+    }
+
+    if (size == 2) {
+        as_put(ctx, "\x66", 1);
+    }
+
+    if (size == 8) {
+        rex |= REX_W;
+    }
+
+    if (reg->reg >= 8) {
+        rex |= REX_B;
+    }
+
+    if (rex != REX || reg->rex8) {
+        as_put(ctx, &rex, 1);
+    }
+
+    as_put(ctx, &op, 1);
+    as_put_le(ctx, imm, imm_len);
+    return 0;
+}
+
+/*
+ * Skip whitespace within a line
+ *
+ * @line: Line being parsed
+ */
+static inline void
+as_skip(struct as_line *line)
+{
+    while (line->p < line->end && (*line->p == ' ' || *line->p == '\t')) {
+        ++line->p;
+    }
+}
+
+/*
+ * Consume a character if it is next
+ *
+ * @line: Line being parsed
+ * @c: Character to consume
+ *
+ * Returns true if it was consumed
+ */
+static inline bool
+as_accept(struct as_line *line, char c)
+{
+    as_skip(line);
+    if (line->p < line->end && *line->p == c) {
+        ++line->p;
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Check if the rest of a line is empty
+ *
+ * @line: Line being parsed
+ */
+static inline bool
+as_at_end(struct as_line *line)
+{
+    as_skip(line);
+    return line->p == line->end;
+}
+
+/*
+ * Parse an identifier
+ *
+ * @line: Line being parsed
+ * @res: Start of the identifier is written here
+ *
+ * Returns the length of the identifier, zero if there is none
+ */
+static size_t
+as_ident(struct as_line *line, const char **res)
+{
+    const char *p;
+    char c;
+
+    as_skip(line);
+    p = line->p;
+    if (p == line->end) {
+        return 0;
+    }
+
+    c = *p;
+    if (!(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') &&
+        c != '_' && c != '.' && c != '?') {
+        return 0;
+    }
+
+    while (p < line->end) {
+        c = *p;
+        if (!(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z') &&
+            !(c >= '0' && c <= '9') && c != '_' && c != '.' &&
+            c != '?' && c != '$' && c != '#' && c != '@' && c != '~') {
+            break;
+        }
+
+        ++p;
+    }
+
+    *res = line->p;
+    line->p = p;
+    return p - *res;
+}
+
+/*
+ * Parse a number with an optional sign, decimal or with
+ * a 0x or 0b prefix.
+ *
+ * @line: Line being parsed
+ * @res: Value is written here
+ *
+ * Returns zero on success
+ */
+static int
+as_number(struct as_line *line, int64_t *res)
+{
+    uint64_t v = 0, base = 10, digit;
+    bool neg, any = false;
+    char c;
+
+    neg = as_accept(line, '-');
+    as_skip(line);
+    if (line->end - line->p > 2 && line->p[0] == '0') {
+        if (line->p[1] == 'x' || line->p[1] == 'X') {
+            base = 16;
+            line->p += 2;
+        } else if (line->p[1] == 'b' || line->p[1] == 'B') {
+            base = 2;
+            line->p += 2;
+        }
+    }
+
+    while (line->p < line->end) {
+        c = *line->p;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else if (c == '_') {
+            ++line->p;
+            continue;
+        } else {
+            break;
+        }
+
+        if (digit >= base || v > (UINT64_MAX - digit) / base) {
+            return as_unsupported();
+        }
+
+        v = v * base + digit;
+        any = true;
+        ++line->p;
+    }
+
+    /* Anything glued to the number is not understood */
+    if (!any || (line->p < line->end && *line->p != ' ' &&
+        *line->p != '\t' && *line->p != ',' && *line->p != ']' &&
+        *line->p != ':')) {
+        return as_unsupported();
+    }
+
+    *res = neg ? -(int64_t)v : (int64_t)v;
+    return 0;
+}
+
+/*
+ * Look up a register
+ *
+ * @s: Register name
+ * @len: Length of name
+ *
+ * Returns NULL if the name is not a register
+ */
+static const struct as_reg *
+as_reg(const char *s, size_t len)
+{
+    size_t i;
+
+    if (len < 2 || len > 4) {
+        return NULL;
+    }
+
+    for (i = 0; i < sizeof(regtab) / sizeof(regtab[0]); ++i) {
+        if (as_eq(s, len, regtab[i].name)) {
+            return &regtab[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Look up a segment register
+ *
+ * @s: Register name
+ * @len: Length of name
+ *
+ * Returns the register number, -1 if the name is not one
+ */
+static int
+as_sreg(const char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(sregtab) / sizeof(sregtab[0]); ++i) {
+        if (as_eq(s, len, sregtab[i])) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Parse a size keyword
+ *
+ * @s: Keyword
+ * @len: Length of keyword
+ *
+ * Returns the size in bytes, zero if it is not one
+ */
+static uint8_t
+as_size_kw(const char *s, size_t len)
+{
+    if (as_eq(s, len, "byte")) {
+        return 1;
+    }
+
+    if (as_eq(s, len, "word")) {
+        return 2;
+    }
+
+    if (as_eq(s, len, "dword")) {
+        return 4;
+    }
+
+    if (as_eq(s, len, "qword")) {
+        return 8;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse a memory reference, either [rel label +/- n]
+ * or [reg +/- n]. 16-bit code has [label +/- n] instead
+ * of the RIP relative form and only takes bx, bp, si or
+ * di as a base.
+ *
+ * @ctx: Assembler state
+ * @line: Line being parsed, after the opening bracket
+ * @res: Operand to fill
+ *
+ * Returns zero on success
+ */
+static int
+as_mem(struct as_ctx *ctx, struct as_line *line, struct as_opnd *res)
+{
+    const struct as_reg *reg;
+    const char *s;
+    size_t len;
+    int64_t disp;
+    bool neg;
+
+    res->kind = OPND_MEM;
+    if ((len = as_ident(line, &s)) == 0) {
+        return as_unsupported();
+    }
+
+    if (ctx->bits == 16) {
+        if ((reg = as_reg(s, len)) != NULL) {
+            if (reg->size != 2 || (reg->reg != 3 && reg->reg < 5) || reg->reg > 7) {
+                return as_unsupported();
+            }
+
+            res->reg = reg->reg;
+        } else if (as_sreg(s, len) >= 0 || as_eq(s, len, "rel")) {
+            return as_unsupported();
+        } else {
+            if (as_sym(ctx, s, len, &res->sym) < 0) {
+                return -1;
+            }
+
+            res->abs = 1;
+        }
+    } else if (as_eq(s, len, "rel")) {
+        if ((len = as_ident(line, &s)) == 0 || as_reg(s, len) != NULL) {
+            return as_unsupported();
+        }
+
+        if (as_sym(ctx, s, len, &res->sym) < 0) {
+            return -1;
+        }
+
+        res->rip = 1;
+    } else {
+        if ((reg = as_reg(s, len)) == NULL || reg->size != 8) {
+            return as_unsupported();
+        }
+
+        res->reg = reg->reg;
+    }
+
+    res->imm = 0;
+    as_skip(line);
+    if (line->p < line->end && (*line->p == '+' || *line->p == '-')) {
+        neg = *line->p++ == '-';
+        as_skip(line);
+        if (line->p < line->end && *line->p == '-') {
+            return as_unsupported();
+        }
+
+        if (as_number(line, &disp) < 0) {
+            return -1;
+        }
+
+        res->imm = neg ? -disp : disp;
+        if (!as_fits_signed(res->imm, as_relsize(ctx))) {
+            return as_unsupported();
+        }
+    }
+
+    if (!as_accept(line, ']')) {
+        return as_unsupported();
+    }
+
+    return 0;
+}
+
+/*
+ * Parse an operand
+ *
+ * @ctx: Assembler state
+ * @line: Line being parsed
+ * @res: Operand to fill
+ *
+ * Returns zero on success
+ */
+static int
+as_operand(struct as_ctx *ctx, struct as_line *line, struct as_opnd *res)
+{
+    const struct as_reg *reg;
+    struct as_line save;
+    const char *s;
+    size_t len;
+    uint8_t size;
+    int sreg;
+
+    memset(res, 0, sizeof(*res));
+    save = *line;
+    if ((len = as_ident(line, &s)) != 0) {
+        if ((size = as_size_kw(s, len)) == 0) {
+            *line = save;
+        }
+
+        res->size = size;
+    }
+
+    if (as_accept(line, '[')) {
+        return as_mem(ctx, line, res);
+    }
+
+    as_skip(line);
+    if (line->p < line->end && (*line->p == '-' ||
+        (*line->p >= '0' && *line->p <= '9'))) {
+        res->kind = OPND_IMM;
+        if (as_number(line, &res->imm) < 0) {
+            return -1;
+        }
+
+        if (!as_accept(line, ':')) {
+            return 0;
+        }
+
+        /* seg:label */
+        if (res->size != 0 || res->imm < 0 || res->imm > UINT16_MAX) {
+            return as_unsupported();
+        }
+
+        res->kind = OPND_FAR;
+        if ((len = as_ident(line, &s)) == 0 || as_reg(s, len) != NULL) {
+            return as_unsupported();
+        }
+
+        return as_sym(ctx, s, len, &res->sym);
+    }
+
+    /* Sizes only apply to memory and immediates */
+    if (res->size != 0 || (len = as_ident(line, &s)) == 0) {
+        return as_unsupported();
+    }
+
+    if ((reg = as_reg(s, len)) != NULL) {
+        res->kind = OPND_REG;
+        res->reg = reg->reg;
+        res->size = reg->size;
+        res->high = reg->high;
+        res->rex8 = reg->size == 1 && reg->reg >= 4 && reg->reg < 8 &&
+            !reg->high;
+        return 0;
+    }
+
+    if ((sreg = as_sreg(s, len)) >= 0) {
+        res->kind = OPND_SREG;
+        res->reg = sreg;
+        res->size = 2;
+        return 0;
+    }
+
+    res->kind = OPND_SYM;
+    return as_sym(ctx, s, len, &res->sym);
+}
+
+/*
+ * Find the operand size of a two operand instruction
+ *
+ * @dst: Destination operand
+ * @src: Source operand
+ *
+ * Returns zero if the size is unknown or inconsistent
+ */
+static uint8_t
+as_opsize(const struct as_opnd *dst, const struct as_opnd *src)
+{
+    if (src->kind == OPND_IMM) {
+        return dst->size;
+    }
+
+    if (dst->size != 0 && src->size != 0 && dst->size != src->size) {
+        return 0;
+    }
+
+    return (dst->size != 0) ? dst->size : src->size;
+}
+
+/*
+ * Encode a mov instruction
+ *
+ * @ctx: Assembler state
+ * @dst: Destination operand
+ * @src: Source operand
+ *
+ * Returns zero on success
+ */
+static int
+as_mov(struct as_ctx *ctx, const struct as_opnd *dst, const struct as_opnd *src)
+{
+    uint8_t size, op;
+
+    if ((size = as_opsize(dst, src)) == 0) {
+        return as_unsupported();
+    }
+
+    /* Segment registers move as words, cs cannot be loaded */
+    if (dst->kind == OPND_SREG && (src->kind == OPND_REG || src->kind == OPND_MEM)) {
+        if (size != 2 || dst->reg == 1) {
+            return as_unsupported();
+        }
+
+        op = 0x8E;
+        return as_encode(ctx, 0, &op, 1, dst->reg, src, 0, 0);
+    }
+
+    if (src->kind == OPND_SREG && (dst->kind == OPND_REG || dst->kind == OPND_MEM)) {
+        if (size != 2) {
+            return as_unsupported();
+        }
+
+        op = 0x8C;
+        return as_encode(ctx, dst->kind == OPND_REG ? 2 : 0, &op, 1, src->reg, dst, 0, 0);
+    }
+
+    /* The address of a label, only known up front in flat binaries */
+    if (src->kind == OPND_SYM && dst->kind == OPND_REG) {
+        if (ctx->bits != 16 || size != 2) {
+            return as_unsupported();
+        }
+
+        op = 0xB8 | (dst->reg & 7);
+        if (as_encode_opreg(ctx, size, op, dst, 0, 0) < 0) {
+            return -1;
+        }
+
+        return as_put_ref(ctx, src->sym, 0, 2, false, 0);
+    }
+
+    if (src->kind == OPND_REG && (dst->kind == OPND_REG || dst->kind == OPND_MEM)) {
+        op = (size == 1) ? 0x88 : 0x89;
+        return as_encode(ctx, size, &op, 1, as_regf(src), dst, 0, 0);
+    }
+
+    if (dst->kind == OPND_REG && src->kind == OPND_MEM) {
+        op = (size == 1) ? 0x8A : 0x8B;
+        return as_encode(ctx, size, &op, 1, as_regf(dst), src, 0, 0);
+    }
+
+    if (src->kind != OPND_IMM || (dst->kind != OPND_REG && dst->kind != OPND_MEM)) {
+        return as_unsupported();
+    }
+
+    if (dst->kind == OPND_MEM) {
+        if (!as_fits(src->imm, size) || (size == 8 && !as_fits_signed(src->imm, 4))) {
+            return as_unsupported();
+        }
+
+        op = (size == 1) ? 0xC6 : 0xC7;
+        return as_encode(ctx, size, &op, 1, 0, dst, src->imm, size == 8 ? 4 : size);
+    }
+
+    /*
+     * A 64-bit move of a value that zero extends from 32
+     * bits becomes a 32-bit move, one that sign extends
+     * uses C7 and anything else needs the full immediate.
+     */
+    if (size == 8 && src->imm >= 0 && src->imm <= UINT32_MAX) {
+        size = 4;
+    } else if (size == 8 && as_fits_signed(src->imm, 4)) {
+        op = 0xC7;
+        return as_encode(ctx, 8, &op, 1, 0, dst, src->imm, 4);
+    } else if (!as_fits(src->imm, size)) {
+        return as_unsupported();
+    }
+
+    op = ((size == 1) ? 0xB0 : 0xB8) | (dst->reg & 7);
+    return as_encode_opreg(ctx, size, op, dst, src->imm, size);
+}
+
+/*
+ * Encode an arithmetic instruction (add, or, adc, sbb,
+ * and, sub, xor, cmp)
+ *
+ * @ctx: Assembler state
+ * @ext: Opcode extension, also selects the opcode row
+ * @dst: Destination operand
+ * @src: Source operand
+ *
+ * Returns zero on success
+ */
+static int
+as_alu(struct as_ctx *ctx, uint8_t ext, const struct as_opnd *dst,
+    const struct as_opnd *src)
+{
+    uint8_t size, op, imm_len;
+    bool acc;
+    int64_t imm;
+
+    if ((size = as_opsize(dst, src)) == 0) {
+        return as_unsupported();
+    }
+
+    if (src->kind == OPND_REG && (dst->kind == OPND_REG || dst->kind == OPND_MEM)) {
+        op = ext * 8 + (size == 1 ? 0 : 1);
+        return as_encode(ctx, size, &op, 1, as_regf(src), dst, 0, 0);
+    }
+
+    if (dst->kind == OPND_REG && src->kind == OPND_MEM) {
+        op = ext * 8 + (size == 1 ? 2 : 3);
+        return as_encode(ctx, size, &op, 1, as_regf(dst), src, 0, 0);
+    }
+
+    if (src->kind != OPND_IMM || (dst->kind != OPND_REG && dst->kind != OPND_MEM)) {
+        return as_unsupported();
+    }
+
+    if (!as_fits(src->imm, size) || (size == 8 && !as_fits_signed(src->imm, 4))) {
+        return as_unsupported();
+    }
+
+    /*
+     * Pick the shortest form: a sign extended byte, then
+     * the short accumulator form, then a full immediate.
+     */
+    imm = as_wrap(src->imm, size);
+    acc = dst->kind == OPND_REG && dst->reg == 0;
+    imm_len = (size == 2) ? 2 : 4;
+    if (size == 1 && acc) {
+        op = ext * 8 + 4;
+        return as_encode(ctx, 1, &op, 1, 0, NULL, imm, 1);
+    }
+
+    if (size == 1) {
+        op = 0x80;
+        return as_encode(ctx, 1, &op, 1, ext, dst, imm, 1);
+    }
+
+    if (as_fits_signed(imm, 1)) {
+        op = 0x83;
+        return as_encode(ctx, size, &op, 1, ext, dst, imm, 1);
+    }
+
+    if (acc) {
+        op = ext * 8 + 5;
+        return as_encode(ctx, size, &op, 1, 0, NULL, imm, imm_len);
+    }
+
+    op = 0x81;
+    return as_encode(ctx, size, &op, 1, ext, dst, imm, imm_len);
+}
+
+/*
+ * Encode a test instruction
+ *
+ * @ctx: Assembler state
+ * @dst: Destination operand
+ * @src: Source operand
+ *
+ * Returns zero on success
+ */
+static int
+as_test(struct as_ctx *ctx, const struct as_opnd *dst, const struct as_opnd *src)
+{
+    const struct as_opnd *tmp;
+    uint8_t size, op, imm_len;
+    int64_t imm;
+
+    if ((size = as_opsize(dst, src)) == 0) {
+        return as_unsupported();
+    }
+
+    /* The operands of test commute */
+    if (dst->kind == OPND_REG && src->kind == OPND_MEM) {
+        tmp = dst;
+        dst = src;
+        src = tmp;
+    }
+
+    if (src->kind == OPND_REG && (dst->kind == OPND_REG || dst->kind == OPND_MEM)) {
+        op = (size == 1) ? 0x84 : 0x85;
+        return as_encode(ctx, size, &op, 1, as_regf(src), dst, 0, 0);
+    }
+
+    if (src->kind != OPND_IMM || (dst->kind != OPND_REG && dst->kind != OPND_MEM)) {
+        return as_unsupported();
+    }
+
+    if (!as_fits(src->imm, size) || (size == 8 && !as_fits_signed(src->imm, 4))) {
+        return as_unsupported();
+    }
+
+    imm = as_wrap(src->imm, size);
+    imm_len = (size == 1 || size == 2) ? size : 4;
+    if (dst->kind == OPND_REG && dst->reg == 0) {
+        op = (size == 1) ? 0xA8 : 0xA9;
+        return as_encode(ctx, size, &op, 1, 0, NULL, imm, imm_len);
+    }
+
+    op = (size == 1) ? 0xF6 : 0xF7;
+    return as_encode(ctx, size, &op, 1, 0, dst, imm, imm_len);
+}
+
+/*
+ * Encode a shift by an immediate or by cl, a shift by one
+ * has a form of its own without the immediate as nasm and
+ * GNU as pick.
+ *
+ * @ctx: Assembler state
+ * @ext: Opcode extension
+ * @dst: Destination operand
+ * @src: Count operand
+ *
+ * Returns zero on success
+ */
+static int
+as_shift(struct as_ctx *ctx, uint8_t ext, const struct as_opnd *dst,
+    const struct as_opnd *src)
+{
+    uint8_t op;
+
+    if ((dst->kind != OPND_REG && dst->kind != OPND_MEM) || dst->size == 0) {
+        return as_unsupported();
+    }
+
+    if (src->kind == OPND_REG && src->size == 1 && src->reg == 1 && !src->high) {
+        op = (dst->size == 1) ? 0xD2 : 0xD3;
+        return as_encode(ctx, dst->size, &op, 1, ext, dst, 0, 0);
+    }
+
+    if (src->kind != OPND_IMM || src->imm < 0 || src->imm > 255) {
+        return as_unsupported();
+    }
+
+    if (src->imm == 1) {
+        op = (dst->size == 1) ? 0xD0 : 0xD1;
+        return as_encode(ctx, dst->size, &op, 1, ext, dst, 0, 0);
+    }
+
+    op = (dst->size == 1) ? 0xC0 : 0xC1;
+    return as_encode(ctx, dst->size, &op, 1, ext, dst, src->imm, 1);
+}
+
+/*
+ * Encode a movzx or a two operand imul, both load their
+ * register operand from a register or memory.
+ *
+ * @ctx: Assembler state
+ * @op: Second opcode byte, after 0x0F
+ * @dst: Destination register
+ * @src: Source operand
+ *
+ * Returns zero on success
+ */
+static int
+as_load0f(struct as_ctx *ctx, uint8_t op, const struct as_opnd *dst,
+    const struct as_opnd *src)
+{
+    uint8_t ops[2] = { 0x0F, op };
+
+    if (dst->kind != OPND_REG || dst->size < 2) {
+        return as_unsupported();
+    }
+
+    if (src->kind != OPND_REG && src->kind != OPND_MEM) {
+        return as_unsupported();
+    }
+
+    /* movzx widens a byte or a word, imul keeps the size */
+    if (op == 0xAF) {
+        if (as_opsize(dst, src) == 0) {
+            return as_unsupported();
+        }
+    } else if (src->size != 1 && src->size != 2) {
+        return as_unsupported();
+    } else if (src->size >= dst->size) {
+        return as_unsupported();
+    } else {
+        ops[1] |= (src->size == 2) ? 1 : 0;
+    }
+
+    return as_encode(ctx, dst->size, ops, 2, as_regf(dst), src, 0, 0);
+}
+
+/*
+ * Encode a two operand imul by an immediate, the short
+ * form of the three operand one with the register as
+ * both source and destination.
+ *
+ * @ctx: Assembler state
+ * @dst: Destination register
+ * @src: Immediate
+ *
+ * Returns zero on success
+ */
+static int
+as_imul_imm(struct as_ctx *ctx, const struct as_opnd *dst,
+    const struct as_opnd *src)
+{
+    uint8_t op, imm_len;
+    int64_t imm;
+
+    if (dst->kind != OPND_REG || dst->size < 2) {
+        return as_unsupported();
+    }
+
+    if (!as_fits(src->imm, dst->size) ||
+        (dst->size == 8 && !as_fits_signed(src->imm, 4))) {
+        return as_unsupported();
+    }
+
+    imm = as_wrap(src->imm, dst->size);
+    if (as_fits_signed(imm, 1)) {
+        op = 0x6B;
+        return as_encode(ctx, dst->size, &op, 1, as_regf(dst), dst, imm, 1);
+    }
+
+    op = 0x69;
+    imm_len = (dst->size == 2) ? 2 : 4;
+    return as_encode(ctx, dst->size, &op, 1, as_regf(dst), dst, imm, imm_len);
+}
+
+/*
+ * End the current fragment with a branch
+ *
+ * @ctx: Assembler state
+ * @br: Branch kind (AS_BR_*)
+ * @cc: Condition code of AS_BR_JCC
+ * @sym: Branch target
+ *
+ * Returns zero on success
+ */
+static int
+as_branch(struct as_ctx *ctx, uint8_t br, uint8_t cc, uint32_t sym)
+{
+    struct as_frag *frag = as_frag(ctx);
+
+    frag->br = br;
+    frag->cc = cc;
+    frag->sym = sym;
+    frag->code16 = ctx->bits == 16;
+    return as_frag_new(ctx);
+}
+
+/*
+ * Encode an instruction
+ *
+ * @ctx: Assembler state
+ * @s: Mnemonic
+ * @len: Length of mnemonic
+ * @line: Line being parsed, after the mnemonic
+ *
+ * Returns zero on success
+ */
+static int
+as_insn(struct as_ctx *ctx, const char *s, size_t len, struct as_line *line)
+{
+    struct as_opnd opnd[AS_MAX_OPND];
+    const struct as_opnd *dst = &opnd[0], *src = &opnd[1];
+    size_t i, count = 0;
+    uint8_t op, word, code[2];
+
+    if (ctx->sect == SECTION_BSS) {
+        return as_unsupported();
+    }
+
+    if (!as_at_end(line)) {
+        do {
+            if (count == AS_MAX_OPND) {
+                return as_unsupported();
+            }
+
+            if (as_operand(ctx, line, &opnd[count++]) < 0) {
+                return -1;
+            }
+        } while (as_accept(line, ','));
+
+        if (!as_at_end(line)) {
+            return as_unsupported();
+        }
+    }
+
+    if (count == 0) {
+        for (i = 0; i < sizeof(plaintab) / sizeof(plaintab[0]); ++i) {
+            if (!as_eq(s, len, plaintab[i].name)) {
+                continue;
+            }
+
+            if (plaintab[i].long_only && ctx->bits != 64) {
+                return as_unsupported();
+            }
+
+            as_put(ctx, plaintab[i].op, plaintab[i].len);
+            return 0;
+        }
+
+        return as_unsupported();
+    }
+
+    if (count == 2) {
+        if (as_eq(s, len, "mov")) {
+            return as_mov(ctx, dst, src);
+        }
+
+        for (i = 0; i < sizeof(alutab) / sizeof(alutab[0]); ++i) {
+            if (as_eq(s, len, alutab[i])) {
+                return as_alu(ctx, i, dst, src);
+            }
+        }
+
+        if (as_eq(s, len, "test")) {
+            return as_test(ctx, dst, src);
+        }
+
+        if (as_eq(s, len, "movzx")) {
+            return as_load0f(ctx, 0xB6, dst, src);
+        }
+
+        if (as_eq(s, len, "imul") && src->kind == OPND_IMM) {
+            return as_imul_imm(ctx, dst, src);
+        }
+
+        if (as_eq(s, len, "imul")) {
+            return as_load0f(ctx, 0xAF, dst, src);
+        }
+
+        for (i = 0; i < sizeof(shifttab) / sizeof(shifttab[0]); ++i) {
+            if (as_eq(s, len, shifttab[i].name)) {
+                return as_shift(ctx, shifttab[i].ext, dst, src);
+            }
+        }
+
+        if (as_eq(s, len, "lea")) {
+            if (dst->kind != OPND_REG || src->kind != OPND_MEM || dst->size == 1) {
+                return as_unsupported();
+            }
+
+            if (src->size != 0) {
+                return as_unsupported();
+            }
+
+            op = 0x8D;
+            return as_encode(ctx, dst->size, &op, 1, as_regf(dst), src, 0, 0);
+        }
+
+        return as_unsupported();
+    }
+
+    /* Near calls, pushes and pops take the natural word size */
+    word = (ctx->bits == 16) ? 2 : 8;
+    if (as_eq(s, len, "call") || as_eq(s, len, "jmp")) {
+        if (dst->kind == OPND_REG && dst->size == word) {
+            op = 0xFF;
+            return as_encode(ctx, 0, &op, 1, s[0] == 'c' ? 2 : 4, dst, 0, 0);
+        }
+
+        if (dst->kind == OPND_FAR) {
+            if (ctx->bits != 16) {
+                return as_unsupported();
+            }
+
+            as_put(ctx, s[0] == 'c' ? "\x9A" : "\xEA", 1);
+            if (as_put_ref(ctx, dst->sym, 0, 2, false, 0) < 0) {
+                return -1;
+            }
+
+            as_put_le(ctx, dst->imm, 2);
+            return 0;
+        }
+
+        if (dst->kind != OPND_SYM) {
+            return as_unsupported();
+        }
+
+        if (s[0] == 'j') {
+            return as_branch(ctx, AS_BR_JMP, 0, dst->sym);
+        }
+
+        as_put(ctx, "\xE8", 1);
+        return as_put_ref(ctx, dst->sym, 0, as_relsize(ctx), true, 0);
+    }
+
+    if (s[0] == 'j') {
+        for (i = 0; i < sizeof(jcctab) / sizeof(jcctab[0]); ++i) {
+            if (!as_eq(s, len, jcctab[i].name)) {
+                continue;
+            }
+
+            if (dst->kind != OPND_SYM) {
+                return as_unsupported();
+            }
+
+            return as_branch(ctx, AS_BR_JCC, jcctab[i].cc, dst->sym);
+        }
+
+        return as_unsupported();
+    }
+
+    /* setcc shares its condition names with the jumps */
+    if (len > 3 && s[0] == 's' && s[1] == 'e' && s[2] == 't') {
+        for (i = 0; i < sizeof(jcctab) / sizeof(jcctab[0]); ++i) {
+            if (!as_eq(s + 3, len - 3, jcctab[i].name + 1)) {
+                continue;
+            }
+
+            if ((dst->kind != OPND_REG && dst->kind != OPND_MEM) ||
+                dst->size != 1) {
+                return as_unsupported();
+            }
+
+            code[0] = 0x0F;
+            code[1] = 0x90 | jcctab[i].cc;
+            return as_encode(ctx, 0, code, 2, 0, dst, 0, 0);
+        }
+    }
+
+    if (as_eq(s, len, "push") || as_eq(s, len, "pop")) {
+        if (dst->kind == OPND_REG && dst->size == word) {
+            op = ((s[1] == 'u') ? 0x50 : 0x58) | (dst->reg & 7);
+            return as_encode_opreg(ctx, 0, op, dst, 0, 0);
+        }
+
+        if (s[1] != 'u' || dst->kind != OPND_IMM ||
+            !as_fits_signed(dst->imm, as_relsize(ctx))) {
+            return as_unsupported();
+        }
+
+        if (as_fits_signed(dst->imm, 1)) {
+            as_put(ctx, "\x6A", 1);
+            as_put_le(ctx, dst->imm, 1);
+        } else {
+            as_put(ctx, "\x68", 1);
+            as_put_le(ctx, dst->imm, as_relsize(ctx));
+        }
+
+        return 0;
+    }
+
+    if (as_eq(s, len, "int")) {
+        if (dst->kind != OPND_IMM || dst->imm < 0 || dst->imm > 255) {
+            return as_unsupported();
+        }
+
+        as_put(ctx, "\xCD", 1);
+        as_put_le(ctx, dst->imm, 1);
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(unarytab) / sizeof(unarytab[0]); ++i) {
+        if (!as_eq(s, len, unarytab[i].name)) {
+            continue;
+        }
+
+        if ((dst->kind != OPND_REG && dst->kind != OPND_MEM) || dst->size == 0) {
+            return as_unsupported();
+        }
+
+        /* 16-bit code still has the one byte inc and dec */
+        if (ctx->bits == 16 && dst->kind == OPND_REG && dst->size != 1 &&
+            unarytab[i].op == 0xFE) {
+            op = 0x40 | unarytab[i].ext << 3 | (dst->reg & 7);
+            return as_encode_opreg(ctx, dst->size, op, dst, 0, 0);
+        }
+
+        op = unarytab[i].op + (dst->size == 1 ? 0 : 1);
+        return as_encode(ctx, dst->size, &op, 1, unarytab[i].ext, dst, 0, 0);
+    }
+
+    return as_unsupported();
+}
+
+/*
+ * Emit a data directive (db, dw, dd, dq)
+ *
+ * @ctx: Assembler state
+ * @size: Size of each item in bytes
+ * @line: Line being parsed, after the directive
+ *
+ * Returns zero on success
+ */
+static int
+as_data(struct as_ctx *ctx, uint8_t size, struct as_line *line)
+{
+    const char *start;
+    int64_t v;
+    char quote;
+
+    /* nasm ignores initialized data in .bss */
+    if (ctx->sect == SECTION_BSS) {
+        return as_unsupported();
+    }
+
+    do {
+        as_skip(line);
+        if (size == 1 && line->p < line->end &&
+            (*line->p == '"' || *line->p == '\'')) {
+            quote = *line->p++;
+            start = line->p;
+            while (line->p < line->end && *line->p != quote) {
+                ++line->p;
+            }
+
+            if (line->p == line->end) {
+                return as_unsupported();
+            }
+
+            as_put(ctx, start, line->p++ - start);
+            continue;
+        }
+
+        if (as_number(line, &v) < 0) {
+            return -1;
+        }
+
+        if (!as_fits(v, size)) {
+            return as_unsupported();
+        }
+
+        as_put_le(ctx, v, size);
+    } while (as_accept(line, ','));
+
+    return as_at_end(line) ? 0 : as_unsupported();
+}
+
+/*
+ * Reserve space (resb, resw, resd, resq)
+ *
+ * @ctx: Assembler state
+ * @size: Size of each item in bytes
+ * @line: Line being parsed, after the directive
+ *
+ * Returns zero on success
+ */
+static int
+as_res(struct as_ctx *ctx, uint8_t size, struct as_line *line)
+{
+    int64_t count;
+
+    /* nasm zero fills outside of .bss, leave that to it */
+    if (ctx->sect != SECTION_BSS) {
+        return as_unsupported();
+    }
+
+    if (as_number(line, &count) < 0) {
+        return -1;
+    }
+
+    if (count < 0 || count > INT32_MAX || !as_at_end(line)) {
+        return as_unsupported();
+    }
+
+    ctx->sects[SECTION_BSS].size += (uint64_t)count * size;
+    return 0;
+}
+
+/*
+ * Handle an assembler directive (section, global, bits, org)
+ *
+ * @ctx: Assembler state
+ * @s: Directive
+ * @len: Length of directive
+ * @line: Line being parsed, after the directive
+ *
+ * Returns zero on success
+ */
+static int
+as_directive(struct as_ctx *ctx, const char *s, size_t len, struct as_line *line)
+{
+    const char *name;
+    bin_section_t i;
+    size_t name_len;
+    uint32_t sym;
+    int64_t v;
+
+    if (as_eq(s, len, "section") || as_eq(s, len, "segment")) {
+        if ((name_len = as_ident(line, &name)) == 0 || !as_at_end(line)) {
+            return as_unsupported();
+        }
+
+        for (i = SECTION_TEXT; i < SECTION_MAX; ++i) {
+            if (!as_eq(name, name_len, sectnames[i])) {
+                continue;
+            }
+
+            if (ctx->sects[i].used) {
+                ctx->sect = i;
+                return 0;
+            }
+
+            ctx->order[ctx->order_count++] = i;
+            ctx->sects[i].used = 1;
+            ctx->sect = i;
+            return 0;
+        }
+
+        return as_unsupported();
+    }
+
+    if (as_eq(s, len, "global")) {
+        do {
+            if ((name_len = as_ident(line, &name)) == 0) {
+                return as_unsupported();
+            }
+
+            if (as_sym(ctx, name, name_len, &sym) < 0) {
+                return -1;
+            }
+
+            ctx->syms[sym].global = 1;
+        } while (as_accept(line, ','));
+
+        return as_at_end(line) ? 0 : as_unsupported();
+    }
+
+    /* Objects only take 64-bit code */
+    if (as_eq(s, len, "bits")) {
+        if (as_number(line, &v) < 0) {
+            return -1;
+        }
+
+        if (!as_at_end(line) || (v != 64 && v != 16)) {
+            return as_unsupported();
+        }
+
+        if (v == 16 && ctx->fmt == MU_OUT_ELF64) {
+            return as_unsupported();
+        }
+
+        ctx->bits = v;
+        return 0;
+    }
+
+    /* nasm rejects more than one origin, let it say so */
+    if (as_eq(s, len, "org")) {
+        if (as_number(line, &v) < 0) {
+            return -1;
+        }
+
+        if (!as_at_end(line) || v < 0 || v > UINT32_MAX) {
+            return as_unsupported();
+        }
+
+        if (ctx->fmt == MU_OUT_ELF64 || ctx->has_org) {
+            return as_unsupported();
+        }
+
+        ctx->org = v;
+        ctx->has_org = true;
+        return 0;
+    }
+
+    return as_unsupported();
+}
+
+/*
+ * Define a label at the current position
+ *
+ * @ctx: Assembler state
+ * @s: Label name
+ * @len: Length of label name
+ *
+ * Returns zero on success
+ */
+static int
+as_label(struct as_ctx *ctx, const char *s, size_t len)
+{
+    struct as_section *sect = &ctx->sects[ctx->sect];
+    struct as_sym *sym;
+    uint32_t idx;
+
+    if (as_reg(s, len) != NULL || as_sreg(s, len) >= 0) {
+        return as_unsupported();
+    }
+
+    if (as_sym(ctx, s, len, &idx) < 0) {
+        return -1;
+    }
+
+    /* Let nasm report redefinitions */
+    sym = &ctx->syms[idx];
+    if (sym->defined) {
+        return as_unsupported();
+    }
+
+    sym->defined = 1;
+    sym->sect = ctx->sect;
+    sym->frag = sect->frag_count - 1;
+    sym->off = (ctx->sect == SECTION_BSS) ? sect->size : as_frag(ctx)->len;
+    if (s[0] != '.') {
+        ctx->scope = sym->name;
+        ctx->scope_len = sym->len;
+    }
+
+    return 0;
+}
+
+/*
+ * Assemble a single line
+ *
+ * @ctx: Assembler state
+ * @p: Start of the line
+ * @end: End of the line
+ *
+ * Returns zero on success
+ */
+static int
+as_stmt(struct as_ctx *ctx, const char *p, const char *end)
+{
+    struct as_line line;
+    const char *s, *q;
+    size_t len;
+    uint8_t size;
+    char quote = 0;
+
+    /* Drop the comment, if any */
+    for (q = p; q < end; ++q) {
+        if (quote != 0) {
+            quote = (*q == quote) ? 0 : quote;
+        } else if (*q == '"' || *q == '\'' || *q == '`') {
+            quote = *q;
+        } else if (*q == ';') {
+            break;
+        }
+    }
+
+    line.p = p;
+    line.end = q;
+    if (as_at_end(&line)) {
+        return 0;
+    }
+
+    /* [directive ...] */
+    if (as_accept(&line, '[')) {
+        while (line.end > line.p && (line.end[-1] == ' ' || line.end[-1] == '\t')) {
+            --line.end;
+        }
+
+        if (line.end == line.p || line.end[-1] != ']') {
+            return as_unsupported();
+        }
+
+        --line.end;
+        if ((len = as_ident(&line, &s)) == 0) {
+            return as_unsupported();
+        }
+
+        return as_directive(ctx, s, len, &line);
+    }
+
+    if ((len = as_ident(&line, &s)) == 0) {
+        return as_unsupported();
+    }
+
+    if (as_accept(&line, ':')) {
+        if (as_label(ctx, s, len) < 0) {
+            return -1;
+        }
+
+        if (as_at_end(&line)) {
+            return 0;
+        }
+
+        if ((len = as_ident(&line, &s)) == 0) {
+            return as_unsupported();
+        }
+    }
+
+    if (len == 2 && s[0] == 'd') {
+        size = (s[1] == 'b') ? 1 : (s[1] == 'w') ? 2 :
+            (s[1] == 'd') ? 4 : (s[1] == 'q') ? 8 : 0;
+        if (size != 0) {
+            return as_data(ctx, size, &line);
+        }
+    }
+
+    if (len == 4 && strncmp(s, "res", 3) == 0) {
+        size = (s[3] == 'b') ? 1 : (s[3] == 'w') ? 2 :
+            (s[3] == 'd') ? 4 : (s[3] == 'q') ? 8 : 0;
+        if (size != 0) {
+            return as_res(ctx, size, &line);
+        }
+    }
+
+    if (as_eq(s, len, "section") || as_eq(s, len, "segment") ||
+        as_eq(s, len, "global") || as_eq(s, len, "bits") ||
+        as_eq(s, len, "org")) {
+        return as_directive(ctx, s, len, &line);
+    }
+
+    return as_insn(ctx, s, len, &line);
+}
+
+/*
+ * Lay out the fragments of a section
+ *
+ * @sect: Section to lay out
+ */
+static void
+as_layout(struct as_section *sect)
+{
+    struct as_frag *frag;
+    uint64_t addr = 0;
+
+    for (frag = sect->frags; frag < &sect->frags[sect->frag_count]; ++frag) {
+        frag->addr = addr;
+        addr += frag->len;
+        if (frag->br == AS_BR_NONE) {
+            continue;
+        }
+
+        if (!frag->is_long) {
+            addr += 2;
+        } else {
+            addr += (frag->br == AS_BR_JMP) ? 1 : 2;
+            addr += frag->code16 ? 2 : 4;
+        }
+    }
+
+    sect->size = addr;
+}
+
+/*
+ * Get the offset of a symbol within its section
+ *
+ * @ctx: Assembler state
+ * @sym: Symbol
+ */
+static inline uint64_t
+as_sym_value(struct as_ctx *ctx, const struct as_sym *sym)
+{
+    if (sym->sect == SECTION_BSS) {
+        return sym->off;
+    }
+
+    return ctx->sects[sym->sect].frags[sym->frag].addr + sym->off;
+}
+
+/*
+ * Get the address of a symbol, its offset within its
+ * section for objects
+ *
+ * @ctx: Assembler state
+ * @sym: Symbol
+ */
+static inline uint64_t
+as_sym_addr(struct as_ctx *ctx, const struct as_sym *sym)
+{
+    return ctx->base[sym->sect] + as_sym_value(ctx, sym);
+}
+
+/*
+ * Pick the size of every branch. Branches start short
+ * and only ever grow until all of them reach, which is
+ * how nasm sizes jumps as well.
+ *
+ * @ctx: Assembler state
+ */
+static void
+as_relax(struct as_ctx *ctx)
+{
+    struct as_section *sect;
+    struct as_frag *frag;
+    struct as_sym *sym;
+    bin_section_t i;
+    bool changed;
+    int64_t disp;
+
+    for (i = SECTION_TEXT; i < SECTION_MAX; ++i) {
+        sect = &ctx->sects[i];
+        for (frag = sect->frags; frag < &sect->frags[sect->frag_count]; ++frag) {
+            if (frag->br != AS_BR_NONE && ctx->syms[frag->sym].sect != i) {
+                frag->is_long = 1;
+            }
+        }
+    }
+
+    do {
+        changed = false;
+        for (i = SECTION_TEXT; i < SECTION_MAX; ++i) {
+            if (i != SECTION_BSS) {
+                as_layout(&ctx->sects[i]);
+            }
+        }
+
+        for (i = SECTION_TEXT; i < SECTION_MAX; ++i) {
+            sect = &ctx->sects[i];
+            for (frag = sect->frags; frag < &sect->frags[sect->frag_count]; ++frag) {
+                if (frag->br == AS_BR_NONE || frag->is_long) {
+                    continue;
+                }
+
+                sym = &ctx->syms[frag->sym];
+                disp = as_sym_value(ctx, sym) - (frag->addr + frag->len + 2);
+                if (!as_fits_signed(disp, 1)) {
+                    frag->is_long = 1;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+}
+
+/*
+ * Give every section of a flat binary its address. Like
+ * nasm, .text starts at the origin, the other sections
+ * follow aligned in the order they were first used and
+ * .bss comes last.
+ *
+ * @ctx: Assembler state
+ */
+static void
+as_place(struct as_ctx *ctx)
+{
+    uint64_t addr = ctx->org;
+    bin_section_t i;
+    size_t j;
+
+    if (ctx->fmt == MU_OUT_ELF64) {
+        return;
+    }
+
+    for (j = 0; j < ctx->order_count; ++j) {
+        i = ctx->order[j];
+        if (i == SECTION_BSS) {
+            continue;
+        }
+
+        if (i != SECTION_TEXT && ctx->sects[i].size > 0) {
+            addr = (addr + AS_BIN_ALIGN - 1) & ~(uint64_t)(AS_BIN_ALIGN - 1);
+        }
+
+        ctx->base[i] = addr;
+        addr += ctx->sects[i].size;
+    }
+
+    /* Boot sectors are loaded whole, signature and all */
+    if (ctx->fmt == MU_OUT_BOOT && addr < ctx->org + AS_BOOT_SIZE) {
+        addr = ctx->org + AS_BOOT_SIZE;
+    }
+
+    addr = (addr + AS_BIN_ALIGN - 1) & ~(uint64_t)(AS_BIN_ALIGN - 1);
+    ctx->base[SECTION_BSS] = addr;
+}
+
+/*
+ * Resolve a field holding the address of a symbol, or
+ * leave a relocation for the linker when the symbol is
+ * in another section of an object.
+ *
+ * @ctx: Assembler state
+ * @sect: Section of the field
+ * @pos: Offset of the field within its section
+ * @sym: Symbol referenced
+ * @addend: Offset from the symbol
+ * @width: Size of the field in bytes
+ * @pcrel: Field is relative to the end of the instruction
+ * @tail: Bytes between the field and the end of the instruction
+ *
+ * Returns zero on success
+ */
+static int
+as_resolve(struct as_ctx *ctx, bin_section_t sect, uint64_t pos, uint32_t sym,
+    int64_t addend, uint8_t width, bool pcrel, uint8_t tail)
+{
+    struct as_section *s = &ctx->sects[sect];
+    struct elf_rela *rela;
+    int64_t v;
+    size_t i;
+
+    /* Objects only ever hold 32-bit PC relative fields */
+    if (ctx->fmt == MU_OUT_ELF64 && (width != 4 || !pcrel)) {
+        return as_unsupported();
+    }
+
+    if (ctx->syms[sym].sect == sect || ctx->fmt != MU_OUT_ELF64) {
+        v = as_sym_addr(ctx, &ctx->syms[sym]) + addend;
+        if (pcrel) {
+            v -= ctx->base[sect] + pos + width + tail;
+        }
+
+        /* Absolute addresses are never negative */
+        if (pcrel ? !as_fits_signed(v, width) :
+            (v < 0 || (uint64_t)v >> (width * 8) != 0)) {
+            return as_unsupported();
+        }
+
+        for (i = 0; i < width; ++i) {
+            s->image.buf[pos + i] = (uint64_t)v >> (i * 8);
+        }
+
+        return 0;
+    }
+
+    if (as_reserve((void **)&s->rela, s->rela_count, &s->rela_cap,
+        sizeof(*s->rela)) < 0) {
+        return -1;
+    }
+
+    rela = &s->rela[s->rela_count++];
+    rela->offset = pos;
+    rela->symbol = sym;
+    rela->type = R_X86_64_PC32;
+    rela->addend = addend - 4 - tail;
+    return 0;
+}
+
+/*
+ * Produce the final contents of every section
+ *
+ * @ctx: Assembler state
+ *
+ * Returns zero on success
+ */
+static int
+as_emit(struct as_ctx *ctx)
+{
+    struct as_section *sect;
+    struct as_frag *frag;
+    struct as_fixup *fixup;
+    bin_section_t i;
+    uint64_t pos;
+    uint8_t br[2], width;
+    int64_t disp;
+
+    for (i = SECTION_TEXT; i < SECTION_MAX; ++i) {
+        sect = &ctx->sects[i];
+        if (i == SECTION_BSS) {
+            continue;
+        }
+
+        for (frag = sect->frags; frag < &sect->frags[sect->frag_count]; ++frag) {
+            if (frag->len > 0) {
+                outbuf_putn(&sect->image, &sect->code.buf[frag->start], frag->len);
+            }
+
+            if (frag->br == AS_BR_NONE) {
+                continue;
+            }
+
+            pos = frag->addr + frag->len;
+            if (!frag->is_long) {
+                disp = as_sym_value(ctx, &ctx->syms[frag->sym]) - (pos + 2);
+                br[0] = (frag->br == AS_BR_JMP) ? 0xEB : 0x70 | frag->cc;
+                br[1] = disp;
+                outbuf_putn(&sect->image, (const char *)br, 2);
+                continue;
+            }
+
+            if (frag->br == AS_BR_JMP) {
+                outbuf_lit(&sect->image, "\xE9");
+                pos += 1;
+            } else {
+                br[0] = 0x0F;
+                br[1] = 0x80 | frag->cc;
+                outbuf_putn(&sect->image, (const char *)br, 2);
+                pos += 2;
+            }
+
+            width = frag->code16 ? 2 : 4;
+            outbuf_putn(&sect->image, "\0\0\0\0", width);
+            if (sect->image.error) {
+                errno = -ENOMEM;
+                return -1;
+            }
+
+            if (as_resolve(ctx, i, pos, frag->sym, 0, width, true, 0) < 0) {
+                return -1;
+            }
+        }
+
+        if (sect->image.error || sect->code.error) {
+            errno = -ENOMEM;
+            return -1;
+        }
+    }
+
+    for (fixup = ctx->fixups; fixup < &ctx->fixups[ctx->fixup_count]; ++fixup) {
+        sect = &ctx->sects[fixup->sect];
+        pos = sect->frags[fixup->frag].addr + fixup->off;
+        if (as_resolve(ctx, fixup->sect, pos, fixup->sym, fixup->addend,
+            fixup->width, fixup->pcrel, fixup->tail) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Write the assembled program as an ELF64 object
+ *
+ * @ctx: Assembler state
+ * @fd: File descriptor to write to
+ *
+ * Returns zero on success
+ */
+static int
+as_write(struct as_ctx *ctx, int fd)
+{
+    struct elf_section sections[SECTION_MAX];
+    struct elf_symbol *symbols;
+    struct as_section *sect;
+    struct as_sym *sym;
+    uint32_t elfidx[SECTION_MAX];
+    size_t count = 0, i;
+    bin_section_t j;
+    int error;
+
+    /* Only sections with contents or labels are kept */
+    memset(elfidx, 0, sizeof(elfidx));
+    for (i = 0; i < ctx->sym_count; ++i) {
+        elfidx[ctx->syms[i].sect] = 1;
+    }
+
+    for (j = SECTION_TEXT; j < SECTION_MAX; ++j) {
+        sect = &ctx->sects[j];
+        if (sect->size == 0 && !elfidx[j]) {
+            continue;
+        }
+
+        elfidx[j] = count;
+        memset(&sections[count], 0, sizeof(sections[count]));
+        sections[count].name = sectnames[j];
+        sections[count].type = (j == SECTION_BSS) ? SHT_NOBITS : SHT_PROGBITS;
+        sections[count].align = (j == SECTION_TEXT) ? 16 : 4;
+        sections[count].data = sect->image.buf;
+        sections[count].size = sect->size;
+        sections[count].rela = sect->rela;
+        sections[count].rela_count = sect->rela_count;
+        switch (j) {
+        case SECTION_TEXT:
+            sections[count].flags = SHF_ALLOC | SHF_EXECINSTR;
+            break;
+        case SECTION_DATA:
+        case SECTION_BSS:
+            sections[count].flags = SHF_ALLOC | SHF_WRITE;
+            break;
+        default:
+            sections[count].flags = SHF_ALLOC;
+            break;
+        }
+
+        ++count;
+    }
+
+    symbols = calloc(ctx->sym_count + 1, sizeof(*symbols));
+    if (symbols == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < ctx->sym_count; ++i) {
+        sym = &ctx->syms[i];
+        symbols[i].name = sym->name;
+        symbols[i].name_len = sym->len;
+        symbols[i].section = elfidx[sym->sect];
+        symbols[i].value = as_sym_value(ctx, sym);
+        symbols[i].global = sym->global;
+    }
+
+    error = elf64_write_rel(
+        fd, DEFAULT_ASMOUT, EM_X86_64,
+        sections, count,
+        symbols, ctx->sym_count
+    );
+
+    free(symbols);
+    return error;
+}
+
+/*
+ * Pad a flat binary out to a boot sector and sign it,
+ * images that already end in the signature are kept.
+ *
+ * @image: Image to seal
+ *
+ * Returns zero on success, fails with -EFBIG if the image
+ * does not fit.
+ */
+static int
+as_seal_boot(struct outbuf *image)
+{
+    if (image->len == AS_BOOT_SIZE &&
+        memcmp(&image->buf[AS_BOOT_SIZE - 2], "\x55\xAA", 2) == 0) {
+        return 0;
+    }
+
+    if (image->len > AS_BOOT_SIZE - 2) {
+        errno = -EFBIG;
+        return -1;
+    }
+
+    while (image->len < AS_BOOT_SIZE - 2) {
+        outbuf_putc(image, '\0');
+    }
+
+    outbuf_lit(image, "\x55\xAA");
+    if (image->error) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Build the image of a flat binary, every section but
+ * .bss at its address relative to the origin.
+ *
+ * @ctx: Assembler state
+ * @image: Image is written here
+ *
+ * Returns zero on success
+ */
+static int
+as_image(struct as_ctx *ctx, struct outbuf *image)
+{
+    struct as_section *sect;
+    bin_section_t i;
+    size_t j;
+
+    for (j = 0; j < ctx->order_count; ++j) {
+        i = ctx->order[j];
+        sect = &ctx->sects[i];
+        if (i == SECTION_BSS || sect->size == 0) {
+            continue;
+        }
+
+        while (image->len < ctx->base[i] - ctx->org) {
+            outbuf_putc(image, '\0');
+        }
+
+        outbuf_putn(image, sect->image.buf, sect->size);
+    }
+
+    if (image->error) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    if (ctx->fmt == MU_OUT_BOOT) {
+        return as_seal_boot(image);
+    }
+
+    return 0;
+}
+
+/*
+ * Release the assembler state
+ *
+ * @ctx: Assembler state
+ */
+static void
+as_destroy(struct as_ctx *ctx)
+{
+    bin_section_t i;
+
+    for (i = 0; i < SECTION_MAX; ++i) {
+        outbuf_destroy(&ctx->sects[i].code);
+        outbuf_destroy(&ctx->sects[i].image);
+        free(ctx->sects[i].frags);
+        free(ctx->sects[i].rela);
+    }
+
+    arena_destroy(&ctx->names);
+    free(ctx->fixups);
+    free(ctx->slots);
+    free(ctx->syms);
+}
+
+/*
+ * Assemble the buffered output, in the order it would
+ * be written out.
+ *
+ * @ctx: Assembler state
+ *
+ * Returns zero on success
+ */
+static int
+as_run(struct as_ctx *ctx)
+{
+    struct gup_state *state = ctx->state;
+    const char *p, *end, *nl;
+    struct as_sym *sym;
+    bin_section_t i;
+    size_t j;
+
+    for (i = SECTION_TEXT; i < SECTION_MAX; ++i) {
+        ctx->sect = i;
+        outbuf_init(&ctx->sects[i].code);
+        outbuf_init(&ctx->sects[i].image);
+        if (as_frag_new(ctx) < 0) {
+            return -1;
+        }
+    }
+
+    /* nasm starts out in .text */
+    ctx->sect = SECTION_TEXT;
+    ctx->sects[SECTION_TEXT].used = 1;
+    ctx->order[ctx->order_count++] = SECTION_TEXT;
+    for (i = 0; i < SECTION_MAX; ++i) {
+        if (state->out[i].error) {
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        p = state->out[i].buf;
+        end = p + state->out[i].len;
+        while (p < end) {
+            if ((nl = memchr(p, '\n', end - p)) == NULL) {
+                nl = end;
+            }
+
+            if (as_stmt(ctx, p, nl) < 0) {
+                return -1;
+            }
+
+            p = nl + 1;
+        }
+    }
+
+    /* Leave undefined symbols to nasm to report */
+    for (j = 0; j < ctx->sym_count; ++j) {
+        sym = &ctx->syms[j];
+        if (!sym->defined) {
+            return as_unsupported();
+        }
+    }
+
+    as_relax(ctx);
+    as_place(ctx);
+    return as_emit(ctx);
+}
+
+int
+mu_assemble(struct gup_state *state, const char *path, mu_out_t fmt)
+{
+    struct as_ctx ctx;
+    struct outbuf image;
+    int fd, error, saved;
+
+    if (state == NULL || path == NULL || fmt >= MU_OUT_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* nasm assembles flat binaries as 16-bit code by default */
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.state = state;
+    ctx.fmt = fmt;
+    ctx.bits = (fmt == MU_OUT_ELF64) ? 64 : 16;
+    if (arena_init(&ctx.names, 0) < 0) {
+        return -1;
+    }
+
+    /* Nothing is written until the whole output is known */
+    outbuf_init(&image);
+    error = as_run(&ctx);
+    if (error == 0 && fmt != MU_OUT_ELF64) {
+        error = as_image(&ctx, &image);
+    }
+
+    if (error == 0) {
+        if (strcmp(path, "-") == 0) {
+            fd = STDOUT_FILENO;
+        } else {
+            fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+
+        if (fd < 0) {
+            error = -1;
+        } else if (fmt == MU_OUT_ELF64) {
+            error = as_write(&ctx, fd);
+        } else {
+            error = outbuf_flush(&image, fd);
+        }
+
+        if (fd > STDOUT_FILENO) {
+            close(fd);
+        }
+    }
+
+    saved = errno;
+    outbuf_destroy(&image);
+    as_destroy(&ctx);
+    errno = saved;
+    return error;
+}
+
+int
+mu_seal_boot(const char *path)
+{
+    struct outbuf image;
+    ssize_t n;
+    int fd, error = -1, saved;
+
+    if (path == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((fd = open(path, O_RDWR)) < 0) {
+        return -1;
+    }
+
+    /* One byte past a sector is enough to tell it is too large */
+    outbuf_init(&image);
+    if (outbuf_grow(&image, AS_BOOT_SIZE + 1) < 0) {
+        errno = -ENOMEM;
+        goto done;
+    }
+
+    while (image.len <= AS_BOOT_SIZE) {
+        n = read(fd, &image.buf[image.len], AS_BOOT_SIZE + 1 - image.len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            goto done;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        image.len += n;
+    }
+
+    if (as_seal_boot(&image) < 0) {
+        goto done;
+    }
+
+    if (lseek(fd, 0, SEEK_SET) == 0) {
+        error = outbuf_flush(&image, fd);
+    }
+done:
+    saved = errno;
+    outbuf_destroy(&image);
+    close(fd);
+    errno = saved;
+    return error;
+}
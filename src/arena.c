@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "gup/arena.h"
+
+/*
+ * Push a new chunk onto an arena
+ *
+ * @arena: Arena to grow
+ * @size: Minimum number of usable bytes
+ *
+ * Returns the new chunk on success
+ */
+static struct arena_chunk *
+arena_grow(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk;
+
+    if (size < arena->chunk_size) {
+        size = arena->chunk_size;
+    }
+
+    if (size > SIZE_MAX - sizeof(*chunk)) {
+        return NULL;
+    }
+
+    if ((chunk = malloc(sizeof(*chunk) + size)) == NULL) {
+        return NULL;
+    }
+
+    chunk->next = arena->head;
+    chunk->size = size;
+    chunk->used = 0;
+    arena->head = chunk;
+    ++arena->chunk_count;
+    return chunk;
+}
+
+int
+arena_init(struct arena *res, size_t chunk_size)
+{
+    if (res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (chunk_size == 0) {
+        chunk_size = ARENA_CHUNK_SIZE;
+    }
+
+    res->head = NULL;
+    res->chunk_size = chunk_size;
+    res->chunk_count = 0;
+    return 0;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t sz, size_t align)
+{
+    struct arena_chunk *chunk;
+    uintptr_t base, p;
+
+    if (arena == NULL || sz == 0) {
+        return NULL;
+    }
+
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+
+    /*
+     * Chunk data is aligned for any object so only the
+     * offset within the chunk needs aligning.
+     */
+    if ((chunk = arena->head) != NULL) {
+        base = (uintptr_t)chunk->data;
+        p = (base + chunk->used + align - 1) & ~(uintptr_t)(align - 1);
+        if (p - base <= chunk->size && sz <= chunk->size - (p - base)) {
+            chunk->used = p - base + sz;
+            return (void *)p;
+        }
+    }
+
+    if (sz > SIZE_MAX - align) {
+        return NULL;
+    }
+
+    if ((chunk = arena_grow(arena, sz + align)) == NULL) {
+        return NULL;
+    }
+
+    base = (uintptr_t)chunk->data;
+    p = (base + align - 1) & ~(uintptr_t)(align - 1);
+    chunk->used = p - base + sz;
+    return (void *)p;
+}
+
+void
+arena_mark(struct arena *arena, struct arena_mark *res)
+{
+    if (arena == NULL || res == NULL) {
+        return;
+    }
+
+    res->chunk = arena->head;
+    res->used = (arena->head != NULL) ? arena->head->used : 0;
+}
+
+void
+arena_reset(struct arena *arena, const struct arena_mark *mark)
+{
+    struct arena_chunk *chunk, *stop;
+
+    if (arena == NULL) {
+        return;
+    }
+
+    stop = (mark != NULL) ? mark->chunk : NULL;
+    while ((chunk = arena->head) != stop && chunk != NULL) {
+        arena->head = chunk->next;
+        --arena->chunk_count;
+        free(chunk);
+    }
+
+    if (stop != NULL) {
+        stop->used = mark->used;
+    }
+}
+
+void
+arena_destroy(struct arena *arena)
+{
+    arena_reset(arena, NULL);
+}
@@ -26,8 +26,101 @@ int ast_alloc_node(struct gup_state *state, ast_op_t type, struct ast_node **res
 
     memset(node, 0, sizeof(*node));
     node->type = type;
+    node->line = state->line_num;
     if (res != NULL) {
         *res = node;
     }
     return 0;
 }
+
+int
+ast_module_init(struct gup_state *state)
+{
+    struct ast_module *mod;
+
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    mod = ptrbox_alloc(&state->ptrbox, sizeof(*mod));
+    if (mod == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    memset(mod, 0, sizeof(*mod));
+    mod->root.tail = &mod->head;
+    mod->open = &mod->root;
+    state->module = mod;
+    return 0;
+}
+
+int
+ast_module_add(struct gup_state *state, struct ast_node *node)
+{
+    struct ast_module *mod;
+    struct ast_block *block;
+
+    if (state == NULL || node == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((mod = state->module) == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    node->next = NULL;
+    *mod->open->tail = node;
+    mod->open->tail = &node->next;
+    if (!ast_opens_block(node)) {
+        return 0;
+    }
+
+    if ((block = mod->free) != NULL) {
+        mod->free = block->up;
+    } else {
+        block = ptrbox_alloc(&state->ptrbox, sizeof(*block));
+        if (block == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
+    }
+
+    node->body = NULL;
+    block->node = node;
+    block->tail = &node->body;
+    block->up = mod->open;
+    mod->open = block;
+    return 0;
+}
+
+int
+ast_module_close(struct gup_state *state, struct ast_node *epilogue)
+{
+    struct ast_module *mod;
+    struct ast_block *block;
+
+    if (state == NULL || (mod = state->module) == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((block = mod->open) == &mod->root) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (epilogue != NULL) {
+        epilogue->next = NULL;
+        *block->tail = epilogue;
+        block->tail = &epilogue->next;
+    }
+
+    mod->open = block->up;
+    block->up = mod->free;
+    mod->free = block;
+    return 0;
+}
@@ -3,12 +3,531 @@
  * Provided under the BSD-3 clause.
  */
 
-#include <stdio.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include "gup/trace.h"
 #include "gup/codegen.h"
+#include "gup/outbuf.h"
 #include "gup/mu.h"
+#include "gup/ir.h"
+
+/* Size of a buffer large enough for any block label */
+#define CG_LABEL_MAX 32
+
+/*
+ * Build the label of a loop or if statement
+ *
+ * @buf: Label is written here, CG_LABEL_MAX bytes
+ * @prefix: 'L' for a loop, 'I' for an if statement
+ * @n: Loop or if statement number
+ * @end: If true, build the end label
+ *
+ * Returns 'buf'
+ */
+static const char *
+cg_label(char *buf, char prefix, size_t n, bool end)
+{
+    char *p = buf;
+
+    *p++ = prefix;
+    *p++ = '.';
+    p += outbuf_fmtu(p, n);
+    if (end) {
+        *p++ = '.';
+        *p++ = '1';
+    }
+
+    *p = '\0';
+    return buf;
+}
+
+/*
+ * Get the procedure being lowered to IR, statements
+ * are only lowered within one.
+ *
+ * @state: Compiler state
+ *
+ * Returns NULL outside of a procedure
+ */
+static struct ir_proc *
+cg_this_proc(struct gup_state *state)
+{
+    if (state->ir == NULL || state->ir->func == NULL) {
+        trace_error(state, "statement outside of a procedure\n");
+        return NULL;
+    }
+
+    return state->ir;
+}
+
+/*
+ * Append an instruction to the procedure being lowered
+ *
+ * @state: Compiler state
+ * @op: Operation
+ * @size: Size of the values operated on
+ *
+ * Returns NULL on failure
+ */
+static struct ir_insn *
+cg_push(struct gup_state *state, ir_op_t op, msize_t size)
+{
+    struct ir_proc *proc;
+    struct ir_insn *insn;
+
+    if ((proc = cg_this_proc(state)) == NULL) {
+        return NULL;
+    }
+
+    if ((insn = ir_push(proc, op, size)) == NULL) {
+        trace_error(state, "failed to allocate IR instruction\n");
+        return NULL;
+    }
+
+    return insn;
+}
+
+/*
+ * Append a jump to a block of the procedure being lowered
+ *
+ * @state: Compiler state
+ * @block: Block to jump to
+ *
+ * Returns zero on success
+ */
+static int
+cg_push_jmp(struct gup_state *state, uint32_t block)
+{
+    struct ir_insn *insn;
+
+    if ((insn = cg_push(state, IR_JMP, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->target[0] = block;
+    return 0;
+}
+
+msize_t
+cg_symbol_msize(struct symbol *symbol)
+{
+    struct datum_type *dtype;
+
+    /* Pointers are promoted to the largest type */
+    dtype = &symbol->data_type;
+    if (dtype->ptr_depth > 0) {
+        return MSIZE_QWORD;
+    }
+
+    return type_to_msize(dtype->type);
+}
+
+/*
+ * Resolve the memory a variable or field access names
+ *
+ * @state: Compiler state
+ * @node: Root of the access, the fields chain to its right
+ * @verb: What is done to it, for diagnostics
+ * @addr: Memory location is written here
+ * @size: Size of the variable or field is written here
+ *
+ * Returns zero on success
+ */
+static int
+cg_access(struct gup_state *state, struct ast_node *node, const char *verb,
+    struct ir_addr *addr, msize_t *size)
+{
+    struct ast_node *cur, *last;
+    struct symbol *symbol;
+    char label_buf[256];
+    char *p, *end;
+    size_t len;
+
+    /* The size comes from the variable or field accessed */
+    for (last = node; last->right != NULL; last = last->right);
+    if ((symbol = last->symbol) == NULL) {
+        errno = -EIO;
+        return -1;
+    }
+
+    if ((*size = cg_symbol_msize(symbol)) == MSIZE_BAD) {
+        trace_error(state, "cannot %s '%s'\n", verb, symbol->name);
+        return -1;
+    }
+
+    addr->label = NULL;
+    addr->off = symbol->frame_off;
+    if (symbol->local) {
+        return 0;
+    }
+
+    /* Join the access path of globals, e.g., 'inst.field' */
+    p = label_buf;
+    end = &label_buf[sizeof(label_buf) - 1];
+    for (cur = node; cur != NULL;) {
+        len = strlen(cur->s);
+        if (len >= (size_t)(end - p)) {
+            trace_error(state, "label of '%s' is too long\n", node->s);
+            return -1;
+        }
+
+        memcpy(p, cur->s, len);
+        p += len;
+        if ((cur = cur->right) != NULL) {
+            *p++ = '.';
+        }
+    }
+
+    /* The label has to outlive the node until selection */
+    *p = '\0';
+    addr->label = intern_str(&state->names, label_buf);
+    if (addr->label == NULL) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the IR operation of a binary operator
+ *
+ * @op: Operator token
+ * @swap: Set if the operands go the other way around,
+ *        may be NULL
+ *
+ * Returns IR_NOP if there is none
+ */
+static ir_op_t
+cg_binop(tt_t op, bool *swap)
+{
+    bool dummy;
+
+    if (swap == NULL) {
+        swap = &dummy;
+    }
+
+    *swap = false;
+    switch (op) {
+    case TT_PLUS:       return IR_ADD;
+    case TT_MINUS:      return IR_SUB;
+    case TT_STAR:       return IR_MUL;
+    case TT_SLASH:      return IR_DIV;
+    case TT_PERCENT:    return IR_MOD;
+    case TT_AMP:        return IR_AND;
+    case TT_PIPE:       return IR_OR;
+    case TT_CARET:      return IR_XOR;
+    case TT_SHL:        return IR_SHL;
+    case TT_SHR:        return IR_SHR;
+    case TT_EQUALITY:   return IR_EQ;
+    case TT_NEQ:        return IR_NE;
+    case TT_LT:         return IR_LT;
+    case TT_LTE:        return IR_LE;
+    case TT_GT:         *swap = true; return IR_LT;
+    case TT_GTE:        *swap = true; return IR_LE;
+    default:            return IR_NOP;
+    }
+}
+
+msize_t
+cg_expr_size(struct ast_node *node)
+{
+    msize_t size = MSIZE_DWORD, other;
+
+    switch (node->type) {
+    case AST_NUMBER:
+        if ((uint64_t)node->v > UINT32_MAX || node->wide) {
+            size = MSIZE_QWORD;
+        }
+
+        break;
+    case AST_ACCESS:
+        while (node->right != NULL) {
+            node = node->right;
+        }
+
+        if (node->symbol != NULL) {
+            other = cg_symbol_msize(node->symbol);
+            size = (other > size) ? other : size;
+        }
+
+        break;
+    case AST_UNOP:
+        if (node->op != TT_BANG) {
+            size = cg_expr_size(node->right);
+        }
+
+        break;
+    case AST_BINOP:
+        /* Results of comparisons are just zero or one */
+        if (cg_binop(node->op, NULL) >= IR_EQ || node->op == TT_LAND ||
+            node->op == TT_LOR) {
+            break;
+        }
+
+        size = cg_expr_size(node->left);
+        if (node->op == TT_SHL || node->op == TT_SHR) {
+            break;
+        }
+
+        other = cg_expr_size(node->right);
+        size = (other > size) ? other : size;
+        break;
+    default:
+        break;
+    }
+
+    return size;
+}
+
+/*
+ * Append a two operand operation to the procedure
+ * being lowered.
+ *
+ * @state: Compiler state
+ * @op: Operation
+ * @size: Size of the values operated on
+ * @a: First operand
+ * @b: Second operand
+ * @res: Virtual register of the result is written here
+ *
+ * Returns zero on success
+ */
+static int
+cg_push_binop(struct gup_state *state, ir_op_t op, msize_t size,
+    const struct ir_operand *a, const struct ir_operand *b,
+    struct ir_operand *res)
+{
+    struct ir_insn *insn;
+
+    if ((insn = cg_push(state, op, size)) == NULL) {
+        return -1;
+    }
+
+    insn->dst = ir_vreg(state->ir);
+    insn->a = *a;
+    insn->b = *b;
+    res->kind = IR_OPND_VREG;
+    res->vreg = insn->dst;
+    return 0;
+}
+
+/*
+ * Lower an expression to IR. Values are unsigned and
+ * arithmetic is done in the size of the widest value
+ * it ends up in, so truncating the result gives the
+ * same as C would.
+ *
+ * XXX: Operands of '&&' and '||' are both evaluated as
+ *      expressions have no side effects.
+ *
+ * @state: Compiler state
+ * @node: Root of the expression
+ * @min: Smallest size to work in, e.g., of the destination
+ * @res: Operand holding the value is written here
+ *
+ * Returns zero on success
+ */
+static int
+cg_lower_expr(struct gup_state *state, struct ast_node *node, msize_t min,
+    struct ir_operand *res)
+{
+    struct ir_operand a, b, zero;
+    struct ir_insn *insn;
+    struct ir_addr addr;
+    msize_t size, opsize;
+    ir_op_t op;
+    bool swap;
+
+    zero.kind = IR_OPND_IMM;
+    zero.imm = 0;
+    size = cg_expr_size(node);
+    size = (min > size) ? min : size;
+
+    switch (node->type) {
+    case AST_NUMBER:
+        res->kind = IR_OPND_IMM;
+        res->imm = node->v;
+        return 0;
+    case AST_ACCESS:
+        if (cg_access(state, node, "read", &addr, &opsize) < 0) {
+            return -1;
+        }
+
+        if ((insn = cg_push(state, IR_LOAD, opsize)) == NULL) {
+            return -1;
+        }
+
+        insn->dst = ir_vreg(state->ir);
+        insn->addr = addr;
+        res->kind = IR_OPND_VREG;
+        res->vreg = insn->dst;
+        return 0;
+    case AST_UNOP:
+        if (node->op == TT_BANG) {
+            size = cg_expr_size(node->right);
+        }
+
+        if (cg_lower_expr(state, node->right, size, &a) < 0) {
+            return -1;
+        }
+
+        /* All ones is truncated to the size worked in */
+        b.kind = IR_OPND_IMM;
+        b.imm = (node->op == TT_TILDE) ? -1 : 0;
+
+        switch (node->op) {
+        case TT_MINUS:
+            return cg_push_binop(state, IR_SUB, size, &b, &a, res);
+        case TT_TILDE:
+            return cg_push_binop(state, IR_XOR, size, &a, &b, res);
+        case TT_BANG:
+            return cg_push_binop(state, IR_EQ, size, &a, &b, res);
+        default:
+            errno = -EINVAL;
+            return -1;
+        }
+    case AST_BINOP:
+        op = cg_binop(node->op, &swap);
+
+        /* Operands of comparisons are worked in by themselves */
+        opsize = size;
+        if (op >= IR_EQ || op == IR_NOP) {
+            opsize = cg_expr_size(node->left);
+            size = cg_expr_size(node->right);
+            opsize = (size > opsize) ? size : opsize;
+        }
+
+        if (cg_lower_expr(state, node->left, opsize, &a) < 0) {
+            return -1;
+        }
+
+        /* The count of a shift has a size of its own */
+        if (op == IR_SHL || op == IR_SHR) {
+            opsize = MSIZE_DWORD;
+        }
+
+        if (cg_lower_expr(state, node->right, opsize, &b) < 0) {
+            return -1;
+        }
+
+        if (op == IR_SHL || op == IR_SHR) {
+            opsize = size;
+        }
+
+        if (node->op == TT_LAND) {
+            /* Both sides are tested against zero on their own */
+            if (cg_push_binop(state, IR_NE, opsize, &a, &zero, &a) < 0) {
+                return -1;
+            }
+
+            if (cg_push_binop(state, IR_NE, opsize, &b, &zero, &b) < 0) {
+                return -1;
+            }
+
+            return cg_push_binop(state, IR_AND, opsize, &a, &b, res);
+        }
+
+        if (node->op == TT_LOR) {
+            if (cg_push_binop(state, IR_OR, opsize, &a, &b, &a) < 0) {
+                return -1;
+            }
+
+            return cg_push_binop(state, IR_NE, opsize, &a, &zero, res);
+        }
+
+        if (op == IR_NOP) {
+            errno = -EINVAL;
+            return -1;
+        }
+
+        if (swap) {
+            return cg_push_binop(state, op, opsize, &b, &a, res);
+        }
+
+        return cg_push_binop(state, op, opsize, &a, &b, res);
+    default:
+        trace_error(state, "expected an expression\n");
+        return -1;
+    }
+}
+
+/*
+ * Lower the condition of a branch to the comparison it
+ * is taken on. A comparison at the root is branched on
+ * as is, rather than through a value of zero or one,
+ * anything else is compared against zero.
+ *
+ * @state: Compiler state
+ * @node: Root of the condition
+ * @cond: Comparison is written here, IR_EQ up to IR_LE
+ * @a: First operand of the comparison is written here
+ * @b: Second operand of the comparison is written here
+ * @size: Size the operands are compared in is written here
+ *
+ * Returns zero on success
+ */
+static int
+cg_lower_cond(struct gup_state *state, struct ast_node *node, ir_op_t *cond,
+    struct ir_operand *a, struct ir_operand *b, msize_t *size)
+{
+    struct ir_operand tmp;
+    ir_op_t op = IR_NOP;
+    msize_t other;
+    bool swap;
+
+    if (node->type == AST_UNOP && node->op == TT_BANG) {
+        if (cg_lower_cond(state, node->right, cond, a, b, size) < 0) {
+            return -1;
+        }
+
+        /* Taken the other way, e.g., '!(a < b)' is 'b <= a' */
+        switch (*cond) {
+        case IR_EQ:
+            *cond = IR_NE;
+            break;
+        case IR_NE:
+            *cond = IR_EQ;
+            break;
+        default:
+            *cond = (*cond == IR_LT) ? IR_LE : IR_LT;
+            tmp = *a;
+            *a = *b;
+            *b = tmp;
+            break;
+        }
+
+        return 0;
+    }
+
+    if (node->type == AST_BINOP) {
+        op = cg_binop(node->op, &swap);
+    }
+
+    if (op < IR_EQ) {
+        *cond = IR_NE;
+        *size = cg_expr_size(node);
+        b->kind = IR_OPND_IMM;
+        b->imm = 0;
+        return cg_lower_expr(state, node, *size, a);
+    }
+
+    /* Operands of comparisons are worked in by themselves */
+    *size = cg_expr_size(node->left);
+    other = cg_expr_size(node->right);
+    *size = (other > *size) ? other : *size;
+
+    if (cg_lower_expr(state, node->left, *size, swap ? b : a) < 0) {
+        return -1;
+    }
+
+    if (cg_lower_expr(state, node->right, *size, swap ? a : b) < 0) {
+        return -1;
+    }
+
+    *cond = op;
+    return 0;
+}
 
 /*
  * Emit inline-assembly from an AST node
@@ -21,21 +540,49 @@
 static int
 cg_emit_asm(struct gup_state *state, struct ast_node *node)
 {
+    struct ir_insn *insn;
+
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    if (node->s != NULL) {
-        mu_cg_inject(state, node->s);
+    if (node->s == NULL) {
+        return 0;
+    }
+
+    /* Only inline assembly may be left to nasm, see mu_assemble() */
+    state->inline_asm = 1;
+
+    /* Top-level assembly has no procedure to go in */
+    if (state->ir == NULL || state->ir->func == NULL) {
+        return mu_cg_inject(state, node->s, node->len);
     }
+
+    if ((insn = cg_push(state, IR_ASM, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->s = node->s;
+    insn->len = node->len;
     return 0;
 }
 
+/*
+ * Begin or end a procedure, the whole procedure is lowered
+ * to IR and then optimized before any of it is emitted.
+ *
+ * @state: Compiler state
+ * @node:  Procedure node
+ *
+ * Returns zero on success
+ */
 static int
 cg_emit_proc(struct gup_state *state, struct ast_node *node)
 {
     struct symbol *symbol;
+    struct ir_proc *proc;
+    int error;
 
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
@@ -48,8 +595,34 @@ cg_emit_proc(struct gup_state *state, struct ast_node *node)
     }
 
     if (node->epilogue) {
-        mu_cg_ret(state);
-        return 0;
+        if ((proc = cg_this_proc(state)) == NULL) {
+            return -1;
+        }
+
+        /* Falling off the end returns, pruned if it cannot */
+        if (cg_push(state, IR_RET, cg_symbol_msize(proc->func)) == NULL) {
+            return -1;
+        }
+
+        error = ir_optimize(proc);
+        if (error == 0) {
+            error = ir_promote(proc);
+        }
+
+        if (error == 0) {
+            error = mu_isel(state, proc);
+        }
+
+        /* Nothing the input did, but it must not go unnoticed */
+        if (error < 0) {
+            trace_error(
+                state, "internal error: failed to emit '%s'\n",
+                proc->func->name
+            );
+        }
+
+        proc->func = NULL;
+        return error;
     }
 
     if ((symbol = node->symbol) == NULL) {
@@ -57,10 +630,16 @@ cg_emit_proc(struct gup_state *state, struct ast_node *node)
         return -1;
     }
 
-    if (node->s != NULL) {
-        mu_cg_label(state, node->s, symbol->global);
+    /* The same storage is reused by every procedure */
+    if (state->ir == NULL) {
+        state->ir = calloc(1, sizeof(*state->ir));
+        if (state->ir == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
     }
 
+    ir_begin(state->ir, symbol);
     return 0;
 }
 
@@ -75,37 +654,176 @@ cg_emit_proc(struct gup_state *state, struct ast_node *node)
 static int
 cg_emit_loop(struct gup_state *state, struct ast_node *node)
 {
-    char label_buf[32];
+    char label_buf[CG_LABEL_MAX];
+    struct ir_proc *proc;
+    uint32_t head, end;
+    size_t loop;
 
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
+    if ((proc = cg_this_proc(state)) == NULL) {
+        return -1;
+    }
+
     /*
-     * If this is not a loop epilogue, generate the
-     * loop start label and that's it.
+     * If this is not a loop epilogue, place the head
+     * block and that's it. The end block is created
+     * right after the head, see 'loops' of the IR.
      */
     if (!node->epilogue) {
-        snprintf(
-            label_buf,
-            sizeof(label_buf),
-            "L.%zu",
-            state->loop_count++
-        );
-
-        mu_cg_label(state, label_buf, false);
-        return 0;
+        loop = state->loop_count++;
+        cg_label(label_buf, 'L', loop, false);
+        if (ir_block(proc, label_buf, &head) < 0) {
+            return -1;
+        }
+
+        cg_label(label_buf, 'L', loop, true);
+        if (ir_block(proc, label_buf, &end) < 0) {
+            return -1;
+        }
+
+        if (ir_loop_push(proc, head) < 0) {
+            return -1;
+        }
+
+        return ir_place(proc, head);
     }
 
-    /* Emit a jump to the start label */
-    snprintf(label_buf, sizeof(label_buf), "L.%zu", state->loop_count - 1);
-    mu_cg_jmp(state, label_buf);
+    if (proc->nloops == 0) {
+        errno = -EIO;
+        return -1;
+    }
 
-    /* Emit the end label */
-    snprintf(label_buf, sizeof(label_buf), "L.%zu.1", state->loop_count - 1);
-    mu_cg_label(state, label_buf, false);
-    return 0;
+    /* Jump back to the head, then place the end */
+    head = proc->loops[--proc->nloops];
+    if (cg_push_jmp(state, head) < 0) {
+        return -1;
+    }
+
+    return ir_place(proc, head + 1);
+}
+
+/*
+ * Emit an if statement, the branch falls through into
+ * the body and jumps past it when the condition fails.
+ * A condition known up front turns into a jump, the
+ * arm never taken is then pruned by ir_optimize().
+ *
+ * @state: Compiler state
+ * @node:  If node
+ *
+ * Returns zero on success
+ */
+static int
+cg_emit_if(struct gup_state *state, struct ast_node *node)
+{
+    char label_buf[CG_LABEL_MAX];
+    struct ir_operand a, b;
+    struct ir_proc *proc;
+    struct ir_insn *insn;
+    uint32_t then, other, end;
+    msize_t size;
+    ir_op_t cond;
+    size_t n;
+
+    if (state == NULL || node == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((proc = cg_this_proc(state)) == NULL) {
+        return -1;
+    }
+
+    /* The end of the body is where an else arm would go */
+    if (node->epilogue) {
+        if (proc->nifs == 0) {
+            errno = -EIO;
+            return -1;
+        }
+
+        return ir_place(proc, proc->ifs[--proc->nifs]);
+    }
+
+    if (cg_lower_cond(state, node->right, &cond, &a, &b, &size) < 0) {
+        return -1;
+    }
+
+    /* The end block is created right after the else block */
+    n = state->if_count++;
+    if (ir_block(proc, NULL, &then) < 0) {
+        return -1;
+    }
+
+    cg_label(label_buf, 'I', n, false);
+    if (ir_block(proc, label_buf, &other) < 0) {
+        return -1;
+    }
+
+    cg_label(label_buf, 'I', n, true);
+    if (ir_block(proc, label_buf, &end) < 0) {
+        return -1;
+    }
+
+    if ((insn = cg_push(state, IR_BR, size)) == NULL) {
+        return -1;
+    }
+
+    insn->cond = cond;
+    insn->a = a;
+    insn->b = b;
+    insn->target[0] = then;
+    insn->target[1] = other;
+    if (ir_if_push(proc, other) < 0) {
+        return -1;
+    }
+
+    return ir_place(proc, then);
+}
+
+/*
+ * Emit the else arm of an if statement, the body of the
+ * if jumps over it to the end block.
+ *
+ * @state: Compiler state
+ * @node:  Else node
+ *
+ * Returns zero on success
+ */
+static int
+cg_emit_else(struct gup_state *state, struct ast_node *node)
+{
+    struct ir_proc *proc;
+    uint32_t other;
+
+    if (state == NULL || node == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((proc = cg_this_proc(state)) == NULL) {
+        return -1;
+    }
+
+    if (proc->nifs == 0) {
+        errno = -EIO;
+        return -1;
+    }
+
+    if (node->epilogue) {
+        other = proc->ifs[--proc->nifs];
+        return ir_place(proc, other + 1);
+    }
+
+    other = proc->ifs[proc->nifs - 1];
+    if (cg_push_jmp(state, other + 1) < 0) {
+        return -1;
+    }
+
+    return ir_place(proc, other);
 }
 
 /*
@@ -156,7 +874,7 @@ cg_emit_globvar(struct gup_state *state, struct ast_node *node)
 static int
 cg_emit_break(struct gup_state *state, struct ast_node *node)
 {
-    char label_buf[32];
+    struct ir_proc *proc;
 
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
@@ -168,14 +886,17 @@ cg_emit_break(struct gup_state *state, struct ast_node *node)
         return -1;
     }
 
-    snprintf(
-        label_buf,
-        sizeof(label_buf),
-        "L.%zu.1",
-        state->loop_count - 1
-    );
+    if ((proc = cg_this_proc(state)) == NULL) {
+        return -1;
+    }
 
-    return mu_cg_jmp(state, label_buf);
+    if (proc->nloops == 0) {
+        errno = -EIO;
+        return -1;
+    }
+
+    /* The end block of the innermost loop */
+    return cg_push_jmp(state, proc->loops[proc->nloops - 1] + 1);
 }
 
 /*
@@ -187,7 +908,7 @@ cg_emit_break(struct gup_state *state, struct ast_node *node)
 static int
 cg_emit_continue(struct gup_state *state, struct ast_node *node)
 {
-    char label_buf[32];
+    struct ir_proc *proc;
 
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
@@ -199,14 +920,16 @@ cg_emit_continue(struct gup_state *state, struct ast_node *node)
         return -1;
     }
 
-    snprintf(
-        label_buf,
-        sizeof(label_buf),
-        "L.%zu",
-        state->loop_count - 1
-    );
+    if ((proc = cg_this_proc(state)) == NULL) {
+        return -1;
+    }
+
+    if (proc->nloops == 0) {
+        errno = -EIO;
+        return -1;
+    }
 
-    return mu_cg_jmp(state, label_buf);
+    return cg_push_jmp(state, proc->loops[proc->nloops - 1]);
 }
 
 /*
@@ -219,6 +942,7 @@ static int
 cg_emit_call(struct gup_state *state, struct ast_node *node)
 {
     struct symbol *symbol;
+    struct ir_insn *insn;
 
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
@@ -240,7 +964,12 @@ cg_emit_call(struct gup_state *state, struct ast_node *node)
         return -1;
     }
 
-    return mu_cg_call(state, symbol->name);
+    if ((insn = cg_push(state, IR_CALL, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->s = symbol->name;
+    return 0;
 }
 
 /*
@@ -252,9 +981,10 @@ cg_emit_call(struct gup_state *state, struct ast_node *node)
 static int
 cg_emit_ret(struct gup_state *state, struct ast_node *node)
 {
-    struct datum_type *dtype;
+    struct ir_operand val;
     struct symbol *symbol;
-    msize_t msize;
+    struct ir_insn *insn;
+    msize_t size;
 
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
@@ -266,20 +996,24 @@ cg_emit_ret(struct gup_state *state, struct ast_node *node)
         return -1;
     }
 
-    if ((symbol = state->this_func) == NULL) {
+    /* The procedure returned from comes with the node */
+    if ((symbol = node->symbol) == NULL) {
         errno = -EIO;
         return -1;
     }
 
-    /* Promote type if needed */
-    dtype = &symbol->data_type;
-    if (dtype->ptr_depth > 0) {
-        msize = MSIZE_QWORD;
-    } else {
-        msize = type_to_msize(dtype->type);
+    /* The value is lowered ahead of the return reading it */
+    size = cg_symbol_msize(symbol);
+    if (cg_lower_expr(state, node->right, size, &val) < 0) {
+        return -1;
     }
 
-    return mu_cg_retimm(state, msize, node->v);
+    if ((insn = cg_push(state, IR_RET, size)) == NULL) {
+        return -1;
+    }
+
+    insn->a = val;
+    return 0;
 }
 
 /*
@@ -313,8 +1047,10 @@ cg_emit_struct(struct gup_state *state, struct ast_node *node)
 static int
 cg_emit_assign(struct gup_state *state, struct ast_node *node)
 {
-    struct ast_node *right, *cur;
-    char label_buf[256];
+    struct ir_operand val;
+    struct ir_insn *insn;
+    struct ir_addr addr;
+    msize_t msize;
 
     if (state == NULL || node == NULL) {
         errno = -EINVAL;
@@ -326,24 +1062,21 @@ cg_emit_assign(struct gup_state *state, struct ast_node *node)
         return -1;
     }
 
-    cur = node->left;
-    right = node->right;
-    label_buf[0] = '\0';
-
-    if (right->type != AST_NUMBER) {
-        trace_error(state, "binexpr in assigns not supported yet\n");
+    if (cg_access(state, node->left, "assign to", &addr, &msize) < 0) {
         return -1;
     }
 
-    while (cur != NULL) {
-        strncat(label_buf, cur->s, sizeof(label_buf) - 1);
-        if ((cur = cur->right) == NULL)
-            break;
+    /* The value is lowered ahead of the store writing it */
+    if (cg_lower_expr(state, node->right, msize, &val) < 0) {
+        return -1;
+    }
 
-        strncat(label_buf, ".", sizeof(label_buf) - 1);
+    if ((insn = cg_push(state, IR_STORE, msize)) == NULL) {
+        return -1;
     }
 
-    mu_cg_loadvar(state, label_buf, MSIZE_BYTE, right->v);
+    insn->addr = addr;
+    insn->a = val;
     return 0;
 }
 
@@ -417,8 +1150,17 @@ cg_compile_node(struct gup_state *state, struct ast_node *node)
 
         break;
     case AST_IF:
-        trace_error(state, "IF statements are a TODO\n");
-        return -1;
+        if (cg_emit_if(state, node) < 0) {
+            return -1;
+        }
+
+        break;
+    case AST_ELSE:
+        if (cg_emit_else(state, node) < 0) {
+            return -1;
+        }
+
+        break;
     default:
         trace_error(state, "bad AST node [type=%d]\n", node->type);
         return -1;
@@ -426,3 +1168,69 @@ cg_compile_node(struct gup_state *state, struct ast_node *node)
 
     return 0;
 }
+
+/*
+ * Emit every node of a block of a module tree in order,
+ * descending into the body of every block.
+ *
+ * @state: Compiler state
+ * @node: First node of the block
+ *
+ * Returns zero on success
+ */
+static int
+cg_compile_block(struct gup_state *state, struct ast_node *node)
+{
+    for (; node != NULL; node = node->next) {
+        /* Diagnostics point at where the node was parsed */
+        state->line_num = node->line;
+        if (cg_compile_node(state, node) < 0) {
+            return -1;
+        }
+
+        if (node->body == NULL) {
+            continue;
+        }
+
+        if (cg_compile_block(state, node->body) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int
+cg_compile_module(struct gup_state *state, struct ast_module *mod)
+{
+    if (state == NULL || mod == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    return cg_compile_block(state, mod->head);
+}
+
+int
+cg_alloc_local(struct gup_state *state, struct symbol *func,
+    struct symbol *local)
+{
+    size_t size;
+
+    if (state == NULL || func == NULL || local == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    size = msize_bytes(cg_symbol_msize(local));
+    if (size == 0) {
+        trace_error(state, "cannot declare local '%s'\n", local->name);
+        return -1;
+    }
+
+    /* Locals grow down from the frame base, naturally aligned */
+    func->frame_size = (func->frame_size + size - 1) & ~(size - 1);
+    func->frame_size += size;
+    local->frame_off = func->frame_size;
+    return 0;
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <elf.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gup/elf.h"
+#include "gup/outbuf.h"
+
+/* Sections every object has past the user sections */
+#define ELF_SHSTRTAB 1
+#define ELF_SYMTAB   2
+#define ELF_STRTAB   3
+#define ELF_NEXTRA   3
+
+/*
+ * Pad an output buffer with zeros up to an alignment
+ *
+ * @ob: Output buffer
+ * @align: Alignment in bytes, zero or one for none
+ */
+static void
+elf_pad(struct outbuf *ob, uint64_t align)
+{
+    while (align > 1 && (ob->len % align) != 0) {
+        outbuf_putc(ob, '\0');
+    }
+}
+
+/*
+ * Append a NUL terminated name to a string table
+ *
+ * @strtab: String table
+ * @name: Name to append, not NUL terminated
+ * @len: Length of the name
+ *
+ * Returns the offset of the name within the table
+ */
+static uint32_t
+elf_strtab_add(struct outbuf *strtab, const char *name, size_t len)
+{
+    uint32_t off = strtab->len;
+
+    outbuf_putn(strtab, name, len);
+    outbuf_putc(strtab, '\0');
+    return off;
+}
+
+/*
+ * Append a symbol table entry
+ *
+ * @symtab: Symbol table
+ * @name: Offset of the name within the string table
+ * @info: Binding and type
+ * @shndx: Section header index
+ * @value: Symbol value
+ */
+static void
+elf_symtab_add(struct outbuf *symtab, uint32_t name, uint8_t info,
+    uint16_t shndx, uint64_t value)
+{
+    Elf64_Sym sym;
+
+    memset(&sym, 0, sizeof(sym));
+    sym.st_name = name;
+    sym.st_info = info;
+    sym.st_shndx = shndx;
+    sym.st_value = value;
+    outbuf_putn(symtab, (const char *)&sym, sizeof(sym));
+}
+
+/*
+ * Fill in a section header
+ *
+ * @shdr: Section header to fill
+ * @name: Offset of the name within the section name table
+ * @type: Section type
+ * @flags: Section flags
+ * @off: File offset of the contents
+ * @size: Size of the contents
+ * @align: Alignment of the contents
+ */
+static void
+elf_shdr(Elf64_Shdr *shdr, uint32_t name, uint32_t type, uint64_t flags,
+    uint64_t off, uint64_t size, uint64_t align)
+{
+    shdr->sh_name = name;
+    shdr->sh_type = type;
+    shdr->sh_flags = flags;
+    shdr->sh_offset = off;
+    shdr->sh_size = size;
+    shdr->sh_addralign = align;
+}
+
+int
+elf64_write_rel(int fd, const char *file, uint16_t machine,
+    const struct elf_section *sections, size_t section_count,
+    const struct elf_symbol *symbols, size_t symbol_count)
+{
+    const struct elf_section *sect;
+    const struct elf_symbol *sym;
+    const struct elf_rela *rela;
+    struct outbuf ob, shstrtab, strtab, symtab;
+    Elf64_Ehdr ehdr;
+    Elf64_Shdr *shdrs;
+    Elf64_Rela ent;
+    uint32_t *symidx, *rela_name, name;
+    uint32_t first_global, shndx;
+    size_t shnum, rela_count, i, j, pass;
+    bool global;
+    int error = -1;
+
+    if (file == NULL || (sections == NULL && section_count > 0)) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (symbols == NULL && symbol_count > 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    rela_count = 0;
+    for (i = 0; i < section_count; ++i) {
+        if (sections[i].rela_count > 0) {
+            ++rela_count;
+        }
+    }
+
+    shnum = 1 + section_count + ELF_NEXTRA + rela_count;
+    if (shnum >= SHN_LORESERVE) {
+        errno = -E2BIG;
+        return -1;
+    }
+
+    shdrs = calloc(shnum, sizeof(*shdrs));
+    symidx = calloc(symbol_count + 1, sizeof(*symidx));
+    rela_name = calloc(section_count + 1, sizeof(*rela_name));
+    if (shdrs == NULL || symidx == NULL || rela_name == NULL) {
+        free(shdrs);
+        free(symidx);
+        free(rela_name);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    outbuf_init(&ob);
+    outbuf_init(&shstrtab);
+    outbuf_init(&strtab);
+    outbuf_init(&symtab);
+
+    /* Section names */
+    outbuf_putc(&shstrtab, '\0');
+    for (i = 0; i < section_count; ++i) {
+        sect = &sections[i];
+        shdrs[i + 1].sh_name = elf_strtab_add(
+            &shstrtab,
+            sect->name,
+            strlen(sect->name)
+        );
+    }
+
+    for (i = 0; i < section_count; ++i) {
+        if (sections[i].rela_count == 0) {
+            continue;
+        }
+
+        rela_name[i] = shstrtab.len;
+        outbuf_lit(&shstrtab, ".rela");
+        elf_strtab_add(&shstrtab, sections[i].name, strlen(sections[i].name));
+    }
+
+    i = section_count;
+    shdrs[i + ELF_SHSTRTAB].sh_name = elf_strtab_add(&shstrtab, ".shstrtab", 9);
+    shdrs[i + ELF_SYMTAB].sh_name = elf_strtab_add(&shstrtab, ".symtab", 7);
+    shdrs[i + ELF_STRTAB].sh_name = elf_strtab_add(&shstrtab, ".strtab", 7);
+
+    /*
+     * The symbol table starts with the null symbol, the
+     * source file and one symbol per section. Locals must
+     * come before globals so they are added in two passes.
+     */
+    outbuf_putc(&strtab, '\0');
+    elf_symtab_add(&symtab, 0, 0, SHN_UNDEF, 0);
+    name = elf_strtab_add(&strtab, file, strlen(file));
+    elf_symtab_add(&symtab, name, ELF64_ST_INFO(STB_LOCAL, STT_FILE), SHN_ABS, 0);
+    for (i = 0; i < section_count; ++i) {
+        elf_symtab_add(
+            &symtab, 0,
+            ELF64_ST_INFO(STB_LOCAL, STT_SECTION),
+            i + 1, 0
+        );
+    }
+
+    first_global = 0;
+    for (pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            first_global = symtab.len / sizeof(Elf64_Sym);
+        }
+
+        for (i = 0; i < symbol_count; ++i) {
+            sym = &symbols[i];
+            global = sym->global || sym->section == ELF_SECTION_UNDEF;
+            if (global != pass) {
+                continue;
+            }
+
+            shndx = SHN_UNDEF;
+            if (sym->section != ELF_SECTION_UNDEF) {
+                shndx = sym->section + 1;
+            }
+
+            symidx[i] = symtab.len / sizeof(Elf64_Sym);
+            name = elf_strtab_add(&strtab, sym->name, sym->name_len);
+            elf_symtab_add(
+                &symtab, name,
+                ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, STT_NOTYPE),
+                shndx, sym->value
+            );
+        }
+    }
+
+    /* The headers are filled in once everything is laid out */
+    memset(&ehdr, 0, sizeof(ehdr));
+    outbuf_putn(&ob, (const char *)&ehdr, sizeof(ehdr));
+    for (i = 0; i < shnum; ++i) {
+        outbuf_putn(&ob, (const char *)&shdrs[0], sizeof(shdrs[0]));
+    }
+
+    for (i = 0; i < section_count; ++i) {
+        sect = &sections[i];
+        if (sect->type != SHT_NOBITS) {
+            elf_pad(&ob, sect->align);
+        }
+
+        elf_shdr(
+            &shdrs[i + 1], shdrs[i + 1].sh_name,
+            sect->type, sect->flags,
+            ob.len, sect->size, sect->align
+        );
+
+        if (sect->type != SHT_NOBITS && sect->size > 0) {
+            outbuf_putn(&ob, sect->data, sect->size);
+        }
+    }
+
+    i = section_count + ELF_SHSTRTAB;
+    elf_shdr(&shdrs[i], shdrs[i].sh_name, SHT_STRTAB, 0, ob.len, shstrtab.len, 1);
+    outbuf_putn(&ob, shstrtab.buf, shstrtab.len);
+
+    i = section_count + ELF_SYMTAB;
+    elf_pad(&ob, 8);
+    elf_shdr(&shdrs[i], shdrs[i].sh_name, SHT_SYMTAB, 0, ob.len, symtab.len, 8);
+    shdrs[i].sh_link = section_count + ELF_STRTAB;
+    shdrs[i].sh_info = first_global;
+    shdrs[i].sh_entsize = sizeof(Elf64_Sym);
+    outbuf_putn(&ob, symtab.buf, symtab.len);
+
+    i = section_count + ELF_STRTAB;
+    elf_shdr(&shdrs[i], shdrs[i].sh_name, SHT_STRTAB, 0, ob.len, strtab.len, 1);
+    outbuf_putn(&ob, strtab.buf, strtab.len);
+
+    j = section_count + ELF_NEXTRA + 1;
+    for (i = 0; i < section_count; ++i) {
+        sect = &sections[i];
+        if (sect->rela_count == 0) {
+            continue;
+        }
+
+        elf_pad(&ob, 8);
+        elf_shdr(
+            &shdrs[j], rela_name[i], SHT_RELA, 0, ob.len,
+            sect->rela_count * sizeof(ent), 8
+        );
+
+        shdrs[j].sh_link = section_count + ELF_SYMTAB;
+        shdrs[j].sh_info = i + 1;
+        shdrs[j].sh_entsize = sizeof(ent);
+        for (rela = sect->rela; rela < &sect->rela[sect->rela_count]; ++rela) {
+            if (rela->symbol >= symbol_count) {
+                errno = -EINVAL;
+                goto done;
+            }
+
+            /* Locals are reached through their section */
+            sym = &symbols[rela->symbol];
+            ent.r_offset = rela->offset;
+            ent.r_addend = rela->addend;
+            if (sym->global || sym->section == ELF_SECTION_UNDEF) {
+                ent.r_info = ELF64_R_INFO(symidx[rela->symbol], rela->type);
+            } else {
+                ent.r_info = ELF64_R_INFO(2 + sym->section, rela->type);
+                ent.r_addend += sym->value;
+            }
+
+            outbuf_putn(&ob, (const char *)&ent, sizeof(ent));
+        }
+
+        ++j;
+    }
+
+    if (ob.error || shstrtab.error || strtab.error || symtab.error) {
+        errno = -ENOMEM;
+        goto done;
+    }
+
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = machine;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_shoff = sizeof(ehdr);
+    ehdr.e_ehsize = sizeof(ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = shnum;
+    ehdr.e_shstrndx = section_count + ELF_SHSTRTAB;
+    memcpy(ob.buf, &ehdr, sizeof(ehdr));
+    memcpy(&ob.buf[sizeof(ehdr)], shdrs, shnum * sizeof(*shdrs));
+    error = outbuf_flush(&ob, fd);
+done:
+    outbuf_destroy(&symtab);
+    outbuf_destroy(&strtab);
+    outbuf_destroy(&shstrtab);
+    outbuf_destroy(&ob);
+    free(rela_name);
+    free(symidx);
+    free(shdrs);
+    return error;
+}
@@ -3,21 +3,122 @@
  * Provided under the BSD-3 clause.
  */
 
+#include <sys/wait.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
 #include "gup/state.h"
 #include "gup/parser.h"
+#include "gup/mu.h"
 
 #define GUP_VERSION "0.0.5"
 #define ELAPSED_NS(STARTP, ENDP)                            \
     (double)((ENDP)->tv_sec - (STARTP)->tv_sec) * 1.0e9 +    \
         (double)((ENDP)->tv_nsec - (STARTP)->tv_nsec)
 
+/* Size of the buffer used to copy output to stdout */
+#define COPY_BUF_SIZE 65536
+
+/* Upper bound on compiler threads given with -j */
+#define THREADS_MAX 256
+
+extern char **environ;
+
+/*
+ * Represents an output format
+ *
+ * @name: Name given with -f
+ * @nasm: Format passed on to nasm
+ * @out: Format of the built-in assembler
+ * @path: Path of the output
+ * @suffix: Suffix of outputs named after their input
+ */
+struct out_fmt {
+    const char *name;
+    const char *nasm;
+    mu_out_t out;
+    const char *path;
+    const char *suffix;
+};
+
+/*
+ * Represents a single input, i.e., a translation unit
+ *
+ * @path: Source input file path
+ * @out: Path of the output
+ * @log: Diagnostics, written to stderr in input order
+ * @error: Set if the input failed to compile
+ * @done: Set once the input has been compiled
+ */
+struct unit {
+    const char *path;
+    char *out;
+    struct outbuf log;
+    bool error;
+    bool done;
+};
+
+/*
+ * Represents the inputs shared between compiler threads
+ *
+ * @units: Every input in command line order
+ * @count: Number of inputs
+ * @next: Index of the next input to be compiled
+ * @stop: Set once an input fails, no more are started
+ * @lock: Protects 'next', 'stop' and the 'done' flag of each input
+ * @cv: Signalled whenever an input is done
+ */
+struct unit_queue {
+    struct unit *units;
+    size_t count;
+    size_t next;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cv;
+};
+
+/*
+ * Represents nasm running in the background while the
+ * next input is compiled.
+ *
+ * @pid: Process ID of nasm
+ * @src: Temporary assembly input, removed once done
+ * @tmp: Temporary output copied to stdout once done, empty if none
+ * @out: Path of the output
+ * @boot: Seal the output as a boot sector once done
+ * @next: Next job
+ */
+struct asm_job {
+    pid_t pid;
+    char src[PATH_MAX];
+    char tmp[PATH_MAX];
+    const char *out;
+    bool boot;
+    struct asm_job *next;
+};
+
+/* Formats the built-in assembler can write */
+static const struct out_fmt fmttab[] = {
+    { "elf64", "elf64", MU_OUT_ELF64, DEFAULT_OBJOUT, ".o"   },
+    { "bin",   "bin",   MU_OUT_BIN,   DEFAULT_BINOUT, ".bin" },
+    { "boot",  "bin",   MU_OUT_BOOT,  DEFAULT_BINOUT, ".bin" }
+};
+
 static bool asm_only = false;
+static bool use_nasm = false;
+static bool optimize = false;
 static const char *bin_fmt = "elf64";
+static const char *out_path = NULL;
+static long nthreads = 1;
+static struct asm_job *jobs = NULL;
 
 static void
 help(void)
@@ -28,9 +129,15 @@ help(void)
         "[-h]   Display this help menu\n"
         "[-v]   Display the version\n"
         "[-a]   Assembly output only\n"
+        "[-n]   Always assemble with nasm\n"
+        "[-O]   Optimize the whole module before emitting it\n"
+        "[-o]   Output path, '-' for stdout\n"
+        "[-j]   Compile up to N inputs at once, 0 for one per CPU\n"
         "[-f]   Output format\n"
         "...... [elf64]\n"
         "...... [bin]\n"
+        "...... [boot] (bin padded and signed as a boot sector)\n"
+        "Inputs of '-' are read from stdin\n"
     );
 }
 
@@ -46,60 +153,585 @@ version(void)
     );
 }
 
-static void
-assemble(const char *path)
+/*
+ * Look up an output format
+ *
+ * @name: Name given with -f
+ *
+ * Returns NULL if nasm is the only way to write it
+ */
+static const struct out_fmt *
+out_fmt(const char *name)
 {
-    char cmd[64];
-
-    snprintf(
-        cmd,
-        sizeof(cmd),
-        "nasm -f%s %s",
-        bin_fmt,
-        path
-    );
+    size_t i;
+
+    for (i = 0; i < sizeof(fmttab) / sizeof(fmttab[0]); ++i) {
+        if (strcmp(fmttab[i].name, name) == 0) {
+            return &fmttab[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Create a file with a unique name in the temporary
+ * directory
+ *
+ * @buf: Path is written here, PATH_MAX bytes
+ * @suffix: Suffix of the name, e.g., ".asm"
+ *
+ * Returns the file descriptor, -1 on failure
+ */
+static int
+tmp_create(char *buf, const char *suffix)
+{
+    const char *dir;
+    int len;
+
+    if ((dir = getenv("TMPDIR")) == NULL || *dir == '\0') {
+        dir = "/tmp";
+    }
+
+    len = snprintf(buf, PATH_MAX, "%s/gupXXXXXX%s", dir, suffix);
+    if (len < 0 || len >= PATH_MAX) {
+        errno = -ENAMETOOLONG;
+        return -1;
+    }
+
+    return mkstemps(buf, strlen(suffix));
+}
+
+/*
+ * Copy a file to stdout
+ *
+ * @path: Path of the file
+ *
+ * Returns zero on success
+ */
+static int
+copy_stdout(const char *path)
+{
+    char buf[COPY_BUF_SIZE];
+    ssize_t n, done, w;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            close(fd);
+            return -1;
+        }
+
+        for (done = 0; done < n; done += w) {
+            w = write(STDOUT_FILENO, &buf[done], n - done);
+            if (w < 0 && errno == EINTR) {
+                w = 0;
+            } else if (w < 0) {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+/*
+ * Wait for a nasm job to finish and clean up after it
+ *
+ * @job: Job to wait for
+ * @log: Diagnostics are written here
+ *
+ * Returns zero if the output was written
+ */
+static int
+job_wait(struct asm_job *job, struct outbuf *log)
+{
+    const char *out;
+    int status, error = 0;
+
+    while (waitpid(job->pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            status = -1;
+            break;
+        }
+    }
+
+    remove(job->src);
+    out = (job->tmp[0] != '\0') ? job->tmp : job->out;
+    if (status != 0) {
+        outbuf_printf(log, "fatal: nasm failed to write %s\n", job->out);
+        error = -1;
+    } else if (job->boot && mu_seal_boot(out) < 0) {
+        /* Unbootable images are not left behind */
+        if (errno == -EFBIG) {
+            outbuf_printf(log, "fatal: boot sector is larger than 510 bytes\n");
+        } else {
+            outbuf_printf(log, "fatal: failed to write %s\n", job->out);
+        }
+
+        remove(out);
+        error = -1;
+    } else if (job->tmp[0] != '\0' && copy_stdout(job->tmp) < 0) {
+        outbuf_printf(log, "fatal: failed to write to stdout\n");
+        error = -1;
+    }
+
+    if (job->tmp[0] != '\0') {
+        remove(job->tmp);
+    }
+
+    return error;
+}
+
+/*
+ * Wait for the nasm jobs writing to an output
+ *
+ * @out: Path of the output, NULL to wait for every job
+ * @log: Diagnostics are written here
+ *
+ * Returns zero if every output was written
+ */
+static int
+jobs_wait(const char *out, struct outbuf *log)
+{
+    struct asm_job **jp, *job;
+    int error = 0;
+
+    jp = &jobs;
+    while ((job = *jp) != NULL) {
+        if (out != NULL && strcmp(job->out, out) != 0) {
+            jp = &job->next;
+            continue;
+        }
+
+        if (job_wait(job, log) < 0) {
+            error = -1;
+        }
+
+        *jp = job->next;
+        free(job);
+    }
+
+    return error;
+}
+
+/*
+ * Start nasm on an assembly file, it is only waited for
+ * right away when compiling on several threads.
+ *
+ * @src: Temporary assembly file, owned by the job from here on
+ * @fmt: Output format, NULL if only nasm knows it
+ * @out: Path of the output
+ * @log: Diagnostics are written here
+ *
+ * Returns zero on success
+ */
+static int
+assemble(const char *src, const struct out_fmt *fmt, const char *out,
+    struct outbuf *log)
+{
+    struct asm_job *job;
+    char *argv[7];
+    int fd, error;
+
+    if ((job = calloc(1, sizeof(*job))) == NULL) {
+        remove(src);
+        return -1;
+    }
+
+    memcpy(job->src, src, sizeof(job->src));
+    job->out = out;
+    job->boot = fmt != NULL && fmt->out == MU_OUT_BOOT;
+
+    /* nasm needs a file it can seek in, stdout gets a copy */
+    if (strcmp(out, "-") == 0) {
+        if ((fd = tmp_create(job->tmp, ".out")) < 0) {
+            remove(job->src);
+            free(job);
+            return -1;
+        }
+
+        close(fd);
+    }
+
+    argv[0] = "nasm";
+    argv[1] = "-f";
+    argv[2] = (char *)((fmt != NULL) ? fmt->nasm : bin_fmt);
+    argv[3] = "-o";
+    argv[4] = (job->tmp[0] != '\0') ? job->tmp : (char *)out;
+    argv[5] = job->src;
+    argv[6] = NULL;
+
+    /* Jobs writing the same output must not overlap */
+    jobs_wait(out, log);
+    error = posix_spawnp(&job->pid, "nasm", NULL, NULL, argv, environ);
+    if (error != 0) {
+        outbuf_printf(log, "fatal: failed to run nasm\n");
+        remove(job->src);
+        if (job->tmp[0] != '\0') {
+            remove(job->tmp);
+        }
+
+        free(job);
+        return -1;
+    }
+
+    /* The job list belongs to the main thread */
+    if (nthreads > 1) {
+        error = job_wait(job, log);
+        free(job);
+        return error;
+    }
+
+    job->next = jobs;
+    jobs = job;
+    return 0;
+}
+
+/*
+ * Write the generated assembly to an output
+ *
+ * @state: Compiler state
+ * @out: Path of the output, "-" for stdout
+ *
+ * Returns zero on success
+ */
+static int
+write_asm(struct gup_state *state, const char *out)
+{
+    int fd, error;
+
+    if (strcmp(out, "-") == 0) {
+        return gup_state_flush(state, STDOUT_FILENO);
+    }
+
+    if ((fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        return -1;
+    }
 
-    system(cmd);
-    remove(path);
+    error = gup_state_flush(state, fd);
+    close(fd);
+    return error;
 }
 
+/*
+ * Compile a single input, its diagnostics are collected
+ * in its log.
+ *
+ * @u: Input to compile
+ *
+ * Returns zero on success
+ */
 static int
-compile(const char *path)
+compile(struct unit *u)
 {
+    const struct out_fmt *fmt;
     struct gup_state state;
     struct timespec start, end;
     double elapsed_ms, elapsed_ns;
+    char src[PATH_MAX];
+    const char *out;
+    bool native = false;
+    int fd, error;
 
-    if (path == NULL) {
+    if (u == NULL) {
         return -1;
     }
 
-    if (gup_state_init(path, &state) < 0) {
+    fmt = out_fmt(bin_fmt);
+    out = u->out;
+    if (gup_state_init(u->path, &state) < 0) {
+        outbuf_printf(&u->log, "fatal: failed to open %s\n", u->path);
         return -1;
     }
 
+    state.diag = &u->log;
+    state.whole_module = optimize;
     clock_gettime(CLOCK_REALTIME, &start);
     if (gup_parse(&state) < 0) {
+        gup_state_destroy(&state);
         return -1;
     }
 
+    if (asm_only) {
+        jobs_wait(out, &u->log);
+        if (write_asm(&state, out) < 0) {
+            outbuf_printf(&u->log, "fatal: failed to write %s\n", out);
+            gup_state_destroy(&state);
+            return -1;
+        }
+    }
+
+    /*
+     * Assemble in-process when possible, programs with inline
+     * assembly that is not understood are handed to nasm.
+     * The code generated is always understood, so that is
+     * never hidden behind nasm.
+     */
+    if (!asm_only && !use_nasm && fmt != NULL) {
+        jobs_wait(out, &u->log);
+        if (mu_assemble(&state, out, fmt->out) == 0) {
+            native = true;
+        } else if (errno == -ENOTSUP && !state.inline_asm) {
+            outbuf_printf(&u->log,
+                "fatal: internal error: generated code not assembled\n");
+            gup_state_destroy(&state);
+            return -1;
+        } else if (errno == -EFBIG) {
+            outbuf_printf(&u->log,
+                "fatal: boot sector is larger than 510 bytes\n");
+            gup_state_destroy(&state);
+            return -1;
+        } else if (errno != -ENOTSUP) {
+            outbuf_printf(&u->log, "fatal: failed to write %s\n", out);
+            gup_state_destroy(&state);
+            return -1;
+        }
+    }
+
+    /* nasm gets a uniquely named copy so runs cannot clobber each other */
+    if (!asm_only && !native) {
+        if ((fd = tmp_create(src, ".asm")) < 0) {
+            outbuf_printf(&u->log,
+                "fatal: failed to create a temporary file\n");
+            gup_state_destroy(&state);
+            return -1;
+        }
+
+        error = gup_state_flush(&state, fd);
+        close(fd);
+        if (error < 0) {
+            outbuf_printf(&u->log, "fatal: failed to write %s\n", src);
+            remove(src);
+            gup_state_destroy(&state);
+            return -1;
+        }
+    }
+
     clock_gettime(CLOCK_REALTIME, &end);
     elapsed_ns = ELAPSED_NS(&start, &end);
     elapsed_ms = elapsed_ns / 1e+6;
-    printf("compiled in %.2fms [%.2fns]\n", elapsed_ms, elapsed_ns);
+    outbuf_printf(&u->log, "compiled in %.2fms [%.2fns]\n",
+        elapsed_ms, elapsed_ns);
 
     gup_state_destroy(&state);
-    if (!asm_only) {
-        assemble(DEFAULT_ASMOUT);
+    if (!asm_only && !native) {
+        return assemble(src, fmt, out, &u->log);
+    }
+
+    return 0;
+}
+
+/*
+ * Compiler thread, takes inputs off the queue until none
+ * are left or one has failed.
+ *
+ * @arg: Input queue
+ */
+static void *
+compile_worker(void *arg)
+{
+    struct unit_queue *q = arg;
+    struct unit *u;
+
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        if (q->stop || q->next == q->count) {
+            pthread_mutex_unlock(&q->lock);
+            break;
+        }
+
+        u = &q->units[q->next++];
+        pthread_mutex_unlock(&q->lock);
+
+        u->error = compile(u) < 0;
+        pthread_mutex_lock(&q->lock);
+        u->done = true;
+        if (u->error) {
+            q->stop = true;
+        }
+
+        pthread_cond_broadcast(&q->cv);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Name the output of an input after the input itself,
+ * e.g., "fw/boot.gup" becomes "fw/boot.o".
+ *
+ * @path: Source input file path
+ *
+ * Returns NULL on failure
+ */
+static char *
+out_name(const char *path)
+{
+    const struct out_fmt *fmt;
+    const char *base, *dot, *suffix;
+    size_t len;
+    char *res;
+
+    if (asm_only) {
+        suffix = ".asm";
+    } else {
+        fmt = out_fmt(bin_fmt);
+        suffix = (fmt != NULL) ? fmt->suffix : ".o";
+    }
+
+    base = strrchr(path, '/');
+    base = (base != NULL) ? base + 1 : path;
+    dot = strrchr(base, '.');
+    len = (dot != NULL && dot != base) ? (size_t)(dot - path) : strlen(path);
+
+    if ((res = malloc(len + strlen(suffix) + 1)) == NULL) {
+        return NULL;
+    }
+
+    memcpy(res, path, len);
+    strcpy(&res[len], suffix);
+    return res;
+}
+
+/*
+ * Pick the output of every input, a single input keeps
+ * the default output while several are each named after
+ * their input so that none of them clobber each other.
+ *
+ * @q: Input queue
+ *
+ * Returns zero on success
+ */
+static int
+units_name(struct unit_queue *q)
+{
+    const struct out_fmt *fmt;
+    const char *out;
+    struct unit *u;
+    size_t i, j;
+
+    fmt = out_fmt(bin_fmt);
+    if (out_path != NULL) {
+        out = out_path;
+    } else if (asm_only) {
+        out = DEFAULT_ASMOUT;
+    } else {
+        out = (fmt != NULL) ? fmt->path : DEFAULT_OBJOUT;
+    }
+
+    for (i = 0; i < q->count; ++i) {
+        u = &q->units[i];
+        if (q->count == 1 || strcmp(u->path, "-") == 0) {
+            u->out = strdup(out);
+        } else {
+            u->out = out_name(u->path);
+        }
+
+        if (u->out == NULL) {
+            return -1;
+        }
+
+        if (strcmp(u->out, u->path) == 0) {
+            fprintf(stderr, "fatal: %s would overwrite itself\n", u->path);
+            return -1;
+        }
+
+        for (j = 0; j < i; ++j) {
+            if (strcmp(q->units[j].out, u->out) == 0) {
+                fprintf(stderr, "fatal: %s and %s both write %s\n",
+                    q->units[j].path, u->path, u->out);
+                return -1;
+            }
+        }
     }
 
     return 0;
 }
 
+/*
+ * Compile every input, on several threads if asked to,
+ * diagnostics are written out in input order either way.
+ *
+ * @q: Input queue
+ *
+ * Returns zero if every input compiled
+ */
+static int
+units_compile(struct unit_queue *q)
+{
+    pthread_t threads[THREADS_MAX];
+    struct unit *u;
+    long i, started = 0;
+    int error = 0;
+
+    if ((size_t)nthreads > q->count) {
+        nthreads = q->count;
+    }
+
+    for (i = 0; nthreads > 1 && i < nthreads; ++i) {
+        if (pthread_create(&threads[i], NULL, compile_worker, q) != 0) {
+            break;
+        }
+
+        ++started;
+    }
+
+    /* Compile on this thread if none were started */
+    if (started == 0) {
+        nthreads = 1;
+    }
+
+    for (i = 0; (size_t)i < q->count; ++i) {
+        u = &q->units[i];
+        if (started == 0) {
+            u->error = compile(u) < 0;
+            u->done = true;
+        }
+
+        pthread_mutex_lock(&q->lock);
+        while (!u->done && !(q->stop && (size_t)i >= q->next)) {
+            pthread_cond_wait(&q->cv, &q->lock);
+        }
+
+        pthread_mutex_unlock(&q->lock);
+        if (!u->done) {
+            break;
+        }
+
+        outbuf_flush(&u->log, STDERR_FILENO);
+        if (u->error) {
+            error = -1;
+            break;
+        }
+    }
+
+    for (i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return error;
+}
+
 int
 main(int argc, char **argv)
 {
-    int opt;
+    struct unit_queue q;
+    struct outbuf log;
+    char *end;
+    size_t i;
+    int opt, error;
 
     if (argc < 2) {
         printf("fatal: too few arguments!\n");
@@ -107,7 +739,7 @@ main(int argc, char **argv)
         return -1;
     }
 
-    while ((opt = getopt(argc, argv, "hvaf:")) != -1) {
+    while ((opt = getopt(argc, argv, "hvanOf:o:j:")) != -1) {
         switch (opt) {
         case 'h':
             help();
@@ -118,17 +750,82 @@ main(int argc, char **argv)
         case 'a':
             asm_only = true;
             break;
+        case 'n':
+            use_nasm = true;
+            break;
+        case 'O':
+            optimize = true;
+            break;
         case 'f':
             bin_fmt = strdup(optarg);
             break;
+        case 'o':
+            out_path = strdup(optarg);
+            break;
+        case 'j':
+            nthreads = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || nthreads < 0) {
+                fprintf(stderr, "fatal: bad thread count %s\n", optarg);
+                return -1;
+            }
+            break;
         }
     }
 
-    while (optind < argc) {
-        if (compile(argv[optind++]) < 0) {
-            return -1;
-        }
+    /* Every input would be written to the same output */
+    if (out_path != NULL && argc - optind > 1) {
+        fprintf(stderr, "fatal: -o takes a single input\n");
+        return -1;
     }
 
-    return 0;
+    if (optind == argc) {
+        return 0;
+    }
+
+    if (nthreads == 0) {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    if (nthreads < 1) {
+        nthreads = 1;
+    } else if (nthreads > THREADS_MAX) {
+        nthreads = THREADS_MAX;
+    }
+
+    memset(&q, 0, sizeof(q));
+    q.count = argc - optind;
+    if ((q.units = calloc(q.count, sizeof(*q.units))) == NULL) {
+        fprintf(stderr, "fatal: out of memory\n");
+        return -1;
+    }
+
+    for (i = 0; i < q.count; ++i) {
+        q.units[i].path = argv[optind + i];
+        outbuf_init(&q.units[i].log);
+    }
+
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.cv, NULL);
+    error = units_name(&q);
+    if (error == 0) {
+        error = units_compile(&q);
+    }
+
+    /* nasm may still be writing outputs of earlier inputs */
+    outbuf_init(&log);
+    if (jobs_wait(NULL, &log) < 0) {
+        error = -1;
+    }
+
+    outbuf_flush(&log, STDERR_FILENO);
+    outbuf_destroy(&log);
+    for (i = 0; i < q.count; ++i) {
+        free(q.units[i].out);
+        outbuf_destroy(&q.units[i].log);
+    }
+
+    pthread_cond_destroy(&q.cv);
+    pthread_mutex_destroy(&q.lock);
+    free(q.units);
+    return error;
 }
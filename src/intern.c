@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "gup/intern.h"
+
+/* Initial number of hash table slots, must be a power of two */
+#define INTERN_INIT_CAP 256
+
+/*
+ * Hash a string (32-bit FNV-1a)
+ *
+ * @s: String to hash
+ * @len: Length of string
+ */
+static inline uint32_t
+intern_hash(const char *s, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        hash ^= (uint8_t)s[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/*
+ * Find the slot of a string
+ *
+ * @pool: Intern pool
+ * @hash: Hash of string
+ * @s: String to find
+ * @len: Length of string
+ *
+ * Returns the slot holding the string or the free slot
+ * it would go in.
+ */
+static struct intern_slot *
+intern_probe(struct intern_pool *pool, uint32_t hash, const char *s,
+    size_t len)
+{
+    struct intern_slot *slot;
+    size_t i, mask;
+
+    mask = pool->slot_cap - 1;
+    i = hash & mask;
+    for (;;) {
+        slot = &pool->slots[i];
+        if (slot->str == NULL) {
+            return slot;
+        }
+
+        if (slot->hash == hash && slot->len == len) {
+            if (memcmp(slot->str, s, len) == 0) {
+                return slot;
+            }
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+/*
+ * Double the number of hash table slots
+ *
+ * @pool: Intern pool to grow
+ *
+ * Returns zero on success
+ */
+static int
+intern_grow(struct intern_pool *pool)
+{
+    struct intern_slot *old, *slot;
+    size_t i, old_cap;
+
+    old = pool->slots;
+    old_cap = pool->slot_cap;
+    pool->slots = calloc(old_cap * 2, sizeof(*pool->slots));
+    if (pool->slots == NULL) {
+        pool->slots = old;
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    pool->slot_cap = old_cap * 2;
+    for (i = 0; i < old_cap; ++i) {
+        if (old[i].str == NULL) {
+            continue;
+        }
+
+        slot = &pool->slots[old[i].hash & (pool->slot_cap - 1)];
+        while (slot->str != NULL) {
+            if (++slot == &pool->slots[pool->slot_cap]) {
+                slot = pool->slots;
+            }
+        }
+
+        *slot = old[i];
+    }
+
+    free(old);
+    return 0;
+}
+
+int
+intern_init(struct intern_pool *res)
+{
+    if (res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->slots = calloc(INTERN_INIT_CAP, sizeof(*res->slots));
+    if (res->slots == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    res->slot_cap = INTERN_INIT_CAP;
+    return arena_init(&res->arena, 0);
+}
+
+const char *
+intern_strn(struct intern_pool *pool, const char *s, size_t len)
+{
+    struct intern_slot *slot;
+    uint32_t hash;
+    char *str;
+
+    if (pool == NULL || s == NULL || len > UINT32_MAX) {
+        return NULL;
+    }
+
+    hash = intern_hash(s, len);
+    slot = intern_probe(pool, hash, s, len);
+    if (slot->str != NULL) {
+        return slot->str;
+    }
+
+    /* Keep the load factor under 3/4 */
+    if ((pool->count + 1) * 4 > pool->slot_cap * 3) {
+        if (intern_grow(pool) < 0) {
+            return NULL;
+        }
+
+        slot = intern_probe(pool, hash, s, len);
+    }
+
+    if ((str = arena_alloc(&pool->arena, len + 1, 1)) == NULL) {
+        return NULL;
+    }
+
+    memcpy(str, s, len);
+    str[len] = '\0';
+
+    slot->hash = hash;
+    slot->len = len;
+    slot->str = str;
+    ++pool->count;
+    return str;
+}
+
+const char *
+intern_str(struct intern_pool *pool, const char *s)
+{
+    if (s == NULL) {
+        return NULL;
+    }
+
+    return intern_strn(pool, s, strlen(s));
+}
+
+const char *
+intern_lookup(struct intern_pool *pool, const char *s, size_t len)
+{
+    if (pool == NULL || s == NULL || len > UINT32_MAX) {
+        return NULL;
+    }
+
+    return intern_probe(pool, intern_hash(s, len), s, len)->str;
+}
+
+void
+intern_destroy(struct intern_pool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    arena_destroy(&pool->arena);
+    free(pool->slots);
+    pool->slots = NULL;
+    pool->count = 0;
+}
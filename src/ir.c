@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gup/ir.h"
+
+/* Initial capacity of each array of a procedure */
+#define IR_INIT_CAP 64
+
+/*
+ * Make room for one more element of an array
+ *
+ * @arr: Array, reallocated if full
+ * @len: Number of elements
+ * @cap: Capacity, updated if the array grows
+ * @elem: Size of an element
+ *
+ * Returns zero on success
+ */
+static int
+ir_reserve(void **arr, size_t len, size_t *cap, size_t elem)
+{
+    size_t new_cap;
+    void *tmp;
+
+    if (len < *cap) {
+        return 0;
+    }
+
+    new_cap = (*cap != 0) ? *cap * 2 : IR_INIT_CAP;
+    if ((tmp = realloc(*arr, new_cap * elem)) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    *arr = tmp;
+    *cap = new_cap;
+    return 0;
+}
+
+void
+ir_begin(struct ir_proc *proc, struct symbol *func)
+{
+    proc->func = func;
+    proc->count = 0;
+    proc->nblocks = 0;
+    proc->nvregs = 0;
+    proc->nloops = 0;
+    proc->nifs = 0;
+}
+
+struct ir_insn *
+ir_push(struct ir_proc *proc, ir_op_t op, msize_t size)
+{
+    struct ir_insn *insn;
+    int error;
+
+    error = ir_reserve(
+        (void **)&proc->insns, proc->count,
+        &proc->cap, sizeof(*proc->insns)
+    );
+
+    if (error < 0) {
+        return NULL;
+    }
+
+    insn = &proc->insns[proc->count++];
+    memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->size = size;
+    insn->dst = IR_VREG_NONE;
+    return insn;
+}
+
+ir_vreg_t
+ir_vreg(struct ir_proc *proc)
+{
+    return proc->nvregs++;
+}
+
+int
+ir_block(struct ir_proc *proc, const char *label, uint32_t *res)
+{
+    struct ir_block *block;
+    int error;
+
+    if (label != NULL && strlen(label) >= IR_LABEL_MAX) {
+        errno = -ENAMETOOLONG;
+        return -1;
+    }
+
+    error = ir_reserve(
+        (void **)&proc->blocks, proc->nblocks,
+        &proc->block_cap, sizeof(*proc->blocks)
+    );
+
+    if (error < 0) {
+        return -1;
+    }
+
+    block = &proc->blocks[proc->nblocks];
+    block->label[0] = '\0';
+    if (label != NULL) {
+        strcpy(block->label, label);
+    }
+
+    *res = proc->nblocks++;
+    return 0;
+}
+
+int
+ir_place(struct ir_proc *proc, uint32_t block)
+{
+    struct ir_insn *insn;
+
+    if (block >= proc->nblocks) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((insn = ir_push(proc, IR_LABEL, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->target[0] = block;
+    return 0;
+}
+
+int
+ir_loop_push(struct ir_proc *proc, uint32_t head)
+{
+    int error;
+
+    error = ir_reserve(
+        (void **)&proc->loops, proc->nloops,
+        &proc->loop_cap, sizeof(*proc->loops)
+    );
+
+    if (error < 0) {
+        return -1;
+    }
+
+    proc->loops[proc->nloops++] = head;
+    return 0;
+}
+
+int
+ir_if_push(struct ir_proc *proc, uint32_t other)
+{
+    int error;
+
+    error = ir_reserve(
+        (void **)&proc->ifs, proc->nifs,
+        &proc->if_cap, sizeof(*proc->ifs)
+    );
+
+    if (error < 0) {
+        return -1;
+    }
+
+    proc->ifs[proc->nifs++] = other;
+    return 0;
+}
+
+void
+ir_destroy(struct ir_proc *proc)
+{
+    if (proc == NULL) {
+        return;
+    }
+
+    free(proc->insns);
+    free(proc->blocks);
+    free(proc->loops);
+    free(proc->ifs);
+    memset(proc, 0, sizeof(*proc));
+}
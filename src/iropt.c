@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gup/ir.h"
+
+/*
+ * Truncate a value to a machine size
+ *
+ * @v: Value to truncate
+ * @size: Machine size
+ */
+static int64_t
+ir_trunc(int64_t v, msize_t size)
+{
+    size_t bits;
+
+    bits = msize_bytes(size) * 8;
+    if (bits == 0 || bits >= 64) {
+        return v;
+    }
+
+    return (int64_t)((uint64_t)v & (((uint64_t)1 << bits) - 1));
+}
+
+/*
+ * Evaluate an operation on two immediates
+ *
+ * @insn: Instruction with immediate operands
+ * @res: Result is written here
+ *
+ * Returns zero if the result is known
+ */
+static int
+ir_eval(const struct ir_insn *insn, int64_t *res)
+{
+    uint64_t a, b;
+    size_t bits;
+
+    a = ir_trunc(insn->a.imm, insn->size);
+    b = ir_trunc(insn->b.imm, insn->size);
+    bits = msize_bytes(insn->size) * 8;
+
+    switch (insn->op) {
+    case IR_ADD: *res = a + b; break;
+    case IR_SUB: *res = a - b; break;
+    case IR_MUL: *res = a * b; break;
+    case IR_AND: *res = a & b; break;
+    case IR_OR:  *res = a | b; break;
+    case IR_XOR: *res = a ^ b; break;
+    case IR_EQ:  *res = a == b; return 0;
+    case IR_NE:  *res = a != b; return 0;
+    case IR_LT:  *res = a < b; return 0;
+    case IR_LE:  *res = a <= b; return 0;
+    case IR_DIV:
+    case IR_MOD:
+        /* Division by zero is left to the machine */
+        if (b == 0) {
+            return -1;
+        }
+
+        *res = (insn->op == IR_DIV) ? a / b : a % b;
+        break;
+    case IR_SHL:
+    case IR_SHR:
+        /* Out of range shifts are left to the machine */
+        if (b >= bits) {
+            return -1;
+        }
+
+        *res = (insn->op == IR_SHL) ? a << b : a >> b;
+        break;
+    default:
+        return -1;
+    }
+
+    *res = ir_trunc(*res, insn->size);
+    return 0;
+}
+
+/*
+ * Replace an operand known to be a constant with an
+ * immediate.
+ *
+ * @opnd: Operand
+ * @known: Set for each virtual register known to be constant
+ * @vals: Value of each constant virtual register
+ */
+static void
+ir_fold_opnd(struct ir_operand *opnd, const uint8_t *known,
+    const int64_t *vals)
+{
+    if (opnd->kind != IR_OPND_VREG || !known[opnd->vreg]) {
+        return;
+    }
+
+    opnd->kind = IR_OPND_IMM;
+    opnd->imm = vals[opnd->vreg];
+}
+
+/*
+ * Fold constants, every virtual register is written once
+ * and ahead of its uses so a single walk sees them all.
+ *
+ * @proc: IR procedure
+ * @known: Scratch space, a byte per virtual register
+ * @vals: Scratch space, a value per virtual register
+ */
+static void
+ir_fold(struct ir_proc *proc, uint8_t *known, int64_t *vals)
+{
+    struct ir_insn *insn, cmp;
+    int64_t v;
+    size_t i;
+
+    memset(known, 0, proc->nvregs);
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        ir_fold_opnd(&insn->a, known, vals);
+        ir_fold_opnd(&insn->b, known, vals);
+
+        if (ir_is_binop(insn->op)) {
+            if (insn->a.kind != IR_OPND_IMM || insn->b.kind != IR_OPND_IMM) {
+                continue;
+            }
+
+            if (ir_eval(insn, &v) < 0) {
+                continue;
+            }
+
+            insn->op = IR_CONST;
+            insn->a.imm = v;
+            insn->b.kind = IR_OPND_NONE;
+        }
+
+        switch (insn->op) {
+        case IR_CONST:
+            if (insn->a.kind == IR_OPND_IMM) {
+                known[insn->dst] = 1;
+                vals[insn->dst] = insn->a.imm;
+            }
+
+            break;
+        case IR_BR:
+            /* A known condition always goes the same way */
+            if (insn->a.kind != IR_OPND_IMM || insn->b.kind != IR_OPND_IMM) {
+                break;
+            }
+
+            cmp = *insn;
+            cmp.op = insn->cond;
+            if (ir_eval(&cmp, &v) < 0) {
+                break;
+            }
+
+            if (v == 0) {
+                insn->target[0] = insn->target[1];
+            }
+
+            insn->op = IR_JMP;
+            insn->a.kind = IR_OPND_NONE;
+            insn->b.kind = IR_OPND_NONE;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/*
+ * Point jumps to a block that does nothing but jump
+ * elsewhere at where it jumps to, e.g., an if statement
+ * that only breaks out of a loop. The block left behind
+ * is then pruned if nothing else reaches it.
+ *
+ * XXX: Only a single hop is taken, so that jumps going
+ *      around in a circle are left alone.
+ *
+ * @proc: IR procedure
+ *
+ * Returns zero on success
+ */
+static int
+ir_thread(struct ir_proc *proc)
+{
+    struct ir_insn *insn, *next;
+    uint32_t *to;
+    size_t i, j, k;
+
+    to = malloc((proc->nblocks + 1) * sizeof(*to));
+    if (to == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < proc->nblocks; ++i) {
+        to[i] = i;
+    }
+
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        if (insn->op != IR_LABEL) {
+            continue;
+        }
+
+        /* Labels placed together all go to the same jump */
+        for (j = i + 1; j < proc->count; ++j) {
+            next = &proc->insns[j];
+            if (next->op != IR_NOP && next->op != IR_LABEL) {
+                break;
+            }
+        }
+
+        if (j == proc->count || proc->insns[j].op != IR_JMP) {
+            continue;
+        }
+
+        /* A block without a label is only ever fallen into */
+        if (proc->blocks[proc->insns[j].target[0]].label[0] == '\0') {
+            i = j;
+            continue;
+        }
+
+        for (k = i; k < j; ++k) {
+            next = &proc->insns[k];
+            if (next->op == IR_LABEL) {
+                to[next->target[0]] = proc->insns[j].target[0];
+            }
+        }
+
+        i = j;
+    }
+
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        switch (insn->op) {
+        case IR_BR:
+            insn->target[1] = to[insn->target[1]];
+            /* FALLTHROUGH */
+        case IR_JMP:
+            insn->target[0] = to[insn->target[0]];
+            break;
+        default:
+            break;
+        }
+    }
+
+    free(to);
+    return 0;
+}
+
+/*
+ * Remove the instructions no path from the entry can
+ * reach. Code is split into runs that start at the entry,
+ * at a label or after a jump, the runs reached are found
+ * with a worklist.
+ *
+ * XXX: Inline assembly may hold labels jumped to from
+ *      anywhere, runs with it are always kept.
+ *
+ * @proc: IR procedure
+ *
+ * Returns zero on success
+ */
+static int
+ir_prune(struct ir_proc *proc)
+{
+    struct ir_insn *insn, *last;
+    size_t *start, *block_run, *work;
+    size_t i, nruns = 0, nwork = 0, nsucc, run;
+    size_t succ[2];
+    uint8_t *live;
+
+    if (proc->count == 0) {
+        return 0;
+    }
+
+    start = malloc((proc->count + 1) * sizeof(*start));
+    block_run = malloc((proc->nblocks + 1) * sizeof(*block_run));
+    work = malloc(proc->count * sizeof(*work));
+    live = calloc(proc->count, 1);
+
+    if (start == NULL || block_run == NULL || work == NULL || live == NULL) {
+        free(start);
+        free(block_run);
+        free(work);
+        free(live);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    /* Blocks that were never placed cannot be reached */
+    for (i = 0; i < proc->nblocks; ++i) {
+        block_run[i] = SIZE_MAX;
+    }
+
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        if (i == 0 || insn->op == IR_LABEL || ir_is_jump(&insn[-1])) {
+            start[nruns++] = i;
+        }
+
+        if (insn->op == IR_LABEL) {
+            block_run[insn->target[0]] = nruns - 1;
+        }
+
+        if (insn->op == IR_ASM && !live[nruns - 1]) {
+            live[nruns - 1] = 1;
+            work[nwork++] = nruns - 1;
+        }
+    }
+
+    start[nruns] = proc->count;
+    if (!live[0]) {
+        live[0] = 1;
+        work[nwork++] = 0;
+    }
+
+    while (nwork > 0) {
+        run = work[--nwork];
+        last = &proc->insns[start[run + 1] - 1];
+
+        nsucc = 0;
+        switch (last->op) {
+        case IR_RET:
+            break;
+        case IR_BR:
+            succ[nsucc++] = block_run[last->target[1]];
+            /* FALLTHROUGH */
+        case IR_JMP:
+            succ[nsucc++] = block_run[last->target[0]];
+            break;
+        default:
+            /* Falls through into the next run */
+            succ[nsucc++] = run + 1;
+            break;
+        }
+
+        for (i = 0; i < nsucc; ++i) {
+            if (succ[i] < nruns && !live[succ[i]]) {
+                live[succ[i]] = 1;
+                work[nwork++] = succ[i];
+            }
+        }
+    }
+
+    for (run = 0; run < nruns; ++run) {
+        if (live[run]) {
+            continue;
+        }
+
+        for (i = start[run]; i < start[run + 1]; ++i) {
+            proc->insns[i].op = IR_NOP;
+        }
+    }
+
+    free(start);
+    free(block_run);
+    free(work);
+    free(live);
+    return 0;
+}
+
+/*
+ * Count a use of an operand
+ *
+ * @opnd: Operand
+ * @uses: Uses of each virtual register
+ * @n: Added to the count, -1 to take a use away
+ */
+static void
+ir_use(const struct ir_operand *opnd, uint32_t *uses, int n)
+{
+    if (opnd->kind == IR_OPND_VREG) {
+        uses[opnd->vreg] += n;
+    }
+}
+
+/*
+ * Remove instructions whose results are never used,
+ * walking backwards so that whole chains go at once.
+ *
+ * @proc: IR procedure
+ * @uses: Scratch space, a count per virtual register
+ */
+static void
+ir_dce(struct ir_proc *proc, uint32_t *uses)
+{
+    struct ir_insn *insn;
+    size_t i;
+
+    memset(uses, 0, proc->nvregs * sizeof(*uses));
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        if (insn->op == IR_NOP) {
+            continue;
+        }
+
+        ir_use(&insn->a, uses, 1);
+        ir_use(&insn->b, uses, 1);
+    }
+
+    for (i = proc->count; i-- > 0;) {
+        insn = &proc->insns[i];
+        if (!ir_is_pure(insn) || uses[insn->dst] != 0) {
+            continue;
+        }
+
+        ir_use(&insn->a, uses, -1);
+        ir_use(&insn->b, uses, -1);
+        insn->op = IR_NOP;
+    }
+}
+
+/*
+ * Write the value stored to a promoted local straight
+ * from the instruction computing it when the store is
+ * its only use, e.g., 'x = x + 1' becomes a single add.
+ *
+ * XXX: Only when both are the same size, a narrower store
+ *      truncates the value.
+ *
+ * @proc: IR procedure
+ * @nvregs: Number of virtual registers before promotion
+ * @uses: Scratch space, a count per virtual register
+ */
+static void
+ir_coalesce(struct ir_proc *proc, ir_vreg_t nvregs, uint32_t *uses)
+{
+    struct ir_insn *insn, *def;
+    size_t i, j;
+
+    memset(uses, 0, nvregs * sizeof(*uses));
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        if (insn->op == IR_NOP) {
+            continue;
+        }
+
+        if (insn->a.kind == IR_OPND_VREG && insn->a.vreg < nvregs) {
+            ++uses[insn->a.vreg];
+        }
+
+        if (insn->b.kind == IR_OPND_VREG && insn->b.vreg < nvregs) {
+            ++uses[insn->b.vreg];
+        }
+    }
+
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        if (insn->op != IR_MOV || insn->a.vreg >= nvregs) {
+            continue;
+        }
+
+        if (uses[insn->a.vreg] != 1) {
+            continue;
+        }
+
+        for (j = i; j-- > 0 && proc->insns[j].op == IR_NOP;);
+        if (j == SIZE_MAX) {
+            continue;
+        }
+
+        def = &proc->insns[j];
+        if (def->dst != insn->a.vreg || def->size != insn->size) {
+            continue;
+        }
+
+        if (def->op != IR_CONST && !ir_is_binop(def->op)) {
+            continue;
+        }
+
+        def->dst = insn->dst;
+        insn->op = IR_NOP;
+    }
+}
+
+int
+ir_promote(struct ir_proc *proc)
+{
+    struct ir_insn *insn;
+    struct symbol *func;
+    ir_vreg_t *home, *repl, nvregs;
+    uint32_t *uses;
+    size_t i;
+
+    if (proc == NULL || (func = proc->func) == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < proc->count; ++i) {
+        if (proc->insns[i].op == IR_ASM) {
+            return 0;
+        }
+    }
+
+    nvregs = proc->nvregs;
+    home = malloc((func->frame_size + 1) * sizeof(*home));
+    repl = malloc((nvregs + 1) * sizeof(*repl));
+    uses = malloc((nvregs + 1) * sizeof(*uses));
+
+    if (home == NULL || repl == NULL || uses == NULL) {
+        free(home);
+        free(repl);
+        free(uses);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    /* Each local is found by its offset in the frame */
+    for (i = 0; i <= func->frame_size; ++i) {
+        home[i] = IR_VREG_NONE;
+    }
+
+    for (i = 0; i < nvregs; ++i) {
+        repl[i] = IR_VREG_NONE;
+    }
+
+    /*
+     * A load only has uses within its own statement and
+     * the store ending the statement comes after them, so
+     * its uses may read the local itself.
+     */
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        if (insn->a.kind == IR_OPND_VREG && repl[insn->a.vreg] != IR_VREG_NONE) {
+            insn->a.vreg = repl[insn->a.vreg];
+        }
+
+        if (insn->b.kind == IR_OPND_VREG && repl[insn->b.vreg] != IR_VREG_NONE) {
+            insn->b.vreg = repl[insn->b.vreg];
+        }
+
+        if (insn->op != IR_LOAD && insn->op != IR_STORE) {
+            continue;
+        }
+
+        if (insn->addr.label != NULL) {
+            continue;
+        }
+
+        if (home[insn->addr.off] == IR_VREG_NONE) {
+            home[insn->addr.off] = ir_vreg(proc);
+        }
+
+        if (insn->op == IR_LOAD) {
+            repl[insn->dst] = home[insn->addr.off];
+            insn->op = IR_NOP;
+            continue;
+        }
+
+        insn->op = (insn->a.kind == IR_OPND_IMM) ? IR_CONST : IR_MOV;
+        insn->dst = home[insn->addr.off];
+    }
+
+    /* Nothing is left in the frame but spill slots */
+    func->frame_size = 0;
+    ir_coalesce(proc, nvregs, uses);
+    free(home);
+    free(repl);
+    free(uses);
+    return 0;
+}
+
+int
+ir_optimize(struct ir_proc *proc)
+{
+    uint8_t *known;
+    int64_t *vals;
+    uint32_t *uses;
+
+    if (proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    known = malloc(proc->nvregs + 1);
+    vals = malloc((proc->nvregs + 1) * sizeof(*vals));
+    uses = malloc((proc->nvregs + 1) * sizeof(*uses));
+
+    if (known == NULL || vals == NULL || uses == NULL) {
+        free(known);
+        free(vals);
+        free(uses);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    /* Folding settles branches, pruning drops uses */
+    ir_fold(proc, known, vals);
+    if (ir_thread(proc) < 0 || ir_prune(proc) < 0) {
+        free(known);
+        free(vals);
+        free(uses);
+        return -1;
+    }
+
+    ir_dce(proc, uses);
+    free(known);
+    free(vals);
+    free(uses);
+    return 0;
+}
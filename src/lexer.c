@@ -5,229 +5,510 @@
 
 #include <stdint.h>
 #include <errno.h>
-#include <ctype.h>
 #include <string.h>
-#include <unistd.h>
 #include <stddef.h>
-#include <stdlib.h>
 #include <stdbool.h>
 #include "gup/lexer.h"
 #include "gup/trace.h"
+#include "gup/scan.h"
 
 /*
- * Place a byte in the putback buffer
+ * Keywords are recognized with a perfect hash over the first
+ * byte, the last byte and the length of an identifier. The
+ * hash is collision free for every keyword in the table below
+ * so that a lookup costs a single comparison.
+ *
+ * XXX: When adding a keyword, make sure its slot is not
+ *      already taken, otherwise grow KWTAB_SIZE.
+ */
+#define KWTAB_SIZE 64
+#define KW_HASH(first, last, len) \
+    (((first) + (last) + (len)) & (KWTAB_SIZE - 1))
+
+/*
+ * Represents a keyword table entry
+ *
+ * @name: Keyword name
+ * @len: Length of keyword name
+ * @type: Token type of keyword
+ */
+struct keyword {
+    const char *name;
+    size_t len;
+    tt_t type;
+};
+
+static const struct keyword kwtab[KWTAB_SIZE] = {
+    [KW_HASH('u', '8', 2)] = { "u8", 2, TT_U8 },
+    [KW_HASH('u', '6', 3)] = { "u16", 3, TT_U16 },
+    [KW_HASH('u', '2', 3)] = { "u32", 3, TT_U32 },
+    [KW_HASH('u', '4', 3)] = { "u64", 3, TT_U64 },
+    [KW_HASH('p', 'c', 4)] = { "proc", 4, TT_PROC },
+    [KW_HASH('p', 'b', 3)] = { "pub", 3, TT_PUB },
+    [KW_HASH('v', 'd', 4)] = { "void", 4, TT_VOID },
+    [KW_HASH('l', 'p', 4)] = { "loop", 4, TT_LOOP },
+    [KW_HASH('b', 'k', 5)] = { "break", 5, TT_BREAK },
+    [KW_HASH('r', 'n', 6)] = { "return", 6, TT_RETURN },
+    [KW_HASH('s', 't', 6)] = { "struct", 6, TT_STRUCT },
+    [KW_HASH('c', 'e', 8)] = { "continue", 8, TT_CONT },
+    [KW_HASH('i', 'f', 2)] = { "if", 2, TT_IF },
+    [KW_HASH('e', 'e', 4)] = { "else", 4, TT_ELSE },
+    [KW_HASH('t', 'e', 4)] = { "type", 4, TT_TYPE }
+};
+
+/*
+ * Character classes used by the scanner
+ *
+ * @CC_SPACE:   Whitespace other than newlines
+ * @CC_NEWLINE: Line feed, counted while skipping
+ * @CC_DIGIT:   Decimal digits
+ * @CC_ALPHA:   Letters and the underscore
+ * @CC_PUNCT:   Start of an operator or punctuator
+ * @CC_QUOTE:   Start of a character literal
+ */
+#define CC_SPACE    (1 << 0)
+#define CC_NEWLINE  (1 << 1)
+#define CC_DIGIT    (1 << 2)
+#define CC_ALPHA    (1 << 3)
+#define CC_PUNCT    (1 << 4)
+#define CC_QUOTE    (1 << 5)
+
+/* Bytes that may appear after the first in an identifier */
+#define CC_IDENT    (CC_ALPHA | CC_DIGIT)
+
+/* Maximum number of two byte tokens sharing a first byte */
+#define LEXER_MAX_EDGES 2
+
+/*
+ * A lookup table used to classify every input byte, any
+ * byte without a class is invalid outside of comments and
+ * assembly.
+ */
+static const uint8_t cctab[256] = {
+    [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\r'] = CC_SPACE,
+    ['\f'] = CC_SPACE, ['\n'] = CC_NEWLINE, ['0'] = CC_DIGIT,
+    ['1'] = CC_DIGIT, ['2'] = CC_DIGIT, ['3'] = CC_DIGIT, ['4'] = CC_DIGIT,
+    ['5'] = CC_DIGIT, ['6'] = CC_DIGIT, ['7'] = CC_DIGIT, ['8'] = CC_DIGIT,
+    ['9'] = CC_DIGIT, ['a'] = CC_ALPHA, ['b'] = CC_ALPHA, ['c'] = CC_ALPHA,
+    ['d'] = CC_ALPHA, ['e'] = CC_ALPHA, ['f'] = CC_ALPHA, ['g'] = CC_ALPHA,
+    ['h'] = CC_ALPHA, ['i'] = CC_ALPHA, ['j'] = CC_ALPHA, ['k'] = CC_ALPHA,
+    ['l'] = CC_ALPHA, ['m'] = CC_ALPHA, ['n'] = CC_ALPHA, ['o'] = CC_ALPHA,
+    ['p'] = CC_ALPHA, ['q'] = CC_ALPHA, ['r'] = CC_ALPHA, ['s'] = CC_ALPHA,
+    ['t'] = CC_ALPHA, ['u'] = CC_ALPHA, ['v'] = CC_ALPHA, ['w'] = CC_ALPHA,
+    ['x'] = CC_ALPHA, ['y'] = CC_ALPHA, ['z'] = CC_ALPHA, ['A'] = CC_ALPHA,
+    ['B'] = CC_ALPHA, ['C'] = CC_ALPHA, ['D'] = CC_ALPHA, ['E'] = CC_ALPHA,
+    ['F'] = CC_ALPHA, ['G'] = CC_ALPHA, ['H'] = CC_ALPHA, ['I'] = CC_ALPHA,
+    ['J'] = CC_ALPHA, ['K'] = CC_ALPHA, ['L'] = CC_ALPHA, ['M'] = CC_ALPHA,
+    ['N'] = CC_ALPHA, ['O'] = CC_ALPHA, ['P'] = CC_ALPHA, ['Q'] = CC_ALPHA,
+    ['R'] = CC_ALPHA, ['S'] = CC_ALPHA, ['T'] = CC_ALPHA, ['U'] = CC_ALPHA,
+    ['V'] = CC_ALPHA, ['W'] = CC_ALPHA, ['X'] = CC_ALPHA, ['Y'] = CC_ALPHA,
+    ['Z'] = CC_ALPHA, ['_'] = CC_ALPHA, ['@'] = CC_PUNCT, [';'] = CC_PUNCT,
+    ['*'] = CC_PUNCT, ['+'] = CC_PUNCT, ['-'] = CC_PUNCT, ['/'] = CC_PUNCT,
+    ['('] = CC_PUNCT, [')'] = CC_PUNCT, ['{'] = CC_PUNCT, ['}'] = CC_PUNCT,
+    ['<'] = CC_PUNCT, ['>'] = CC_PUNCT, ['.'] = CC_PUNCT, ['='] = CC_PUNCT,
+    ['&'] = CC_PUNCT, ['|'] = CC_PUNCT, ['^'] = CC_PUNCT, ['~'] = CC_PUNCT,
+    ['!'] = CC_PUNCT, ['%'] = CC_PUNCT, ['\''] = CC_QUOTE
+};
+
+/*
+ * Maps the first byte of an operator or punctuator to
+ * its single byte token type.
+ */
+static const uint8_t punctab[256] = {
+    ['@'] = TT_ASM,
+    [';'] = TT_SEMI,
+    ['*'] = TT_STAR,
+    ['+'] = TT_PLUS,
+    ['-'] = TT_MINUS,
+    ['/'] = TT_SLASH,
+    ['('] = TT_LPAREN,
+    [')'] = TT_RPAREN,
+    ['{'] = TT_LBRACE,
+    ['}'] = TT_RBRACE,
+    ['<'] = TT_LT,
+    ['>'] = TT_GT,
+    ['.'] = TT_DOT,
+    ['='] = TT_EQUALS,
+    ['&'] = TT_AMP,
+    ['|'] = TT_PIPE,
+    ['^'] = TT_CARET,
+    ['~'] = TT_TILDE,
+    ['!'] = TT_BANG,
+    ['%'] = TT_PERCENT
+};
+
+/*
+ * Maps hexadecimal digits to their value tagged with
+ * HEX_VALID, any other byte maps to zero.
+ */
+#define HEX_VALID 0x10
+#define HEX(v) (HEX_VALID | (v))
+static const uint8_t hextab[256] = {
+    ['0'] = HEX(0x0), ['1'] = HEX(0x1), ['2'] = HEX(0x2), ['3'] = HEX(0x3),
+    ['4'] = HEX(0x4), ['5'] = HEX(0x5), ['6'] = HEX(0x6), ['7'] = HEX(0x7),
+    ['8'] = HEX(0x8), ['9'] = HEX(0x9), ['a'] = HEX(0xA), ['b'] = HEX(0xB),
+    ['c'] = HEX(0xC), ['d'] = HEX(0xD), ['e'] = HEX(0xE), ['f'] = HEX(0xF),
+    ['A'] = HEX(0xA), ['B'] = HEX(0xB), ['C'] = HEX(0xC), ['D'] = HEX(0xD),
+    ['E'] = HEX(0xE), ['F'] = HEX(0xF)
+};
+
+/*
+ * Represents a transition from a single byte token to a
+ * two byte token.
+ *
+ * @next: Second byte that takes this edge
+ * @type: Token type after taking this edge
+ */
+struct lexer_edge {
+    uint8_t next;
+    uint8_t type;
+};
+
+/*
+ * Two byte token transitions indexed by the first byte,
+ * an edge with a zero 'next' ends the list.
+ */
+static const struct lexer_edge edgetab[256][LEXER_MAX_EDGES] = {
+    ['='] = { { '=', TT_EQUALITY } },
+    ['/'] = { { '/', TT_COMMENT } },
+    ['!'] = { { '=', TT_NEQ } },
+    ['<'] = { { '<', TT_SHL }, { '=', TT_LTE } },
+    ['>'] = { { '>', TT_SHR }, { '=', TT_GTE } },
+    ['&'] = { { '&', TT_LAND } },
+    ['|'] = { { '|', TT_LOR } }
+};
+
+/*
+ * Skip the remainder of a line
  *
  * @state: Compiler state
- * @c: Byte to place
  */
-static inline void
-lexer_putback(struct gup_state *state, char c)
+static void
+lexer_skip_line(struct gup_state *state)
 {
-    if (state == NULL) {
+    const char *p, *end;
+
+    p = state->in_buf + state->in_off;
+    end = state->in_buf + state->in_len;
+    if ((p = scan_find_nl(p, end)) == NULL) {
+        state->in_off = state->in_len;
         return;
     }
 
-    state->putback = c;
+    state->in_off = (p - state->in_buf) + 1;
+    ++state->line_num;
 }
 
-static void
-lexer_skip_line(struct gup_state *state)
+/*
+ * Scan a line of assembly
+ *
+ * @state: Compiler state
+ * @res: Token result written here
+ *
+ * XXX: The cursor must be past the '@'
+ *
+ * Returns zero on success
+ */
+static int
+lexer_scan_asm(struct gup_state *state, struct token *res)
 {
-    char c;
+    const char *start, *end, *p;
 
-    while (read(state->in_fd, &c, 1) > 0) {
-        if (c == '\n') {
-            break;
-        }
+    if (state == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
     }
+
+    start = state->in_buf + state->in_off;
+    end = state->in_buf + state->in_len;
+
+    /*
+     * This serves to ensure the assembly output stays
+     * pretty without any weird whitespaces. Skip a
+     * single space after the '@' if there is one.
+     */
+    if (start < end && *start == ' ') {
+        ++start;
+    }
+
+    if ((p = memchr(start, ';', end - start)) == NULL) {
+        state->in_off = state->in_len;
+        trace_error(state, "unexpected end of file\n");
+        trace_warn(state, "missing a semicolon?\n");
+        return -1;
+    }
+
+    /* Assembly may span multiple lines */
+    state->line_num += scan_count_nl(start, p);
+
+    res->type = TT_ASM;
+    res->off = start - state->in_buf;
+    res->len = p - start;
+    state->in_off = (p - state->in_buf) + 1;
+    return 0;
 }
 
 /*
- * Returns true if the input character 'c' is
- * a whitespace character
+ * Convert eight ASCII decimal digits to their value in
+ * one go.
  *
- * @state: Compiler state
- * @c: Character to check against
+ * @p: Digits to convert, most significant first
+ * @res: Value is written here
+ *
+ * Returns zero on success, or a negative value if any
+ * of the eight bytes is not a digit.
  */
-static bool
-lexer_is_ws(struct gup_state *state, char c)
+static inline int
+lexer_swar8(const uint8_t *p, uint64_t *res)
 {
-    if (state == NULL) {
-        return false;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+
+    /* Every byte must be within '0' and '9' */
+    if ((v & 0xF0F0F0F0F0F0F0F0) != 0x3030303030303030) {
+        return -1;
     }
 
-    switch (c) {
-    case '\n':
-        ++state->line_num;
-    case '\r':
-    case '\f':
-    case '\t':
-    case ' ':
-        return true;
+    if (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) != 0x3030303030303030) {
+        return -1;
     }
 
-    return false;
+    /* Combine digit pairs, then pairs of pairs */
+    v -= 0x3030303030303030;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+        (((v >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >> 32;
+
+    *res = v;
+    return 0;
+#else
+    return -1;
+#endif  /* __BYTE_ORDER__ */
 }
 
 /*
- * Consume a single byte from the input source file
+ * Scan the digits of a decimal number
  *
  * @state: Compiler state
- * @accept_ws: If true, accept whitespace
+ * @p: Cursor, advanced past the digits
+ * @end: End of source input
+ * @res: Value is written here
  *
- * Returns the character grabbed from the input source
+ * Returns zero on success, or a negative value if the
+ * number does not fit in 64 bits.
  */
-static char
-lexer_nom(struct gup_state *state, bool accept_ws)
+static int
+lexer_scan_dec(struct gup_state *state, const uint8_t **p, const uint8_t *end,
+    uint64_t *res)
 {
-    char c;
+    const uint8_t *cur = *p;
+    uint64_t acc = 0, chunk;
+    bool overflow = false;
+
+    while (cur < end) {
+        /* Take eight digits at a time when we can */
+        if (end - cur >= 8 && lexer_swar8(cur, &chunk) == 0) {
+            overflow |= __builtin_mul_overflow(acc, 100000000, &acc);
+            overflow |= __builtin_add_overflow(acc, chunk, &acc);
+            cur += 8;
+            continue;
+        }
 
-    if (state == NULL) {
-        return '\0';
-    }
+        /*
+         * Sometimes large numbers may be hard to read, the '_'
+         * character is valid to seperate digits and serves no
+         * programmatic purpose.
+         */
+        if (*cur == '_') {
+            ++cur;
+            continue;
+        }
 
-    /* Take from the putback buffer if we can */
-    if (state->putback != '\0') {
-        c = state->putback;
-        state->putback = '\0';
-        if (lexer_is_ws(state, c) && accept_ws)
-            return c;
-        if (!lexer_is_ws(state, c))
-            return c;
+        if ((cctab[*cur] & CC_DIGIT) == 0) {
+            break;
+        }
+
+        overflow |= __builtin_mul_overflow(acc, 10, &acc);
+        overflow |= __builtin_add_overflow(acc, *cur - '0', &acc);
+        ++cur;
     }
 
-    while (read(state->in_fd, &c, 1) > 0) {
-        if (lexer_is_ws(state, c) && !accept_ws) {
+    *p = cur;
+    *res = acc;
+    return overflow ? -1 : 0;
+}
+
+/*
+ * Scan the digits of a hexadecimal or binary number
+ *
+ * @state: Compiler state
+ * @p: Cursor, advanced past the digits
+ * @end: End of source input
+ * @shift: Bits per digit, 4 for hex and 1 for binary
+ * @res: Value is written here
+ *
+ * Returns zero on success, or a negative value if the
+ * number does not fit in 64 bits.
+ */
+static int
+lexer_scan_radix(struct gup_state *state, const uint8_t **p,
+    const uint8_t *end, uint8_t shift, uint64_t *res)
+{
+    const uint8_t *cur = *p;
+    uint64_t acc = 0;
+    uint8_t digit;
+    bool overflow = false;
+
+    for (; cur < end; ++cur) {
+        if (*cur == '_') {
             continue;
         }
 
-        return c;
+        if ((digit = hextab[*cur]) == 0) {
+            break;
+        }
+
+        digit &= ~HEX_VALID;
+        if (digit >= (1 << shift)) {
+            break;
+        }
+
+        overflow |= (acc >> (64 - shift)) != 0;
+        acc = (acc << shift) | digit;
     }
 
-    return '\0';
+    *p = cur;
+    *res = acc;
+    return overflow ? -1 : 0;
 }
 
 /*
- * Scan a line of assembly
+ * Scan a character literal such as 'A' or '\n'
  *
  * @state: Compiler state
- * @res: Token result written here
+ * @res: Token result is written here
+ *
+ * XXX: The cursor must be at the opening quote
  *
  * Returns zero on success
  */
 static int
-lexer_scan_asm(struct gup_state *state, struct token *res)
+lexer_scan_char(struct gup_state *state, struct token *res)
 {
-    char *buf;
-    size_t buf_cap;
-    size_t buf_size;
-    char c;
-
-    if (state == NULL || res == NULL) {
-        errno = -EINVAL;
-        return -1;
-    }
+    const uint8_t *p, *end, *digits;
+    uint64_t v;
 
-    buf_cap = 8;
-    buf_size = 0;
-    if ((buf = malloc(buf_cap)) == NULL) {
-        errno = -ENOMEM;
+    p = (const uint8_t *)state->in_buf + state->in_off + 1;
+    end = (const uint8_t *)state->in_buf + state->in_len;
+    if (p >= end || *p == '\n' || *p == '\'') {
+        trace_error(state, "bad character literal\n");
         return -1;
     }
 
-    /*
-     * This serves to ensure the assembly output stays
-     * pretty without any weird whitespaces. If the
-     * programmer skipped a whitespace after the '@',
-     * put whatever we grabbed back.
-     */
-    if ((c = lexer_nom(state, true)) != ' ') {
-        lexer_putback(state, c);
-    }
-
-    for (;;) {
-        if ((c = lexer_nom(state, true)) == '\0') {
-            trace_error(state, "unexpected end of file\n");
-            trace_warn("missing a semicolon?\n");
-            free(buf);
-            return -1;
-        }
+    v = *p++;
+    if (v == '\\' && p < end) {
+        switch (*p++) {
+        case 'n':  v = '\n'; break;
+        case 't':  v = '\t'; break;
+        case 'r':  v = '\r'; break;
+        case '0':  v = '\0'; break;
+        case '\\': v = '\\'; break;
+        case '\'': v = '\''; break;
+        case 'x':
+            digits = p;
+            if (lexer_scan_radix(state, &p, end, 4, &v) < 0)
+                v = UINT64_MAX;
+            if (p == digits || v > 0xFF) {
+                trace_error(state, "bad hex escape in character literal\n");
+                return -1;
+            }
 
-        /* Is this the end of the assembly? */
-        if (c == ';') {
-            buf[buf_size] = '\0';
             break;
-        }
-
-        buf[buf_size++] = c;
-        if (buf_size >= buf_cap - 1) {
-            buf_cap += 8;
-            buf = realloc(buf, buf_cap);
-        }
-
-        if (buf == NULL) {
+        default:
+            trace_error(state, "unknown escape in character literal\n");
             return -1;
         }
     }
 
-    res->s = ptrbox_strdup(&state->ptrbox, buf);
-    res->type = TT_ASM;
-    free(buf);
+    if (p >= end || *p != '\'') {
+        trace_error(state, "unterminated character literal\n");
+        return -1;
+    }
+
+    ++p;
+    res->v = v;
+    res->type = TT_NUMBER;
+    res->len = (p - (const uint8_t *)state->in_buf) - res->off;
+    state->in_off = res->off + res->len;
     return 0;
 }
 
 /*
- * Scan a number in the source input
+ * Scan a number in the source input, numbers may be
+ * decimal, hexadecimal ('0x') or binary ('0b') and are
+ * written straight into the token as 64-bit values.
  *
  * @state: Compiler state
- * @lc: Last character
  * @res: Token result is written here
  *
+ * XXX: The cursor must be at the first digit
+ *
  * Returns zero on success
  */
 static int
-lexer_scan_num(struct gup_state *state, int lc, struct token *res)
+lexer_scan_num(struct gup_state *state, struct token *res)
 {
-    char buf[22];
-    uint8_t buf_i = 0;
-    char c;
+    const uint8_t *p, *end, *digits;
+    uint64_t v;
+    int error;
 
     if (state == NULL || res == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    buf[buf_i++] = lc;
-    for (;;) {
-        if ((c = lexer_nom(state, false)) == '\0') {
-            buf[buf_i] = '\0';
-            break;
-        }
+    p = (const uint8_t *)state->in_buf + state->in_off;
+    end = (const uint8_t *)state->in_buf + state->in_len;
+
+    digits = p;
+    if (p[0] == '0' && end - p > 1 && (p[1] | 0x20) == 'x') {
+        digits = p += 2;
+        error = lexer_scan_radix(state, &p, end, 4, &v);
+    } else if (p[0] == '0' && end - p > 1 && (p[1] | 0x20) == 'b') {
+        digits = p += 2;
+        error = lexer_scan_radix(state, &p, end, 1, &v);
+    } else {
+        error = lexer_scan_dec(state, &p, end, &v);
+    }
 
-        /*
-         * Sometimes large numbers may be hard to read, the '_'
-         * character is valid to seperate digits and serves no
-         * programmatic purpose.
-         */
-        if (c == '_') {
-            continue;
-        }
+    /* A radix prefix must be followed by digits */
+    if (p == digits) {
+        trace_error(state, "expected digits after radix prefix\n");
+        return -1;
+    }
 
-        if (!isdigit(c)) {
-            buf[buf_i] = '\0';
-            lexer_putback(state, c);
-            break;
-        }
+    if (error < 0) {
+        trace_error(state, "integer literal does not fit in 64 bits\n");
+        return -1;
+    }
 
-        buf[buf_i++] = c;
-        if (buf_i >= sizeof(buf) - 1) {
-            buf[buf_i] = '\0';
-            break;
-        }
+    /* Catch things like '12ab' or '0b102' */
+    if (p < end && (cctab[*p] & CC_IDENT) != 0) {
+        trace_error(state, "invalid digit '%c' in integer literal\n", *p);
+        return -1;
     }
 
-    res->v = atoi(buf);
+    /*
+     * Values are kept as their 64-bit pattern, a u64 constant
+     * above INT64_MAX reads back negative but is emitted with
+     * the same bits.
+     */
+    res->v = (ssize_t)v;
     res->type = TT_NUMBER;
+    res->len = (p - (const uint8_t *)state->in_buf) - res->off;
+    state->in_off = res->off + res->len;
     return 0;
 }
 
@@ -235,59 +516,84 @@ lexer_scan_num(struct gup_state *state, int lc, struct token *res)
  * Scan an identifier from the source input
  *
  * @state: Compiler state
- * @lc: Last character
  * @res: Token result is written here
  *
+ * XXX: The cursor must be at the first byte
+ *
  * Returns zero on success
  */
 static int
-lexer_scan_ident(struct gup_state *state, int lc, struct token *res)
+lexer_scan_ident(struct gup_state *state, struct token *res)
 {
-    char *buf;
-    size_t buf_cap;
-    size_t buf_size;
-    char c;
+    const uint8_t *p, *end;
 
     if (state == NULL || res == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    buf_cap = 8;
-    buf_size = 0;
-    if ((buf = malloc(buf_cap)) == NULL) {
-        errno = -ENOMEM;
-        return -1;
+    p = (const uint8_t *)state->in_buf + state->in_off + 1;
+    end = (const uint8_t *)state->in_buf + state->in_len;
+    while (p < end && (cctab[*p] & CC_IDENT) != 0) {
+        ++p;
     }
 
-    buf[buf_size++] = lc;
-    for (;;) {
-        if ((c = lexer_nom(state, true)) == '\0') {
-            buf[buf_size] = '\0';
-            break;
-        }
+    res->type = TT_IDENT;
+    res->len = (p - (const uint8_t *)state->in_buf) - res->off;
+    state->in_off = res->off + res->len;
+    return 0;
+}
+
+/*
+ * Scan an operator or punctuator, taking a transition
+ * to a two byte token if the next byte allows it.
+ *
+ * @state: Compiler state
+ * @res: Token result is written here
+ *
+ * XXX: The cursor must be at the first byte
+ *
+ * Returns zero on success
+ */
+static int
+lexer_scan_punct(struct gup_state *state, struct token *res)
+{
+    const struct lexer_edge *edge;
+    uint8_t c, next;
+    size_t i;
+
+    c = state->in_buf[state->in_off++];
+    res->type = punctab[c];
+
+    next = '\0';
+    if (state->in_off < state->in_len) {
+        next = state->in_buf[state->in_off];
+    }
 
-        if (!isalnum(c) && c != '_') {
-            lexer_putback(state, c);
-            buf[buf_size] = '\0';
+    for (i = 0; i < LEXER_MAX_EDGES; ++i) {
+        edge = &edgetab[c][i];
+        if (edge->next == '\0') {
             break;
         }
 
-        buf[buf_size++] = c;
-        if (buf_size >= buf_cap - 1) {
-            buf_cap += 8;
-            buf = realloc(buf, buf_cap);
+        if (edge->next == next) {
+            res->type = edge->type;
+            res->len = 2;
+            ++state->in_off;
+            break;
         }
+    }
 
-        if (buf == NULL) {
-            errno = -ENOMEM;
-            return -1;
-        }
+    switch (res->type) {
+    case TT_ASM:
+        return lexer_scan_asm(state, res);
+    case TT_COMMENT:
+        lexer_skip_line(state);
+        return 0;
+    default:
+        return 0;
     }
 
-    res->type = TT_IDENT;
-    res->s = ptrbox_strdup(&state->ptrbox, buf);
-    free(buf);
     return 0;
 }
 
@@ -303,6 +609,9 @@ lexer_scan_ident(struct gup_state *state, int lc, struct token *res)
 static int
 lexer_is_kw(struct gup_state *state, struct token *tok)
 {
+    const struct keyword *kw;
+    const uint8_t *s;
+
     if (state == NULL || tok == NULL) {
         errno = -EINVAL;
         return -1;
@@ -313,204 +622,65 @@ lexer_is_kw(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    switch (*tok->s) {
-    case 'u':
-        if (strcmp(tok->s, "u8") == 0) {
-            tok->type = TT_U8;
-            return 0;
-        }
-
-        if (strcmp(tok->s, "u16") == 0) {
-            tok->type = TT_U16;
-            return 0;
-        }
-
-        if (strcmp(tok->s, "u32") == 0) {
-            tok->type = TT_U32;
-            return 0;
-        }
-
-        if (strcmp(tok->s, "u64") == 0) {
-            tok->type = TT_U64;
-            return 0;
-        }
-
-        break;
-    case 'p':
-        if (strcmp(tok->s, "proc") == 0) {
-            tok->type = TT_PROC;
-            return 0;
-        }
-
-        if (strcmp(tok->s, "pub") == 0) {
-            tok->type = TT_PUB;
-            return 0;
-        }
-
-        break;
-    case 'v':
-        if (strcmp(tok->s, "void") == 0) {
-            tok->type = TT_VOID;
-            return 0;
-        }
-
-        break;
-    case 'l':
-        if (strcmp(tok->s, "loop") == 0) {
-            tok->type = TT_LOOP;
-            return 0;
-        }
-
-        break;
-    case 'b':
-        if (strcmp(tok->s, "break") == 0) {
-            tok->type = TT_BREAK;
-            return 0;
-        }
-
-        break;
-    case 'r':
-        if (strcmp(tok->s, "return") == 0) {
-            tok->type = TT_RETURN;
-            return 0;
-        }
-
-        break;
-    case 's':
-        if (strcmp(tok->s, "struct") == 0) {
-            tok->type = TT_STRUCT;
-            return 0;
-        }
-
-        break;
-    case 'c':
-        if (strcmp(tok->s, "continue") == 0) {
-            tok->type = TT_CONT;
-            return 0;
-        }
-
-        break;
-    case 'i':
-        if (strcmp(tok->s, "if") == 0) {
-            tok->type = TT_IF;
-            return 0;
-        }
-
-        break;
-    case 't':
-        if (strcmp(tok->s, "type") == 0) {
-            tok->type = TT_TYPE;
-            return 0;
-        }
+    s = (const uint8_t *)lexer_tokstr(state, tok);
+    kw = &kwtab[KW_HASH(s[0], s[tok->len - 1], tok->len)];
+    if (kw->len != tok->len) {
+        return -1;
+    }
 
-        break;
+    if (memcmp(kw->name, s, tok->len) != 0) {
+        return -1;
     }
 
-    return -1;
+    tok->type = kw->type;
+    return 0;
 }
 
 int
 lexer_scan(struct gup_state *state, struct token *res)
 {
-    char c;
+    const char *p, *end;
+    uint8_t cc;
 
     if (state == NULL || res == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    /* Consume a single byte */
-    if ((c = lexer_nom(state, false)) == '\0') {
-        return -1;
-    }
-
-    switch (c) {
-    case '@':
-        if (lexer_scan_asm(state, res) < 0) {
-            return -1;
-        }
+    p = state->in_buf + state->in_off;
+    end = state->in_buf + state->in_len;
 
+    /* Skip whitespace, counting lines in the same pass */
+    p = scan_skip_ws(p, end, &state->line_num);
+    state->in_off = p - state->in_buf;
+    res->off = state->in_off;
+    res->len = 0;
+    if (p >= end) {
+        res->type = TT_NONE;
         return 0;
-    case ';':
-        res->type = TT_SEMI;
-        res->c = c;
-        return 0;
-    case '*':
-        res->type = TT_STAR;
-        res->c = c;
-        return 0;
-    case '+':
-        res->type = TT_PLUS;
-        res->c = c;
-        return 0;
-    case '-':
-        res->type = TT_MINUS;
-        res->c = c;
-        return 0;
-    case '/':
-        res->type = TT_SLASH;
-        res->c = c;
-        if ((c = lexer_nom(state, true)) != '/') {
-            lexer_putback(state, c);
-            return 0;
-        }
+    }
 
-        res->type = TT_COMMENT;
-        lexer_skip_line(state);
-        return 0;
-    case '(':
-        res->type = TT_LPAREN;
-        res->c = c;
-        return 0;
-    case ')':
-        res->type = TT_RPAREN;
-        res->c = c;
-        return 0;
-    case '<':
-        res->type = TT_LT;
-        res->c = c;
-        return 0;
-    case '>':
-        res->type = TT_GT;
-        res->c = c;
-        return 0;
-    case '.':
-        res->type = TT_DOT;
-        res->c = c;
-        return 0;
-    case '=':
-        res->type = TT_EQUALS;
-        res->c = c;
-        if ((c = lexer_nom(state, true)) == '=') {
-            res->type = TT_EQUALITY;
-            return 0;
-        }
+    res->len = 1;
+    cc = cctab[(uint8_t)*p];
 
-        lexer_putback(state, c);
-        return 0;
-    case '{':
-        res->type = TT_LBRACE;
-        res->c = c;
+    if (cc & CC_ALPHA) {
+        lexer_scan_ident(state, res);
+        lexer_is_kw(state, res);
         return 0;
-    case '}':
-        res->type = TT_RBRACE;
-        res->c = c;
-        return 0;
-    default:
-        /* Is this a digit? */
-        if (isdigit(c)) {
-            if (lexer_scan_num(state, c, res) < 0)
-                return -1;
+    }
 
-            return 0;
-        }
+    if (cc & CC_DIGIT) {
+        return lexer_scan_num(state, res);
+    }
 
-        /* Is this an identifier? */
-        if (lexer_scan_ident(state, c, res) == 0) {
-            lexer_is_kw(state, res);
-            return 0;
-        }
+    if (cc & CC_PUNCT) {
+        return lexer_scan_punct(state, res);
+    }
+
+    if (cc & CC_QUOTE) {
+        return lexer_scan_char(state, res);
     }
 
+    trace_error(state, "unexpected character 0x%02x\n", (uint8_t)*p);
     return -1;
 }
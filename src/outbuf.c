@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "gup/outbuf.h"
+
+/* Pairs of decimal digits, 00 through 99 */
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+int
+outbuf_init(struct outbuf *res)
+{
+    if (res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Memory is allocated on the first write */
+    res->buf = NULL;
+    res->len = 0;
+    res->cap = 0;
+    res->error = 0;
+    return 0;
+}
+
+int
+outbuf_grow(struct outbuf *ob, size_t n)
+{
+    size_t cap;
+    char *buf;
+
+    if (ob->error) {
+        return -1;
+    }
+
+    cap = (ob->cap != 0) ? ob->cap : OUTBUF_INIT_CAP;
+    while (cap - ob->len < n) {
+        if (cap > SIZE_MAX / 2) {
+            ob->error = 1;
+            return -1;
+        }
+
+        cap *= 2;
+    }
+
+    if ((buf = realloc(ob->buf, cap)) == NULL) {
+        ob->error = 1;
+        return -1;
+    }
+
+    ob->buf = buf;
+    ob->cap = cap;
+    return 0;
+}
+
+size_t
+outbuf_fmtu(char *dst, uint64_t v)
+{
+    char tmp[OUTBUF_INT_MAX];
+    char *p = &tmp[sizeof(tmp)];
+    size_t len;
+
+    /* Two digits at a time, from the least significant end */
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, &digit_pairs[(v % 100) * 2], 2);
+        v /= 100;
+    }
+
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &digit_pairs[v * 2], 2);
+    } else {
+        *--p = '0' + v;
+    }
+
+    len = &tmp[sizeof(tmp)] - p;
+    memcpy(dst, p, len);
+    return len;
+}
+
+void
+outbuf_putu(struct outbuf *ob, uint64_t v)
+{
+    if (ob->cap - ob->len < OUTBUF_INT_MAX) {
+        if (outbuf_grow(ob, OUTBUF_INT_MAX) < 0) {
+            return;
+        }
+    }
+
+    ob->len += outbuf_fmtu(&ob->buf[ob->len], v);
+}
+
+void
+outbuf_puti(struct outbuf *ob, int64_t v)
+{
+    if (v >= 0) {
+        outbuf_putu(ob, v);
+        return;
+    }
+
+    /* Negate as unsigned so INT64_MIN stays in range */
+    outbuf_putc(ob, '-');
+    outbuf_putu(ob, -(uint64_t)v);
+}
+
+void
+outbuf_vprintf(struct outbuf *ob, const char *fmt, va_list ap)
+{
+    va_list aq;
+    int len;
+
+    va_copy(aq, ap);
+    len = vsnprintf(NULL, 0, fmt, aq);
+    va_end(aq);
+    if (len < 0) {
+        ob->error = 1;
+        return;
+    }
+
+    /* Room for the NUL vsnprintf() writes, it is not kept */
+    if (ob->cap - ob->len <= (size_t)len) {
+        if (outbuf_grow(ob, (size_t)len + 1) < 0) {
+            return;
+        }
+    }
+
+    vsnprintf(&ob->buf[ob->len], (size_t)len + 1, fmt, ap);
+    ob->len += len;
+}
+
+void
+outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    outbuf_vprintf(ob, fmt, ap);
+    va_end(ap);
+}
+
+int
+outbuf_flushv(struct outbuf *obs, size_t count, int fd)
+{
+    struct iovec iov[OUTBUF_IOV_MAX];
+    size_t i, iovcnt = 0;
+    ssize_t n;
+
+    if (obs == NULL || count > OUTBUF_IOV_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (obs[i].error) {
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        if (obs[i].len == 0) {
+            continue;
+        }
+
+        iov[iovcnt].iov_base = obs[i].buf;
+        iov[iovcnt].iov_len = obs[i].len;
+        ++iovcnt;
+    }
+
+    /* Short writes leave the rest of the vector to retry */
+    i = 0;
+    while (i < iovcnt) {
+        n = writev(fd, &iov[i], iovcnt - i);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            return -1;
+        }
+
+        while (i < iovcnt && (size_t)n >= iov[i].iov_len) {
+            n -= iov[i++].iov_len;
+        }
+
+        if (i < iovcnt) {
+            iov[i].iov_base = (char *)iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        obs[i].len = 0;
+    }
+
+    return 0;
+}
+
+int
+outbuf_flush(struct outbuf *ob, int fd)
+{
+    return outbuf_flushv(ob, 1, fd);
+}
+
+void
+outbuf_destroy(struct outbuf *ob)
+{
+    if (ob == NULL) {
+        return;
+    }
+
+    free(ob->buf);
+    ob->buf = NULL;
+    ob->len = 0;
+    ob->cap = 0;
+}
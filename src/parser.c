@@ -5,15 +5,18 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <errno.h>
 #include "gup/parser.h"
 #include "gup/token.h"
 #include "gup/lexer.h"
+#include "gup/tokstream.h"
 #include "gup/trace.h"
 #include "gup/ast.h"
 #include "gup/codegen.h"
 #include "gup/types.h"
 #include "gup/scope.h"
+#include "gup/pass.h"
 
 #define tokstr(tt)          \
     toktab[(tt)]
@@ -42,10 +45,6 @@
         "unexpected end of file\n"  \
     );
 
-/* Most previous input token */
-static struct token last_token;
-static struct token tail_token; /* Previous previous token */
-
 /*
  * A lookup table used to convert token constants
  * to human readable strings.
@@ -67,6 +66,19 @@ static const char *toktab[] = {
     [TT_DOT]    = "DOT",
     [TT_EQUALS] = "EQUALS",
     [TT_EQUALITY] = "EQUALITY",
+    [TT_NEQ]    = "NOT-EQUAL",
+    [TT_LTE]    = "LESS-OR-EQUAL",
+    [TT_GTE]    = "GREATER-OR-EQUAL",
+    [TT_SHL]    = "SHIFT-LEFT",
+    [TT_SHR]    = "SHIFT-RIGHT",
+    [TT_AMP]    = "AMPERSAND",
+    [TT_PIPE]   = "PIPE",
+    [TT_CARET]  = "CARET",
+    [TT_TILDE]  = "TILDE",
+    [TT_BANG]   = "BANG",
+    [TT_PERCENT] = "PERCENT",
+    [TT_LAND]   = "LOGICAL-AND",
+    [TT_LOR]    = "LOGICAL-OR",
     [TT_U8]     = "U8",
     [TT_U16]    = "U16",
     [TT_U32]    = "U32",
@@ -80,36 +92,134 @@ static const char *toktab[] = {
     [TT_RETURN] = "RETURN",
     [TT_STRUCT] = "STRUCT",
     [TT_IF]     = "IF",
+    [TT_ELSE]   = "ELSE",
     [TT_TYPE]   = "TYPE",
     [TT_NUMBER] = "NUMBER",
     [TT_IDENT]  = "IDENTIFIER",
     [TT_COMMENT] = "COMMENT"
 };
 
+/*
+ * Grab the next token from the token stream
+ *
+ * @state: Compiler state
+ * @tok: Result is written here
+ *
+ * Returns zero on success, a negative value at
+ * the end of the token stream.
+ */
+static int
+parse_scan(struct gup_state *state, struct token *tok)
+{
+    struct tokstream *ts = &state->tokens;
+    size_t idx = state->tok_idx;
+
+    if (tokstream_get(ts, idx, tok) < 0) {
+        return -1;
+    }
+
+    state->line_num = ts->line[idx];
+    state->tok_idx = idx + 1;
+    return 0;
+}
+
 /*
  * Lookbehind current token
  *
+ * @state: Compiler state
  * @n: Number of steps to look behind
  * @tok: Result is written here
  *
  * XXX: 'n' being zero returns the current token
  *
- * TODO: Use a token buffer
+ * Returns zero on success
  */
 static inline int
-parse_lookbehind(size_t n, struct token *tok)
+parse_lookbehind(struct gup_state *state, size_t n, struct token *tok)
 {
-    if (n == 0) {
-        *tok = last_token;
-        return 0;
+    if (n >= state->tok_idx) {
+        return -1;
     }
 
-    if (n > 1) {
-        return -1;
+    return tokstream_get(&state->tokens, state->tok_idx - 1 - n, tok);
+}
+
+/*
+ * Lookahead of the current token without consuming
+ * anything
+ *
+ * @state: Compiler state
+ * @n: Number of steps to look ahead
+ * @tok: Result is written here
+ *
+ * XXX: 'n' being zero returns the next token
+ *
+ * Returns zero on success
+ */
+static inline int
+parse_lookahead(struct gup_state *state, size_t n, struct token *tok)
+{
+    return tokstream_get(&state->tokens, state->tok_idx + n, tok);
+}
+
+/*
+ * Hand a node over to be emitted, either right away or
+ * once the whole module has been parsed.
+ *
+ * @state: Compiler state
+ * @node: Node to emit
+ *
+ * Returns zero on success
+ */
+static int
+parse_emit(struct gup_state *state, struct ast_node *node)
+{
+    if (state->module != NULL) {
+        return ast_module_add(state, node);
     }
 
-    *tok = tail_token;
-    return 0;
+    return cg_compile_node(state, node);
+}
+
+/*
+ * Hand over the end of a procedure or loop, see
+ * parse_emit().
+ *
+ * @state: Compiler state
+ * @epilogue: Epilogue node, NULL if the block has none
+ *
+ * Returns zero on success
+ */
+static int
+parse_close(struct gup_state *state, struct ast_node *epilogue)
+{
+    if (state->module != NULL) {
+        return ast_module_close(state, epilogue);
+    }
+
+    if (epilogue == NULL) {
+        return 0;
+    }
+
+    return cg_compile_node(state, epilogue);
+}
+
+/*
+ * Intern the text of a token so that it may be shared
+ * by symbols and AST nodes.
+ *
+ * @state: Compiler state
+ * @tok:   Token to intern
+ *
+ * Returns a NUL terminated interned string on success
+ */
+static const char *
+parse_intern(struct gup_state *state, struct token *tok)
+{
+    const char *s;
+
+    s = lexer_tokstr(state, tok);
+    return intern_strn(&state->names, s, tok->len);
 }
 
 /*
@@ -137,25 +247,30 @@ parse_get_type(tt_t tt)
 
 /*
  * If we are currently in a loop, return true,
- * otherwise false.
+ * otherwise false. The arms of if statements are
+ * looked through.
  *
  * @state: Compiler state
  */
 static bool
 parse_in_loop(struct gup_state *state)
 {
-    tt_t scope;
+    struct scope *scope;
 
     if (state == NULL) {
         return false;
     }
 
-    scope = scope_top(state);
-    switch (scope) {
-    case TT_LOOP:
-        return true;
-    default:
-        return false;
+    for (scope = scope_current(state); scope != NULL; scope = scope->parent) {
+        switch (scope->type) {
+        case TT_LOOP:
+            return true;
+        case TT_IF:
+        case TT_ELSE:
+            continue;
+        default:
+            return false;
+        }
     }
 
     return false;
@@ -189,7 +304,7 @@ parse_ptr(struct gup_state *state, struct token *tok, struct datum_type *datum)
     }
 
     while (tok->type == TT_STAR) {
-        if (lexer_scan(state, tok) < 0) {
+        if (parse_scan(state, tok) < 0) {
             ueof(state);
             return -1;
         }
@@ -203,19 +318,23 @@ parse_ptr(struct gup_state *state, struct token *tok, struct datum_type *datum)
  * Look up a typedef
  *
  * @state: Compiler state
- * @name:  Typedef name
+ * @tok:   Typedef name token
  *
  * Returns symbol of typedef
  */
 static struct symbol *
-parse_lookup_typedef(struct gup_state *state, const char *name)
+parse_lookup_typedef(struct gup_state *state, struct token *tok)
 {
     struct symbol *symbol;
+    const char *name;
 
-    if (state == NULL || name == NULL) {
+    if (state == NULL || tok == NULL) {
         return NULL;
     }
 
+    /* A name that was never interned cannot be a typedef */
+    name = lexer_tokstr(state, tok);
+    name = intern_lookup(&state->names, name, tok->len);
     symbol = symbol_from_name(&state->symtab, name);
     if (symbol == NULL) {
         return NULL;
@@ -246,7 +365,7 @@ parse_type(struct gup_state *state, struct token *tok, struct datum_type *res)
 
     type = parse_get_type(tok->type);
     if (type == GUP_TYPE_BAD) {
-        type_symbol = parse_lookup_typedef(state, tok->s);
+        type_symbol = parse_lookup_typedef(state, tok);
         if (type_symbol == NULL) {
             utok1(state, "TYPE", tokstr1(tok));
             return -1;
@@ -260,7 +379,7 @@ parse_type(struct gup_state *state, struct token *tok, struct datum_type *res)
     res->type = type;
     res->ptr_depth = 0;
 
-    if (lexer_scan(state, tok) < 0) {
+    if (parse_scan(state, tok) < 0) {
         ueof(state);
         return -1;
     }
@@ -290,7 +409,7 @@ parse_expect(struct gup_state *state, struct token *tok, tt_t what)
         return -1;
     }
 
-    if (lexer_scan(state, tok) < 0) {
+    if (parse_scan(state, tok) < 0) {
         ueof(state);
         return -1;
     }
@@ -327,8 +446,48 @@ parse_asm(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    node->s = tok->s;
-    return cg_compile_node(state, node);
+    /* Assembly is emitted straight from the source input */
+    node->s = lexer_tokstr(state, tok);
+    node->len = tok->len;
+    return parse_emit(state, node);
+}
+
+/*
+ * Parse the else arm of an if statement, it ends the
+ * block of the if in place of its epilogue.
+ *
+ * @state: Compiler state
+ * @tok:   Last token
+ *
+ * Returns zero on success
+ */
+static int
+parse_else(struct gup_state *state, struct token *tok)
+{
+    struct ast_node *root;
+
+    if (parse_expect(state, tok, TT_ELSE) < 0) {
+        return -1;
+    }
+
+    if (parse_expect(state, tok, TT_LBRACE) < 0) {
+        return -1;
+    }
+
+    if (parse_close(state, NULL) < 0) {
+        return -1;
+    }
+
+    if (scope_push(state, TT_ELSE) < 0) {
+        return -1;
+    }
+
+    if (ast_alloc_node(state, AST_ELSE, &root) < 0) {
+        trace_error(state, "failed to allocate AST_ELSE\n");
+        return -1;
+    }
+
+    return parse_emit(state, root);
 }
 
 /*
@@ -343,6 +502,8 @@ static int
 parse_rbrace(struct gup_state *state, struct token *tok)
 {
     struct ast_node *root;
+    struct symbol *func;
+    struct token next;
     tt_t scope;
 
     if (state == NULL || tok == NULL) {
@@ -357,19 +518,16 @@ parse_rbrace(struct gup_state *state, struct token *tok)
 
     switch (scope) {
     case TT_PROC:
-        if (state->unreachable) {
-            state->unreachable = 0;
-            return 0;
-        }
-
+        func = state->this_func;
+        state->this_func = NULL;
         if (ast_alloc_node(state, AST_PROC, &root) < 0) {
             trace_error(state, "could not allocate AST_PROC epilogue\n");
             return -1;
         }
 
         root->epilogue = 1;
-        state->this_func = NULL;
-        return cg_compile_node(state, root);
+        root->symbol = func;
+        return parse_close(state, root);
     case TT_LOOP:
         if (ast_alloc_node(state, AST_LOOP, &root) < 0) {
             trace_error(state, "could not allocate AST_LOOP epilogue\n");
@@ -377,7 +535,27 @@ parse_rbrace(struct gup_state *state, struct token *tok)
         }
 
         root->epilogue = 1;
-        return cg_compile_node(state, root);
+        return parse_close(state, root);
+    case TT_IF:
+        if (parse_lookahead(state, 0, &next) == 0 && next.type == TT_ELSE) {
+            return parse_else(state, tok);
+        }
+
+        if (ast_alloc_node(state, AST_IF, &root) < 0) {
+            trace_error(state, "could not allocate AST_IF epilogue\n");
+            return -1;
+        }
+
+        root->epilogue = 1;
+        return parse_close(state, root);
+    case TT_ELSE:
+        if (ast_alloc_node(state, AST_ELSE, &root) < 0) {
+            trace_error(state, "could not allocate AST_ELSE epilogue\n");
+            return -1;
+        }
+
+        root->epilogue = 1;
+        return parse_close(state, root);
     default:
         break;
     }
@@ -437,9 +615,9 @@ parse_proc(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    if (parse_lookbehind(1, &prev_tok) < 0) {
-        trace_error(state, "lookbehind failure\n");
-        return -1;
+    /* The first token of the input has nothing behind it */
+    if (parse_lookbehind(state, 1, &prev_tok) < 0) {
+        prev_tok.type = TT_NONE;
     }
 
     if (prev_tok.type == TT_PUB) {
@@ -455,7 +633,7 @@ parse_proc(struct gup_state *state, struct token *tok)
     }
 
     /* Duplicate the identifier */
-    root->s = ptrbox_strdup(&state->ptrbox, tok->s);
+    root->s = parse_intern(state, tok);
     if (root->s == NULL) {
         return -1;
     }
@@ -468,7 +646,7 @@ parse_proc(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    if (lexer_scan(state, tok) < 0) {
+    if (parse_scan(state, tok) < 0) {
         ueof(state);
         return -1;
     }
@@ -504,7 +682,8 @@ parse_proc(struct gup_state *state, struct token *tok)
         }
 
         state->this_func = symbol;
-        return cg_compile_node(state, root);
+        state->decl_locals = 1;
+        return parse_emit(state, root);
     default:
         utok(state, tok->type);
         return -1;
@@ -536,7 +715,83 @@ parse_loop(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    return cg_compile_node(state, root);
+    return parse_emit(state, root);
+}
+
+/*
+ * Returns true if a token begins a variable declaration
+ *
+ * @state: Compiler state
+ * @tok:   Token to test
+ */
+static bool
+parse_is_decl(struct gup_state *state, struct token *tok)
+{
+    if (parse_get_type(tok->type) != GUP_TYPE_BAD) {
+        return true;
+    }
+
+    if (tok->type != TT_IDENT) {
+        return false;
+    }
+
+    return parse_lookup_typedef(state, tok) != NULL;
+}
+
+/*
+ * Parse a local variable, the type has already been
+ * parsed.
+ *
+ * @state: Compiler state
+ * @scope: Scope to declare the variable in
+ * @type:  Type of the variable
+ * @tok:   Last token
+ *
+ * Returns zero on success
+ */
+static int
+parse_local(struct gup_state *state, struct scope *scope,
+    struct datum_type *type, struct token *tok)
+{
+    struct symbol *symbol;
+    const char *name;
+
+    if (scope->type != TT_PROC || !state->decl_locals) {
+        trace_error(
+            state,
+            "locals must be declared at the start of a procedure\n"
+        );
+        return -1;
+    }
+
+    if (tok->type != TT_IDENT) {
+        utok1(state, "IDENT", tokstr1(tok));
+        return -1;
+    }
+
+    if ((name = parse_intern(state, tok)) == NULL) {
+        trace_error(state, "failed to intern identifier\n");
+        return -1;
+    }
+
+    if (symbol_alloc(&state->symtab, name, type->type, &symbol) < 0) {
+        trace_error(state, "failed to create symbol\n");
+        return -1;
+    }
+
+    symbol->type = SYMBOL_VAR;
+    symbol->local = 1;
+    symbol->data_type = *type;
+    if (scope_insert(scope, symbol) < 0) {
+        trace_error(state, "redeclaration of '%s'\n", name);
+        return -1;
+    }
+
+    if (cg_alloc_local(state, state->this_func, symbol) < 0) {
+        return -1;
+    }
+
+    return parse_expect(state, tok, TT_SEMI);
 }
 
 /*
@@ -553,6 +808,8 @@ parse_var(struct gup_state *state, struct token *tok)
     struct datum_type type;
     struct symbol *symbol;
     struct ast_node *root;
+    struct scope *scope;
+    const char *name;
     int error;
 
     if (state == NULL || tok == NULL) {
@@ -560,26 +817,36 @@ parse_var(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    /* TODO: Add support for local variables */
-    if (scope_top(state) != TT_NONE) {
-        trace_error(state, "only globals are supported now\n");
-        return -1;
-    }
-
     /* We need a type */
     if (parse_type(state, tok, &type) < 0) {
         return -1;
     }
 
+    /* Anything within a scope is a local */
+    if ((scope = scope_current(state)) != NULL) {
+        return parse_local(state, scope, &type, tok);
+    }
+
     /* Now an identifier */
     if (tok->type != TT_IDENT) {
         utok1(state, "IDENT", tokstr1(tok));
         return -1;
     }
 
+    if ((name = parse_intern(state, tok)) == NULL) {
+        trace_error(state, "failed to dup identifier\n");
+        return -1;
+    }
+
+    /* Both would end up as the same label */
+    if (symbol_from_name(&state->symtab, name) != NULL) {
+        trace_error(state, "redeclaration of '%s'\n", name);
+        return -1;
+    }
+
     error = symbol_new(
         &state->symtab,
-        tok->s,
+        name,
         type.type,
         &symbol
     );
@@ -602,7 +869,7 @@ parse_var(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    return cg_compile_node(state, root);
+    return parse_emit(state, root);
 }
 
 /*
@@ -635,7 +902,7 @@ parse_break(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    return cg_compile_node(state, node);
+    return parse_emit(state, node);
 }
 
 /*
@@ -684,118 +951,265 @@ parse_call(struct gup_state *state, const char *ident, struct token *tok)
     }
 
     root->symbol = symbol;
-    return cg_compile_node(state, root);
+    return parse_emit(state, root);
 }
 
 /*
- * Parse a binary expression
- *
- * @state: Compiler state
- * @tok:   Last token
+ * Get the binding power of a binary operator, higher
+ * binds tighter.
  *
- * XXX: 'tok' becomes the next after the last of this
- *      expression
+ * @tt: Token type of the operator
  *
- * Returns an AST node on success
+ * Returns zero if the token is not a binary operator
  */
-static struct ast_node *
-parse_binexpr(struct gup_state *state, struct token *tok)
+static uint8_t
+parse_bp(tt_t tt)
 {
-    struct ast_node *left, *node, *right;
-
-    if (state == NULL || tok == NULL) {
-        return NULL;
-    }
-
-    if (parse_expect(state, tok, TT_NUMBER) < 0) {
-        return NULL;
-    }
-
-    if (ast_alloc_node(state, AST_NUMBER, &left) < 0) {
-        trace_error(state, "failed to allocate AST_NUMBER\n");
-        return NULL;
-    }
-
-    left->v = tok->v;
-    if (lexer_scan(state, tok) < 0) {
-        ueof(state);
-        return NULL;
-    }
-
-    /*
-     * If this is a binary expression then we'll need to splice
-     * the root with an operator node.
-     */
-    switch (tok->type) {
+    switch (tt) {
+    case TT_LOR:        return 1;
+    case TT_LAND:       return 2;
+    case TT_PIPE:       return 3;
+    case TT_CARET:      return 4;
+    case TT_AMP:        return 5;
     case TT_EQUALITY:
-        if (ast_alloc_node(state, AST_EQUALITY, &node) < 0) {
-            trace_error(state, "failed to allocate AST_EQUALITY\n");
-            return NULL;
-        }
-
-        /* XXX: Perhaps have a seperate function handle values */
-        node->left = left;
-        if (parse_expect(state, tok, TT_NUMBER) < 0) {
-            return NULL;
-        }
-
-        if (ast_alloc_node(state, AST_NUMBER, &right) < 0) {
-            trace_error(state, "failed to allocate AST_NUMBER\n");
-            return NULL;
-        }
-
-        right->v = tok->v;
-        node->right = right;
-        if (lexer_scan(state, tok) < 0) {
-            return NULL;
-        }
+    case TT_NEQ:        return 6;
+    case TT_LT:
+    case TT_LTE:
+    case TT_GT:
+    case TT_GTE:        return 7;
+    case TT_SHL:
+    case TT_SHR:        return 8;
+    case TT_PLUS:
+    case TT_MINUS:      return 9;
+    case TT_STAR:
+    case TT_SLASH:
+    case TT_PERCENT:    return 10;
+    default:            return 0;
+    }
+}
 
-        return node;
-    default:
-        break;
+/*
+ * Truncate a constant to the size it is worked in
+ *
+ * @v: Constant to truncate
+ * @size: Machine size, MSIZE_DWORD or MSIZE_QWORD
+ */
+static uint64_t
+parse_trunc(uint64_t v, msize_t size)
+{
+    if (size != MSIZE_DWORD) {
+        return v;
     }
 
-    return left;
+    return v & UINT32_MAX;
 }
 
 /*
- * Parse a struct access
+ * Fold a binary operator on two constants, in the size
+ * it would be worked in at runtime so that folding
+ * never changes the result, see ir_eval().
  *
  * @state: Compiler state
- * @tok:   Last token
+ * @op: Token type of the operator
+ * @a: Left operand
+ * @b: Right operand
+ * @size: Size the operator is worked in
+ * @res: Result is written here
  *
- * Returns zero on success
+ * Returns zero if folded, a positive value if the result
+ * is left to the machine, e.g., for out of range shifts
  */
 static int
-parse_struct_access(struct gup_state *state, char *ident, struct token *tok)
+parse_fold(struct gup_state *state, tt_t op, uint64_t a, uint64_t b,
+    msize_t size, uint64_t *res)
 {
-    struct ast_node *root, *cur;
+    uint64_t bits;
+
+    a = parse_trunc(a, size);
+    b = parse_trunc(b, size);
+    bits = msize_bytes(size) * 8;
+
+    switch (op) {
+    case TT_PLUS:       *res = a + b; break;
+    case TT_MINUS:      *res = a - b; break;
+    case TT_STAR:       *res = a * b; break;
+    case TT_AMP:        *res = a & b; break;
+    case TT_PIPE:       *res = a | b; break;
+    case TT_CARET:      *res = a ^ b; break;
+    case TT_EQUALITY:   *res = a == b; break;
+    case TT_NEQ:        *res = a != b; break;
+    case TT_LT:         *res = a < b; break;
+    case TT_LTE:        *res = a <= b; break;
+    case TT_GT:         *res = a > b; break;
+    case TT_GTE:        *res = a >= b; break;
+    case TT_LAND:       *res = a != 0 && b != 0; break;
+    case TT_LOR:        *res = a != 0 || b != 0; break;
+    case TT_SHL:
+    case TT_SHR:
+        if (b >= bits) {
+            return 1;
+        }
 
-    if (state == NULL || ident == NULL) {
-        errno = -EINVAL;
-        return -1;
-    }
+        *res = (op == TT_SHL) ? a << b : a >> b;
+        break;
+    case TT_SLASH:
+    case TT_PERCENT:
+        if (b == 0) {
+            trace_error(state, "division by zero in constant\n");
+            return -1;
+        }
 
-    if (tok == NULL) {
-        errno = -EINVAL;
+        *res = (op == TT_SLASH) ? a / b : a % b;
+        break;
+    default:
+        utok(state, op);
         return -1;
     }
 
-    if (tok->type != TT_DOT) {
-        utok1(state, "DOT", tokstr1(tok));
-        return -1;
+    *res = parse_trunc(*res, size);
+    return 0;
+}
+
+/*
+ * Returns true if the operands of a binary operator are
+ * worked in by themselves rather than in the size of
+ * the operator, see cg_lower_expr().
+ *
+ * @op: Token type of the operator
+ */
+static bool
+parse_is_cmp(tt_t op)
+{
+    switch (op) {
+    case TT_EQUALITY:
+    case TT_NEQ:
+    case TT_LT:
+    case TT_LTE:
+    case TT_GT:
+    case TT_GTE:
+    case TT_LAND:
+    case TT_LOR:
+        return true;
+    default:
+        return false;
     }
+}
 
-    if (ast_alloc_node(state, AST_ACCESS, &root) < 0) {
-        trace_error(state, "failed to allocated AST_ACCESS\n");
-        return -1;
+/*
+ * Fold the constant subexpressions of an expression,
+ * going down in the sizes cg_lower_expr() works them
+ * in. A folded node keeps the size it is worked in by
+ * itself, see cg_expr_size().
+ *
+ * @state: Compiler state
+ * @node: Root of the expression, replaced with a number
+ *        if it is constant
+ * @min: Smallest size to work in, e.g., of the destination
+ *
+ * Returns zero on success
+ */
+static int
+parse_fold_expr(struct gup_state *state, struct ast_node *node, msize_t min)
+{
+    msize_t self, size, opsize, other;
+    uint64_t v;
+    int error;
+
+    self = cg_expr_size(node);
+    size = (min > self) ? min : self;
+
+    switch (node->type) {
+    case AST_UNOP:
+        opsize = (node->op == TT_BANG) ? cg_expr_size(node->right) : size;
+        if (parse_fold_expr(state, node->right, opsize) < 0) {
+            return -1;
+        }
+
+        if (node->right->type != AST_NUMBER) {
+            return 0;
+        }
+
+        v = node->right->v;
+        if (node->op == TT_MINUS) {
+            v = 0 - v;
+        } else if (node->op == TT_TILDE) {
+            v = ~v;
+        } else {
+            v = parse_trunc(v, opsize) == 0;
+        }
+
+        v = parse_trunc(v, opsize);
+        break;
+    case AST_BINOP:
+        opsize = size;
+        if (parse_is_cmp(node->op)) {
+            opsize = cg_expr_size(node->left);
+            other = cg_expr_size(node->right);
+            opsize = (other > opsize) ? other : opsize;
+        }
+
+        if (parse_fold_expr(state, node->left, opsize) < 0) {
+            return -1;
+        }
+
+        /* The count of a shift has a size of its own */
+        other = opsize;
+        if (node->op == TT_SHL || node->op == TT_SHR) {
+            other = MSIZE_DWORD;
+        }
+
+        if (parse_fold_expr(state, node->right, other) < 0) {
+            return -1;
+        }
+
+        if (node->left->type != AST_NUMBER || node->right->type != AST_NUMBER) {
+            return 0;
+        }
+
+        error = parse_fold(
+            state, node->op, node->left->v,
+            node->right->v, opsize, &v
+        );
+
+        if (error != 0) {
+            return (error < 0) ? -1 : 0;
+        }
+
+        break;
+    default:
+        return 0;
     }
 
-    root->s = ident;
-    cur = root;
+    /* Constants never make it to codegen */
+    node->type = AST_NUMBER;
+    node->v = (ssize_t)v;
+    node->wide = self == MSIZE_QWORD;
+    node->left = NULL;
+    node->right = NULL;
+    return 0;
+}
 
-    /* Begin scanning fields */
-    for (;;) {
+/*
+ * Parse the fields of a struct access, e.g., '.a.b'
+ *
+ * @state: Compiler state
+ * @root:  Access of the instance, fields are chained
+ *         to its right
+ * @tok:   Last token, a DOT
+ *
+ * XXX: 'tok' becomes the next after the last field
+ *
+ * Returns zero on success
+ */
+static int
+parse_fields(struct gup_state *state, struct ast_node *root,
+    struct token *tok)
+{
+    struct ast_node *cur = root;
+    struct symbol *symbol = root->symbol;
+    struct scope *fields;
+
+    while (tok->type == TT_DOT) {
         if (parse_expect(state, tok, TT_IDENT) < 0) {
             return -1;
         }
@@ -805,50 +1219,366 @@ parse_struct_access(struct gup_state *state, char *ident, struct token *tok)
             return -1;
         }
 
+        /* Fields are resolved within the scope of their struct */
+        if ((fields = symbol->fields) == NULL) {
+            trace_error(state, "'%s' has no fields\n", symbol->name);
+            return -1;
+        }
+
         cur = cur->right;
-        cur->s = ptrbox_strdup(&state->ptrbox, tok->s);
+        cur->s = parse_intern(state, tok);
         if (cur->s == NULL) {
             trace_error(state, "failed to dup field name\n");
             return -1;
         }
 
+        if ((symbol = scope_find(fields, cur->s)) == NULL) {
+            trace_error(state, "no field named '%s'\n", cur->s);
+            return -1;
+        }
+
+        cur->symbol = symbol;
+
         /* Grab the next token */
-        if (lexer_scan(state, tok) < 0) {
+        if (parse_scan(state, tok) < 0) {
             ueof(state);
             return -1;
         }
+    }
 
-        switch (tok->type) {
-        case TT_DOT:
-            continue;
-        case TT_EQUALS:
-            /*
-             * If we have an assign operator after the struct field,
-             * we'll need to splice it with the root.
-             */
-            if (ast_alloc_node(state, AST_ASSIGN, &cur) < 0) {
-                trace_error(state, "failed to access AST_ACCESS\n");
-                return -1;
-            }
+    return 0;
+}
 
-            cur->left = root;
-            if ((cur->right = parse_binexpr(state, tok)) == NULL) {
-                return -1;
-            }
+static struct ast_node *parse_expr(struct gup_state *state,
+    struct token *tok, uint8_t min_bp);
 
-            if (tok->type != TT_SEMI) {
-                utok1(state, "SEMI", tokstr1(tok));
-                return -1;
-            }
+/*
+ * Parse a variable or field read within an expression
+ *
+ * @state: Compiler state
+ * @tok:   Last token, the name of the variable
+ *
+ * Returns an AST node on success
+ */
+static struct ast_node *
+parse_load(struct gup_state *state, struct token *tok)
+{
+    struct ast_node *root;
+    struct symbol *symbol;
+    const char *ident;
 
-            return cg_compile_node(state, cur);
-        default:
-            utok1(state, "DOT or EQUALS", tokstr1(tok));
-            return -1;
+    if ((ident = parse_intern(state, tok)) == NULL) {
+        trace_error(state, "out of memory\n");
+        return NULL;
+    }
+
+    symbol = scope_lookup(state, ident);
+    if (symbol == NULL || symbol->type != SYMBOL_VAR) {
+        trace_error(state, "'%s' is not a variable\n", ident);
+        return NULL;
+    }
+
+    if (ast_alloc_node(state, AST_ACCESS, &root) < 0) {
+        trace_error(state, "failed to allocate AST_ACCESS\n");
+        return NULL;
+    }
+
+    root->s = ident;
+    root->symbol = symbol;
+    if (parse_scan(state, tok) < 0) {
+        ueof(state);
+        return NULL;
+    }
+
+    if (parse_fields(state, root, tok) < 0) {
+        return NULL;
+    }
+
+    return root;
+}
+
+/*
+ * Parse an operand of a binary expression, a unary
+ * operator applies to the operand after it.
+ *
+ * @state: Compiler state
+ * @tok:   Last token
+ *
+ * XXX: 'tok' becomes the next after the operand
+ *
+ * Returns an AST node on success
+ */
+static struct ast_node *
+parse_operand(struct gup_state *state, struct token *tok)
+{
+    struct ast_node *node, *right;
+    tt_t op;
+
+    if (parse_scan(state, tok) < 0) {
+        ueof(state);
+        return NULL;
+    }
+
+    switch (tok->type) {
+    case TT_NUMBER:
+        if (ast_alloc_node(state, AST_NUMBER, &node) < 0) {
+            trace_error(state, "failed to allocate AST_NUMBER\n");
+            return NULL;
         }
+
+        node->v = tok->v;
+        if (parse_scan(state, tok) < 0) {
+            ueof(state);
+            return NULL;
+        }
+
+        return node;
+    case TT_MINUS:
+    case TT_TILDE:
+    case TT_BANG:
+        op = tok->type;
+        if ((right = parse_operand(state, tok)) == NULL) {
+            return NULL;
+        }
+
+        if (ast_alloc_node(state, AST_UNOP, &node) < 0) {
+            trace_error(state, "failed to allocate AST_UNOP\n");
+            return NULL;
+        }
+
+        node->op = op;
+        node->right = right;
+        return node;
+    case TT_LPAREN:
+        if ((node = parse_expr(state, tok, 0)) == NULL) {
+            return NULL;
+        }
+
+        if (tok->type != TT_RPAREN) {
+            utok1(state, "RPAREN", tokstr1(tok));
+            return NULL;
+        }
+
+        if (parse_scan(state, tok) < 0) {
+            ueof(state);
+            return NULL;
+        }
+
+        return node;
+    case TT_IDENT:
+        return parse_load(state, tok);
+    default:
+        utok(state, tok->type);
+        return NULL;
     }
+}
 
-    return 0;
+/*
+ * Parse an expression by precedence climbing, taking
+ * every operator that binds tighter than 'min_bp'.
+ *
+ * @state: Compiler state
+ * @tok:   Last token
+ * @min_bp: Binding power of the operator on the left
+ *
+ * XXX: 'tok' becomes the next after the last of this
+ *      expression
+ *
+ * Returns an AST node on success
+ */
+static struct ast_node *
+parse_expr(struct gup_state *state, struct token *tok, uint8_t min_bp)
+{
+    struct ast_node *left, *right, *node;
+    uint8_t bp;
+    tt_t op;
+
+    if ((left = parse_operand(state, tok)) == NULL) {
+        return NULL;
+    }
+
+    /* Operators of equal power associate to the left */
+    while ((bp = parse_bp(tok->type)) > min_bp) {
+        op = tok->type;
+        if ((right = parse_expr(state, tok, bp)) == NULL) {
+            return NULL;
+        }
+
+        if (ast_alloc_node(state, AST_BINOP, &node) < 0) {
+            trace_error(state, "failed to allocate AST_BINOP\n");
+            return NULL;
+        }
+
+        node->op = op;
+        node->left = left;
+        node->right = right;
+        left = node;
+    }
+
+    return left;
+}
+
+/*
+ * Parse a binary expression, folding whatever of it
+ * is constant.
+ *
+ * @state: Compiler state
+ * @tok:   Last token
+ * @min:   Size of the destination, MSIZE_BAD if none
+ *
+ * XXX: 'tok' becomes the next after the last of this
+ *      expression
+ *
+ * Returns an AST node on success
+ */
+static struct ast_node *
+parse_binexpr(struct gup_state *state, struct token *tok, msize_t min)
+{
+    struct ast_node *root;
+
+    if (state == NULL || tok == NULL) {
+        return NULL;
+    }
+
+    if ((root = parse_expr(state, tok, 0)) == NULL) {
+        return NULL;
+    }
+
+    if (parse_fold_expr(state, root, min) < 0) {
+        return NULL;
+    }
+
+    return root;
+}
+
+/*
+ * Parse a struct access
+ *
+ * @state: Compiler state
+ * @tok:   Last token
+ *
+ * Returns zero on success
+ */
+static int
+parse_struct_access(struct gup_state *state, const char *ident,
+    struct token *tok)
+{
+    struct ast_node *root, *cur, *last;
+    struct symbol *symbol;
+    msize_t min;
+
+    if (state == NULL || ident == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (tok == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (tok->type != TT_DOT) {
+        utok1(state, "DOT", tokstr1(tok));
+        return -1;
+    }
+
+    if ((symbol = scope_lookup(state, ident)) == NULL) {
+        trace_error(state, "undefined reference to %s\n", ident);
+        return -1;
+    }
+
+    if (ast_alloc_node(state, AST_ACCESS, &root) < 0) {
+        trace_error(state, "failed to allocated AST_ACCESS\n");
+        return -1;
+    }
+
+    root->s = ident;
+    root->symbol = symbol;
+    if (parse_fields(state, root, tok) < 0) {
+        return -1;
+    }
+
+    if (tok->type != TT_EQUALS) {
+        utok1(state, "DOT or EQUALS", tokstr1(tok));
+        return -1;
+    }
+
+    /*
+     * If we have an assign operator after the struct field,
+     * we'll need to splice it with the root.
+     */
+    if (ast_alloc_node(state, AST_ASSIGN, &cur) < 0) {
+        trace_error(state, "failed to access AST_ACCESS\n");
+        return -1;
+    }
+
+    /* The value takes the size of the last field */
+    cur->left = root;
+    for (last = root; last->right != NULL; last = last->right);
+    min = cg_symbol_msize(last->symbol);
+    if ((cur->right = parse_binexpr(state, tok, min)) == NULL) {
+        return -1;
+    }
+
+    if (tok->type != TT_SEMI) {
+        utok1(state, "SEMI", tokstr1(tok));
+        return -1;
+    }
+
+    return parse_emit(state, cur);
+}
+
+/*
+ * Parse an assignment to a variable
+ *
+ * @state: Compiler state
+ * @ident: Name of variable
+ * @tok:   Last token
+ *
+ * Returns zero on success
+ */
+static int
+parse_assign(struct gup_state *state, const char *ident, struct token *tok)
+{
+    struct ast_node *root, *var;
+    struct symbol *symbol;
+    msize_t min;
+
+    if (state == NULL || ident == NULL || tok == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    symbol = scope_lookup(state, ident);
+    if (symbol == NULL || symbol->type != SYMBOL_VAR) {
+        trace_error(state, "'%s' is not a variable\n", ident);
+        return -1;
+    }
+
+    if (ast_alloc_node(state, AST_ACCESS, &var) < 0) {
+        trace_error(state, "failed to allocate AST_ACCESS\n");
+        return -1;
+    }
+
+    if (ast_alloc_node(state, AST_ASSIGN, &root) < 0) {
+        trace_error(state, "failed to allocate AST_ASSIGN\n");
+        return -1;
+    }
+
+    var->s = ident;
+    var->symbol = symbol;
+    root->left = var;
+    min = cg_symbol_msize(symbol);
+    if ((root->right = parse_binexpr(state, tok, min)) == NULL) {
+        return -1;
+    }
+
+    if (tok->type != TT_SEMI) {
+        utok1(state, "SEMI", tokstr1(tok));
+        return -1;
+    }
+
+    return parse_emit(state, root);
 }
 
 /*
@@ -862,20 +1592,20 @@ parse_struct_access(struct gup_state *state, char *ident, struct token *tok)
 static int
 parse_ident(struct gup_state *state, struct token *tok)
 {
-    char *ident;
+    const char *ident;
 
     if (state == NULL || tok == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    ident = ptrbox_strdup(&state->ptrbox, tok->s);
+    ident = parse_intern(state, tok);
     if (ident == NULL) {
         trace_error(state, "out of memory\n");
         return -1;
     }
 
-    if (lexer_scan(state, tok) < 0) {
+    if (parse_scan(state, tok) < 0) {
         ueof(state);
         return -1;
     }
@@ -892,6 +1622,12 @@ parse_ident(struct gup_state *state, struct token *tok)
             return -1;
         }
 
+        break;
+    case TT_EQUALS:
+        if (parse_assign(state, ident, tok) < 0) {
+            return -1;
+        }
+
         break;
     default:
         return -1;
@@ -912,6 +1648,7 @@ parse_return(struct gup_state *state, struct token *tok)
     struct ast_node *root;
     struct datum_type *func_type;
     struct symbol *func;
+    msize_t min;
 
     if (state == NULL || tok == NULL) {
         errno = -EINVAL;
@@ -934,23 +1671,23 @@ parse_return(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    /* TODO: Support binary expressions */
-    if (parse_expect(state, tok, TT_NUMBER) < 0) {
+    if (ast_alloc_node(state, AST_RET, &root) < 0) {
+        trace_error(state, "failed to allocate AST_RET\n");
         return -1;
     }
 
-    if (ast_alloc_node(state, AST_RET, &root) < 0) {
-        trace_error(state, "failed to allocate AST_RET\n");
+    root->symbol = func;
+    min = cg_symbol_msize(func);
+    if ((root->right = parse_binexpr(state, tok, min)) == NULL) {
         return -1;
     }
 
-    root->v = tok->v;
-    if (parse_expect(state, tok, TT_SEMI) < 0) {
+    if (tok->type != TT_SEMI) {
+        utok1(state, "SEMI", tokstr1(tok));
         return -1;
     }
 
-    state->unreachable = 1;
-    return cg_compile_node(state, root);
+    return parse_emit(state, root);
 }
 
 /*
@@ -964,9 +1701,11 @@ parse_return(struct gup_state *state, struct token *tok)
 static struct ast_node *
 parse_struct_field(struct gup_state *state, struct token *tok)
 {
-    char *identifier;
+    const char *identifier;
     struct ast_node *root;
     struct datum_type type;
+    struct symbol *symbol;
+    int error;
 
     if (parse_type(state, tok, &type) < 0) {
         return NULL;
@@ -977,7 +1716,7 @@ parse_struct_field(struct gup_state *state, struct token *tok)
         return NULL;
     }
 
-    identifier = ptrbox_strdup(&state->ptrbox, tok->s);
+    identifier = parse_intern(state, tok);
     if (identifier == NULL) {
         trace_error(state, "failed to dup identifier\n");
             return NULL;
@@ -987,6 +1726,25 @@ parse_struct_field(struct gup_state *state, struct token *tok)
         return NULL;
     }
 
+    error = symbol_alloc(
+        &state->symtab,
+        identifier,
+        type.type,
+        &symbol
+    );
+
+    if (error < 0) {
+        trace_error(state, "failed to create field symbol\n");
+        return NULL;
+    }
+
+    symbol->type = SYMBOL_FIELD;
+    symbol->data_type = type;
+    if (scope_insert(scope_current(state), symbol) < 0) {
+        trace_error(state, "duplicate field '%s'\n", identifier);
+        return NULL;
+    }
+
     /* Allocate a field node */
     if (ast_alloc_node(state, AST_FIELD, &root) < 0) {
         trace_error(state, "failed to allocate AST_FIELD\n");
@@ -994,6 +1752,7 @@ parse_struct_field(struct gup_state *state, struct token *tok)
     }
 
     root->s = identifier;
+    root->symbol = symbol;
     root->field_type = type.type;
     return root;
 }
@@ -1007,10 +1766,11 @@ parse_struct_field(struct gup_state *state, struct token *tok)
 static int
 parse_struct(struct gup_state *state, struct token *tok)
 {
-    struct symbol *symbol;
+    struct symbol *symbol, *instance;
     struct ast_node *root = NULL;
     struct ast_node *cur;
-    char *struct_name, *instance_name = NULL;
+    struct scope *fields = NULL;
+    const char *struct_name, *instance_name = NULL;
     int error;
 
     if (state == NULL || tok == NULL) {
@@ -1027,13 +1787,13 @@ parse_struct(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    struct_name = ptrbox_strdup(&state->ptrbox, tok->s);
+    struct_name = parse_intern(state, tok);
     if (struct_name == NULL) {
         trace_error(state, "failed to dup struct name\n");
         return -1;
     }
 
-    if (lexer_scan(state, tok) < 0) {
+    if (parse_scan(state, tok) < 0) {
         ueof(state);
         return -1;
     }
@@ -1047,7 +1807,7 @@ parse_struct(struct gup_state *state, struct token *tok)
          *
          * struct <name> <instance_name>;
          */
-        instance_name = ptrbox_strdup(&state->ptrbox, tok->s);
+        instance_name = parse_intern(state, tok);
         if (instance_name == NULL) {
             trace_error(state, "failed to allocate instance name\n");
             return -1;
@@ -1058,18 +1818,44 @@ parse_struct(struct gup_state *state, struct token *tok)
         }
 
         symbol = symbol_from_name(&state->symtab, struct_name);
+        if (symbol == NULL || symbol->type != SYMBOL_STRUCT) {
+            trace_error(state, "unknown struct %s\n", struct_name);
+            return -1;
+        }
+
+        error = symbol_new(
+            &state->symtab,
+            instance_name,
+            GUP_TYPE_VOID,
+            &instance
+        );
+
+        if (error < 0) {
+            trace_error(state, "could not create new symbol\n");
+            return -1;
+        }
+
+        /* Instances share the fields of their struct */
+        instance->type = SYMBOL_VAR;
+        instance->fields = symbol->fields;
+        instance->tree = symbol->tree;
         if (ast_alloc_node(state, AST_STRUCT, &cur) < 0) {
             trace_error(state, "failed to allocate AST_STRUCT\n");
             return -1;
         }
 
-        cur->s = ptrbox_strdup(&state->ptrbox, instance_name);
+        cur->s = instance_name;
+        cur->symbol = instance;
         cur->right = symbol->tree;
-        return cg_compile_node(state, cur);
+        return parse_emit(state, cur);
     case TT_LBRACE:
         if (parse_lbrace(state, TT_STRUCT, tok) < 0) {
             return -1;
         }
+
+        /* The field scope lives on with the struct */
+        fields = scope_current(state);
+        fields->keep = 1;
         break;
     default:
         utok(state, tok->type);
@@ -1088,6 +1874,8 @@ parse_struct(struct gup_state *state, struct token *tok)
         return -1;
     }
 
+    symbol->type = SYMBOL_STRUCT;
+    symbol->fields = fields;
     if (ast_alloc_node(state, AST_STRUCT, &root) < 0) {
         trace_error(state, "failed to allocate AST_STRUCT\n");
         return -1;
@@ -1098,7 +1886,7 @@ parse_struct(struct gup_state *state, struct token *tok)
     cur->symbol = symbol;
 
     for (;;) {
-        if (lexer_scan(state, tok) < 0) {
+        if (parse_scan(state, tok) < 0) {
             ueof(state);
             return -1;
         }
@@ -1165,7 +1953,7 @@ parse_continue(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    return cg_compile_node(state, root);
+    return parse_emit(state, root);
 }
 
 static int
@@ -1187,7 +1975,7 @@ parse_if(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    if ((condition = parse_binexpr(state, tok)) == NULL) {
+    if ((condition = parse_binexpr(state, tok, MSIZE_BAD)) == NULL) {
         return -1;
     }
 
@@ -1211,13 +1999,13 @@ parse_if(struct gup_state *state, struct token *tok)
     }
 
     root->right = condition;
-    return cg_compile_node(state, root);
+    return parse_emit(state, root);
 }
 
 static int
 parse_typedef(struct gup_state *state, struct token *tok)
 {
-    char *type_dest;
+    const char *type_dest;
     struct datum_type type_src;
     struct symbol *symbol;
     int error;
@@ -1233,7 +2021,7 @@ parse_typedef(struct gup_state *state, struct token *tok)
     }
 
     /* We need a type now */
-    if (lexer_scan(state, tok) < 0) {
+    if (parse_scan(state, tok) < 0) {
         ueof(state);
         return -1;
     }
@@ -1258,7 +2046,7 @@ parse_typedef(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    type_dest = ptrbox_strdup(&state->ptrbox, tok->s);
+    type_dest = parse_intern(state, tok);
     if (type_dest == NULL) {
         trace_error(state, "failed to allocate type_dest\n");
         return -1;
@@ -1294,11 +2082,18 @@ parse_typedef(struct gup_state *state, struct token *tok)
 static int
 begin_parse(struct gup_state *state, struct token *tok)
 {
+    struct token next;
+
     if (state == NULL || tok == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
+    /* The body of a procedure begins after its locals */
+    if (state->decl_locals && !parse_is_decl(state, tok)) {
+        state->decl_locals = 0;
+    }
+
     switch (tok->type) {
     case TT_ASM:
         if (parse_asm(state, tok) < 0) {
@@ -1337,6 +2132,14 @@ begin_parse(struct gup_state *state, struct token *tok)
 
         break;
     case TT_IDENT:
+        if (parse_lookup_typedef(state, tok) != NULL) {
+            if (parse_var(state, tok) < 0) {
+                return -1;
+            }
+
+            break;
+        }
+
         if (parse_ident(state, tok) < 0) {
             return -1;
         }
@@ -1367,8 +2170,16 @@ begin_parse(struct gup_state *state, struct token *tok)
 
         break;
     case TT_PUB:
-        break;
-    case TT_COMMENT:
+        if (parse_lookahead(state, 0, &next) < 0) {
+            ueof(state);
+            return -1;
+        }
+
+        if (next.type != TT_PROC) {
+            utok1(state, "PROC", tokstr1(&next));
+            return -1;
+        }
+
         break;
     default:
         if (parse_var(state, tok) == 0) {
@@ -1379,13 +2190,13 @@ begin_parse(struct gup_state *state, struct token *tok)
         return -1;
     }
 
-    tail_token = *tok;
     return 0;
 }
 
 int
 gup_parse(struct gup_state *state)
 {
+    struct token tok;
     int error = 0;
 
     if (state == NULL) {
@@ -1393,18 +2204,42 @@ gup_parse(struct gup_state *state)
         return -1;
     }
 
-    while (lexer_scan(state, &last_token) == 0) {
-        trace_debug("got token %s\n", toktab[last_token.type]);
-        if ((error = begin_parse(state, &last_token)) < 0) {
+    /* Lex the whole input up front */
+    if (tokstream_lex(state, &state->tokens) < 0) {
+        return -1;
+    }
+
+    if (state->whole_module && ast_module_init(state) < 0) {
+        trace_error(state, "failed to allocate module tree\n");
+        return -1;
+    }
+
+    state->tok_idx = 0;
+    while (parse_scan(state, &tok) == 0) {
+        trace_debug("got token %s\n", toktab[tok.type]);
+        if ((error = begin_parse(state, &tok)) < 0) {
             break;
         }
     }
 
-    if (scope_top(state) != TT_NONE && error == 0) {
+    if (error < 0) {
+        return -1;
+    }
+
+    if (scope_top(state) != TT_NONE) {
         ueof(state);
-        trace_warn("missing RBRACE ('}') ?\n");
+        trace_warn(state, "missing RBRACE ('}') ?\n");
         return -1;
     }
 
-    return 0;
+    if (state->module == NULL) {
+        return 0;
+    }
+
+    /* The whole module is known, optimize it before emitting */
+    if (pass_run(state) < 0) {
+        return -1;
+    }
+
+    return cg_compile_module(state, state->module);
 }
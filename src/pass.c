@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include "gup/pass.h"
+#include "gup/trace.h"
+
+/*
+ * Returns true if control never reaches the node after
+ * this one within the same block.
+ *
+ * @node: Node to test
+ */
+static bool
+pass_is_jump(const struct ast_node *node)
+{
+    switch (node->type) {
+    case AST_RET:
+    case AST_BREAK:
+    case AST_CONTINUE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Returns true if an unreachable node can be dropped
+ * without changing what the module means.
+ *
+ * XXX: Inline assembly may hold labels that are jumped
+ *      to, blocks hold epilogues that are. Both stay, as
+ *      do nodes that could still fail to compile.
+ *
+ * @node: Node to test
+ */
+static bool
+pass_is_droppable(const struct ast_node *node)
+{
+    if (pass_is_jump(node)) {
+        return true;
+    }
+
+    if (node->type != AST_CALL || node->symbol == NULL) {
+        return false;
+    }
+
+    return node->symbol->type == SYMBOL_FUNC;
+}
+
+/*
+ * Drop the unreachable nodes of a block and of every
+ * block within it.
+ *
+ * @link: Link to the first node of the block
+ */
+static void
+pass_unreachable_block(struct ast_node **link)
+{
+    struct ast_node *node;
+    bool dead = false;
+
+    while ((node = *link) != NULL) {
+        if (dead && pass_is_droppable(node)) {
+            *link = node->next;
+            continue;
+        }
+
+        if (node->body != NULL) {
+            pass_unreachable_block(&node->body);
+        }
+
+        /* Anything kept may be jumped back into */
+        dead = pass_is_jump(node);
+        link = &node->next;
+    }
+}
+
+/*
+ * Drop statements that follow a return, break or
+ * continue within the same block.
+ *
+ * @state: Compiler state
+ * @mod: Module tree
+ *
+ * Returns zero on success
+ */
+static int
+pass_unreachable(struct gup_state *state, struct ast_module *mod)
+{
+    (void)state;
+    pass_unreachable_block(&mod->head);
+    return 0;
+}
+
+/* Passes in the order they run */
+static const struct pass passtab[] = {
+    { "unreachable", pass_unreachable }
+};
+
+int
+pass_run(struct gup_state *state)
+{
+    size_t i;
+
+    if (state == NULL || state->module == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < sizeof(passtab) / sizeof(passtab[0]); ++i) {
+        if (passtab[i].run(state, state->module) < 0) {
+            trace_error(state, "pass '%s' failed\n", passtab[i].name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -13,74 +13,54 @@ ptrbox_init(struct ptrbox *res)
         return -1;
     }
 
-    TAILQ_INIT(&res->entries);
-    res->entry_count = 0;
-    return 0;
+    return arena_init(&res->arena, 0);
 }
 
 void *
 ptrbox_alloc(struct ptrbox *ptrbox, size_t sz)
 {
-    struct ptrbox_entry *entry;
-
     if (ptrbox == NULL || sz == 0) {
         return NULL;
     }
 
-    if ((entry = malloc(sizeof(*entry))) == NULL) {
-        return NULL;
-    }
+    return arena_alloc(&ptrbox->arena, sz, ARENA_ALIGN);
+}
 
-    if ((entry->data = malloc(sz)) == NULL) {
-        free(entry);
+void *
+ptrbox_strdup(struct ptrbox *ptrbox, const char *s)
+{
+    if (ptrbox == NULL || s == 0) {
         return NULL;
     }
 
-    TAILQ_INSERT_TAIL(&ptrbox->entries, entry, link);
-    ++ptrbox->entry_count;
-    return entry->data;
+    return ptrbox_strndup(ptrbox, s, strlen(s));
 }
 
 void *
-ptrbox_strdup(struct ptrbox *ptrbox, const char *s)
+ptrbox_strndup(struct ptrbox *ptrbox, const char *s, size_t len)
 {
-    struct ptrbox_entry *entry;
+    char *p;
 
     if (ptrbox == NULL || s == 0) {
         return NULL;
     }
 
-    if ((entry = malloc(sizeof(*entry))) == NULL) {
-        return NULL;
-    }
-
-    if ((entry->data = strdup(s)) == NULL) {
-        free(entry);
+    len = strnlen(s, len);
+    if ((p = arena_alloc(&ptrbox->arena, len + 1, 1)) == NULL) {
         return NULL;
     }
 
-    TAILQ_INSERT_TAIL(&ptrbox->entries, entry, link);
-    ++ptrbox->entry_count;
-    return entry->data;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
 }
 
 void
 ptrbox_destroy(struct ptrbox *ptrbox)
 {
-    struct ptrbox_entry *entry;
-
     if (ptrbox == NULL) {
         return;
     }
 
-    if ((entry = TAILQ_FIRST(&ptrbox->entries)) == NULL) {
-        return;
-    }
-
-    do {
-        TAILQ_REMOVE(&ptrbox->entries, entry, link);
-        free(entry->data);
-        free(entry);
-        entry = TAILQ_FIRST(&ptrbox->entries);
-    } while (entry != NULL);
+    arena_destroy(&ptrbox->arena);
 }
@@ -0,0 +1,785 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gup/regalloc.h"
+
+/* Deepest loop nesting that still adds to the weight of a use */
+#define RA_DEPTH_MAX 6
+
+/*
+ * Represents the live interval of a virtual register
+ *
+ * @vreg: Virtual register
+ * @start: First instruction it is live at
+ * @end: Last instruction it is live at
+ * @weight: Uses per instruction live, weighted by loop depth
+ * @reg: Register held in while active
+ * @reg_end: Last instruction the register is held at
+ * @split: Set if the register is left before 'end'
+ * @var: Set for a variable, e.g., a promoted local, it
+ *       is written more than once or read before it is
+ *       written and is never split
+ */
+struct ra_interval {
+    ir_vreg_t vreg;
+    size_t start;
+    size_t end;
+    double weight;
+    uint8_t reg;
+    size_t reg_end;
+    bool split;
+    bool var;
+};
+
+/*
+ * Represents a loop, found by its backward jump
+ *
+ * @head: Label of the head block
+ * @tail: Last backward jump to the head
+ */
+struct ra_loop {
+    size_t head;
+    size_t tail;
+};
+
+/*
+ * Represents the state of a register allocation
+ *
+ * @proc: IR procedure
+ * @target: Registers of the target
+ * @res: Allocation being built
+ * @ivs: Live intervals, by start once sorted
+ * @niv: Number of live intervals
+ * @active: Intervals holding a register
+ * @nactive: Number of active intervals
+ * @loops: Loops of the procedure
+ * @nloops: Number of loops
+ * @clobbers: Calls and inline assembly, in order
+ * @nclobbers: Number of clobbers
+ * @slot_end: Last instruction each spill slot is taken up to
+ * @slot_cap: Capacity of 'slot_end'
+ * @spill_cap: Capacity of the spills of 'res'
+ */
+struct ra {
+    struct ir_proc *proc;
+    const struct ra_target *target;
+    struct ra_alloc *res;
+    struct ra_interval *ivs;
+    size_t niv;
+    struct ra_interval **active;
+    size_t nactive;
+    struct ra_loop *loops;
+    size_t nloops;
+    size_t *clobbers;
+    size_t nclobbers;
+    size_t *slot_end;
+    size_t slot_cap;
+    size_t spill_cap;
+};
+
+/*
+ * Returns true if an instruction clobbers registers
+ *
+ * @insn: Instruction to test
+ */
+static inline bool
+ra_is_clobber(const struct ir_insn *insn)
+{
+    return insn->op == IR_CALL || insn->op == IR_ASM;
+}
+
+/*
+ * Count a use of an operand
+ *
+ * @opnd: Operand
+ * @start: First instruction of each virtual register
+ * @end: Last use of each virtual register
+ * @var: Set for each virtual register that is a variable
+ * @i: Instruction of the use
+ */
+static void
+ra_use(const struct ir_operand *opnd, size_t *start, size_t *end,
+    uint8_t *var, size_t i)
+{
+    if (opnd->kind != IR_OPND_VREG) {
+        return;
+    }
+
+    /* Read before it is written, live from here */
+    if (start[opnd->vreg] == SIZE_MAX) {
+        start[opnd->vreg] = i;
+        var[opnd->vreg] = 1;
+    }
+
+    if (end[opnd->vreg] < i) {
+        end[opnd->vreg] = i;
+    }
+}
+
+/*
+ * Add to the weight of an operand
+ *
+ * @opnd: Operand
+ * @weight: Weight of each virtual register
+ * @w: Weight of the use
+ */
+static void
+ra_weigh(const struct ir_operand *opnd, double *weight, double w)
+{
+    if (opnd->kind == IR_OPND_VREG) {
+        weight[opnd->vreg] += w;
+    }
+}
+
+/*
+ * Record a backward jump, loops sharing a head are
+ * one loop.
+ *
+ * @ra: Register allocation state
+ * @head: Label jumped back to
+ * @tail: Jump
+ */
+static void
+ra_add_loop(struct ra *ra, size_t head, size_t tail)
+{
+    size_t i;
+
+    for (i = 0; i < ra->nloops; ++i) {
+        if (ra->loops[i].head == head) {
+            ra->loops[i].tail = tail;
+            return;
+        }
+    }
+
+    ra->loops[ra->nloops].head = head;
+    ra->loops[ra->nloops++].tail = tail;
+}
+
+/*
+ * Stretch every interval that is live across the bounds
+ * of a loop over the whole loop, the value has to make
+ * it around the backward jump. Variables are stretched
+ * over every loop they are in, whatever was written in
+ * one trip may be read in the next.
+ *
+ * @ra: Register allocation state
+ */
+static void
+ra_stretch(struct ra *ra)
+{
+    struct ra_interval *iv;
+    struct ra_loop *loop;
+    bool changed = true;
+    size_t i, j;
+
+    /* Nested loops may stretch an interval more than once */
+    while (changed) {
+        changed = false;
+        for (i = 0; i < ra->nloops; ++i) {
+            loop = &ra->loops[i];
+            for (j = 0; j < ra->niv; ++j) {
+                iv = &ra->ivs[j];
+                if (iv->end < loop->head || iv->start > loop->tail) {
+                    continue;
+                }
+
+                if (!iv->var && iv->start >= loop->head &&
+                    iv->end <= loop->tail) {
+                    continue;
+                }
+
+                if (iv->start > loop->head) {
+                    iv->start = loop->head;
+                    changed = true;
+                }
+
+                if (iv->end < loop->tail) {
+                    iv->end = loop->tail;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Find the live intervals, loops and clobbers of the
+ * procedure.
+ *
+ * @ra: Register allocation state
+ *
+ * Returns zero on success
+ */
+static int
+ra_scan(struct ra *ra)
+{
+    static const double depth_weight[RA_DEPTH_MAX + 1] = {
+        1, 8, 64, 512, 4096, 32768, 262144
+    };
+    struct ir_proc *proc = ra->proc;
+    struct ir_insn *insn;
+    size_t *start, *end, *label;
+    uint8_t *var;
+    double *weight;
+    long *depth;
+    size_t i, k, head, nvregs = proc->nvregs;
+    long d;
+    double w;
+
+    start = malloc((nvregs + 1) * sizeof(*start));
+    end = malloc((nvregs + 1) * sizeof(*end));
+    weight = calloc(nvregs + 1, sizeof(*weight));
+    var = calloc(nvregs + 1, sizeof(*var));
+    label = malloc((proc->nblocks + 1) * sizeof(*label));
+    depth = calloc(proc->count + 1, sizeof(*depth));
+
+    if (start == NULL || end == NULL || weight == NULL ||
+        var == NULL || label == NULL || depth == NULL) {
+        free(start);
+        free(end);
+        free(weight);
+        free(var);
+        free(label);
+        free(depth);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < nvregs; ++i) {
+        start[i] = SIZE_MAX;
+        end[i] = 0;
+    }
+
+    for (i = 0; i < proc->nblocks; ++i) {
+        label[i] = SIZE_MAX;
+    }
+
+    for (i = 0; i < proc->count; ++i) {
+        insn = &proc->insns[i];
+        switch (insn->op) {
+        case IR_NOP:
+            continue;
+        case IR_LABEL:
+            label[insn->target[0]] = i;
+            break;
+        case IR_BR:
+            head = label[insn->target[1]];
+            if (head <= i) {
+                ra_add_loop(ra, head, i);
+            }
+
+            /* FALLTHROUGH */
+        case IR_JMP:
+            head = label[insn->target[0]];
+            if (head <= i) {
+                ra_add_loop(ra, head, i);
+            }
+
+            break;
+        default:
+            if (ra_is_clobber(insn)) {
+                ra->clobbers[ra->nclobbers++] = i;
+            }
+
+            break;
+        }
+
+        ra_use(&insn->a, start, end, var, i);
+        ra_use(&insn->b, start, end, var, i);
+        if (insn->dst != IR_VREG_NONE) {
+            if (start[insn->dst] != SIZE_MAX) {
+                var[insn->dst] = 1;
+            } else {
+                start[insn->dst] = i;
+            }
+
+            if (end[insn->dst] < i) {
+                end[insn->dst] = i;
+            }
+        }
+    }
+
+    /* Loop depth of each instruction, from the loop bounds */
+    for (i = 0; i < ra->nloops; ++i) {
+        ++depth[ra->loops[i].head];
+        --depth[ra->loops[i].tail + 1];
+    }
+
+    for (i = 0, d = 0; i < proc->count; ++i) {
+        d += depth[i];
+        insn = &proc->insns[i];
+        if (insn->op == IR_NOP) {
+            continue;
+        }
+
+        w = depth_weight[(d > RA_DEPTH_MAX) ? RA_DEPTH_MAX : d];
+        ra_weigh(&insn->a, weight, w);
+        ra_weigh(&insn->b, weight, w);
+        if (insn->dst != IR_VREG_NONE) {
+            weight[insn->dst] += w;
+        }
+    }
+
+    for (i = 0, k = 0; i < nvregs; ++i) {
+        if (start[i] == SIZE_MAX) {
+            continue;
+        }
+
+        ra->ivs[k].vreg = i;
+        ra->ivs[k].start = start[i];
+        ra->ivs[k].end = end[i];
+        ra->ivs[k].weight = weight[i];
+        ra->ivs[k].reg = RA_NOREG;
+        ra->ivs[k].split = false;
+        ra->ivs[k].var = var[i];
+        ++k;
+    }
+
+    ra->niv = k;
+    ra_stretch(ra);
+    for (i = 0; i < ra->niv; ++i) {
+        ra->ivs[i].weight /= ra->ivs[i].end - ra->ivs[i].start + 1;
+    }
+
+    free(start);
+    free(end);
+    free(weight);
+    free(var);
+    free(label);
+    free(depth);
+    return 0;
+}
+
+/*
+ * Order intervals by where they start
+ */
+static int
+ra_cmp_start(const void *a, const void *b)
+{
+    const struct ra_interval *ia = a, *ib = b;
+
+    if (ia->start != ib->start) {
+        return (ia->start < ib->start) ? -1 : 1;
+    }
+
+    return (ia->vreg < ib->vreg) ? -1 : (ia->vreg > ib->vreg);
+}
+
+/*
+ * Order spills by where the register is stored
+ */
+static int
+ra_cmp_spill(const void *a, const void *b)
+{
+    const struct ra_spill *sa = a, *sb = b;
+
+    if (sa->pos != sb->pos) {
+        return (sa->pos < sb->pos) ? -1 : 1;
+    }
+
+    return (sa->slot < sb->slot) ? -1 : (sa->slot > sb->slot);
+}
+
+/*
+ * Get the registers an interval may be held in for the
+ * whole of its life.
+ *
+ * @ra: Register allocation state
+ * @iv: Interval
+ * @first: First clobber it is live across, SIZE_MAX if none
+ */
+static uint32_t
+ra_mask(struct ra *ra, struct ra_interval *iv, size_t *first)
+{
+    const struct ir_insn *insn;
+    uint32_t mask;
+    size_t i, pos;
+
+    mask = (uint32_t)(((uint64_t)1 << ra->target->count) - 1);
+    *first = SIZE_MAX;
+
+    for (i = 0; i < ra->nclobbers && mask != 0; ++i) {
+        pos = ra->clobbers[i];
+        if (pos <= iv->start) {
+            continue;
+        }
+
+        if (pos >= iv->end) {
+            break;
+        }
+
+        if (*first == SIZE_MAX) {
+            *first = pos;
+        }
+
+        /* Inline assembly may write any register */
+        insn = &ra->proc->insns[pos];
+        if (insn->op == IR_ASM) {
+            mask = 0;
+        } else {
+            mask &= ra->target->saved;
+        }
+    }
+
+    return mask;
+}
+
+/*
+ * Pick a register, preferring the ones that need not
+ * be saved by the procedure.
+ *
+ * @ra: Register allocation state
+ * @mask: Registers to pick from
+ *
+ * Returns RA_NOREG if there are none
+ */
+static uint8_t
+ra_pick(struct ra *ra, uint32_t mask)
+{
+    uint32_t scratch;
+    uint8_t reg;
+
+    if (mask == 0) {
+        return RA_NOREG;
+    }
+
+    if ((scratch = mask & ~ra->target->saved) != 0) {
+        mask = scratch;
+    }
+
+    for (reg = 0; (mask & ((uint32_t)1 << reg)) == 0; ++reg);
+    return reg;
+}
+
+/*
+ * Move where a register is left up to the head of any
+ * loop it would otherwise be left within, so that the
+ * value is in its slot all the way around the loop.
+ *
+ * @ra: Register allocation state
+ * @start: Start of the interval
+ * @pos: Instruction the register would be left at
+ */
+static size_t
+ra_hoist(struct ra *ra, size_t start, size_t pos)
+{
+    struct ra_loop *loop;
+    bool changed = true;
+    size_t i;
+
+    while (changed) {
+        changed = false;
+        for (i = 0; i < ra->nloops; ++i) {
+            loop = &ra->loops[i];
+            if (start < loop->head && loop->head < pos && pos <= loop->tail) {
+                pos = loop->head;
+                changed = true;
+            }
+        }
+    }
+
+    return pos;
+}
+
+/*
+ * Take a spill slot, slots are shared by intervals
+ * that are not in them at once.
+ *
+ * @ra: Register allocation state
+ * @from: First instruction the slot is used at
+ * @end: Last instruction the slot is used at
+ *
+ * Returns RA_NOSLOT on failure
+ */
+static size_t
+ra_slot(struct ra *ra, size_t from, size_t end)
+{
+    size_t i, new_cap, *tmp;
+
+    for (i = 0; i < ra->res->nslots; ++i) {
+        if (ra->slot_end[i] < from) {
+            ra->slot_end[i] = end;
+            return i;
+        }
+    }
+
+    if (ra->res->nslots == ra->slot_cap) {
+        new_cap = (ra->slot_cap != 0) ? ra->slot_cap * 2 : 8;
+        tmp = realloc(ra->slot_end, new_cap * sizeof(*tmp));
+        if (tmp == NULL) {
+            errno = -ENOMEM;
+            return RA_NOSLOT;
+        }
+
+        ra->slot_end = tmp;
+        ra->slot_cap = new_cap;
+    }
+
+    ra->slot_end[ra->res->nslots] = end;
+    return ra->res->nslots++;
+}
+
+/*
+ * Split an interval, leaving its register for a spill
+ * slot at an instruction.
+ *
+ * The register is stored to the slot right after the
+ * interval is written rather than where it is left, the
+ * split may be within an if arm that is not always run
+ * while the write comes ahead of every use.
+ *
+ * XXX: Only for intervals written once, see 'var'.
+ *
+ * @ra: Register allocation state
+ * @iv: Interval holding a register
+ * @pos: Instruction the register is left at
+ *
+ * Returns zero on success
+ */
+static int
+ra_split(struct ra *ra, struct ra_interval *iv, size_t pos)
+{
+    struct ra_alloc *res = ra->res;
+    struct ra_loc *loc = &res->locs[iv->vreg];
+    struct ra_spill *tmp;
+    size_t new_cap;
+
+    if ((loc->slot = ra_slot(ra, iv->start, iv->end)) == RA_NOSLOT) {
+        return -1;
+    }
+
+    if (res->nspills == ra->spill_cap) {
+        new_cap = (ra->spill_cap != 0) ? ra->spill_cap * 2 : 8;
+        tmp = realloc(res->spills, new_cap * sizeof(*tmp));
+        if (tmp == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        res->spills = tmp;
+        ra->spill_cap = new_cap;
+    }
+
+    loc->split = pos;
+    iv->split = true;
+    iv->reg_end = pos - 1;
+    res->spills[res->nspills].pos = iv->start + 1;
+    res->spills[res->nspills].reg = iv->reg;
+    res->spills[res->nspills++].slot = loc->slot;
+    return 0;
+}
+
+/*
+ * Hand a register to an interval
+ *
+ * @ra: Register allocation state
+ * @iv: Interval
+ * @reg: Register
+ */
+static void
+ra_assign(struct ra *ra, struct ra_interval *iv, uint8_t reg)
+{
+    iv->reg = reg;
+    iv->reg_end = iv->end;
+    ra->res->locs[iv->vreg].reg = reg;
+    ra->res->used |= (uint32_t)1 << reg;
+    ra->active[ra->nactive++] = iv;
+}
+
+/*
+ * Allocate a register for an interval, the intervals
+ * come in order of where they start.
+ *
+ * @ra: Register allocation state
+ * @iv: Interval
+ * @free_regs: Registers free at the start of 'iv'
+ *
+ * Returns zero on success
+ */
+static int
+ra_interval(struct ra *ra, struct ra_interval *iv, uint32_t *free_regs)
+{
+    struct ra_interval *victim = NULL;
+    struct ra_loc *loc;
+    size_t i, victim_idx = 0, first, pos;
+    uint32_t mask;
+    uint8_t reg;
+
+    mask = ra_mask(ra, iv, &first);
+    if ((reg = ra_pick(ra, *free_regs & mask)) != RA_NOREG) {
+        *free_regs &= ~((uint32_t)1 << reg);
+        ra_assign(ra, iv, reg);
+        return 0;
+    }
+
+    /*
+     * Keep it in a register up until the first clobber,
+     * variables are written more than once so there is no
+     * single write to store them at, they stay in their
+     * slot from the start instead.
+     */
+    if (!iv->var && first != SIZE_MAX && (reg = ra_pick(ra, *free_regs)) != RA_NOREG) {
+        *free_regs &= ~((uint32_t)1 << reg);
+        ra_assign(ra, iv, reg);
+        return ra_split(ra, iv, ra_hoist(ra, iv->start, first));
+    }
+
+    for (i = 0; i < ra->nactive; ++i) {
+        if (ra->active[i]->split || ra->active[i]->var) {
+            continue;
+        }
+
+        if ((mask & ((uint32_t)1 << ra->active[i]->reg)) == 0) {
+            continue;
+        }
+
+        if (victim == NULL || ra->active[i]->weight < victim->weight) {
+            victim = ra->active[i];
+            victim_idx = i;
+        }
+    }
+
+    /* The one used least is left in memory */
+    if (victim == NULL || victim->weight >= iv->weight) {
+        loc = &ra->res->locs[iv->vreg];
+        loc->slot = ra_slot(ra, iv->start, iv->end);
+        return (loc->slot == RA_NOSLOT) ? -1 : 0;
+    }
+
+    pos = ra_hoist(ra, victim->start, iv->start);
+    if (ra_split(ra, victim, pos) < 0) {
+        return -1;
+    }
+
+    ra->active[victim_idx] = ra->active[--ra->nactive];
+    ra_assign(ra, iv, victim->reg);
+    return 0;
+}
+
+/*
+ * Allocate registers for every interval, in order of
+ * where they start.
+ *
+ * @ra: Register allocation state
+ *
+ * Returns zero on success
+ */
+static int
+ra_linear_scan(struct ra *ra)
+{
+    struct ra_interval *iv;
+    uint32_t free_regs;
+    size_t i, j;
+
+    free_regs = (uint32_t)(((uint64_t)1 << ra->target->count) - 1);
+    if (ra->niv > 0) {
+        qsort(ra->ivs, ra->niv, sizeof(*ra->ivs), ra_cmp_start);
+    }
+
+    for (i = 0; i < ra->niv; ++i) {
+        iv = &ra->ivs[i];
+
+        /* Expire the intervals done with their register */
+        for (j = 0; j < ra->nactive;) {
+            if (ra->active[j]->reg_end >= iv->start) {
+                ++j;
+                continue;
+            }
+
+            free_regs |= (uint32_t)1 << ra->active[j]->reg;
+            ra->active[j] = ra->active[--ra->nactive];
+        }
+
+        if (ra_interval(ra, iv, &free_regs) < 0) {
+            return -1;
+        }
+    }
+
+    if (ra->res->nspills > 0) {
+        qsort(
+            ra->res->spills, ra->res->nspills,
+            sizeof(*ra->res->spills), ra_cmp_spill
+        );
+    }
+
+    return 0;
+}
+
+int
+ra_allocate(struct ir_proc *proc, const struct ra_target *target,
+    struct ra_alloc *res)
+{
+    struct ra ra;
+    size_t i;
+    int error;
+
+    if (proc == NULL || target == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (target->count > RA_REG_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(res, 0, sizeof(*res));
+    memset(&ra, 0, sizeof(ra));
+    ra.proc = proc;
+    ra.target = target;
+    ra.res = res;
+
+    res->locs = malloc((proc->nvregs + 1) * sizeof(*res->locs));
+    ra.ivs = malloc((proc->nvregs + 1) * sizeof(*ra.ivs));
+    ra.active = malloc((proc->nvregs + 1) * sizeof(*ra.active));
+    ra.loops = malloc((proc->count + 1) * sizeof(*ra.loops));
+    ra.clobbers = malloc((proc->count + 1) * sizeof(*ra.clobbers));
+
+    if (res->locs == NULL || ra.ivs == NULL || ra.active == NULL ||
+        ra.loops == NULL || ra.clobbers == NULL) {
+        errno = -ENOMEM;
+        error = -1;
+        goto done;
+    }
+
+    for (i = 0; i < proc->nvregs; ++i) {
+        res->locs[i].reg = RA_NOREG;
+        res->locs[i].slot = RA_NOSLOT;
+        res->locs[i].split = SIZE_MAX;
+    }
+
+    if ((error = ra_scan(&ra)) == 0) {
+        error = ra_linear_scan(&ra);
+    }
+
+done:
+    free(ra.ivs);
+    free(ra.active);
+    free(ra.loops);
+    free(ra.clobbers);
+    free(ra.slot_end);
+    if (error < 0) {
+        ra_free(res);
+    }
+
+    return error;
+}
+
+void
+ra_free(struct ra_alloc *ra)
+{
+    if (ra == NULL) {
+        return;
+    }
+
+    free(ra->locs);
+    free(ra->spills);
+    memset(ra, 0, sizeof(*ra));
+}
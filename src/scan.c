@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "gup/scan.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_SIMD 1
+#else
+#define SCAN_SIMD 0
+#endif  /* __x86_64__ */
+
+/* Whitespace runs up to this long are skipped without a kernel */
+#define SCAN_SHORT 16
+
+/*
+ * Represents a set of scanning kernels, selected
+ * once at runtime based on what the host supports.
+ *
+ * @skip_ws:  Skip whitespace and count newlines
+ * @find_nl:  Find the next newline
+ * @count_nl: Count newlines
+ */
+struct scan_ops {
+    const char *(*skip_ws)(const char *, const char *, size_t *);
+    const char *(*find_nl)(const char *, const char *);
+    size_t (*count_nl)(const char *, const char *);
+};
+
+/*
+ * Returns non-zero if 'c' is whitespace, this must agree
+ * with the character classes used by the lexer.
+ */
+static inline int
+scan_is_ws(char c)
+{
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case '\f':
+        return 1;
+    }
+
+    return 0;
+}
+
+static const char *
+scan_skip_ws_scalar(const char *p, const char *end, size_t *nlines)
+{
+    size_t n = 0;
+
+    while (p < end && scan_is_ws(*p)) {
+        n += (*p == '\n');
+        ++p;
+    }
+
+    *nlines += n;
+    return p;
+}
+
+static const char *
+scan_find_nl_scalar(const char *p, const char *end)
+{
+    return memchr(p, '\n', end - p);
+}
+
+static size_t
+scan_count_nl_scalar(const char *p, const char *end)
+{
+    size_t n = 0;
+
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        ++n;
+        ++p;
+    }
+
+    return n;
+}
+
+static const struct scan_ops scan_scalar = {
+    .skip_ws = scan_skip_ws_scalar,
+    .find_nl = scan_find_nl_scalar,
+    .count_nl = scan_count_nl_scalar
+};
+
+#if SCAN_SIMD
+/*
+ * Compute the whitespace and newline masks of a
+ * 16 byte block.
+ *
+ * @v:  Block to classify
+ * @nl: Newline mask is written here
+ *
+ * Returns the whitespace mask
+ */
+static inline uint32_t
+scan_ws_mask_sse2(__m128i v, uint32_t *nl)
+{
+    __m128i ws, n;
+
+    n = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    ws = _mm_or_si128(n, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    ws = _mm_or_si128(ws, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+    ws = _mm_or_si128(ws, _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    ws = _mm_or_si128(ws, _mm_cmpeq_epi8(v, _mm_set1_epi8('\f')));
+    *nl = _mm_movemask_epi8(n);
+    return _mm_movemask_epi8(ws);
+}
+
+static const char *
+scan_skip_ws_sse2(const char *p, const char *end, size_t *nlines)
+{
+    uint32_t ws, nl, stop;
+    size_t n = 0;
+
+    while (end - p >= 16) {
+        ws = scan_ws_mask_sse2(_mm_loadu_si128((const __m128i *)p), &nl);
+        if (ws != 0xFFFF) {
+            stop = __builtin_ctz(~ws);
+            n += __builtin_popcount(nl & ((1U << stop) - 1));
+            *nlines += n;
+            return p + stop;
+        }
+
+        n += __builtin_popcount(nl);
+        p += 16;
+    }
+
+    *nlines += n;
+    return scan_skip_ws_scalar(p, end, nlines);
+}
+
+static const char *
+scan_find_nl_sse2(const char *p, const char *end)
+{
+    __m128i nl = _mm_set1_epi8('\n');
+    uint32_t mask;
+
+    while (end - p >= 16) {
+        mask = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), nl)
+        );
+
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return scan_find_nl_scalar(p, end);
+}
+
+static size_t
+scan_count_nl_sse2(const char *p, const char *end)
+{
+    __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0;
+
+    while (end - p >= 16) {
+        n += __builtin_popcount(
+            _mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), nl)
+            )
+        );
+
+        p += 16;
+    }
+
+    return n + scan_count_nl_scalar(p, end);
+}
+
+static const struct scan_ops scan_sse2 = {
+    .skip_ws = scan_skip_ws_sse2,
+    .find_nl = scan_find_nl_sse2,
+    .count_nl = scan_count_nl_sse2
+};
+
+/*
+ * Compute the whitespace and newline masks of a
+ * 32 byte block.
+ *
+ * @v:  Block to classify
+ * @nl: Newline mask is written here
+ *
+ * Returns the whitespace mask
+ */
+__attribute__((target("avx2")))
+static inline uint32_t
+scan_ws_mask_avx2(__m256i v, uint32_t *nl)
+{
+    __m256i ws, n;
+
+    n = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    ws = _mm256_or_si256(n, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    ws = _mm256_or_si256(ws, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    ws = _mm256_or_si256(ws, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')));
+    ws = _mm256_or_si256(ws, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\f')));
+    *nl = _mm256_movemask_epi8(n);
+    return _mm256_movemask_epi8(ws);
+}
+
+__attribute__((target("avx2")))
+static const char *
+scan_skip_ws_avx2(const char *p, const char *end, size_t *nlines)
+{
+    uint32_t ws, nl, stop;
+    size_t n = 0;
+
+    while (end - p >= 32) {
+        ws = scan_ws_mask_avx2(_mm256_loadu_si256((const __m256i *)p), &nl);
+        if (ws != 0xFFFFFFFF) {
+            stop = __builtin_ctz(~ws);
+            n += __builtin_popcount(nl & ((1U << stop) - 1));
+            *nlines += n;
+            return p + stop;
+        }
+
+        n += __builtin_popcount(nl);
+        p += 32;
+    }
+
+    *nlines += n;
+    return scan_skip_ws_sse2(p, end, nlines);
+}
+
+__attribute__((target("avx2")))
+static const char *
+scan_find_nl_avx2(const char *p, const char *end)
+{
+    __m256i nl = _mm256_set1_epi8('\n');
+    uint32_t mask;
+
+    while (end - p >= 32) {
+        mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl)
+        );
+
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    return scan_find_nl_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static size_t
+scan_count_nl_avx2(const char *p, const char *end)
+{
+    __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0;
+
+    while (end - p >= 32) {
+        n += __builtin_popcount(
+            _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl)
+            )
+        );
+
+        p += 32;
+    }
+
+    return n + scan_count_nl_sse2(p, end);
+}
+
+static const struct scan_ops scan_avx2 = {
+    .skip_ws = scan_skip_ws_avx2,
+    .find_nl = scan_find_nl_avx2,
+    .count_nl = scan_count_nl_avx2
+};
+#endif  /* SCAN_SIMD */
+
+/* Kernels in use, NULL until first selected */
+static const struct scan_ops *scan_ops = NULL;
+
+/*
+ * Obtain the best kernels for this host
+ *
+ * XXX: Every caller selects the same kernels so racing
+ *      on the first selection is harmless.
+ */
+static const struct scan_ops *
+scan_get_ops(void)
+{
+    const struct scan_ops *ops;
+
+    ops = __atomic_load_n(&scan_ops, __ATOMIC_ACQUIRE);
+    if (ops != NULL) {
+        return ops;
+    }
+
+    ops = &scan_scalar;
+#if SCAN_SIMD
+    __builtin_cpu_init();
+    ops = &scan_sse2;
+    if (__builtin_cpu_supports("avx2")) {
+        ops = &scan_avx2;
+    }
+#endif  /* SCAN_SIMD */
+
+    __atomic_store_n(&scan_ops, ops, __ATOMIC_RELEASE);
+    return ops;
+}
+
+const char *
+scan_skip_ws(const char *p, const char *end, size_t *nlines)
+{
+    const char *stop;
+    size_t n;
+
+    /* Most runs are a byte or none at all */
+    if (p >= end || !scan_is_ws(*p)) {
+        return p;
+    }
+
+    if (end - p < 2 || !scan_is_ws(p[1])) {
+        *nlines += (*p == '\n');
+        return p + 1;
+    }
+
+    /* Then a line break and an indent, still too short for a kernel */
+    stop = (end - p > SCAN_SHORT) ? p + SCAN_SHORT : end;
+    n = (*p == '\n') + (p[1] == '\n');
+    p += 2;
+    while (p < stop && scan_is_ws(*p)) {
+        n += (*p == '\n');
+        ++p;
+    }
+
+    *nlines += n;
+    if (p < stop || p == end || !scan_is_ws(*p)) {
+        return p;
+    }
+
+    return scan_get_ops()->skip_ws(p, end, nlines);
+}
+
+const char *
+scan_find_nl(const char *p, const char *end)
+{
+    if (p >= end) {
+        return NULL;
+    }
+
+    return scan_get_ops()->find_nl(p, end);
+}
+
+size_t
+scan_count_nl(const char *p, const char *end)
+{
+    if (p >= end) {
+        return 0;
+    }
+
+    return scan_get_ops()->count_nl(p, end);
+}
@@ -4,50 +4,307 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 #include "gup/trace.h"
 #include "gup/scope.h"
 
+/* Initial number of slots in a scope, must be a power of two */
+#define SCOPE_INIT_CAP 8
+
+/*
+ * Hash an interned name by its address
+ *
+ * @name: Name to hash
+ */
+static inline size_t
+scope_hash(const char *name)
+{
+    uint64_t p = (uintptr_t)name;
+
+    return (p * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+/*
+ * Find the slot of a name within a scope
+ *
+ * @scope: Scope to search, must have slots
+ * @name: Interned name
+ *
+ * Returns the slot holding the name or the free slot
+ * it would go in.
+ */
+static struct scope_slot *
+scope_probe(const struct scope *scope, const char *name)
+{
+    struct scope_slot *slot;
+    size_t i, mask;
+
+    mask = scope->slot_cap - 1;
+    i = scope_hash(name) & mask;
+    for (;;) {
+        slot = &scope->slots[i];
+        if (slot->gen != scope->gen || slot->symbol == NULL) {
+            return slot;
+        }
+
+        if (slot->symbol->name == name) {
+            return slot;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+/*
+ * Double the number of slots of a scope
+ *
+ * @scope: Scope to grow
+ *
+ * Returns zero on success
+ */
+static int
+scope_grow(struct scope *scope)
+{
+    struct scope_slot *old, *slot;
+    size_t i, old_cap;
+
+    old = scope->slots;
+    old_cap = scope->slot_cap;
+    scope->slot_cap = (old_cap == 0) ? SCOPE_INIT_CAP : old_cap * 2;
+    scope->slots = calloc(scope->slot_cap, sizeof(*scope->slots));
+    if (scope->slots == NULL) {
+        scope->slots = old;
+        scope->slot_cap = old_cap;
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (i = 0; i < old_cap; ++i) {
+        if (old[i].gen != scope->gen || old[i].symbol == NULL) {
+            continue;
+        }
+
+        slot = scope_probe(scope, old[i].symbol->name);
+        *slot = old[i];
+    }
+
+    free(old);
+    return 0;
+}
+
+/*
+ * Obtain an empty scope, reusing a popped one if we can
+ *
+ * @state: Compiler state
+ *
+ * Returns NULL on failure
+ */
+static struct scope *
+scope_alloc(struct gup_state *state)
+{
+    struct scope *scope;
+
+    if ((scope = state->scope_free) != NULL) {
+        state->scope_free = scope->next;
+
+        /* Drop every symbol of the last use at once */
+        if (++scope->gen == 0) {
+            memset(scope->slots, 0, scope->slot_cap * sizeof(*scope->slots));
+            scope->gen = 1;
+        }
+
+        scope->count = 0;
+        return scope;
+    }
+
+    if ((scope = calloc(1, sizeof(*scope))) == NULL) {
+        return NULL;
+    }
+
+    scope->gen = 1;
+    scope->all = state->scope_all;
+    state->scope_all = scope;
+    return scope;
+}
+
 int
 scope_push(struct gup_state *state, tt_t scope_tok)
 {
+    struct scope *scope, *parent;
+
     if (state == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    if (state->scope_depth >= MAX_SCOPE_DEPTH) {
-        trace_error(state, "maximum scope depth reached\n");
+    if ((scope = scope_alloc(state)) == NULL) {
+        trace_error(state, "failed to allocate scope\n");
         return -1;
     }
 
-    state->scope_stack[state->scope_depth++] = scope_tok;
+    /*
+     * Only the innermost scope gains symbols, so the nearest
+     * scope holding any cannot change while this one is open.
+     */
+    parent = state->scope;
+    scope->type = scope_tok;
+    scope->parent = parent;
+    scope->keep = 0;
+    scope->next = NULL;
+    scope->lookup = NULL;
+    if (parent != NULL) {
+        scope->lookup = (parent->count > 0) ? parent : parent->lookup;
+    }
+
+    state->scope = scope;
     return 0;
 }
 
 tt_t
 scope_top(struct gup_state *state)
 {
-    if (state == NULL) {
+    if (state == NULL || state->scope == NULL) {
         return TT_NONE;
     }
 
-    if (state->scope_depth == 0) {
-        return state->scope_stack[0];
-    }
-
-    return state->scope_stack[state->scope_depth - 1];
+    return state->scope->type;
 }
 
 tt_t
 scope_pop(struct gup_state *state)
 {
-    tt_t scope;
+    struct scope *scope;
 
-    if (state->scope_depth == 0) {
-        return state->scope_stack[0];
+    if (state == NULL || (scope = state->scope) == NULL) {
+        return TT_NONE;
     }
 
-    scope = state->scope_stack[--state->scope_depth];
-    state->scope_stack[state->scope_depth] = TT_NONE;
-    return scope;
+    state->scope = scope->parent;
+    if (!scope->keep) {
+        scope->next = state->scope_free;
+        state->scope_free = scope;
+    }
+
+    return scope->type;
+}
+
+struct scope *
+scope_current(struct gup_state *state)
+{
+    if (state == NULL) {
+        return NULL;
+    }
+
+    return state->scope;
+}
+
+struct scope *
+scope_proc(struct gup_state *state)
+{
+    struct scope *scope;
+
+    if (state == NULL) {
+        return NULL;
+    }
+
+    for (scope = state->scope; scope != NULL; scope = scope->parent) {
+        if (scope->type == TT_PROC) {
+            return scope;
+        }
+    }
+
+    return NULL;
+}
+
+int
+scope_insert(struct scope *scope, struct symbol *symbol)
+{
+    struct scope_slot *slot;
+
+    if (scope == NULL || symbol == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Keep the load factor under 3/4 */
+    if ((scope->count + 1) * 4 > scope->slot_cap * 3) {
+        if (scope_grow(scope) < 0) {
+            return -1;
+        }
+    }
+
+    slot = scope_probe(scope, symbol->name);
+    if (slot->gen == scope->gen && slot->symbol != NULL) {
+        errno = -EEXIST;
+        return -1;
+    }
+
+    slot->gen = scope->gen;
+    slot->symbol = symbol;
+    ++scope->count;
+    return 0;
+}
+
+struct symbol *
+scope_find(const struct scope *scope, const char *name)
+{
+    struct scope_slot *slot;
+
+    if (scope == NULL || name == NULL || scope->count == 0) {
+        return NULL;
+    }
+
+    slot = scope_probe(scope, name);
+    if (slot->gen != scope->gen) {
+        return NULL;
+    }
+
+    return slot->symbol;
+}
+
+struct symbol *
+scope_lookup(struct gup_state *state, const char *name)
+{
+    struct symbol *symbol;
+    struct scope *scope;
+
+    if (state == NULL || name == NULL) {
+        return NULL;
+    }
+
+    /* Skip straight past scopes without any symbols */
+    scope = state->scope;
+    if (scope != NULL && scope->count == 0) {
+        scope = scope->lookup;
+    }
+
+    while (scope != NULL) {
+        if ((symbol = scope_find(scope, name)) != NULL) {
+            return symbol;
+        }
+
+        scope = scope->lookup;
+    }
+
+    return symbol_from_name(&state->symtab, name);
+}
+
+void
+scope_destroy(struct gup_state *state)
+{
+    struct scope *scope;
+
+    if (state == NULL) {
+        return;
+    }
+
+    while ((scope = state->scope_all) != NULL) {
+        state->scope_all = scope->all;
+        free(scope->slots);
+        free(scope);
+    }
+
+    state->scope = NULL;
+    state->scope_free = NULL;
 }
@@ -3,57 +3,255 @@
  * Provided under the BSD-3 clause.
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include "gup/state.h"
 #include "gup/ptrbox.h"
+#include "gup/scope.h"
+#include "gup/ir.h"
+
+/* Initial size of the buffered input fallback */
+#define INPUT_BUF_INIT 4096
+
+/* Rough number of source bytes per token, used to size the stream */
+#define INPUT_BYTES_PER_TOKEN 8
+
+/*
+ * Read the whole source input into a heap buffer, used
+ * for pipes and other files that cannot be mapped.
+ *
+ * @state: Compiler state
+ * @fd: Source input file descriptor
+ *
+ * Returns zero on success
+ */
+static int
+gup_input_read(struct gup_state *state, int fd)
+{
+    char *buf, *tmp;
+    size_t cap, len;
+    ssize_t n;
+
+    cap = INPUT_BUF_INIT;
+    len = 0;
+    if ((buf = malloc(cap)) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (;;) {
+        if (len == cap) {
+            cap *= 2;
+            if ((tmp = realloc(buf, cap)) == NULL) {
+                free(buf);
+                errno = -ENOMEM;
+                return -1;
+            }
+
+            buf = tmp;
+        }
+
+        n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        len += n;
+    }
+
+    state->in_buf = buf;
+    state->in_len = len;
+    state->in_mapped = 0;
+    return 0;
+}
+
+/*
+ * Make the source input available in memory, mapping it
+ * when possible.
+ *
+ * @state: Compiler state
+ * @fd: Source input file descriptor
+ *
+ * Returns zero on success
+ */
+static int
+gup_input_open(struct gup_state *state, int fd)
+{
+    struct stat st;
+    void *map;
+
+    if (fstat(fd, &st) < 0) {
+        return -1;
+    }
+
+    /* Empty files and non-regular files are read instead */
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        return gup_input_read(state, fd);
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return gup_input_read(state, fd);
+    }
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    state->in_buf = map;
+    state->in_len = st.st_size;
+    state->in_mapped = 1;
+    return 0;
+}
+
+/*
+ * Release the source input buffer
+ *
+ * @state: Compiler state
+ */
+static void
+gup_input_close(struct gup_state *state)
+{
+    if (state->in_buf == NULL) {
+        return;
+    }
+
+    if (state->in_mapped) {
+        munmap((void *)state->in_buf, state->in_len);
+    } else {
+        free((void *)state->in_buf);
+    }
+
+    state->in_buf = NULL;
+    state->in_len = 0;
+}
 
 int
 gup_state_init(const char *path, struct gup_state *state)
 {
+    int fd, error;
+    size_t i;
+
     if (path == NULL || state == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
     memset(state, 0, sizeof(*state));
-    state->in_fd = open(path, O_RDONLY);
-    if (state->in_fd < 0) {
+    if (strcmp(path, "-") == 0) {
+        fd = STDIN_FILENO;
+    } else if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+
+    /* The descriptor is not needed once the input is in memory */
+    error = gup_input_open(state, fd);
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    if (error < 0) {
         return -1;
     }
 
     if (ptrbox_init(&state->ptrbox) < 0) {
-        close(state->in_fd);
+        gup_input_close(state);
         return -1;
     }
 
-    if (symbol_table_init(&state->symtab) < 0) {
-        close(state->in_fd);
+    if (intern_init(&state->names) < 0) {
+        ptrbox_destroy(&state->ptrbox);
+        gup_input_close(state);
         return -1;
     }
 
-    state->out_fp = fopen(DEFAULT_ASMOUT, "w");
-    if (state->out_fp == NULL) {
-        symbol_table_destroy(&state->symtab);
-        close(state->in_fd);
+    error = tokstream_init(
+        &state->tokens,
+        state->in_len / INPUT_BYTES_PER_TOKEN
+    );
+
+    if (error < 0) {
+        intern_destroy(&state->names);
+        ptrbox_destroy(&state->ptrbox);
+        gup_input_close(state);
         return -1;
     }
 
+    if (symbol_table_init(&state->symtab) < 0) {
+        tokstream_destroy(&state->tokens);
+        intern_destroy(&state->names);
+        ptrbox_destroy(&state->ptrbox);
+        gup_input_close(state);
+        return -1;
+    }
+
+    for (i = 0; i < SECTION_MAX; ++i) {
+        outbuf_init(&state->out[i]);
+    }
+
     state->line_num = 1;
     return 0;
 }
 
+void
+gup_state_log(struct gup_state *state, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (state->diag != NULL) {
+        outbuf_vprintf(state->diag, fmt, ap);
+    } else {
+        vfprintf(stderr, fmt, ap);
+    }
+
+    va_end(ap);
+}
+
+int
+gup_state_flush(struct gup_state *state, int fd)
+{
+    if (state == NULL || fd < 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Each buffer already starts with its section directive */
+    return outbuf_flushv(state->out, SECTION_MAX, fd);
+}
+
 void
 gup_state_destroy(struct gup_state *state)
 {
+    size_t i;
+
     if (state == NULL) {
         return;
     }
 
-    close(state->in_fd);
-    fclose(state->out_fp);
+    scope_destroy(state);
+    tokstream_destroy(&state->tokens);
+    gup_input_close(state);
+    for (i = 0; i < SECTION_MAX; ++i) {
+        outbuf_destroy(&state->out[i]);
+    }
+
     ptrbox_destroy(&state->ptrbox);
     symbol_table_destroy(&state->symtab);
+    intern_destroy(&state->names);
+    ir_destroy(state->ir);
+    free(state->ir);
 }
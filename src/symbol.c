@@ -8,6 +8,188 @@
 #include <string.h>
 #include "gup/symbol.h"
 
+/* Initial number of hash table slots, must be a power of two */
+#define SYMTAB_INIT_CAP 64
+
+/* Number of old slots moved per insert while growing */
+#define SYMTAB_MIGRATE 16
+
+/* Initial capacity of the symbol vector */
+#define SYMTAB_INIT_SYMBOLS 64
+
+/*
+ * Hash an interned symbol name, equal names share an
+ * address so the address alone is hashed.
+ *
+ * @name: Name to hash
+ */
+static inline uint32_t
+symbol_hash(const char *name)
+{
+    uint64_t p = (uintptr_t)name;
+
+    return (p * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+/*
+ * Find the slot of a name within a set of slots
+ *
+ * @slots: Slots to search
+ * @cap: Number of slots, must be a power of two
+ * @hash: Hash of name
+ * @name: Interned name to look up
+ *
+ * Returns the slot holding the name or the free slot
+ * it would go in.
+ */
+static struct symbol_slot *
+symbol_probe(struct symbol_slot *slots, size_t cap, uint32_t hash,
+    const char *name)
+{
+    struct symbol_slot *slot;
+    struct symbol *symbol;
+    size_t i;
+
+    i = hash & (cap - 1);
+    for (;;) {
+        slot = &slots[i];
+        if ((symbol = slot->symbol) == NULL) {
+            return slot;
+        }
+
+        if (symbol->name == name) {
+            return slot;
+        }
+
+        i = (i + 1) & (cap - 1);
+    }
+}
+
+/*
+ * Move some slots over from the old table of a symbol
+ * table that is growing.
+ *
+ * @symtab: Symbol table
+ * @count: Maximum number of old slots to move
+ */
+static void
+symbol_migrate(struct symbol_table *symtab, size_t count)
+{
+    struct symbol_slot *old, *slot;
+    size_t i;
+
+    if (symtab->old_slots == NULL) {
+        return;
+    }
+
+    for (i = 0; i < count && symtab->old_idx < symtab->old_cap; ++i) {
+        old = &symtab->old_slots[symtab->old_idx++];
+        if (old->symbol == NULL) {
+            continue;
+        }
+
+        slot = &symtab->slots[old->hash & (symtab->slot_cap - 1)];
+        while (slot->symbol != NULL) {
+            if (++slot == &symtab->slots[symtab->slot_cap]) {
+                slot = symtab->slots;
+            }
+        }
+
+        *slot = *old;
+    }
+
+    if (symtab->old_idx == symtab->old_cap) {
+        free(symtab->old_slots);
+        symtab->old_slots = NULL;
+        symtab->old_cap = 0;
+        symtab->old_idx = 0;
+    }
+}
+
+/*
+ * Start growing the hash table of a symbol table
+ *
+ * @symtab: Symbol table to grow
+ *
+ * Returns zero on success
+ */
+static int
+symbol_table_grow(struct symbol_table *symtab)
+{
+    struct symbol_slot *slots;
+    size_t cap;
+
+    /* Finish any previous growth first */
+    symbol_migrate(symtab, symtab->old_cap);
+
+    cap = symtab->slot_cap * 2;
+    if ((slots = calloc(cap, sizeof(*slots))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    symtab->old_slots = symtab->slots;
+    symtab->old_cap = symtab->slot_cap;
+    symtab->old_idx = 0;
+    symtab->slots = slots;
+    symtab->slot_cap = cap;
+    return 0;
+}
+
+/*
+ * Add a symbol to the hash table of a symbol table, the
+ * first symbol declared with a name is the one found.
+ *
+ * @symtab: Symbol table
+ * @symbol: Symbol to add
+ *
+ * Returns zero on success
+ */
+static int
+symbol_table_insert(struct symbol_table *symtab, struct symbol *symbol)
+{
+    struct symbol_slot *slot;
+    uint32_t hash;
+
+    /* Keep the load factor under 3/4 */
+    if ((symtab->slot_count + 1) * 4 > symtab->slot_cap * 3) {
+        if (symbol_table_grow(symtab) < 0) {
+            return -1;
+        }
+    }
+
+    symbol_migrate(symtab, SYMTAB_MIGRATE);
+    hash = symbol_hash(symbol->name);
+    if (symtab->old_slots != NULL) {
+        slot = symbol_probe(
+            symtab->old_slots,
+            symtab->old_cap,
+            hash,
+            symbol->name
+        );
+
+        if (slot->symbol != NULL) {
+            return 0;
+        }
+    }
+
+    slot = symbol_probe(
+        symtab->slots,
+        symtab->slot_cap,
+        hash,
+        symbol->name
+    );
+
+    if (slot->symbol != NULL) {
+        return 0;
+    }
+
+    slot->hash = hash;
+    slot->symbol = symbol;
+    ++symtab->slot_count;
+    return 0;
+}
+
 int
 symbol_table_init(struct symbol_table *symtab)
 {
@@ -16,13 +198,58 @@ symbol_table_init(struct symbol_table *symtab)
         return -1;
     }
 
-    symtab->symbol_count = 0;
-    TAILQ_INIT(&symtab->symbols);
+    memset(symtab, 0, sizeof(*symtab));
+    symtab->slots = calloc(SYMTAB_INIT_CAP, sizeof(*symtab->slots));
+    if (symtab->slots == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    symtab->slot_cap = SYMTAB_INIT_CAP;
+    if (arena_init(&symtab->arena, 0) < 0) {
+        free(symtab->slots);
+        symtab->slots = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Make room for another symbol in the symbol vector
+ *
+ * @symtab: Symbol table
+ *
+ * Returns zero on success
+ */
+static int
+symbol_table_reserve(struct symbol_table *symtab)
+{
+    struct symbol **symbols;
+    size_t cap;
+
+    if (symtab->symbol_count < symtab->symbol_cap) {
+        return 0;
+    }
+
+    cap = symtab->symbol_cap * 2;
+    if (cap == 0) {
+        cap = SYMTAB_INIT_SYMBOLS;
+    }
+
+    symbols = realloc(symtab->symbols, cap * sizeof(*symbols));
+    if (symbols == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    symtab->symbols = symbols;
+    symtab->symbol_cap = cap;
     return 0;
 }
 
 int
-symbol_new(struct symbol_table *symtab, const char *name, gup_type_t type,
+symbol_alloc(struct symbol_table *symtab, const char *name, gup_type_t type,
     struct symbol **res)
 {
     struct symbol *symbol;
@@ -33,7 +260,16 @@ symbol_new(struct symbol_table *symtab, const char *name, gup_type_t type,
         return -1;
     }
 
-    symbol = malloc(sizeof(*symbol));
+    if (symbol_table_reserve(symtab) < 0) {
+        return -1;
+    }
+
+    symbol = arena_alloc(
+        &symtab->arena,
+        sizeof(*symbol),
+        _Alignof(struct symbol)
+    );
+
     if (symbol == NULL) {
         errno = -ENOMEM;
         return -1;
@@ -41,8 +277,9 @@ symbol_new(struct symbol_table *symtab, const char *name, gup_type_t type,
 
     /* Initialize the symbol */
     memset(symbol, 0, sizeof(*symbol));
+    symbol->name = name;
     symbol->id = symtab->symbol_count++;
-    symbol->name = strdup(name);
+    symtab->symbols[symbol->id] = symbol;
 
     /* Initialize the datam type */
     dtype = &symbol->data_type;
@@ -52,66 +289,77 @@ symbol_new(struct symbol_table *symtab, const char *name, gup_type_t type,
         *res = symbol;
     }
 
-    TAILQ_INSERT_TAIL(&symtab->symbols, symbol, link);
     return 0;
 }
 
-struct symbol *
-symbol_from_id(struct symbol_table *symtab, sym_id_t id)
+int
+symbol_new(struct symbol_table *symtab, const char *name, gup_type_t type,
+    struct symbol **res)
 {
     struct symbol *symbol;
 
-    if (symtab == NULL) {
-        return NULL;
+    if (symbol_alloc(symtab, name, type, &symbol) < 0) {
+        return -1;
     }
 
-    TAILQ_FOREACH(symbol, &symtab->symbols, link) {
-        if (symbol->id == id) {
-            return symbol;
-        }
+    if (symbol_table_insert(symtab, symbol) < 0) {
+        return -1;
+    }
+
+    if (res != NULL) {
+        *res = symbol;
+    }
+
+    return 0;
+}
+
+struct symbol *
+symbol_from_id(struct symbol_table *symtab, sym_id_t id)
+{
+    if (symtab == NULL || id >= symtab->symbol_count) {
+        return NULL;
     }
 
-    return NULL;
+    return symtab->symbols[id];
 }
 
 struct symbol *
 symbol_from_name(struct symbol_table *symtab, const char *name)
 {
-    struct symbol *symbol;
+    struct symbol_slot *slot;
+    uint32_t hash;
 
     if (symtab == NULL || name == NULL) {
         return NULL;
     }
 
-    TAILQ_FOREACH(symbol, &symtab->symbols, link) {
-        if (*symbol->name != *name) {
-            continue;
-        }
-
-        if (strcmp(symbol->name, name) == 0) {
-            return symbol;
-        }
+    hash = symbol_hash(name);
+    slot = symbol_probe(symtab->slots, symtab->slot_cap, hash, name);
+    if (slot->symbol == NULL && symtab->old_slots != NULL) {
+        slot = symbol_probe(
+            symtab->old_slots,
+            symtab->old_cap,
+            hash,
+            name
+        );
     }
 
-    return NULL;
+    return slot->symbol;
 }
 
 void
 symbol_table_destroy(struct symbol_table *symtab)
 {
-    struct symbol *symbol;
-
     if (symtab == NULL) {
         return;
     }
 
-    symbol = TAILQ_FIRST(&symtab->symbols);
-    while (symbol != NULL) {
-        TAILQ_REMOVE(&symtab->symbols, symbol, link);
-        if (symbol->name != NULL) {
-            free(symbol->name);
-        }
-        free(symbol);
-        symbol = TAILQ_FIRST(&symtab->symbols);
-    }
+    arena_destroy(&symtab->arena);
+    free(symtab->symbols);
+    free(symtab->slots);
+    free(symtab->old_slots);
+    symtab->symbols = NULL;
+    symtab->slots = NULL;
+    symtab->old_slots = NULL;
+    symtab->symbol_count = 0;
 }
@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gup/tokstream.h"
+#include "gup/lexer.h"
+#include "gup/state.h"
+#include "gup/trace.h"
+#include "gup/scan.h"
+
+/* Minimum number of token slots to allocate */
+#define TOKSTREAM_MIN_CAP 64
+
+/* Inputs smaller than this are always lexed serially */
+#define TOKSTREAM_PAR_MIN (1 << 20)
+
+/* Smallest chunk worth a thread of its own */
+#define TOKSTREAM_CHUNK_MIN (256 << 10)
+
+/* Upper bound on lexer threads */
+#define TOKSTREAM_MAX_THREADS 64
+
+/*
+ * Represents a chunk of the source input that is lexed
+ * on its own thread.
+ *
+ * @lex: Private lexer state, shares the source input
+ * @ts: Tokens lexed from this chunk
+ * @start: Offset of the first byte of the chunk
+ * @end: Offset past the last byte of the chunk
+ * @stop: Offset lexing of the next chunk resumes from
+ * @nlines: Number of newlines within [start, end)
+ * @error: Set if lexing this chunk failed
+ * @thread: Thread lexing this chunk
+ *
+ * XXX: Chunks begin right after a newline but may still
+ *      begin inside of multi-line assembly, lexing them
+ *      is speculative and checked when stitching.
+ */
+struct tokstream_chunk {
+    struct gup_state lex;
+    struct tokstream ts;
+    size_t start;
+    size_t end;
+    size_t stop;
+    size_t nlines;
+    int error;
+    pthread_t thread;
+};
+
+/*
+ * Resize one array of a token stream
+ *
+ * @p: Pointer to array base
+ * @elem_size: Size of one element
+ * @cap: New capacity in elements
+ *
+ * Returns zero on success
+ */
+static int
+tokstream_resize(void *p, size_t elem_size, size_t cap)
+{
+    void **base = p;
+    void *tmp;
+
+    if ((tmp = realloc(*base, elem_size * cap)) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    *base = tmp;
+    return 0;
+}
+
+/*
+ * Grow the token arrays of a token stream
+ *
+ * @ts: Token stream to grow
+ * @cap: New capacity
+ *
+ * Returns zero on success
+ */
+static int
+tokstream_grow(struct tokstream *ts, size_t cap)
+{
+    if (tokstream_resize(&ts->type, sizeof(*ts->type), cap) < 0)
+        return -1;
+    if (tokstream_resize(&ts->off, sizeof(*ts->off), cap) < 0)
+        return -1;
+    if (tokstream_resize(&ts->len, sizeof(*ts->len), cap) < 0)
+        return -1;
+    if (tokstream_resize(&ts->line, sizeof(*ts->line), cap) < 0)
+        return -1;
+    if (tokstream_resize(&ts->vidx, sizeof(*ts->vidx), cap) < 0)
+        return -1;
+
+    ts->cap = cap;
+    return 0;
+}
+
+int
+tokstream_init(struct tokstream *ts, size_t hint)
+{
+    if (ts == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(ts, 0, sizeof(*ts));
+    if (hint < TOKSTREAM_MIN_CAP) {
+        hint = TOKSTREAM_MIN_CAP;
+    }
+
+    if (tokstream_grow(ts, hint) < 0) {
+        tokstream_destroy(ts);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+tokstream_push(struct tokstream *ts, const struct token *tok, size_t line)
+{
+    size_t i, cap;
+
+    if (ts == NULL || tok == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (ts->count >= ts->cap) {
+        if (tokstream_grow(ts, ts->cap * 2) < 0)
+            return -1;
+    }
+
+    i = ts->count;
+    ts->type[i] = tok->type;
+    ts->off[i] = tok->off;
+    ts->len[i] = tok->len;
+    ts->line[i] = line;
+    ts->vidx[i] = 0;
+
+    if (tok->type == TT_NUMBER) {
+        if (ts->value_count >= ts->value_cap) {
+            cap = ts->value_cap * 2;
+            if (cap == 0) {
+                cap = TOKSTREAM_MIN_CAP;
+            }
+
+            if (tokstream_resize(&ts->value, sizeof(*ts->value), cap) < 0)
+                return -1;
+
+            ts->value_cap = cap;
+        }
+
+        ts->vidx[i] = ts->value_count;
+        ts->value[ts->value_count++] = tok->v;
+    }
+
+    ++ts->count;
+    return 0;
+}
+
+/*
+ * Lex tokens from the cursor onwards until one begins
+ * at or past 'end'.
+ *
+ * @state: Compiler state
+ * @ts: Token stream to append to
+ * @end: Offset to stop at
+ * @stop: Offset to resume lexing from is written here
+ *
+ * XXX: Only whitespace lies between 'stop' and the first
+ *      token not taken, so 'stop' never exceeds 'end'
+ *      unless the last token taken runs past it.
+ *
+ * Returns zero on success
+ */
+static int
+tokstream_lex_range(struct gup_state *state, struct tokstream *ts,
+    size_t end, size_t *stop)
+{
+    struct token tok;
+    size_t resume;
+
+    for (;;) {
+        resume = state->in_off;
+        if (lexer_scan(state, &tok) < 0) {
+            return -1;
+        }
+
+        if (tok.type == TT_NONE || tok.off >= end) {
+            *stop = resume;
+            return 0;
+        }
+
+        if (tok.type == TT_COMMENT) {
+            continue;
+        }
+
+        if (tokstream_push(ts, &tok, state->line_num) < 0) {
+            trace_error(state, "failed to grow token stream\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Append the tokens of a chunk to a token stream
+ *
+ * @ts: Token stream to append to
+ * @src: Tokens to append
+ * @line_base: Added to the line of every token
+ *
+ * Returns zero on success
+ */
+static int
+tokstream_append(struct tokstream *ts, const struct tokstream *src,
+    size_t line_base)
+{
+    size_t cap, i, n;
+    uint32_t vbase;
+
+    cap = ts->cap;
+    while (cap < ts->count + src->count) {
+        cap *= 2;
+    }
+
+    if (cap != ts->cap && tokstream_grow(ts, cap) < 0) {
+        return -1;
+    }
+
+    if (ts->value_cap < ts->value_count + src->value_count) {
+        cap = ts->value_count + src->value_count;
+        if (tokstream_resize(&ts->value, sizeof(*ts->value), cap) < 0)
+            return -1;
+
+        ts->value_cap = cap;
+    }
+
+    n = ts->count;
+    vbase = ts->value_count;
+    memcpy(&ts->type[n], src->type, src->count * sizeof(*ts->type));
+    memcpy(&ts->off[n], src->off, src->count * sizeof(*ts->off));
+    memcpy(&ts->len[n], src->len, src->count * sizeof(*ts->len));
+    for (i = 0; i < src->count; ++i) {
+        ts->line[n + i] = src->line[i] + line_base;
+        ts->vidx[n + i] = src->vidx[i] + vbase;
+    }
+
+    memcpy(
+        &ts->value[vbase],
+        src->value,
+        src->value_count * sizeof(*ts->value)
+    );
+
+    ts->count += src->count;
+    ts->value_count += src->value_count;
+    return 0;
+}
+
+/*
+ * Thread entry for lexing a single chunk
+ *
+ * @arg: Chunk to lex
+ */
+static void *
+tokstream_chunk_main(void *arg)
+{
+    struct tokstream_chunk *chunk = arg;
+    const char *buf = chunk->lex.in_buf;
+    struct tokstream *ts = &chunk->ts;
+
+    chunk->nlines = scan_count_nl(buf + chunk->start, buf + chunk->end);
+    chunk->error = tokstream_init(ts, (chunk->end - chunk->start) / 8);
+    if (chunk->error < 0) {
+        return NULL;
+    }
+
+    chunk->error = tokstream_lex_range(
+        &chunk->lex,
+        ts,
+        chunk->end,
+        &chunk->stop
+    );
+
+    return NULL;
+}
+
+/*
+ * Split the source input into chunks at line boundaries
+ *
+ * @state: Compiler state
+ * @chunks: Chunks are written here
+ * @nchunks: Maximum number of chunks
+ *
+ * Returns the number of chunks made
+ */
+static size_t
+tokstream_split(struct gup_state *state, struct tokstream_chunk *chunks,
+    size_t nchunks)
+{
+    const char *buf = state->in_buf, *end = buf + state->in_len;
+    const char *p;
+    size_t i, n = 0, start = 0;
+
+    for (i = 1; i <= nchunks && start < state->in_len; ++i) {
+        p = buf + (state->in_len / nchunks) * i;
+        if (i == nchunks || p <= buf + start) {
+            p = end;
+        } else if ((p = scan_find_nl(p, end)) == NULL) {
+            p = end;
+        } else {
+            ++p;
+        }
+
+        memset(&chunks[n], 0, sizeof(chunks[n]));
+        chunks[n].lex.in_buf = buf;
+        chunks[n].lex.in_len = state->in_len;
+        chunks[n].lex.in_off = start;
+        chunks[n].lex.quiet = 1;
+        chunks[n].start = start;
+        chunks[n].end = p - buf;
+        start = chunks[n++].end;
+    }
+
+    return n;
+}
+
+/*
+ * Lex the source input on several threads and stitch
+ * the results together. Chunks whose speculative lexing
+ * does not line up with the previous chunk are lexed
+ * again serially.
+ *
+ * @state: Compiler state
+ * @ts: Token stream to lex into
+ * @nthreads: Number of threads to use
+ *
+ * Returns zero on success
+ */
+static int
+tokstream_lex_parallel(struct gup_state *state, struct tokstream *ts,
+    size_t nthreads)
+{
+    struct tokstream_chunk *chunks, *chunk;
+    size_t i, n, line_base, stop = 0;
+    int error = 0;
+
+    if ((chunks = calloc(nthreads, sizeof(*chunks))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    n = tokstream_split(state, chunks, nthreads);
+    for (i = 0; i < n; ++i) {
+        chunk = &chunks[i];
+        error = pthread_create(
+            &chunk->thread,
+            NULL,
+            tokstream_chunk_main,
+            chunk
+        );
+
+        /* Lex it here if we are out of threads */
+        if (error != 0) {
+            tokstream_chunk_main(chunk);
+            chunk->thread = pthread_self();
+            error = 0;
+        }
+    }
+
+    line_base = 1;
+    for (i = 0; i < n; ++i) {
+        chunk = &chunks[i];
+        if (!pthread_equal(chunk->thread, pthread_self())) {
+            pthread_join(chunk->thread, NULL);
+        }
+
+        if (error < 0) {
+            tokstream_destroy(&chunk->ts);
+            continue;
+        }
+
+        /*
+         * If the previous chunk did not run into this one, this
+         * chunk was lexed from a token boundary and its tokens
+         * are what a serial lexer would have produced.
+         */
+        if (chunk->error == 0 && stop <= chunk->start) {
+            error = tokstream_append(ts, &chunk->ts, line_base);
+            stop = chunk->stop;
+        } else {
+            state->in_off = stop;
+            state->line_num = 1;
+            state->line_num += scan_count_nl(
+                state->in_buf,
+                state->in_buf + stop
+            );
+
+            error = tokstream_lex_range(state, ts, chunk->end, &stop);
+        }
+
+        line_base += chunk->nlines;
+        tokstream_destroy(&chunk->ts);
+    }
+
+    free(chunks);
+    return error;
+}
+
+int
+tokstream_lex(struct gup_state *state, struct tokstream *ts)
+{
+    size_t stop;
+    long ncpu;
+    size_t nthreads;
+
+    if (state == NULL || ts == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Offsets and lengths are stored in 32 bits */
+    if (state->in_len > UINT32_MAX) {
+        trace_error(state, "source input too large\n");
+        return -1;
+    }
+
+    nthreads = 1;
+    if (state->in_len >= TOKSTREAM_PAR_MIN) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = state->in_len / TOKSTREAM_CHUNK_MIN;
+        if (ncpu > 0 && nthreads > (size_t)ncpu)
+            nthreads = ncpu;
+        if (nthreads > TOKSTREAM_MAX_THREADS)
+            nthreads = TOKSTREAM_MAX_THREADS;
+    }
+
+    if (nthreads > 1) {
+        return tokstream_lex_parallel(state, ts, nthreads);
+    }
+
+    return tokstream_lex_range(state, ts, SIZE_MAX, &stop);
+}
+
+int
+tokstream_get(const struct tokstream *ts, size_t idx, struct token *res)
+{
+    if (ts == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (idx >= ts->count) {
+        return -1;
+    }
+
+    res->type = ts->type[idx];
+    res->off = ts->off[idx];
+    res->len = ts->len[idx];
+    res->v = 0;
+    if (res->type == TT_NUMBER) {
+        res->v = ts->value[ts->vidx[idx]];
+    }
+
+    return 0;
+}
+
+void
+tokstream_destroy(struct tokstream *ts)
+{
+    if (ts == NULL) {
+        return;
+    }
+
+    free(ts->type);
+    free(ts->off);
+    free(ts->len);
+    free(ts->line);
+    free(ts->vidx);
+    free(ts->value);
+    memset(ts, 0, sizeof(*ts));
+}
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# Run every test of this directory against the compiler
+# in the root of the tree, a test fails by exiting with
+# a non-zero status.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+fail=0
+for t in test/*.sh; do
+    if [ "$t" = "test/check.sh" ] || [ "$t" = "test/common.sh" ]; then
+        continue
+    fi
+
+    if sh "$t"; then
+        echo "PASS: $t"
+    else
+        echo "FAIL: $t"
+        fail=1
+    fi
+done
+
+exit $fail
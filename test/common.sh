@@ -0,0 +1,72 @@
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# Sourced by the tests, sets up a scratch directory that
+# is removed on exit.
+#
+
+GUP=${GUP:-$PWD/gup}
+CC=${CC:-cc}
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+#
+# Compile a gup source to an object with the built-in
+# assembler only, nasm is kept out of reach so that code
+# it cannot encode is never hidden.
+#
+# $1: Source path
+# $2: Object path
+# $3...: Further options, e.g., '-f bin'
+#
+gup_obj() {
+    src=$1
+    obj=$2
+    shift 2
+    log=$(PATH=/nonexistent "$GUP" "$@" -o "$obj" "$src" 2>&1) || {
+        echo "$log"
+        return 1
+    }
+}
+
+#
+# Compile a gup source and link it with a harness that
+# runs checks against it. The test writes the C ahead of
+# main() to '$tmp/decl.h' and the body of main() to
+# '$tmp/body.h', where CHECK(got, want) fails the test
+# if the two differ.
+#
+# $1: Source path
+#
+gup_check() {
+    name=$(basename "$1" .gup)
+    cat > "$tmp/main.c" <<'C'
+#include <stdint.h>
+#include <stdio.h>
+
+#define CHECK(got, want) \
+    if ((got) != (want)) { \
+        printf("%s: got %llu, want %llu\n", #got, \
+            (unsigned long long)(got), (unsigned long long)(want)); \
+        fail = 1; \
+    }
+
+#include "decl.h"
+
+int
+main(void)
+{
+    int fail = 0;
+
+#include "body.h"
+    return fail;
+}
+C
+
+    gup_obj "$1" "$tmp/$name.o" || return 1
+    $CC -no-pie -z noexecstack -I"$tmp" "$tmp/main.c" "$tmp/$name.o" \
+        -o "$tmp/$name" || return 1
+    "$tmp/$name"
+}
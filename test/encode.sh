@@ -0,0 +1,192 @@
+#!/bin/sh
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# Instructions put through the built-in assembler against
+# the bytes nasm gives for them, each is assembled on its
+# own into a flat binary. With nasm on the PATH the bytes
+# are checked against it as well.
+#
+# Entries are 'assembly | bytes', statements of an entry
+# are split by ' / ' and '[bits N]' lines set the mode.
+#
+
+. "$(dirname "$0")/common.sh"
+
+NASM=$(command -v nasm)
+
+#
+# Write the bytes of a file as hex, e.g., 'c3'
+#
+# $1: Path of the file
+#
+hex() {
+    od -An -tx1 -v "$1" | tr -s ' \n' '  ' | sed 's/^ //; s/ $//'
+}
+
+corpus() {
+    cat <<'ASM'
+[bits 64]
+ret | c3
+leave | c9
+push rbp | 55
+mov rbp, rsp | 48 89 e5
+sub rsp, 8 | 48 83 ec 08
+sub rsp, 16 | 48 83 ec 10
+sub rsp, 1024 | 48 81 ec 00 04 00 00
+add rsp, 8 | 48 83 c4 08
+push rbx | 53
+push r12 | 41 54
+pop r15 | 41 5f
+pop rbx | 5b
+mov eax, 1 | b8 01 00 00 00
+mov eax, 4294967295 | b8 ff ff ff ff
+mov rax, -1 | 48 c7 c0 ff ff ff ff
+mov rax, 9223372036854775807 | 48 b8 ff ff ff ff ff ff ff 7f
+# Zero extended through the 32-bit register, as nasm does
+mov rax, 4294967295 | b8 ff ff ff ff
+mov esi, eax | 89 c6
+mov r8d, esi | 41 89 f0
+mov rdi, r9 | 4c 89 cf
+mov r13d, 250 | 41 bd fa 00 00 00
+movzx eax, al | 0f b6 c0
+movzx eax, ax | 0f b7 c0
+movzx r13d, sil | 44 0f b6 ee
+movzx edi, dil | 40 0f b6 ff
+movzx esi, byte [rbp - 1] | 0f b6 75 ff
+movzx eax, word [rbp - 2] | 0f b7 45 fe
+mov eax, dword [rbp - 4] | 8b 45 fc
+mov rax, qword [rbp - 8] | 48 8b 45 f8
+mov r14, qword [rbp - 264] | 4c 8b b5 f8 fe ff ff
+mov byte [rbp - 1], al | 88 45 ff
+mov byte [rbp - 1], sil | 40 88 75 ff
+mov word [rbp - 2], ax | 66 89 45 fe
+mov dword [rbp - 4], r12d | 44 89 65 fc
+mov qword [rbp - 200], r15 | 4c 89 bd 38 ff ff ff
+mov byte [rbp - 1], 44 | c6 45 ff 2c
+mov word [rbp - 2], 4464 | 66 c7 45 fe 70 11
+mov dword [rbp - 4], 4294967295 | c7 45 fc ff ff ff ff
+mov qword [rbp - 8], -1 | 48 c7 45 f8 ff ff ff ff
+add eax, 1 | 83 c0 01
+add eax, 1000 | 05 e8 03 00 00
+add eax, esi | 01 f0
+add rax, r8 | 4c 01 c0
+sub eax, ecx | 29 c8
+sub rax, 200 | 48 2d c8 00 00 00
+imul eax, 3 | 6b c0 03
+imul eax, 1000 | 69 c0 e8 03 00 00
+imul eax, ecx | 0f af c1
+imul rax, rdx | 48 0f af c2
+and eax, 255 | 25 ff 00 00 00
+or eax, r10d | 44 09 d0
+xor eax, 4294967295 | 83 f0 ff
+xor edx, edx | 31 d2
+xor rax, -1 | 48 83 f0 ff
+cmp eax, 10 | 83 f8 0a
+cmp ebx, 10 | 83 fb 0a
+cmp eax, 4000000000 | 3d 00 28 6b ee
+cmp rax, r11 | 4c 39 d8
+cmp r15d, 127 | 41 83 ff 7f
+test eax, eax | 85 c0
+test r9d, r9d | 45 85 c9
+test rbx, rbx | 48 85 db
+sete al | 0f 94 c0
+setne al | 0f 95 c0
+setb al | 0f 92 c0
+setbe al | 0f 96 c0
+shl eax, cl | d3 e0
+shr rax, cl | 48 d3 e8
+shl eax, 4 | c1 e0 04
+shr rax, 33 | 48 c1 e8 21
+shl eax, 1 | d1 e0
+sar rax, 1 | 48 d1 f8
+shl cl, 1 | d0 e1
+div ecx | f7 f1
+div rcx | 48 f7 f1
+mov eax, dword [rel x] / x: | 8b 05 00 00 00 00
+mov rdx, qword [rel x] / x: | 48 8b 15 00 00 00 00
+mov byte [rel x], 200 / x: | c6 05 00 00 00 00 c8
+mov dword [rel x], esi / x: | 89 35 00 00 00 00
+movzx eax, word [rel x] / x: | 0f b7 05 00 00 00 00
+x: / jmp x | eb fe
+jmp x / x: | eb 00
+je x / x: | 74 00
+jne x / x: | 75 00
+jb x / x: | 72 00
+jae x / x: | 73 00
+jbe x / x: | 76 00
+ja x / x: | 77 00
+call x / x: | e8 00 00 00 00
+[bits 16]
+xor ax, ax | 31 c0
+mov ds, ax | 8e d8
+mov ss, ax | 8e d0
+cli | fa
+cld | fc
+hlt | f4
+lodsb | ac
+or al, al | 08 c0
+xor bx, bx | 31 db
+int 0x10 | cd 10
+mov ah, 0x0E | b4 0e
+mov si, x / x: | be 03 00
+mov byte [x], dl / x: | 88 16 04 00
+x: / jz x | 74 fe
+x: / jmp x | eb fe
+call x / x: | e8 00 00
+ret | c3
+jmp 0x00:x / x: | ea 05 00 00 00
+x: / db "Hi", 0x0D, 0x00 | 48 69 0d 00
+ASM
+}
+
+fail=0
+bits=64
+corpus > "$tmp/corpus"
+while IFS= read -r entry; do
+    case $entry in
+    "#"*)
+        continue
+        ;;
+    "[bits "*)
+        bits=${entry#\[bits }
+        bits=${bits%\]}
+        continue
+        ;;
+    esac
+
+    asm=${entry% | *}
+    want=${entry##* | }
+    echo "[bits $bits]" > "$tmp/e.asm"
+    echo "$asm" | sed 's/ \/ /\n/g' >> "$tmp/e.asm"
+    sed 's/.*/@ & ;/' "$tmp/e.asm" > "$tmp/e.gup"
+
+    if ! gup_obj "$tmp/e.gup" "$tmp/e.bin" -f bin; then
+        echo "$asm: not assembled"
+        fail=1
+        continue
+    fi
+
+    got=$(hex "$tmp/e.bin")
+    if [ "$got" != "$want" ]; then
+        echo "$asm: got '$got', want '$want'"
+        fail=1
+    fi
+
+    if [ -n "$NASM" ]; then
+        "$NASM" -f bin -o "$tmp/n.bin" "$tmp/e.asm" || {
+            echo "$asm: nasm failed"
+            fail=1
+            continue
+        }
+
+        got=$(hex "$tmp/n.bin")
+        if [ "$got" != "$want" ]; then
+            echo "$asm: nasm gives '$got', want '$want'"
+            fail=1
+        fi
+    fi
+done < "$tmp/corpus"
+
+exit $fail
@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# Expressions folded at parse time give what the same
+# expressions give at runtime, for each size they may
+# be worked in. Each expression is compiled once with
+# constants and once reading them from globals.
+#
+
+. "$(dirname "$0")/common.sh"
+
+exprs='(a + b) / 2
+(a + b) % 7
+(a * b) >> 3
+(a - b) > c
+(a - b) >= c
+(b - a) < a
+a - b - c
+~a / 3
+(0 - a) % 5
+(a + b) == c
+(a << 4) >> 4
+(a + a) != (b + b)
+!(a - a) + (a && b) + (c || 0)
+(a ^ c) & (b | 1)
+a >> 33
+(b << 40) + 1'
+
+gen() {
+    type=$1
+    ctype=$2
+    a=$3
+    b=$4
+    c=$5
+    n=0
+
+    for v in a b c; do
+        echo "$type ${v}_$type;" >> "$tmp/fold.gup"
+    done
+
+    echo "$exprs" | while read -r e; do
+        folded=$(echo "$e" | sed "s/a/$a/g; s/b/$b/g; s/c/$c/g")
+        e=$(echo "$e" | sed "s/[abc]/&_$type/g")
+        cat >> "$tmp/fold.gup" <<GUP
+pub proc f_$type$n -> $type {
+    return $folded;
+}
+
+pub proc r_$type$n -> $type {
+    a_$type = $a;
+    b_$type = $b;
+    c_$type = $c;
+    return $e;
+}
+
+GUP
+        echo "$ctype f_$type$n(void), r_$type$n(void);" >> "$tmp/decl.h"
+        echo "    CHECK(f_$type$n(), r_$type$n());" >> "$tmp/body.h"
+        n=$((n + 1))
+    done
+}
+
+: > "$tmp/decl.h"
+: > "$tmp/body.h"
+: > "$tmp/fold.gup"
+gen u8 uint8_t 200 100 255
+gen u16 uint16_t 60000 50000 65535
+gen u32 uint32_t 4000000000 4000000000 4294967295
+
+gup_check "$tmp/fold.gup"
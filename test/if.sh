@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# An if whose arm is always taken only jumps to a block
+# that has no label, it is fallen into and never threaded.
+#
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$tmp/if.gup" <<'GUP'
+u32 g;
+
+pub proc both_arms -> u32 {
+    g = 0;
+    if (g == 0) { g = 1; } else { g = 3; }
+    if (2 > 1) { g = g + 2; }
+    return g;
+}
+
+pub proc one_arm -> u32 {
+    g = 4;
+    if (g == 0) { g = 1; }
+    if (2 > 1) { g = g + 2; }
+    return g;
+}
+GUP
+
+cat > "$tmp/decl.h" <<'C'
+uint32_t both_arms(void);
+uint32_t one_arm(void);
+C
+
+cat > "$tmp/body.h" <<'C'
+    CHECK(both_arms(), 3);
+    CHECK(one_arm(), 6);
+C
+
+gup_check "$tmp/if.gup"
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# Immediates wider than where they go are truncated to
+# it, and encoded in-process.
+#
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$tmp/imm.gup" <<'GUP'
+u32 r;
+u8 b;
+
+pub proc ret8 -> u8 {
+    return 300;
+}
+
+pub proc max32 -> u32 {
+    r = 9223372036854775807;
+    return r;
+}
+
+pub proc big32 -> u32 {
+    r = 1099511627776;
+    return r;
+}
+
+pub proc store8 -> u8 {
+    b = 300;
+    return b;
+}
+
+pub proc local16 -> u16 {
+    u16 w;
+    w = 70000;
+    return w;
+}
+GUP
+
+cat > "$tmp/decl.h" <<'C'
+uint8_t ret8(void);
+uint32_t max32(void);
+uint32_t big32(void);
+uint8_t store8(void);
+uint16_t local16(void);
+C
+
+cat > "$tmp/body.h" <<'C'
+    CHECK(ret8(), 44);
+    CHECK(max32(), 4294967295u);
+    CHECK(big32(), 0);
+    CHECK(store8(), 44);
+    CHECK(local16(), 4464);
+C
+
+gup_check "$tmp/imm.gup"
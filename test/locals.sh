@@ -0,0 +1,210 @@
+#!/bin/sh
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# Locals kept in registers rather than the frame, across
+# loops, both arms of an if, calls that clobber registers
+# and stores that truncate.
+#
+
+. "$(dirname "$0")/common.sh"
+
+cat > "$tmp/locals.gup" <<'GUP'
+u32 calls;
+u64 g;
+
+proc bump -> void {
+    calls = calls + 1;
+}
+
+pub proc sum -> u32 {
+    u32 i;
+    u32 s;
+
+    i = 0;
+    s = 0;
+    loop {
+        if (i == 10) {
+            break;
+        }
+
+        s = s + i * 3;
+        i = i + 1;
+    }
+
+    return s;
+}
+
+pub proc around_call -> u32 {
+    u32 i;
+    u32 s;
+    u8 b;
+
+    i = 0;
+    s = 0;
+    b = 250;
+    calls = 0;
+    loop {
+        if (i == 10) {
+            break;
+        }
+
+        bump();
+        s = s + i;
+        b = b + 1;
+        i = i + 1;
+    }
+
+    return s * 1000 + b * 100 + calls;
+}
+
+pub proc arms -> u32 {
+    u32 i;
+    u32 odd;
+    u32 even;
+
+    i = 0;
+    odd = 0;
+    even = 0;
+    loop {
+        if (i == 7) {
+            break;
+        }
+
+        if ((i & 1) == 1) {
+            odd = odd + i;
+        } else {
+            even = even + i;
+        }
+
+        i = i + 1;
+    }
+
+    return odd * 100 + even;
+}
+
+pub proc narrow -> u32 {
+    u16 w;
+    u8 b;
+    u32 d;
+
+    w = 65535;
+    w = w + 2;
+    b = w + 255;
+    d = 4294967295;
+    d = d + w;
+    return d + b;
+}
+
+pub proc call_in_arm -> u64 {
+    u64 a;
+    u64 b;
+    u64 c;
+    u64 d;
+    u64 e;
+    u64 f;
+    u64 h;
+    u64 i;
+
+    g = 3;
+    a = g;
+    b = g + 1;
+    c = g + 2;
+    d = g + 3;
+    e = g + 4;
+    f = g + 5;
+    h = g + 6;
+    i = g + 7;
+    if (g == 5) {
+        bump();
+    }
+
+    return a + b * 3 + c * 5 + d * 7 + e * 11 + f * 13 + h * 17 + i * 19;
+}
+
+pub proc many -> u64 {
+    u64 a;
+    u64 b;
+    u64 c;
+    u64 d;
+    u64 e;
+    u64 f;
+    u64 g;
+    u64 h;
+    u64 i;
+    u64 j;
+    u64 k;
+    u64 l;
+    u64 n;
+
+    a = 1;
+    b = 2;
+    c = 3;
+    d = 4;
+    e = 5;
+    f = 6;
+    g = 7;
+    h = 8;
+    i = 9;
+    j = 10;
+    k = 11;
+    l = 12;
+    n = 0;
+    loop {
+        if (n == 3) {
+            break;
+        }
+
+        bump();
+        a = a + b;
+        b = b + c;
+        c = c + d;
+        d = d + e;
+        e = e + f;
+        f = f + g;
+        g = g + h;
+        h = h + i;
+        i = i + j;
+        j = j + k;
+        k = k + l;
+        l = l + a;
+        n = n + 1;
+    }
+
+    return a + b * 3 + c * 5 + d * 7 + e * 11 + f * 13 + g * 17 +
+        h * 19 + i * 23 + j * 29 + k * 31 + l * 37;
+}
+GUP
+
+cat > "$tmp/decl.h" <<'C'
+uint32_t sum(void), around_call(void), arms(void), narrow(void);
+uint64_t many(void), call_in_arm(void);
+
+static uint64_t
+many_ref(void)
+{
+    uint64_t a = 1, b = 2, c = 3, d = 4, e = 5, f = 6, g = 7, h = 8;
+    uint64_t i = 9, j = 10, k = 11, l = 12, n;
+
+    for (n = 0; n < 3; ++n) {
+        a += b; b += c; c += d; d += e; e += f; f += g;
+        g += h; h += i; i += j; j += k; k += l; l += a;
+    }
+
+    return a + b * 3 + c * 5 + d * 7 + e * 11 + f * 13 + g * 17 +
+        h * 19 + i * 23 + j * 29 + k * 31 + l * 37;
+}
+C
+
+cat > "$tmp/body.h" <<'C'
+    CHECK(sum(), 135);
+    CHECK(around_call(), 45000 + 4 * 100 + 10);
+    CHECK(arms(), 9 * 100 + 12);
+    CHECK(narrow(), 0 + 0);
+    CHECK(many(), many_ref());
+    CHECK(call_in_arm(), 3 + 4 * 3 + 5 * 5 + 6 * 7 + 7 * 11 + 8 * 13 +
+        9 * 17 + 10 * 19);
+C
+
+gup_check "$tmp/locals.gup"
@@ -0,0 +1,100 @@
+#!/bin/sh
+#
+# Copyright (c) 2026, Ian Moffett.
+# Provided under the BSD-3 clause.
+#
+# Compiling on several threads gives the same outputs and
+# the same diagnostics, in the same order, as compiling on
+# one. The large inputs are also lexed on several threads.
+#
+
+. "$(dirname "$0")/common.sh"
+
+#
+# Generate an input of procedures with locals, loops and
+# calls.
+#
+# $1: Path of the input
+# $2: Number of procedures
+#
+gen() {
+    awk -v n="$2" 'BEGIN {
+        print "u32 total;"
+        for (i = 0; i < n; ++i) {
+            print "proc p" i " -> u32 {"
+            print "    u32 i;"
+            print "    u32 s;"
+            print ""
+            print "    i = 0;"
+            print "    s = " i ";"
+            print "    loop {"
+            print "        if (i == " (i % 13) ") {"
+            print "            break;"
+            print "        }"
+            print ""
+            print "        s = s * 3 + (i ^ " i ");"
+            print "        i = i + 1;"
+            print "    }"
+            print ""
+            print "    total = total + s;"
+            print "    return s;"
+            print "}"
+            print ""
+        }
+    }' > "$1"
+}
+
+mkdir "$tmp/in"
+gen "$tmp/in/a.gup" 6000
+gen "$tmp/in/b.gup" 7000
+gen "$tmp/in/c.gup" 50
+gen "$tmp/in/d.gup" 400
+gen "$tmp/in/e.gup" 1
+
+# Fails last, after every other input is written
+cp "$tmp/in/c.gup" "$tmp/in/f.gup"
+echo "proc broken -> void {" >> "$tmp/in/f.gup"
+
+fail=0
+for j in 1 2 4 8; do
+    for mode in -a -f; do
+        dir=$tmp/j$j$mode
+        cp -r "$tmp/in" "$dir"
+        if [ "$mode" = "-f" ]; then
+            mode="-f elf64"
+        fi
+
+        # shellcheck disable=SC2086
+        (cd "$dir" && PATH=/nonexistent "$GUP" -j $j $mode \
+            a.gup b.gup c.gup d.gup e.gup f.gup) > "$dir/log" 2>&1
+        echo "status $?" >> "$dir/log"
+        grep -v "^compiled in" "$dir/log" > "$dir/diag"
+        rm "$dir/log"
+    done
+done
+
+for mode in -a -f; do
+    for j in 2 4 8; do
+        if ! diff -r "$tmp/j1$mode" "$tmp/j$j$mode" > /dev/null; then
+            echo "-j $j $mode differs from -j 1"
+            diff -r "$tmp/j1$mode" "$tmp/j$j$mode" | head -20
+            fail=1
+        fi
+    done
+done
+
+# The run itself has to have worked
+for f in a.asm b.asm c.asm d.asm e.asm; do
+    [ -s "$tmp/j1-a/$f" ] || { echo "missing $f"; fail=1; }
+done
+
+for f in a.o b.o c.o d.o e.o; do
+    [ -s "$tmp/j1-f/$f" ] || { echo "missing $f"; fail=1; }
+done
+
+grep -q "missing RBRACE" "$tmp/j1-a/diag" || {
+    echo "no diagnostic for f.gup"
+    fail=1
+}
+
+exit $fail